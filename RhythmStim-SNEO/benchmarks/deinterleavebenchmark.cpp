@@ -0,0 +1,174 @@
+// UsbDeinterleaver micro-benchmark.
+//
+// Deinterleaves a USB read of random sample frames for 1 to 8 data streams with each kernel the
+// CPU supports, and with a per-word loop into nested vectors like the one in
+// Rhs2000DataBlock::fillFromUsbBuffer(), checks that every kernel gives the same samples and
+// compares their rates with the sample rate of the largest configuration.  Standalone; build with e.g.
+//
+//     g++ -std=c++11 -O2 -I../qt_files deinterleavebenchmark.cpp ../qt_files/usbdeinterleaver.cpp -o deinterleavebenchmark
+//
+// Usage: deinterleavebenchmark [seconds per measurement]
+
+#include <iostream>
+#include <iomanip>
+#include <cstdlib>
+#include <chrono>
+#include <random>
+#include <vector>
+#include "usbdeinterleaver.h"
+
+using namespace std;
+
+#define SAMPLES_PER_DATA_BLOCK 128
+#define BUFFER_SIZE_IN_BLOCKS 32
+#define MAX_SAMPLE_RATE 30000.0
+
+static inline int loadWord(const unsigned char* buffer)
+{
+    return buffer[0] | (buffer[1] << 8);
+}
+
+// Nested [stream][channel][t] vectors, as Rhs2000DataBlock holds its samples.
+struct NestedSamples
+{
+    vector<unsigned int> timeStamp;
+    vector<vector<vector<int> > > amplifierData;
+    vector<vector<vector<int> > > dcAmplifierData;
+    vector<vector<vector<int> > > auxiliaryData;
+    vector<vector<vector<int> > > stimFlags;
+
+    NestedSamples(int numStreams, int numSamples) :
+        timeStamp(numSamples),
+        amplifierData(numStreams, vector<vector<int> >(16, vector<int>(numSamples))),
+        dcAmplifierData(numStreams, vector<vector<int> >(16, vector<int>(numSamples))),
+        auxiliaryData(numStreams, vector<vector<int> >(4, vector<int>(numSamples))),
+        stimFlags(numStreams, vector<vector<int> >(4, vector<int>(numSamples))) {}
+};
+
+// One word at a time, in frame order.
+static void fillNested(const unsigned char* buffer, int numStreams, int numSamples, NestedSamples &samples)
+{
+    int index = 0;
+    for (int t = 0; t < numSamples; ++t) {
+        index += 8;
+        samples.timeStamp[t] = (unsigned int) loadWord(buffer + index) | ((unsigned int) loadWord(buffer + index + 2) << 16);
+        index += 4;
+        for (int command = 1; command < 4; ++command) {
+            for (int stream = 0; stream < numStreams; ++stream) {
+                samples.auxiliaryData[stream][command][t] = loadWord(buffer + index);
+                index += 4;
+            }
+        }
+        for (int channel = 0; channel < 16; ++channel) {
+            for (int stream = 0; stream < numStreams; ++stream) {
+                samples.dcAmplifierData[stream][channel][t] = loadWord(buffer + index);
+                samples.amplifierData[stream][channel][t] = loadWord(buffer + index + 2);
+                index += 4;
+            }
+        }
+        for (int stream = 0; stream < numStreams; ++stream) {
+            samples.auxiliaryData[stream][0][t] = loadWord(buffer + index);
+            index += 4;
+        }
+        for (int flag = 0; flag < 4; ++flag) {
+            for (int stream = 0; stream < numStreams; ++stream) {
+                samples.stimFlags[stream][flag][t] = loadWord(buffer + index);
+                index += 2;
+            }
+        }
+        index += 2 * (8 + 8 + 2);
+    }
+}
+
+static bool matches(const SamplePlanes &planes, const NestedSamples &samples)
+{
+    for (int t = 0; t < planes.numSamples; ++t) {
+        if (planes.timeStamp[t] != samples.timeStamp[t]) return false;
+    }
+    for (int stream = 0; stream < planes.numDataStreams; ++stream) {
+        for (int channel = 0; channel < 16; ++channel) {
+            const short* amplifier = planes.amplifierPlane(stream, channel);
+            const unsigned short* dcAmplifier = planes.dcAmplifierPlane(stream, channel);
+            for (int t = 0; t < planes.numSamples; ++t) {
+                if (amplifier[t] != samples.amplifierData[stream][channel][t] - 32768) return false;
+                if (dcAmplifier[t] != samples.dcAmplifierData[stream][channel][t]) return false;
+            }
+        }
+        for (int i = 0; i < 4; ++i) {
+            const unsigned short* aux = planes.auxiliaryPlane(stream, i);
+            const unsigned short* flags = planes.stimFlagPlane(stream, (StimFlag) i);
+            for (int t = 0; t < planes.numSamples; ++t) {
+                if (aux[t] != samples.auxiliaryData[stream][i][t]) return false;
+                if (flags[t] != samples.stimFlags[stream][i][t]) return false;
+            }
+        }
+    }
+    return true;
+}
+
+// Run f repeatedly for about seconds and return samples per second.
+template <typename Function>
+static double measure(Function f, int numSamples, double seconds)
+{
+    long long iterations = 0;
+    auto start = chrono::steady_clock::now();
+    double elapsed;
+    do {
+        f();
+        iterations++;
+        elapsed = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    } while (elapsed < seconds);
+    return iterations * numSamples / elapsed;
+}
+
+int main(int argc, char* argv[])
+{
+    double seconds = (argc > 1) ? atof(argv[1]) : 0.5;
+    int numSamples = BUFFER_SIZE_IN_BLOCKS * SAMPLES_PER_DATA_BLOCK;
+    mt19937 randomGenerator(1);
+    bool allMatch = true;
+
+    cout << "Deinterleaving " << numSamples << " samples per call (million samples/s, and x the " <<
+            MAX_SAMPLE_RATE / 1000.0 << " kS/s sample rate)" << endl;
+    cout << "streams      nested";
+    for (int k = UsbDeinterleaver::KernelScalar; k <= UsbDeinterleaver::KernelAvx2; ++k) {
+        if (UsbDeinterleaver::isKernelSupported((UsbDeinterleaver::Kernel) k)) {
+            cout << setw(20) << UsbDeinterleaver::kernelName((UsbDeinterleaver::Kernel) k);
+        }
+    }
+    cout << endl;
+
+    for (int numStreams = 1; numStreams <= 8; ++numStreams) {
+        int sampleSize = UsbDeinterleaver::sampleSizeInBytes(numStreams);
+        vector<unsigned char> buffer((size_t) numSamples * sampleSize);
+        for (size_t i = 0; i < buffer.size(); ++i) {
+            buffer[i] = (unsigned char) randomGenerator();
+        }
+
+        NestedSamples nested(numStreams, numSamples);
+        double nestedRate = measure([&] { fillNested(buffer.data(), numStreams, numSamples, nested); }, numSamples, seconds);
+        cout << fixed << setprecision(1) << setw(7) << numStreams << setw(12) << nestedRate / 1.0e6;
+
+        for (int k = UsbDeinterleaver::KernelScalar; k <= UsbDeinterleaver::KernelAvx2; ++k) {
+            UsbDeinterleaver::Kernel kernel = (UsbDeinterleaver::Kernel) k;
+            if (!UsbDeinterleaver::isKernelSupported(kernel)) {
+                continue;
+            }
+            SamplePlanes planes;
+            planes.allocate(numStreams, numSamples);
+            double rate = measure([&] { UsbDeinterleaver::deinterleave(kernel, buffer.data(), numSamples, planes); },
+                                  numSamples, seconds);
+            bool ok = matches(planes, nested);
+            allMatch = allMatch && ok;
+            cout << setw(12) << rate / 1.0e6 << " (" << setw(4) << setprecision(0) << rate / MAX_SAMPLE_RATE << "x)" <<
+                    setprecision(1) << (ok ? "" : "!");
+        }
+        cout << endl;
+    }
+
+    if (!allMatch) {
+        cerr << "Error: kernels marked ! do not match the nested-vector samples." << endl;
+        return 1;
+    }
+    return 0;
+}
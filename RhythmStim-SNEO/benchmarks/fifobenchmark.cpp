@@ -0,0 +1,99 @@
+// DataStreamFifo throughput micro-benchmark.
+//
+// One thread streams USB-sized transfers into the FIFO with reserveWrite()/commitWrite() while
+// another drains it with peekRead()/releaseRead(), checking the data on the way out, as the USB
+// data thread and the GUI thread do.  The sustained rate is compared with the USB data rate of
+// the largest configuration (8 data streams at 30 kS/s).  Standalone; build with e.g.
+//
+//     g++ -std=c++11 -O2 -pthread -I../qt_files fifobenchmark.cpp ../qt_files/datastreamfifo.cpp -o fifobenchmark
+//
+// Usage: fifobenchmark [seconds] [hugepages]
+//
+// The producer retries as fast as it can, so the FIFO runs full and reports many overruns.
+
+#include <iostream>
+#include <iomanip>
+#include <cstdlib>
+#include <cstring>
+#include <chrono>
+#include <thread>
+#include <atomic>
+#include "datastreamfifo.h"
+
+using namespace std;
+
+#define SAMPLES_PER_DATA_BLOCK 128
+#define MAX_NUM_DATA_STREAMS 8
+#define BUFFER_SIZE_IN_BLOCKS 32
+#define MAX_SAMPLE_RATE 30000.0
+
+// Same as Rhs2000DataBlock::calculateDataBlockSizeInWords().
+static unsigned int dataBlockSizeInWords(int numDataStreams)
+{
+    return SAMPLES_PER_DATA_BLOCK * (4 + 2 + numDataStreams * (2 * 16 + 4 * 3) + 8 + 2 + 8);
+}
+
+int main(int argc, char* argv[])
+{
+    double seconds = (argc > 1) ? atof(argv[1]) : 5.0;
+    bool useHugePages = (argc > 2) && (strcmp(argv[2], "hugepages") == 0);
+
+    unsigned int blockSizeInBytes = 2 * dataBlockSizeInWords(MAX_NUM_DATA_STREAMS);
+    unsigned int transferBytes = BUFFER_SIZE_IN_BLOCKS * blockSizeInBytes;
+    double requiredRate = MAX_SAMPLE_RATE * blockSizeInBytes / SAMPLES_PER_DATA_BLOCK;
+
+    // Same sizing as MainWindow: 10 s at 40 kS/s.
+    unsigned int bufferSize = 10 * 40000 * blockSizeInBytes / SAMPLES_PER_DATA_BLOCK;
+    DataStreamFifo fifo(bufferSize, 2 * transferBytes, useHugePages);
+
+    atomic<bool> stop(false);
+    unsigned long long bytesRead = 0;
+    unsigned long long numErrors = 0;
+
+    thread consumer([&]() {
+        while (!stop.load(memory_order_relaxed) || fifo.bytesAvailable() >= blockSizeInBytes) {
+            unsigned char* span = fifo.peekRead(blockSizeInBytes);
+            if (!span) {
+                this_thread::yield();
+                continue;
+            }
+            // Every transfer is filled with its own sequence number.
+            unsigned char expected = (unsigned char) (bytesRead / transferBytes);
+            for (unsigned int i = 0; i < blockSizeInBytes; i += 64) {
+                if (span[i] != expected) numErrors++;
+            }
+            fifo.releaseRead(blockSizeInBytes);
+            bytesRead += blockSizeInBytes;
+        }
+    });
+
+    unsigned char pattern = 0;
+    auto start = chrono::steady_clock::now();
+    auto end = start + chrono::duration<double>(seconds);
+    while (chrono::steady_clock::now() < end) {
+        unsigned char* span = fifo.reserveWrite(transferBytes);
+        if (!span) {
+            this_thread::yield();
+            continue;
+        }
+        memset(span, pattern++, transferBytes);
+        fifo.commitWrite(transferBytes);
+    }
+    stop = true;
+    consumer.join();
+    double elapsed = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+    double rate = bytesRead / elapsed;
+    cout << fixed << setprecision(1);
+    cout << "Buffer " << bufferSize / 1.0e6 << " MB" << (fifo.isHugePageBacked() ? " (huge pages)" : "") <<
+            ", transfers of " << transferBytes / 1.0e3 << " kB, " << elapsed << " s" << endl;
+    cout << "Sustained throughput: " << rate / 1.0e6 << " MB/s (" << rate / requiredRate <<
+            "x the " << requiredRate / 1.0e6 << " MB/s of " << MAX_NUM_DATA_STREAMS << " streams at " <<
+            MAX_SAMPLE_RATE / 1000.0 << " kS/s)" << endl;
+    fifo.printStatistics();
+    if (numErrors > 0) {
+        cerr << "Error: " << numErrors << " corrupted cache lines read from the FIFO." << endl;
+        return 1;
+    }
+    return 0;
+}
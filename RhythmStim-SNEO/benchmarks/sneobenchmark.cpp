@@ -0,0 +1,139 @@
+// SneoDetector micro-benchmark.
+//
+// Generates the synthetic recording of spikemodelbenchmark (noise with negative spikes at random
+// times and a stimulation pulse every second, 32 channels of one detector), runs it in data
+// blocks through SpikeDetectorModel and through SneoDetector with each kernel the CPU supports,
+// and checks that every kernel gives the model's detection records.  Reports the processing
+// rate and the number of channels one core can keep up with at 25 and 30 kS/s.  Standalone;
+// build with e.g.
+//
+//     g++ -std=c++11 -O2 -I../qt_files sneobenchmark.cpp ../qt_files/sneodetector.cpp ../qt_files/spikedetectormodel.cpp ../qt_files/usbdeinterleaver.cpp -o sneobenchmark
+//
+// Usage: sneobenchmark [seconds of recording]
+
+#include <iostream>
+#include <iomanip>
+#include <cstdlib>
+#include <chrono>
+#include <random>
+#include <vector>
+#include "spikedetectormodel.h"
+#include "sneodetector.h"
+
+using namespace std;
+
+#define SAMPLES_PER_DATA_BLOCK 128
+#define MAX_SAMPLE_RATE 30000.0
+
+// Extracellular-like test signal: Gaussian noise of 10 uV RMS (0.195 uV per LSB) with 100 uV
+// spikes of 1 ms at 20 Hz on average.
+static void makeRecording(int numSamples, vector<vector<short> > &samples, vector<unsigned int> &timeStamps,
+                          vector<unsigned char> &stimTriggers)
+{
+    mt19937 randomGenerator(1);
+    normal_distribution<double> noise(0.0, 50.0);
+    bernoulli_distribution spikeStart(20.0 / MAX_SAMPLE_RATE);
+    const int spikeLength = 30;
+
+    samples.assign(SPIKE_MODEL_CHANNELS, vector<short>(numSamples));
+    for (int channel = 0; channel < SPIKE_MODEL_CHANNELS; ++channel) {
+        int spikeSample = spikeLength;
+        for (int t = 0; t < numSamples; ++t) {
+            double value = noise(randomGenerator);
+            if (spikeSample >= spikeLength && spikeStart(randomGenerator)) {
+                spikeSample = 0;
+            }
+            if (spikeSample < spikeLength) {
+                double phase = spikeSample / (double) spikeLength;
+                value -= 500.0 * phase * (1.0 - phase) * 4.0 * (phase < 0.5 ? 1.0 : -0.4);
+                spikeSample++;
+            }
+            samples[channel][t] = (short) value;
+        }
+    }
+
+    timeStamps.resize(numSamples);
+    stimTriggers.resize(numSamples);
+    for (int t = 0; t < numSamples; ++t) {
+        timeStamps[t] = (unsigned int) t;
+        stimTriggers[t] = (t % (int) MAX_SAMPLE_RATE) < 5;
+    }
+}
+
+// Run the recording through detector block by block; returns seconds taken.
+template <class Detector>
+static double run(Detector &detector, const vector<vector<short> > &samples,
+                  const vector<unsigned int> &timeStamps, const vector<unsigned char> &stimTriggers,
+                  vector<unsigned short> &records)
+{
+    int numSamples = (int) timeStamps.size();
+    const short* blockSamples[SPIKE_MODEL_CHANNELS];
+
+    records.clear();
+    detector.reset();
+    auto start = chrono::steady_clock::now();
+    for (int t = 0; t + SAMPLES_PER_DATA_BLOCK <= numSamples; t += SAMPLES_PER_DATA_BLOCK) {
+        for (int channel = 0; channel < SPIKE_MODEL_CHANNELS; ++channel) {
+            blockSamples[channel] = samples[channel].data() + t;
+        }
+        detector.process(blockSamples, timeStamps.data() + t, stimTriggers.data() + t, SAMPLES_PER_DATA_BLOCK,
+                         records);
+    }
+    return chrono::duration<double>(chrono::steady_clock::now() - start).count();
+}
+
+static void report(const char* name, int numSamples, double elapsed, const vector<unsigned short> &records, bool ok)
+{
+    double rate = (double) numSamples * SPIKE_MODEL_CHANNELS / elapsed;
+    cout << fixed << setw(8) << name << setw(12) << records.size() / SPIKE_MODEL_RECORD_WORDS << (ok ? " " : "!") <<
+            setw(26) << setprecision(1) << rate / 1.0e6 << setw(14) << setprecision(0) << rate / 25000.0 <<
+            setw(14) << rate / MAX_SAMPLE_RATE << endl;
+}
+
+int main(int argc, char* argv[])
+{
+    double seconds = (argc > 1) ? atof(argv[1]) : 10.0;
+    int numSamples = (int) (seconds * MAX_SAMPLE_RATE);
+    numSamples -= numSamples % SAMPLES_PER_DATA_BLOCK;
+    bool allMatch = true;
+
+    vector<vector<short> > samples;
+    vector<unsigned int> timeStamps;
+    vector<unsigned char> stimTriggers;
+    makeRecording(numSamples, samples, timeStamps, stimTriggers);
+
+    cout << "Detecting spikes in " << numSamples / MAX_SAMPLE_RATE << " s of " << SPIKE_MODEL_CHANNELS <<
+            " channels" << endl;
+    cout << "  kernel  detections  million channel samples/s  ch @ 25 kS/s  ch @ 30 kS/s" << endl;
+
+    SpikeDetectorModel model;
+    model.setThresholdMult(11);
+    model.setBlindWindow(2);
+    vector<unsigned short> modelRecords;
+    double elapsed = run(model, samples, timeStamps, stimTriggers, modelRecords);
+    report("model", numSamples, elapsed, modelRecords, true);
+
+    const SneoDetector::Kernel kernels[] = { SneoDetector::KernelScalar, SneoDetector::KernelAvx2 };
+    for (SneoDetector::Kernel kernel : kernels) {
+        if (!SneoDetector::isKernelSupported(kernel)) {
+            cout << setw(8) << SneoDetector::kernelName(kernel) << "  not supported by this CPU" << endl;
+            continue;
+        }
+        SneoDetector detector;
+        detector.setKernel(kernel);
+        detector.setThresholdMult(11);
+        detector.setBlindWindow(2);
+
+        vector<unsigned short> records;
+        elapsed = run(detector, samples, timeStamps, stimTriggers, records);
+        bool ok = records == modelRecords;
+        allMatch = allMatch && ok;
+        report(SneoDetector::kernelName(kernel), numSamples, elapsed, records, ok);
+    }
+
+    if (!allMatch) {
+        cerr << "Error: detections marked ! differ from the model's." << endl;
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,122 @@
+// SpikeDetectorModel micro-benchmark.
+//
+// Generates a synthetic recording for the 32 channels of one detector (noise with negative
+// spikes at random times and a stimulation pulse every second), runs it through the model in
+// data blocks with both ports and with the first port only, and compares the processing rate
+// with the 30 kS/s sample rate.  Runs each configuration twice from reset to check that the
+// detections are reproducible.  Standalone; build with e.g.
+//
+//     g++ -std=c++11 -O2 -I../qt_files spikemodelbenchmark.cpp ../qt_files/spikedetectormodel.cpp ../qt_files/usbdeinterleaver.cpp -o spikemodelbenchmark
+//
+// Usage: spikemodelbenchmark [seconds of recording]
+
+#include <iostream>
+#include <iomanip>
+#include <cstdlib>
+#include <chrono>
+#include <random>
+#include <vector>
+#include "spikedetectormodel.h"
+
+using namespace std;
+
+#define SAMPLES_PER_DATA_BLOCK 128
+#define MAX_SAMPLE_RATE 30000.0
+
+// Extracellular-like test signal: Gaussian noise of 10 uV RMS (0.195 uV per LSB) with 100 uV
+// spikes of 1 ms at 20 Hz on average.
+static void makeRecording(int numSamples, vector<vector<short> > &samples, vector<unsigned int> &timeStamps,
+                          vector<unsigned char> &stimTriggers)
+{
+    mt19937 randomGenerator(1);
+    normal_distribution<double> noise(0.0, 50.0);
+    bernoulli_distribution spikeStart(20.0 / MAX_SAMPLE_RATE);
+    const int spikeLength = 30;
+
+    samples.assign(SPIKE_MODEL_CHANNELS, vector<short>(numSamples));
+    for (int channel = 0; channel < SPIKE_MODEL_CHANNELS; ++channel) {
+        int spikeSample = spikeLength;
+        for (int t = 0; t < numSamples; ++t) {
+            double value = noise(randomGenerator);
+            if (spikeSample >= spikeLength && spikeStart(randomGenerator)) {
+                spikeSample = 0;
+            }
+            if (spikeSample < spikeLength) {
+                double phase = spikeSample / (double) spikeLength;
+                value -= 500.0 * phase * (1.0 - phase) * 4.0 * (phase < 0.5 ? 1.0 : -0.4);
+                spikeSample++;
+            }
+            samples[channel][t] = (short) value;
+        }
+    }
+
+    timeStamps.resize(numSamples);
+    stimTriggers.resize(numSamples);
+    for (int t = 0; t < numSamples; ++t) {
+        timeStamps[t] = (unsigned int) t;
+        stimTriggers[t] = (t % (int) MAX_SAMPLE_RATE) < 5;
+    }
+}
+
+// Run the recording through model block by block; returns seconds taken.
+static double run(SpikeDetectorModel &model, const vector<vector<short> > &samples,
+                  const vector<unsigned int> &timeStamps, const vector<unsigned char> &stimTriggers,
+                  vector<unsigned short> &records)
+{
+    int numSamples = (int) timeStamps.size();
+    const short* blockSamples[SPIKE_MODEL_CHANNELS];
+
+    records.clear();
+    model.reset();
+    auto start = chrono::steady_clock::now();
+    for (int t = 0; t + SAMPLES_PER_DATA_BLOCK <= numSamples; t += SAMPLES_PER_DATA_BLOCK) {
+        for (int channel = 0; channel < SPIKE_MODEL_CHANNELS; ++channel) {
+            blockSamples[channel] = samples[channel].data() + t;
+        }
+        model.process(blockSamples, timeStamps.data() + t, stimTriggers.data() + t, SAMPLES_PER_DATA_BLOCK,
+                      records);
+    }
+    return chrono::duration<double>(chrono::steady_clock::now() - start).count();
+}
+
+int main(int argc, char* argv[])
+{
+    double seconds = (argc > 1) ? atof(argv[1]) : 10.0;
+    int numSamples = (int) (seconds * MAX_SAMPLE_RATE);
+    numSamples -= numSamples % SAMPLES_PER_DATA_BLOCK;
+    bool allMatch = true;
+
+    vector<vector<short> > samples;
+    vector<unsigned int> timeStamps;
+    vector<unsigned char> stimTriggers;
+    makeRecording(numSamples, samples, timeStamps, stimTriggers);
+
+    cout << "Detecting spikes in " << numSamples / MAX_SAMPLE_RATE << " s of " << MAX_SAMPLE_RATE / 1000.0 <<
+            " kS/s data" << endl;
+    cout << "ports  channels  detections  million channel samples/s  x real time" << endl;
+
+    for (int numPorts = SPIKE_MODEL_PORTS; numPorts >= 1; --numPorts) {
+        SpikeDetectorModel model;
+        model.setThresholdMult(11);
+        model.setBlindWindow(2);
+        model.setPortEnabled(1, numPorts > 1);
+
+        vector<unsigned short> records, repeatedRecords;
+        double elapsed = run(model, samples, timeStamps, stimTriggers, records);
+        run(model, samples, timeStamps, stimTriggers, repeatedRecords);
+        bool ok = records == repeatedRecords;
+        allMatch = allMatch && ok;
+
+        int numChannels = numPorts * SPIKE_MODEL_CHANNELS_PER_PORT;
+        double rate = (double) numSamples * numChannels / elapsed;
+        cout << fixed << setw(5) << numPorts << setw(10) << numChannels << setw(12) <<
+                records.size() / SPIKE_MODEL_RECORD_WORDS << (ok ? " " : "!") << setw(26) << setprecision(1) <<
+                rate / 1.0e6 << setw(13) << setprecision(0) << numSamples / MAX_SAMPLE_RATE / elapsed << endl;
+    }
+
+    if (!allMatch) {
+        cerr << "Error: detections marked ! differ between two runs from reset." << endl;
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,79 @@
+#include <cstdlib>
+#include <new>
+#include <atomic>
+
+#include "allocationcounter.h"
+
+using namespace std;
+
+// Heap allocation counter
+
+#ifdef RHYTHM_COUNT_ALLOCATIONS
+
+static atomic<unsigned long long> numAllocations(0);
+static thread_local unsigned long long numThreadAllocations = 0;
+
+static void* countedAllocate(size_t size)
+{
+    numAllocations.fetch_add(1, memory_order_relaxed);
+    numThreadAllocations++;
+    void* memory = malloc(size ? size : 1);
+    if (!memory) {
+        throw bad_alloc();
+    }
+    return memory;
+}
+
+static void* countedAllocate(size_t size, const nothrow_t&) noexcept
+{
+    numAllocations.fetch_add(1, memory_order_relaxed);
+    numThreadAllocations++;
+    return malloc(size ? size : 1);
+}
+
+void* operator new(size_t size) { return countedAllocate(size); }
+void* operator new[](size_t size) { return countedAllocate(size); }
+void* operator new(size_t size, const nothrow_t& tag) noexcept { return countedAllocate(size, tag); }
+void* operator new[](size_t size, const nothrow_t& tag) noexcept { return countedAllocate(size, tag); }
+void operator delete(void* memory) noexcept { free(memory); }
+void operator delete[](void* memory) noexcept { free(memory); }
+void operator delete(void* memory, size_t) noexcept { free(memory); }
+void operator delete[](void* memory, size_t) noexcept { free(memory); }
+void operator delete(void* memory, const nothrow_t&) noexcept { free(memory); }
+void operator delete[](void* memory, const nothrow_t&) noexcept { free(memory); }
+
+bool AllocationCounter::isEnabled()
+{
+    return true;
+}
+
+// Number of heap allocations made by all threads since the program started.
+unsigned long long AllocationCounter::totalAllocations()
+{
+    return numAllocations.load(memory_order_relaxed);
+}
+
+// Number of heap allocations made by the calling thread since it started.
+unsigned long long AllocationCounter::threadAllocations()
+{
+    return numThreadAllocations;
+}
+
+#else
+
+bool AllocationCounter::isEnabled()
+{
+    return false;
+}
+
+unsigned long long AllocationCounter::totalAllocations()
+{
+    return 0;
+}
+
+unsigned long long AllocationCounter::threadAllocations()
+{
+    return 0;
+}
+
+#endif
@@ -0,0 +1,19 @@
+#ifndef ALLOCATIONCOUNTER_H
+#define ALLOCATIONCOUNTER_H
+
+// Heap allocation counter, used to check that the acquisition loops run without allocating.
+//
+// Building with DEFINES += RHYTHM_COUNT_ALLOCATIONS replaces the global operator new and
+// operator delete with versions that count every allocation, in total and per thread.
+// Without it the counts stay at zero and isEnabled() returns false.
+
+class AllocationCounter
+{
+
+public:
+    static bool isEnabled();
+    static unsigned long long totalAllocations();
+    static unsigned long long threadAllocations();
+};
+
+#endif // ALLOCATIONCOUNTER_H
@@ -0,0 +1,162 @@
+#include <iostream>
+#include <chrono>
+
+#include "boardconfigtransaction.h"
+#include "rhs2000evalboard.h"
+#include "metricsregistry.h"
+
+#ifdef RHYTHM_EMULATOR
+#include "emulatedfrontpanel.h"
+#else
+#include "okFrontPanelDLL.h"
+#endif
+
+// Board configuration transaction
+
+// Innermost open transaction of the calling thread; setters join it rather than committing on their own.
+// Open transactions form a stack through their previous pointers.
+static thread_local BoardConfigTransaction *openTransaction = nullptr;
+
+BoardConfigTransaction::BoardConfigTransaction(Rhs2000EvalBoard *board_, BoardIoScheduler::IoClass ioClass_) :
+    board(board_),
+    ioClass(ioClass_),
+    outer(nullptr),
+    previous(openTransaction),
+    committed(false),
+    numWireInUpdates(0),
+    commitLatencyUs(0.0)
+{
+    for (BoardConfigTransaction *t = previous; t; t = t->previous) {
+        if (t->board == board) {
+            outer = t->outer ? t->outer : t;
+            break;
+        }
+    }
+    openTransaction = this;
+}
+
+BoardConfigTransaction::~BoardConfigTransaction()
+{
+    commit();
+}
+
+// Stage a masked write to a wire-in endpoint.
+void BoardConfigTransaction::setWireInValue(int endPoint, unsigned int value, unsigned int mask)
+{
+    if (outer) {
+        outer->setWireInValue(endPoint, value, mask);
+        return;
+    }
+    if (committed) {
+        cerr << "Error in BoardConfigTransaction::setWireInValue: transaction already committed." << endl;
+        return;
+    }
+    writes.push_back({false, endPoint, value, mask});
+}
+
+// Stage a trigger-in.  Wire-in writes staged before it are sent to the board before it fires.
+void BoardConfigTransaction::activateTriggerIn(int endPoint, int bit)
+{
+    if (outer) {
+        outer->activateTriggerIn(endPoint, bit);
+        return;
+    }
+    if (committed) {
+        cerr << "Error in BoardConfigTransaction::activateTriggerIn: transaction already committed." << endl;
+        return;
+    }
+    writes.push_back({true, endPoint, (unsigned int) bit, 0});
+}
+
+// Send all staged writes to the board.  Returns the commit latency in microseconds, from the
+// request to the I/O scheduler until the last UpdateWireIns() returned (0 for nested or empty
+// transactions).
+double BoardConfigTransaction::commit()
+{
+    if (committed) {
+        return commitLatencyUs;
+    }
+    committed = true;
+    unlink();
+    if (outer || writes.empty()) {
+        return 0.0;
+    }
+
+    auto start = chrono::steady_clock::now();
+    board->ioScheduler->execute(ioClass, [&] {
+        bool updatePending = false;
+        for (const StagedWrite &write : writes) {
+            if (write.trigger) {
+                if (updatePending) {
+                    board->dev->UpdateWireIns();
+                    numWireInUpdates++;
+                    updatePending = false;
+                }
+                board->dev->ActivateTriggerIn(write.endPoint, (int) write.value);
+            } else {
+                board->dev->SetWireInValue(write.endPoint, write.value, write.mask);
+                updatePending = true;
+            }
+        }
+        if (updatePending) {
+            board->dev->UpdateWireIns();
+            numWireInUpdates++;
+        }
+    });
+    commitLatencyUs = chrono::duration<double, micro>(chrono::steady_clock::now() - start).count();
+
+    static LatencyHistogram* commitTimeMetric = MetricsRegistry::global()->histogram("board.config_commit_time", "us");
+    commitTimeMetric->record((unsigned long long) commitLatencyUs);
+    return commitLatencyUs;
+}
+
+// Take this transaction off the calling thread's stack of open transactions, wherever it sits,
+// so that committing out of order never leaves a committed one on the stack.  Transactions
+// still open that were nested in this one now go to the oldest of them instead.  (Private method.)
+void BoardConfigTransaction::unlink()
+{
+    BoardConfigTransaction *newOuter = nullptr;
+    BoardConfigTransaction **link = &openTransaction;
+    vector<BoardConfigTransaction*> orphans;
+    while (*link) {
+        BoardConfigTransaction *t = *link;
+        if (t == this) {
+            *link = previous;
+            continue;
+        }
+        if (!outer && t->outer == this) {
+            orphans.push_back(t);
+        }
+        link = &t->previous;
+    }
+
+    // orphans runs from innermost to outermost.
+    for (auto t = orphans.rbegin(); t != orphans.rend(); ++t) {
+        (*t)->outer = newOuter;
+        if (!newOuter) {
+            newOuter = *t;
+        }
+    }
+    previous = nullptr;
+}
+
+bool BoardConfigTransaction::isNested() const
+{
+    return outer != nullptr;
+}
+
+int BoardConfigTransaction::getNumStagedWrites() const
+{
+    return (int) writes.size();
+}
+
+// Number of USB wire-in updates the commit took.
+int BoardConfigTransaction::getNumWireInUpdates() const
+{
+    return numWireInUpdates;
+}
+
+double BoardConfigTransaction::getCommitLatencyUs() const
+{
+    return commitLatencyUs;
+}
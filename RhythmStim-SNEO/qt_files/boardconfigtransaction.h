@@ -0,0 +1,68 @@
+#ifndef BOARDCONFIGTRANSACTION_H
+#define BOARDCONFIGTRANSACTION_H
+
+#include <vector>
+
+#include "boardioscheduler.h"
+
+using namespace std;
+
+class Rhs2000EvalBoard;
+
+// Batch of wire-in writes (and the trigger-ins that sample them) sent to the board with as few
+// UpdateWireIns() calls as possible.  Writes are staged in order and replayed at commit(): all
+// writes up to the next trigger-in share a single UpdateWireIns(), so a parameter change that
+// used to take one USB control transaction per setter takes one in total.
+//
+// While a transaction is open, every Rhs2000EvalBoard setter called from the same thread joins
+// it instead of talking to the board, so callers can group existing setters:
+//
+//     BoardConfigTransaction transaction(evalBoard);
+//     evalBoard->setThresholdMult(5.5);
+//     evalBoard->setBlindWindowLength(10);
+//     evalBoard->setDeactiveChannels(channels);
+//     double latencyUs = transaction.commit();
+//
+// A transaction opened while another one is open on the same thread is nested: its writes go
+// to the outer transaction and its commit() does nothing.  Transactions may be committed in any
+// order; if the outer one commits first, later writes of the nested ones are committed with the
+// outermost of those.  Uncommitted writes are committed by the destructor.  Commit latencies are
+// published as the board.config_commit_time histogram.
+
+class BoardConfigTransaction
+{
+
+public:
+    BoardConfigTransaction(Rhs2000EvalBoard *board_, BoardIoScheduler::IoClass ioClass_ = BoardIoScheduler::WireUpdate);
+    ~BoardConfigTransaction();
+
+    void setWireInValue(int endPoint, unsigned int value, unsigned int mask = 0xffffffff);
+    void activateTriggerIn(int endPoint, int bit);
+    double commit();
+
+    bool isNested() const;
+    int getNumStagedWrites() const;
+    int getNumWireInUpdates() const;
+    double getCommitLatencyUs() const;
+
+private:
+    struct StagedWrite {
+        bool trigger;
+        int endPoint;
+        unsigned int value;     // trigger bit for trigger-ins
+        unsigned int mask;
+    };
+
+    void unlink();
+
+    Rhs2000EvalBoard *board;
+    BoardIoScheduler::IoClass ioClass;
+    BoardConfigTransaction *outer;      // top-level transaction this one forwards to, if nested
+    BoardConfigTransaction *previous;   // transaction open on this thread before this one
+    vector<StagedWrite> writes;
+    bool committed;
+    int numWireInUpdates;
+    double commitLatencyUs;
+};
+
+#endif // BOARDCONFIGTRANSACTION_H
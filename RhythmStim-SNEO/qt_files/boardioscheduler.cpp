@@ -0,0 +1,153 @@
+#include <iostream>
+#include <iomanip>
+
+#include "boardioscheduler.h"
+
+// Board I/O scheduler
+// Owns all USB traffic to the Opal Kelly board, so that latency-critical requests
+// (spike pipe reads, stimulation triggers) can jump ahead of bulk waveform reads.
+
+BoardIoScheduler::BoardIoScheduler(mutex &okMutex_) :
+    okMutex(okMutex_)
+{
+    stopThread = false;
+    resetStatistics();
+    ioThread = thread(&BoardIoScheduler::run, this);
+}
+
+BoardIoScheduler::~BoardIoScheduler()
+{
+    {
+        lock_guard<mutex> lockQueue(queueMutex);
+        stopThread = true;
+    }
+    requestPending.notify_one();
+    ioThread.join();
+}
+
+// Queue an operation in the given priority class and block until the I/O thread has executed it.
+// Operations must not call execute() themselves; nested calls from the I/O thread run in place.
+void BoardIoScheduler::execute(IoClass ioClass, const function<void()> &operation)
+{
+    if (isSchedulerThread()) {
+        operation();
+        return;
+    }
+
+    Request request;
+    request.operation = &operation;
+    request.enqueueTime = chrono::steady_clock::now();
+    request.done = false;
+
+    unique_lock<mutex> lockQueue(queueMutex);
+    queues[ioClass].push_back(&request);
+    requestPending.notify_one();
+    requestDone.wait(lockQueue, [&request] { return request.done; });
+}
+
+bool BoardIoScheduler::isSchedulerThread() const
+{
+    return this_thread::get_id() == ioThread.get_id();
+}
+
+void BoardIoScheduler::run()
+{
+    unique_lock<mutex> lockQueue(queueMutex);
+
+    while (true) {
+        Request *request = nullptr;
+        int ioClass;
+        for (ioClass = 0; ioClass < NumIoClasses; ++ioClass) {
+            if (!queues[ioClass].empty()) {
+                request = queues[ioClass].front();
+                queues[ioClass].pop_front();
+                break;
+            }
+        }
+
+        if (!request) {
+            if (stopThread) {
+                break;
+            }
+            requestPending.wait(lockQueue);
+            continue;
+        }
+        lockQueue.unlock();
+
+        unsigned long long delayNs = chrono::duration_cast<chrono::nanoseconds>(
+                    chrono::steady_clock::now() - request->enqueueTime).count();
+        numRequests[ioClass]++;
+        totalDelayNs[ioClass] += delayNs;
+        unsigned long long previousMax = maxDelayNs[ioClass];
+        while (delayNs > previousMax && !maxDelayNs[ioClass].compare_exchange_weak(previousMax, delayNs)) { }
+
+        {
+            lock_guard<mutex> lockOk(okMutex);
+            (*request->operation)();
+        }
+
+        lockQueue.lock();
+        request->done = true;
+        requestDone.notify_all();
+    }
+}
+
+// Number of requests served in a priority class since the last statistics reset.
+unsigned long long BoardIoScheduler::getNumRequests(IoClass ioClass) const
+{
+    return numRequests[ioClass];
+}
+
+// Mean time (in microseconds) requests of a priority class have spent waiting in the queue.
+double BoardIoScheduler::getMeanQueueDelayUs(IoClass ioClass) const
+{
+    unsigned long long n = numRequests[ioClass];
+    if (n == 0) {
+        return 0.0;
+    }
+    return 1.0e-3 * totalDelayNs[ioClass] / n;
+}
+
+// Longest time (in microseconds) a request of a priority class has spent waiting in the queue.
+double BoardIoScheduler::getMaxQueueDelayUs(IoClass ioClass) const
+{
+    return 1.0e-3 * maxDelayNs[ioClass];
+}
+
+void BoardIoScheduler::resetStatistics()
+{
+    for (int i = 0; i < NumIoClasses; ++i) {
+        numRequests[i] = 0;
+        totalDelayNs[i] = 0;
+        maxDelayNs[i] = 0;
+    }
+}
+
+void BoardIoScheduler::printStatistics() const
+{
+    cout << "Board I/O queueing delay:" << endl;
+    for (int i = 0; i < NumIoClasses; ++i) {
+        IoClass ioClass = (IoClass) i;
+        cout << "  " << setw(12) << left << ioClassName(ioClass) << right <<
+                " n = " << getNumRequests(ioClass) <<
+                "  mean = " << fixed << setprecision(1) << getMeanQueueDelayUs(ioClass) << " us" <<
+                "  max = " << getMaxQueueDelayUs(ioClass) << " us" << endl;
+    }
+    cout.unsetf(ios::fixed);
+}
+
+const char* BoardIoScheduler::ioClassName(IoClass ioClass)
+{
+    switch (ioClass) {
+    case SpikeRead:
+        return "SpikeRead";
+    case StimTrigger:
+        return "StimTrigger";
+    case WireUpdate:
+        return "WireUpdate";
+    case BulkRead:
+        return "BulkRead";
+    default:
+        return "Unknown";
+    }
+}
@@ -0,0 +1,69 @@
+#ifndef BOARDIOSCHEDULER_H
+#define BOARDIOSCHEDULER_H
+
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <condition_variable>
+
+using namespace std;
+
+// Single thread that performs every USB transaction with the Opal Kelly board.
+// Requests are grouped in priority classes: a pending request of a lower class
+// number is always served before any request of a higher class number, so a
+// spike pipe read never has to wait for more than one bulk chunk in flight.
+
+class BoardIoScheduler
+{
+
+public:
+    enum IoClass {
+        SpikeRead = 0,
+        StimTrigger = 1,
+        WireUpdate = 2,
+        BulkRead = 3
+    };
+
+    static const int NumIoClasses = 4;
+
+    BoardIoScheduler(mutex &okMutex_);
+    ~BoardIoScheduler();
+
+    void execute(IoClass ioClass, const function<void()> &operation);
+    bool isSchedulerThread() const;
+
+    unsigned long long getNumRequests(IoClass ioClass) const;
+    double getMeanQueueDelayUs(IoClass ioClass) const;
+    double getMaxQueueDelayUs(IoClass ioClass) const;
+    void resetStatistics();
+    void printStatistics() const;
+    static const char* ioClassName(IoClass ioClass);
+
+private:
+    struct Request {
+        const function<void()> *operation;
+        chrono::steady_clock::time_point enqueueTime;
+        bool done;
+    };
+
+    void run();
+
+    // Held while an operation is executed, so methods still locking it directly are serialized with us.
+    mutex &okMutex;
+
+    thread ioThread;
+    mutable mutex queueMutex;
+    condition_variable requestPending;
+    condition_variable requestDone;
+    deque<Request*> queues[NumIoClasses];
+    bool stopThread;
+
+    atomic<unsigned long long> numRequests[NumIoClasses];
+    atomic<unsigned long long> totalDelayNs[NumIoClasses];
+    atomic<unsigned long long> maxDelayNs[NumIoClasses];
+};
+
+#endif // BOARDIOSCHEDULER_H
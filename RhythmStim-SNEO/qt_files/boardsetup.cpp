@@ -0,0 +1,120 @@
+#include <QCoreApplication>
+#include <iostream>
+
+#include "boardsetup.h"
+#include "globalconstants.h"
+#include "rhs2000evalboard.h"
+#include "rhs2000datablock.h"
+
+// Interface board bring-up
+
+// Return the Intan chip ID stored in ROM register 255.  If the data is invalid
+// (due to a SPI communication channel with the wrong delay or a chip not present)
+// then return -1.
+int BoardSetup::deviceId(Rhs2000DataBlock *dataBlock, int stream)
+{
+    bool intanChipPresent;
+
+    // First, check ROM registers 251-253 to verify that they hold 'INTAN'.
+    // This is just used to verify that we are getting good data over the SPI
+    // communication channel.
+    intanChipPresent = ((char) ((dataBlock->auxiliaryData[stream][0][61] & 0xff00) >> 8) == 'I' &&
+                        (char) ((dataBlock->auxiliaryData[stream][0][61] & 0x00ff) >> 0) == 'N' &&
+                        (char) ((dataBlock->auxiliaryData[stream][0][60] & 0xff00) >> 8) == 'T' &&
+                        (char) ((dataBlock->auxiliaryData[stream][0][60] & 0x00ff) >> 0) == 'A' &&
+                        (char) ((dataBlock->auxiliaryData[stream][0][59] & 0xff00) >> 8) == 'N' &&
+                        (char) ((dataBlock->auxiliaryData[stream][0][59] & 0x00ff) >> 0) == 0);
+
+    if (!intanChipPresent) {
+        return -1;
+    } else {
+        return dataBlock->auxiliaryData[stream][0][57]; // chip ID (Register 255)
+    }
+}
+
+// Run the SPI command sequence at all 16 possible FPGA MISO delay settings, with all data
+// streams enabled, and set the delay of each port to one that gives good communication with
+// its RHS2000 chips.  Returns the chip ID found on each data stream (-1 if none) in chipId and
+// the delay chosen for each SPI port in portDelay.
+void BoardSetup::scanCableDelays(Rhs2000EvalBoard *evalBoard, QVector<int> &chipId, QVector<int> &portDelay)
+{
+    int delay, stream, id;
+
+    chipId.fill(-1, MAX_NUM_DATA_STREAMS);
+    portDelay.fill(0, MAX_NUM_SPI_PORTS);
+
+    // Enable all data streams
+    for (stream = 0; stream < MAX_NUM_DATA_STREAMS; stream++) {
+        evalBoard->enableDataStream(stream, true);
+    }
+
+    // Since our longest command sequence is 128 commands, we run the SPI
+    // interface for 128 samples.
+    evalBoard->setMaxTimeStep(SAMPLES_PER_DATA_BLOCK);
+    evalBoard->setContinuousRunMode(false);
+
+    Rhs2000DataBlock *dataBlock =
+            new Rhs2000DataBlock(evalBoard->getNumEnabledDataStreams());
+
+    QVector<int> sumGoodDelays(MAX_NUM_DATA_STREAMS, 0);
+    QVector<int> indexFirstGoodDelay(MAX_NUM_DATA_STREAMS, -1);
+    QVector<int> indexSecondGoodDelay(MAX_NUM_DATA_STREAMS, -1);
+
+    for (delay = 0; delay < 16; ++delay) {
+        evalBoard->setCableDelay(Rhs2000EvalBoard::PortA, delay);
+        evalBoard->setCableDelay(Rhs2000EvalBoard::PortB, delay);
+        evalBoard->setCableDelay(Rhs2000EvalBoard::PortC, delay);
+        evalBoard->setCableDelay(Rhs2000EvalBoard::PortD, delay);
+
+        runOnce(evalBoard);
+
+        // Read the resulting single data block from the USB interface.
+        evalBoard->readDataBlock(dataBlock);
+
+        // Read the Intan chip ID number from each RHS2000 chip found.
+        // Record delay settings that yield good communication with the chip.
+        for (stream = 0; stream < MAX_NUM_DATA_STREAMS; ++stream) {
+            id = deviceId(dataBlock, stream);
+
+            if (id == CHIP_ID_RHS2116) {
+                sumGoodDelays[stream] = sumGoodDelays[stream] + 1;
+                if (indexFirstGoodDelay[stream] == -1) {
+                    indexFirstGoodDelay[stream] = delay;
+                    chipId[stream] = id;
+                } else if (indexSecondGoodDelay[stream] == -1) {
+                    indexSecondGoodDelay[stream] = delay;
+                    chipId[stream] = id;
+                }
+            }
+        }
+    }
+
+    delete dataBlock;
+
+    // Set cable delay settings that yield good communication with each
+    // RHS2000 chip.
+    QVector<int> optimumDelay(MAX_NUM_DATA_STREAMS, 0);
+    for (stream = 0; stream < MAX_NUM_DATA_STREAMS; ++stream) {
+        if (sumGoodDelays[stream] == 1 || sumGoodDelays[stream] == 2) {
+            optimumDelay[stream] = indexFirstGoodDelay[stream];
+        } else if (sumGoodDelays[stream] > 2) {
+            optimumDelay[stream] = indexSecondGoodDelay[stream];
+        }
+    }
+
+    // Two data streams per SPI port
+    for (int port = 0; port < MAX_NUM_SPI_PORTS; ++port) {
+        portDelay[port] = qMax(optimumDelay[2 * port], optimumDelay[2 * port + 1]);
+        evalBoard->setCableDelay((Rhs2000EvalBoard::BoardPort) port, portDelay[port]);
+        cout << "Port " << (char) ('A' + port) << " cable delay: " << portDelay[port] << endl;
+    }
+}
+
+// Start the SPI interface for one non-continuous run and wait for it to complete.
+void BoardSetup::runOnce(Rhs2000EvalBoard *evalBoard)
+{
+    evalBoard->run();
+    while (evalBoard->isRunning()) {
+        QCoreApplication::processEvents();
+    }
+}
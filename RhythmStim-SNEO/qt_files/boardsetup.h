@@ -0,0 +1,23 @@
+#ifndef BOARDSETUP_H
+#define BOARDSETUP_H
+
+#include <QVector>
+
+using namespace std;
+
+class Rhs2000EvalBoard;
+class Rhs2000DataBlock;
+
+// Steps of bringing up the interface board that need no widgets, shared by MainWindow and the
+// headless acquisition daemon.
+
+class BoardSetup
+{
+
+public:
+    static int deviceId(Rhs2000DataBlock *dataBlock, int stream);
+    static void scanCableDelays(Rhs2000EvalBoard *evalBoard, QVector<int> &chipId, QVector<int> &portDelay);
+    static void runOnce(Rhs2000EvalBoard *evalBoard);
+};
+
+#endif // BOARDSETUP_H
@@ -0,0 +1,187 @@
+#include <iostream>
+#include <algorithm>
+
+#include "datablockpool.h"
+#include "rhs2000datablock.h"
+
+// Data block arena and handle queue
+
+DataBlockPool::DataBlockPool()
+{
+    numDataStreams = 0;
+}
+
+DataBlockPool::~DataBlockPool()
+{
+    clear();
+}
+
+// Preallocate numBlocks data blocks for numDataStreams_ data streams.  Does nothing if the pool
+// already has that shape, so it can be called at the start of every run.  Only call while no
+// block is in use.
+void DataBlockPool::allocate(int numBlocks, int numDataStreams_)
+{
+    if (numBlocks == capacity() && numDataStreams_ == numDataStreams) {
+        return;
+    }
+    clear();
+
+    numDataStreams = numDataStreams_;
+    blocks.reserve(numBlocks);
+    freeList.reserve(numBlocks);
+    for (int i = 0; i < numBlocks; ++i) {
+        blocks.push_back(new Rhs2000DataBlock(numDataStreams));
+    }
+    for (int i = numBlocks - 1; i >= 0; --i) {
+        freeList.push_back(i);
+    }
+    inUse.assign(numBlocks, false);
+}
+
+// Free all blocks.  Only call while no block is in use.
+void DataBlockPool::clear()
+{
+    for (unsigned int i = 0; i < blocks.size(); ++i) {
+        delete blocks[i];
+    }
+    blocks.clear();
+    freeList.clear();
+    inUse.clear();
+    numDataStreams = 0;
+}
+
+int DataBlockPool::capacity() const
+{
+    return (int) blocks.size();
+}
+
+int DataBlockPool::numFree() const
+{
+    return (int) freeList.size();
+}
+
+int DataBlockPool::getNumDataStreams() const
+{
+    return numDataStreams;
+}
+
+// Take a free block out of the pool.  Returns INVALID_DATA_BLOCK if all blocks are in use.
+DataBlockHandle DataBlockPool::acquire()
+{
+    if (freeList.empty()) {
+        return INVALID_DATA_BLOCK;
+    }
+    DataBlockHandle handle = freeList.back();
+    freeList.pop_back();
+    inUse[handle] = true;
+    return handle;
+}
+
+// Return a block to the pool.  Handles that are not in use (including ones already released)
+// are rejected, so that two users can never be handed the same block.
+void DataBlockPool::release(DataBlockHandle handle)
+{
+    if (handle < 0 || handle >= capacity()) {
+        cerr << "Error in DataBlockPool::release: invalid data block handle " << handle << "." << endl;
+        return;
+    }
+    if (!inUse[handle]) {
+        cerr << "Error in DataBlockPool::release: data block " << handle << " is not in use." << endl;
+        return;
+    }
+    inUse[handle] = false;
+    freeList.push_back(handle);
+}
+
+Rhs2000DataBlock* DataBlockPool::block(DataBlockHandle handle) const
+{
+    return blocks[handle];
+}
+
+DataBlockQueue::DataBlockQueue(int capacity_)
+{
+    setCapacity(capacity_);
+}
+
+// Set the maximum number of handles the queue can hold.  Empties the queue.
+void DataBlockQueue::setCapacity(int capacity_)
+{
+    handles.assign(capacity_, INVALID_DATA_BLOCK);
+    head = 0;
+    count = 0;
+}
+
+int DataBlockQueue::capacity() const
+{
+    return (int) handles.size();
+}
+
+int DataBlockQueue::size() const
+{
+    return count;
+}
+
+bool DataBlockQueue::empty() const
+{
+    return count == 0;
+}
+
+bool DataBlockQueue::full() const
+{
+    return count == capacity();
+}
+
+void DataBlockQueue::clear()
+{
+    head = 0;
+    count = 0;
+}
+
+// Append a handle.  Returns false if the queue is full.
+bool DataBlockQueue::push(DataBlockHandle handle)
+{
+    if (full()) {
+        return false;
+    }
+    handles[(head + count) % capacity()] = handle;
+    count++;
+    return true;
+}
+
+DataBlockHandle DataBlockQueue::front() const
+{
+    return at(0);
+}
+
+// Handle index places behind the front of the queue.
+DataBlockHandle DataBlockQueue::at(int index) const
+{
+    if (index < 0 || index >= count) {
+        return INVALID_DATA_BLOCK;
+    }
+    return handles[(head + index) % capacity()];
+}
+
+// Remove and return the handle at the front of the queue, or INVALID_DATA_BLOCK if it is empty.
+DataBlockHandle DataBlockQueue::pop()
+{
+    if (empty()) {
+        return INVALID_DATA_BLOCK;
+    }
+    DataBlockHandle handle = handles[head];
+    head = (head + 1) % capacity();
+    count--;
+    return handle;
+}
+
+// The queued handles, oldest first, as two contiguous runs in the queue's storage: first holds
+// firstSize handles, followed by secondSize handles at second (zero unless the queue wraps
+// around the end of its storage).  Valid until the next push or pop.
+void DataBlockQueue::spans(const DataBlockHandle* &first, int &firstSize,
+                           const DataBlockHandle* &second, int &secondSize) const
+{
+    first = handles.data() + head;
+    firstSize = min(count, capacity() - head);
+    second = handles.data();
+    secondSize = count - firstSize;
+}
@@ -0,0 +1,85 @@
+#ifndef DATABLOCKPOOL_H
+#define DATABLOCKPOOL_H
+
+#include <vector>
+#include "usbheaderscanner.h"
+
+using namespace std;
+
+class Rhs2000DataBlock;
+
+// Index of a data block in a DataBlockPool.
+typedef int DataBlockHandle;
+#define INVALID_DATA_BLOCK -1
+
+// Fixed arena of preallocated data blocks.  All blocks are allocated up front by allocate(),
+// so acquiring, filling and releasing them during acquisition never touches the heap.
+// Blocks are passed between the parse and process stages by handle; SignalProcessor still
+// takes its input as a queue<Rhs2000DataBlock>, so the process stage copies each block once
+// (and allocates for the copy) when it hands it over.
+
+class DataBlockPool
+{
+
+public:
+    DataBlockPool();
+    ~DataBlockPool();
+
+    void allocate(int numBlocks, int numDataStreams_);
+    void clear();
+    int capacity() const;
+    int numFree() const;
+    int getNumDataStreams() const;
+
+    DataBlockHandle acquire();
+    void release(DataBlockHandle handle);
+    Rhs2000DataBlock* block(DataBlockHandle handle) const;
+
+private:
+    vector<Rhs2000DataBlock*> blocks;
+    vector<DataBlockHandle> freeList;
+    vector<bool> inUse;
+    int numDataStreams;
+};
+
+// Data blocks parsed from one USB read, numBlocks consecutive blocks of a DataBlockPool starting
+// at firstBlock, with the USB status at the time.  Handed from the parse stage of the
+// acquisition pipeline to the process stage.
+struct DataBlockBatch
+{
+    DataBlockHandle firstBlock;
+    int numBlocks;
+    double usbBufferPercentFull;        // host DataStreamFifo
+    bool cpuWarning;                    // the data was waiting when the parse stage got to it
+    UsbGlitchStatistics usbGlitches;    // since the start of the run
+};
+
+// Fixed-capacity FIFO of data block handles.  Not thread safe.
+
+class DataBlockQueue
+{
+
+public:
+    DataBlockQueue(int capacity_ = 0);
+
+    void setCapacity(int capacity_);
+    int capacity() const;
+    int size() const;
+    bool empty() const;
+    bool full() const;
+    void clear();
+
+    bool push(DataBlockHandle handle);
+    DataBlockHandle front() const;
+    DataBlockHandle at(int index) const;
+    DataBlockHandle pop();
+    void spans(const DataBlockHandle* &first, int &firstSize,
+               const DataBlockHandle* &second, int &secondSize) const;
+
+private:
+    vector<DataBlockHandle> handles;
+    int head;
+    int count;
+};
+
+#endif // DATABLOCKPOOL_H
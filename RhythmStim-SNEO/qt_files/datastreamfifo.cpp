@@ -0,0 +1,347 @@
+//  ------------------------------------------------------------------------
+//
+//  This file is part of the Intan Technologies RHS2000 Interface
+//  Version 1.01
+//  Copyright (C) 2013-2017 Intan Technologies
+//
+//  ------------------------------------------------------------------------
+//
+//  This program is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU Lesser General Public License as published
+//  by the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU Lesser General Public License for more details.
+//
+//  You should have received a copy of the GNU Lesser General Public License
+//  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include <iostream>
+#include <iomanip>
+#include <cstring>
+#include <new>
+#include <chrono>
+#include "datastreamfifo.h"
+
+#ifdef __linux__
+#include <sys/mman.h>
+#define FIFO_HUGE_PAGE_SIZE (2 * 1024 * 1024)
+#endif
+
+using namespace std;
+
+// Constructor.  Allocates bufferSize bytes of ring memory, plus maxSpanBytes of mirror area
+// used to keep reserved and peeked spans contiguous across the end of the ring.
+DataStreamFifo::DataStreamFifo(unsigned int bufferSize_, unsigned int maxSpanBytes_, bool useHugePages) :
+    memoryBuffer(nullptr),
+    allocatedBytes(0),
+    hugePages(false),
+    bufferSize(bufferSize_),
+    maxSpanBytes(maxSpanBytes_),
+    writeCount(0),
+    cachedReadCount(0),
+    readCount(0),
+    cachedWriteCount(0),
+    mirroredBytes(0),
+    readerWaiting(false)
+{
+    if (maxSpanBytes > bufferSize) {
+        maxSpanBytes = bufferSize;
+    }
+    resetStatistics();
+
+    allocatedBytes = (size_t) bufferSize + maxSpanBytes;
+    cout << "DataStreamFifo: Allocating " << allocatedBytes / 1.0e6 << " MBytes for FIFO buffer." << endl;
+
+#ifdef __linux__
+    if (useHugePages) {
+        size_t hugePageBytes = (allocatedBytes + FIFO_HUGE_PAGE_SIZE - 1) & ~((size_t) FIFO_HUGE_PAGE_SIZE - 1);
+        void* memory = mmap(nullptr, hugePageBytes, PROT_READ | PROT_WRITE,
+                            MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if (memory != MAP_FAILED) {
+            memoryBuffer = (unsigned char*) memory;
+            allocatedBytes = hugePageBytes;
+            hugePages = true;
+        } else {
+            cout << "DataStreamFifo: Huge pages not available; using normal pages." << endl;
+        }
+    }
+#else
+    if (useHugePages) {
+        cout << "DataStreamFifo: Huge pages not supported on this platform; using normal pages." << endl;
+    }
+#endif
+
+    if (!hugePages) {
+        memoryBuffer = new (nothrow) unsigned char [allocatedBytes];
+        if (memoryBuffer == nullptr) {
+            cerr << "Error: DataStreamFifo constructor could not allocate " << allocatedBytes << " bytes of memory." << endl;
+        }
+    }
+}
+
+DataStreamFifo::~DataStreamFifo()
+{
+#ifdef __linux__
+    if (hugePages) {
+        munmap(memoryBuffer, allocatedBytes);
+        return;
+    }
+#endif
+    if (memoryBuffer) delete [] memoryBuffer;
+}
+
+// Free space as seen by the producer.  The cached read counter is only refreshed when it
+// does not show at least numBytes free.  (Private method.)
+unsigned int DataStreamFifo::freeSpaceForWriter(unsigned int numBytes)
+{
+    unsigned long long writeEnd = writeCount.load(memory_order_relaxed);
+    unsigned int freeSpace = bufferSize - (unsigned int) (writeEnd - cachedReadCount);
+    if (freeSpace < numBytes) {
+        cachedReadCount = readCount.load(memory_order_acquire);
+        freeSpace = bufferSize - (unsigned int) (writeEnd - cachedReadCount);
+    }
+    return freeSpace;
+}
+
+// Data available as seen by the consumer.  The cached write counter is only refreshed when it
+// does not show at least numBytes available.  (Private method.)
+unsigned int DataStreamFifo::usedSpaceForReader(unsigned int numBytes)
+{
+    unsigned long long readStart = readCount.load(memory_order_relaxed);
+    unsigned int usedSpace = (unsigned int) (cachedWriteCount - readStart);
+    if (usedSpace < numBytes) {
+        cachedWriteCount = writeCount.load(memory_order_acquire);
+        usedSpace = (unsigned int) (cachedWriteCount - readStart);
+    }
+    return usedSpace;
+}
+
+// (Private method.)
+void DataStreamFifo::recordOverrun(unsigned int numBytes)
+{
+    numOverruns.store(numOverruns.load(memory_order_relaxed) + 1, memory_order_relaxed);
+    overrunBytes.store(overrunBytes.load(memory_order_relaxed) + numBytes, memory_order_relaxed);
+}
+
+// Update the wrap count and high-water mark for a write of numBytes ending at writeEnd.
+// (Private method.)
+void DataStreamFifo::recordWrite(unsigned long long writeEnd, unsigned int numBytes)
+{
+    if ((writeEnd - numBytes) % bufferSize + numBytes >= bufferSize) {
+        numWraps.store(numWraps.load(memory_order_relaxed) + 1, memory_order_relaxed);
+    }
+    unsigned int usedSpace = (unsigned int) (writeEnd - readCount.load(memory_order_relaxed));
+    if (usedSpace > highWaterBytes.load(memory_order_relaxed)) {
+        highWaterBytes.store(usedSpace, memory_order_relaxed);
+    }
+}
+
+// Write numBytes bytes from dataSource to the FIFO.  Returns false if there is not enough free space.
+bool DataStreamFifo::writeToBuffer(unsigned char* dataSource, unsigned int numBytes)
+{
+    if (freeSpaceForWriter(numBytes) < numBytes) {
+        recordOverrun(numBytes);
+        return false;
+    }
+    unsigned long long writeStart = writeCount.load(memory_order_relaxed);
+    unsigned int writeIndex = writeStart % bufferSize;
+    unsigned int numBytesToEnd = bufferSize - writeIndex;
+    if (numBytes <= numBytesToEnd) {
+        memcpy(&memoryBuffer[writeIndex], dataSource, numBytes);
+    } else {
+        memcpy(&memoryBuffer[writeIndex], dataSource, numBytesToEnd);
+        memcpy(memoryBuffer, dataSource + numBytesToEnd, numBytes - numBytesToEnd);
+    }
+    writeCount.store(writeStart + numBytes, memory_order_release);
+    recordWrite(writeStart + numBytes, numBytes);
+    wakeReader();
+    return true;
+}
+
+// Read numBytes bytes from the FIFO into dataSink.  Returns false if that much data is not available.
+bool DataStreamFifo::readFromBuffer(unsigned char* dataSink, unsigned int numBytes)
+{
+    if (usedSpaceForReader(numBytes) < numBytes) {
+        return false;
+    }
+    unsigned long long readStart = readCount.load(memory_order_relaxed);
+    unsigned int readIndex = readStart % bufferSize;
+    unsigned int numBytesToEnd = bufferSize - readIndex;
+    if (numBytes <= numBytesToEnd) {
+        memcpy(dataSink, &memoryBuffer[readIndex], numBytes);
+    } else {
+        memcpy(dataSink, &memoryBuffer[readIndex], numBytesToEnd);
+        memcpy(dataSink + numBytesToEnd, memoryBuffer, numBytes - numBytesToEnd);
+    }
+    mirroredBytes = 0;
+    readCount.store(readStart + numBytes, memory_order_release);
+    return true;
+}
+
+// Returns a contiguous span of numBytes writable bytes at the head of the FIFO, or nullptr if
+// there is not enough free space (counted as an overrun) or numBytes exceeds the maximum span
+// size.  Nothing is visible to the reader until commitWrite() is called.  (Producer thread only.)
+unsigned char* DataStreamFifo::reserveWrite(unsigned int numBytes)
+{
+    if (numBytes > maxSpanBytes) {
+        return nullptr;
+    }
+    if (freeSpaceForWriter(numBytes) < numBytes) {
+        recordOverrun(numBytes);
+        return nullptr;
+    }
+    return &memoryBuffer[writeCount.load(memory_order_relaxed) % bufferSize];
+}
+
+// Publish the first numBytes bytes of the span returned by reserveWrite().  Bytes written past
+// the end of the ring are moved to its start.
+void DataStreamFifo::commitWrite(unsigned int numBytes)
+{
+    if (numBytes > maxSpanBytes || freeSpaceForWriter(numBytes) < numBytes) {
+        cerr << "Error in DataStreamFifo::commitWrite: committing more bytes than were reserved." << endl;
+        return;
+    }
+    unsigned long long writeStart = writeCount.load(memory_order_relaxed);
+    unsigned int writeIndex = writeStart % bufferSize;
+    if (writeIndex + numBytes > bufferSize) {
+        memcpy(memoryBuffer, &memoryBuffer[bufferSize], writeIndex + numBytes - bufferSize);
+    }
+    writeCount.store(writeStart + numBytes, memory_order_release);
+    recordWrite(writeStart + numBytes, numBytes);
+    wakeReader();
+}
+
+// Returns a contiguous span holding the next numBytes bytes of the FIFO, or nullptr if that much
+// data is not available yet or numBytes exceeds the maximum span size.  The data stays in the FIFO
+// (and may be modified in place) until releaseRead().  Peeking again with a larger numBytes before
+// releasing extends the same span.  (Consumer thread only.)
+unsigned char* DataStreamFifo::peekRead(unsigned int numBytes)
+{
+    if (numBytes > maxSpanBytes || usedSpaceForReader(numBytes) < numBytes) {
+        return nullptr;
+    }
+    unsigned int readIndex = readCount.load(memory_order_relaxed) % bufferSize;
+    if (readIndex + numBytes > bufferSize + mirroredBytes) {
+        // Only copy what has not been mirrored yet, so edits already made to the span survive.
+        unsigned int numBytesPastEnd = readIndex + numBytes - bufferSize;
+        memcpy(&memoryBuffer[bufferSize + mirroredBytes], &memoryBuffer[mirroredBytes], numBytesPastEnd - mirroredBytes);
+        mirroredBytes = numBytesPastEnd;
+    }
+    return &memoryBuffer[readIndex];
+}
+
+// Remove numBytes bytes, previously obtained with peekRead(), from the FIFO.
+void DataStreamFifo::releaseRead(unsigned int numBytes)
+{
+    if (usedSpaceForReader(numBytes) < numBytes) {
+        cerr << "Error in DataStreamFifo::releaseRead: releasing more bytes than are available." << endl;
+        return;
+    }
+    mirroredBytes = 0;
+    readCount.store(readCount.load(memory_order_relaxed) + numBytes, memory_order_release);
+}
+
+unsigned int DataStreamFifo::getBufferSize() const
+{
+    return bufferSize;
+}
+
+// Largest span reserveWrite() and peekRead() can return.
+unsigned int DataStreamFifo::getMaxSpanBytes() const
+{
+    return maxSpanBytes;
+}
+
+// Is at least numBytes of data available for reading?
+bool DataStreamFifo::dataAvailable(unsigned int numBytes) const
+{
+    return (bytesAvailable() >= numBytes);
+}
+
+// Block until at least numBytes bytes are in the FIFO (returns true) or keepWaiting turns false
+// (returns false).  keepWaiting is checked every FIFO_WAIT_CHECK_MS, so whoever clears it need
+// not know about the FIFO.  (Consumer thread only.)
+bool DataStreamFifo::waitForData(unsigned int numBytes, const atomic<bool> &keepWaiting)
+{
+    if (bytesAvailable() >= numBytes) {
+        return true;
+    }
+    unique_lock<mutex> lock(waitMutex);
+    readerWaiting.store(true, memory_order_relaxed);
+    while (bytesAvailable() < numBytes && keepWaiting) {
+        dataWritten.wait_for(lock, chrono::milliseconds(FIFO_WAIT_CHECK_MS));
+    }
+    readerWaiting.store(false, memory_order_relaxed);
+    return bytesAvailable() >= numBytes;
+}
+
+// Wake the reader if it is blocked in waitForData().  A wake-up lost to the race with the reader
+// setting readerWaiting only delays it until its next check.  (Private method.)
+void DataStreamFifo::wakeReader()
+{
+    if (readerWaiting.load(memory_order_relaxed)) {
+        lock_guard<mutex> lock(waitMutex);
+        dataWritten.notify_one();
+    }
+}
+
+// Number of bytes in the FIFO.  May be called from any thread.
+unsigned int DataStreamFifo::bytesAvailable() const
+{
+    unsigned long long readStart = readCount.load(memory_order_acquire);
+    return (unsigned int) (writeCount.load(memory_order_acquire) - readStart);
+}
+
+double DataStreamFifo::percentFull() const
+{
+    return 100.0 * ((double) bytesAvailable()) / ((double) bufferSize);
+}
+
+// Discard all data.  Only call while neither thread is using the FIFO.
+void DataStreamFifo::resetBuffer()
+{
+    writeCount.store(0, memory_order_relaxed);
+    readCount.store(0, memory_order_relaxed);
+    cachedReadCount = 0;
+    cachedWriteCount = 0;
+    mirroredBytes = 0;
+    atomic_thread_fence(memory_order_seq_cst);
+}
+
+bool DataStreamFifo::isHugePageBacked() const
+{
+    return hugePages;
+}
+
+// Overrun, wrap and high-water statistics.  May be called from any thread.
+DataStreamFifoStatistics DataStreamFifo::getStatistics() const
+{
+    DataStreamFifoStatistics statistics;
+    statistics.numOverruns = numOverruns.load(memory_order_relaxed);
+    statistics.overrunBytes = overrunBytes.load(memory_order_relaxed);
+    statistics.numWraps = numWraps.load(memory_order_relaxed);
+    statistics.highWaterBytes = highWaterBytes.load(memory_order_relaxed);
+    return statistics;
+}
+
+// Only call while the producer is not writing.
+void DataStreamFifo::resetStatistics()
+{
+    numOverruns.store(0, memory_order_relaxed);
+    overrunBytes.store(0, memory_order_relaxed);
+    numWraps.store(0, memory_order_relaxed);
+    highWaterBytes.store(0, memory_order_relaxed);
+}
+
+void DataStreamFifo::printStatistics() const
+{
+    DataStreamFifoStatistics statistics = getStatistics();
+    cout << "DataStreamFifo: high water " << statistics.highWaterBytes << " bytes (" << fixed << setprecision(1) <<
+            100.0 * statistics.highWaterBytes / bufferSize << "%), " << statistics.numWraps << " wraps, " <<
+            statistics.numOverruns << " overruns (" << statistics.overrunBytes << " bytes refused)" << endl;
+    cout.unsetf(ios::fixed);
+}
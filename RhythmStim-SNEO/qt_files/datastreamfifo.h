@@ -0,0 +1,123 @@
+//  ------------------------------------------------------------------------
+//
+//  This file is part of the Intan Technologies RHS2000 Interface
+//  Version 1.01
+//  Copyright (C) 2013-2017 Intan Technologies
+//
+//  ------------------------------------------------------------------------
+//
+//  This program is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU Lesser General Public License as published
+//  by the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU Lesser General Public License for more details.
+//
+//  You should have received a copy of the GNU Lesser General Public License
+//  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef DATASTREAMFIFO_H
+#define DATASTREAMFIFO_H
+
+#include <atomic>
+#include <cstddef>
+#include <mutex>
+#include <condition_variable>
+
+using namespace std;
+
+// Producer and consumer state live on separate cache lines so the USB thread and the GUI
+// thread do not invalidate each other's cache on every transfer.
+#define FIFO_CACHE_LINE_SIZE 64
+// A reader blocked in waitForData() rechecks its stop flag at least this often.
+#define FIFO_WAIT_CHECK_MS 10
+
+struct DataStreamFifoStatistics
+{
+    unsigned long long numOverruns;     // writes refused for lack of free space
+    unsigned long long overrunBytes;    // bytes in those writes
+    unsigned long long numWraps;        // writes that crossed the end of the ring
+    unsigned int highWaterBytes;        // largest number of bytes ever held
+};
+
+// Lock-free single-producer, single-consumer byte FIFO between the USB data thread and the GUI
+// thread.  The producer only advances writeCount and the consumer only advances readCount
+// (both count bytes since the last reset), so no locks are needed; each side caches the other
+// side's counter and only reloads it when the cached value says the FIFO is full or empty.
+//
+// Besides the copying writeToBuffer()/readFromBuffer() calls, the FIFO hands out contiguous
+// spans of its own memory: reserveWrite()/commitWrite() let the USB transfer land directly in
+// the ring, and peekRead()/releaseRead() let the parser work on the data in place.  Spans of up
+// to maxSpanBytes are contiguous even where they cross the end of the ring, thanks to a mirror
+// area of that size past the end of the buffer.
+//
+// The buffer can optionally be backed by huge pages (Linux only; falls back to normal pages)
+// to cut TLB misses when streaming through tens of megabytes.  Statistics and the fill level
+// can be read from any thread.  The reader can block in waitForData() until the producer has
+// written enough; the producer only takes a lock to wake it while it is waiting.
+
+class DataStreamFifo
+{
+public:
+    DataStreamFifo(unsigned int bufferSize_, unsigned int maxSpanBytes_ = 0, bool useHugePages = false);
+    ~DataStreamFifo();
+
+    bool writeToBuffer(unsigned char* dataSource, unsigned int numBytes);
+    bool readFromBuffer(unsigned char* dataSink, unsigned int numBytes);
+
+    unsigned char* reserveWrite(unsigned int numBytes);
+    void commitWrite(unsigned int numBytes);
+    unsigned char* peekRead(unsigned int numBytes);
+    void releaseRead(unsigned int numBytes);
+    unsigned int getBufferSize() const;
+    unsigned int getMaxSpanBytes() const;
+
+    bool dataAvailable(unsigned int numBytes) const;
+    bool waitForData(unsigned int numBytes, const atomic<bool> &keepWaiting);
+    unsigned int bytesAvailable() const;
+    double percentFull() const;
+    void resetBuffer();
+
+    bool isHugePageBacked() const;
+    DataStreamFifoStatistics getStatistics() const;
+    void resetStatistics();
+    void printStatistics() const;
+
+private:
+    unsigned int freeSpaceForWriter(unsigned int numBytes);
+    unsigned int usedSpaceForReader(unsigned int numBytes);
+    void recordOverrun(unsigned int numBytes);
+    void recordWrite(unsigned long long writeEnd, unsigned int numBytes);
+    void wakeReader();
+
+    unsigned char* memoryBuffer;
+    size_t allocatedBytes;
+    bool hugePages;
+    unsigned int bufferSize;
+    unsigned int maxSpanBytes;
+
+    // Producer side (USB data thread)
+    alignas(FIFO_CACHE_LINE_SIZE) atomic<unsigned long long> writeCount;
+    unsigned long long cachedReadCount;
+
+    // Consumer side (GUI thread)
+    alignas(FIFO_CACHE_LINE_SIZE) atomic<unsigned long long> readCount;
+    unsigned long long cachedWriteCount;
+    unsigned int mirroredBytes;     // bytes from the start of the ring copied past its end for the current read span
+
+    // Blocking reads
+    atomic<bool> readerWaiting;
+    mutex waitMutex;
+    condition_variable dataWritten;
+
+    // Statistics, written by the producer
+    alignas(FIFO_CACHE_LINE_SIZE) atomic<unsigned long long> numOverruns;
+    atomic<unsigned long long> overrunBytes;
+    atomic<unsigned long long> numWraps;
+    atomic<unsigned int> highWaterBytes;
+};
+
+#endif // DATASTREAMFIFO_H
@@ -0,0 +1,258 @@
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+#include <climits>
+#include <cstring>
+#include <cstdlib>
+
+#include "detectioncomparator.h"
+#include "metricsregistry.h"
+
+// Shadow mode comparison of hardware and host spike detections
+
+#define DEFAULT_TOLERANCE_SAMPLES 2
+#define DEFAULT_TIMEOUT_SECONDS 2.0
+
+static long long nowNs()
+{
+    return chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+DetectionComparator::DetectionComparator(SpikeEventBuffer *hardwareEvents, SpikeEventBuffer *hostEvents,
+                                         int hostChannelOffset_) :
+    hostChannelOffset(hostChannelOffset_),
+    tolerance(DEFAULT_TOLERANCE_SAMPLES),
+    timeoutNs((long long) (DEFAULT_TIMEOUT_SECONDS * 1.0e9))
+{
+    spikeEvents[Hardware] = hardwareEvents;
+    spikeEvents[Host] = hostEvents;
+
+    MetricsRegistry* metrics = MetricsRegistry::global();
+    matchedMetric = metrics->counter("shadow.matched");
+    unmatchedMetric[Hardware] = metrics->counter("shadow.hardware_only");
+    unmatchedMetric[Host] = metrics->counter("shadow.host_only");
+    matchRateMetric = metrics->gauge("shadow.match_rate");
+    skewMetric = metrics->histogram("shadow.timestamp_skew", "samples");
+    lagMetric[Hardware] = metrics->histogram("shadow.hardware_lag", "us");
+    lagMetric[Host] = metrics->histogram("shadow.host_lag", "us");
+
+    reset();
+}
+
+// Largest timestamp difference, in samples, of two events that match.
+void DetectionComparator::setTolerance(int samples)
+{
+    tolerance = qMax(0, samples);
+}
+
+// Longest time an event waits for its match.
+void DetectionComparator::setTimeout(double seconds)
+{
+    timeoutNs = (long long) (seconds * 1.0e9);
+}
+
+// Drop pending events and results and start both cursors at the newest event, e.g. when both
+// detectors are started.
+void DetectionComparator::reset()
+{
+    for (int detector = Hardware; detector <= Host; ++detector) {
+        cursors[detector] = spikeEvents[detector]->writeCursor();
+        for (int channel = 0; channel < COMPARATOR_NUM_CHANNELS; ++channel) {
+            pending[detector][channel].count = 0;
+        }
+        anyEvents[detector] = false;
+        latestTimestamp[detector] = 0;
+        numUnmatched[detector] = 0;
+    }
+    numMatched = 0;
+    totalSkew = 0;
+    minSkew = INT_MAX;
+    maxSkew = INT_MIN;
+    totalArrivalGapNs = 0;
+    minArrivalGapNs = LLONG_MAX;
+    maxArrivalGapNs = LLONG_MIN;
+}
+
+// Read the new events of both detectors, match them and settle the events that can no longer
+// be matched.  Call often (e.g. after each readSpike()), as arrival times are taken here.
+// Returns the number of new events.
+int DetectionComparator::compare()
+{
+    long long now = nowNs();
+    int numEvents = readEvents(Hardware, now) + readEvents(Host, now);
+    expireEvents(now);
+
+    matchRateMetric->set(getStatistics().matchRate);
+    return numEvents;
+}
+
+DetectionComparatorStatistics DetectionComparator::getStatistics() const
+{
+    DetectionComparatorStatistics statistics;
+    statistics.numMatched = numMatched;
+    statistics.numHardwareOnly = numUnmatched[Hardware];
+    statistics.numHostOnly = numUnmatched[Host];
+
+    unsigned long long numCompared = statistics.numMatched + statistics.numHardwareOnly + statistics.numHostOnly;
+    statistics.matchRate = (numCompared > 0) ? 100.0 * statistics.numMatched / numCompared : 100.0;
+
+    if (statistics.numMatched > 0) {
+        statistics.meanSkewSamples = (double) totalSkew / statistics.numMatched;
+        statistics.minSkewSamples = minSkew;
+        statistics.maxSkewSamples = maxSkew;
+        statistics.meanArrivalGapMs = 1.0e-6 * totalArrivalGapNs / statistics.numMatched;
+        statistics.minArrivalGapMs = 1.0e-6 * minArrivalGapNs;
+        statistics.maxArrivalGapMs = 1.0e-6 * maxArrivalGapNs;
+    } else {
+        statistics.meanSkewSamples = 0.0;
+        statistics.minSkewSamples = 0;
+        statistics.maxSkewSamples = 0;
+        statistics.meanArrivalGapMs = 0.0;
+        statistics.minArrivalGapMs = 0.0;
+        statistics.maxArrivalGapMs = 0.0;
+    }
+    return statistics;
+}
+
+void DetectionComparator::printStatistics() const
+{
+    DetectionComparatorStatistics statistics = getStatistics();
+    cout << "Shadow comparison: " << statistics.numMatched << " matched, " << statistics.numHardwareOnly <<
+            " hardware only, " << statistics.numHostOnly << " host only (" << fixed << setprecision(2) <<
+            statistics.matchRate << "% match), skew " << statistics.meanSkewSamples << " samples mean (" <<
+            statistics.minSkewSamples << " to " << statistics.maxSkewSamples << "), host arrival " <<
+            statistics.meanArrivalGapMs << " ms after hardware mean (" << statistics.minArrivalGapMs << " to " <<
+            statistics.maxArrivalGapMs << ")" << endl;
+    cout.unsetf(ios::fixed);
+}
+
+// Copy the detector's new events out of its buffer a batch at a time and match those on the
+// compared channels.  Returns the number of events read.  (Private method.)
+int DetectionComparator::readEvents(Detector detector, long long arrivalNs)
+{
+    const SpikeEvent* events;
+    const unsigned char* records;
+    int numEvents, total = 0;
+    int channelOffset = (detector == Host) ? hostChannelOffset : 0;
+
+    while ((numEvents = spikeEvents[detector]->peek(cursors[detector], events, records)) > 0) {
+        numEvents = qMin(numEvents, COMPARATOR_BATCH_EVENTS);
+        memcpy(batch, events, numEvents * sizeof(SpikeEvent));
+        if (!spikeEvents[detector]->release(cursors[detector], numEvents)) {
+            continue;       // overwritten while copied
+        }
+        for (int i = 0; i < numEvents; ++i) {
+            int channel = batch[i].channel - channelOffset;
+            if (channel >= 0 && channel < COMPARATOR_NUM_CHANNELS) {
+                addEvent(detector, channel, batch[i].timestamp, arrivalNs);
+            }
+        }
+        total += numEvents;
+    }
+    return total;
+}
+
+// Match an event against the other detector's pending events on its channel, taking the one
+// closest in time; keep it pending if there is none within tolerance.  (Private method.)
+void DetectionComparator::addEvent(Detector detector, int channel, quint32 timestamp, long long arrivalNs)
+{
+    Detector other = (detector == Hardware) ? Host : Hardware;
+    PendingEvents &candidates = pending[other][channel];
+    int best = -1;
+    int bestDistance = tolerance + 1;
+    for (int i = 0; i < candidates.count; ++i) {
+        int distance = abs((qint32) (timestamp - candidates.events[i].timestamp));
+        if (distance < bestDistance) {
+            best = i;
+            bestDistance = distance;
+        }
+    }
+
+    if (best >= 0) {
+        const PendingEvent &match = candidates.events[best];
+        if (detector == Host) {
+            countMatch((qint32) (timestamp - match.timestamp), arrivalNs - match.arrivalNs);
+        } else {
+            countMatch((qint32) (match.timestamp - timestamp), match.arrivalNs - arrivalNs);
+        }
+        removePending(candidates, best);
+    } else {
+        PendingEvents &queue = pending[detector][channel];
+        if (queue.count == COMPARATOR_PENDING_EVENTS) {
+            countUnmatched(detector, 1);
+            removePending(queue, 0);
+        }
+        queue.events[queue.count].timestamp = timestamp;
+        queue.events[queue.count].arrivalNs = arrivalNs;
+        queue.count++;
+    }
+
+    if (!anyEvents[detector] || (qint32) (timestamp - latestTimestamp[detector]) > 0) {
+        latestTimestamp[detector] = timestamp;
+    }
+    anyEvents[detector] = true;
+}
+
+// Count pending events as unmatched once the other detector has moved more than the tolerance
+// past them, or they have waited for the timeout.  Both detectors report events in time order,
+// so only the oldest events of each channel need checking.  (Private method.)
+void DetectionComparator::expireEvents(long long nowNs)
+{
+    for (int detector = Hardware; detector <= Host; ++detector) {
+        int other = (detector == Hardware) ? Host : Hardware;
+        for (int channel = 0; channel < COMPARATOR_NUM_CHANNELS; ++channel) {
+            PendingEvents &queue = pending[detector][channel];
+            while (queue.count > 0) {
+                const PendingEvent &oldest = queue.events[0];
+                bool overtaken = anyEvents[other] && (qint32) (latestTimestamp[other] - oldest.timestamp) > tolerance;
+                if (!overtaken && nowNs - oldest.arrivalNs <= timeoutNs) {
+                    break;
+                }
+                countUnmatched((Detector) detector, 1);
+                removePending(queue, 0);
+            }
+        }
+    }
+}
+
+// (Private method.)
+void DetectionComparator::removePending(PendingEvents &queue, int index)
+{
+    memmove(&queue.events[index], &queue.events[index + 1], (queue.count - index - 1) * sizeof(PendingEvent));
+    queue.count--;
+}
+
+// (Private method.)
+void DetectionComparator::countUnmatched(Detector detector, unsigned long long numEvents)
+{
+    numUnmatched[detector] += numEvents;
+    unmatchedMetric[detector]->add(numEvents);
+}
+
+// Skew and arrival gap are host minus hardware.  (Private method.)
+void DetectionComparator::countMatch(int skew, long long arrivalGapNs)
+{
+    numMatched++;
+    totalSkew += skew;
+    totalArrivalGapNs += arrivalGapNs;
+    if (skew < minSkew) {
+        minSkew = skew;
+    }
+    if (skew > maxSkew) {
+        maxSkew = skew;
+    }
+    if (arrivalGapNs < minArrivalGapNs) {
+        minArrivalGapNs = arrivalGapNs;
+    }
+    if (arrivalGapNs > maxArrivalGapNs) {
+        maxArrivalGapNs = arrivalGapNs;
+    }
+
+    matchedMetric->add();
+    skewMetric->record(abs(skew));
+    if (arrivalGapNs >= 0) {
+        lagMetric[Host]->record(arrivalGapNs / 1000);
+    } else {
+        lagMetric[Hardware]->record(-arrivalGapNs / 1000);
+    }
+}
@@ -0,0 +1,116 @@
+#ifndef DETECTIONCOMPARATOR_H
+#define DETECTIONCOMPARATOR_H
+
+#include <atomic>
+#include "spikeeventbuffer.h"
+
+using namespace std;
+
+class MetricCounter;
+class MetricGauge;
+class LatencyHistogram;
+
+// Number of channels compared: those of the hardware spike detector.
+#define COMPARATOR_NUM_CHANNELS 32
+// Unmatched events kept per channel and detector; beyond that the oldest is counted unmatched.
+#define COMPARATOR_PENDING_EVENTS 64
+// Events copied out of a SpikeEventBuffer at a time.
+#define COMPARATOR_BATCH_EVENTS 256
+
+// Running results of a DetectionComparator.
+struct DetectionComparatorStatistics
+{
+    unsigned long long numMatched;
+    unsigned long long numHardwareOnly;     // hardware events with no host event in tolerance
+    unsigned long long numHostOnly;         // host events with no hardware event in tolerance
+    double matchRate;                       // matched events over all events compared, in percent
+    double meanSkewSamples;                 // host minus hardware timestamp of matched events
+    int minSkewSamples;
+    int maxSkewSamples;
+    double meanArrivalGapMs;                // host minus hardware arrival time of matched events
+    double minArrivalGapMs;
+    double maxArrivalGapMs;
+};
+
+// Shadow mode check of a host detector against the hardware spike detector running on the same
+// samples.  Events from pipe 0xa1 and from the host detector (whose channels hostChannelOffset
+// to hostChannelOffset + 31 are the hardware's 0-31) are read from their SpikeEventBuffers
+// through cursors of their own and matched by channel and timestamp, within tolerance samples.
+// For each match the timestamp skew and the gap between the times the two events were read
+// (wall clock, so it includes each detector's delivery latency) are kept.
+//
+// An event stays pending until it is matched, or until the other detector has reported an event
+// more than the tolerance later, or for at most the timeout; it is then counted as detected by
+// one side only.  Pending events live in fixed per-channel arrays and events are copied out of
+// the buffers in fixed batches, so memory is bounded and nothing is allocated per event.  Results
+// are published as shadow.* metrics while running.  Call compare() and reset() from one thread;
+// statistics may be read from any thread.
+
+class DetectionComparator
+{
+
+public:
+    DetectionComparator(SpikeEventBuffer *hardwareEvents, SpikeEventBuffer *hostEvents, int hostChannelOffset_);
+
+    void setTolerance(int samples);
+    void setTimeout(double seconds);
+    void reset();
+
+    int compare();
+
+    DetectionComparatorStatistics getStatistics() const;
+    void printStatistics() const;
+
+private:
+    enum Detector {
+        Hardware = 0,
+        Host = 1
+    };
+
+    struct PendingEvent
+    {
+        quint32 timestamp;
+        long long arrivalNs;
+    };
+
+    struct PendingEvents
+    {
+        PendingEvent events[COMPARATOR_PENDING_EVENTS];     // oldest first
+        int count;
+    };
+
+    int readEvents(Detector detector, long long arrivalNs);
+    void addEvent(Detector detector, int channel, quint32 timestamp, long long arrivalNs);
+    void expireEvents(long long nowNs);
+    void removePending(PendingEvents &queue, int index);
+    void countUnmatched(Detector detector, unsigned long long numEvents);
+    void countMatch(int skew, long long arrivalGapNs);
+
+    SpikeEventBuffer *spikeEvents[2];
+    quint64 cursors[2];
+    int hostChannelOffset;
+    int tolerance;
+    long long timeoutNs;
+
+    PendingEvents pending[2][COMPARATOR_NUM_CHANNELS];
+    bool anyEvents[2];
+    quint32 latestTimestamp[2];
+    SpikeEvent batch[COMPARATOR_BATCH_EVENTS];
+
+    atomic<unsigned long long> numMatched;
+    atomic<unsigned long long> numUnmatched[2];
+    atomic<long long> totalSkew;
+    atomic<int> minSkew;
+    atomic<int> maxSkew;
+    atomic<long long> totalArrivalGapNs;
+    atomic<long long> minArrivalGapNs;
+    atomic<long long> maxArrivalGapNs;
+
+    MetricCounter *matchedMetric;
+    MetricCounter *unmatchedMetric[2];
+    MetricGauge *matchRateMetric;
+    LatencyHistogram *skewMetric;
+    LatencyHistogram *lagMetric[2];
+};
+
+#endif // DETECTIONCOMPARATOR_H
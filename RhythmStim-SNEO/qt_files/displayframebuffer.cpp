@@ -0,0 +1,142 @@
+#include <cstring>
+#include "displayframebuffer.h"
+
+// Display frame triple buffer
+
+// Element-wise copy of numSamples samples of every waveform, to offset samples into the frame,
+// that reuses the destination's memory: once the frames have the shape of the SignalProcessor
+// arrays and DISPLAY_MAX_BLOCKS of samples, publishing a batch does not allocate.  (Plain QVector
+// assignment would share the data, and the next write by SignalProcessor would detach it.)
+template <typename T>
+static void appendDisplayData(QVector<T> &destination, const QVector<T> &source, int offset, int numSamples)
+{
+    if (destination.size() != source.size()) {
+        destination.resize(source.size());
+    }
+    T* data = destination.data();
+    for (int i = 0; i < source.size(); ++i) {
+        appendDisplayData(data[i], source.at(i), offset, numSamples);
+    }
+}
+
+template <typename T>
+static void appendSamples(QVector<T> &destination, const QVector<T> &source, int offset, int numSamples)
+{
+    if (destination.size() < DISPLAY_MAX_BLOCKS * SAMPLES_PER_DATA_BLOCK) {
+        destination.resize(DISPLAY_MAX_BLOCKS * SAMPLES_PER_DATA_BLOCK);
+    }
+    memcpy(destination.data() + offset, source.constData(), numSamples * sizeof(T));
+}
+
+static void appendDisplayData(QVector<double> &destination, const QVector<double> &source, int offset, int numSamples)
+{
+    appendSamples(destination, source, offset, numSamples);
+}
+
+static void appendDisplayData(QVector<int> &destination, const QVector<int> &source, int offset, int numSamples)
+{
+    appendSamples(destination, source, offset, numSamples);
+}
+
+DisplayFrameBuffer::DisplayFrameBuffer()
+{
+    reset();
+}
+
+// Forget any published frame.  Only call while neither thread is using the buffer.
+void DisplayFrameBuffer::reset()
+{
+    backIndex = 0;
+    middleIndex = 1;
+    frontIndex = 2;
+    for (int i = 0; i < 3; ++i) {
+        frames[i].status.numBlocks = 0;
+    }
+    numPublished = 0;
+    numBlocksDropped = 0;
+}
+
+// Append the display waveforms of the status.numBlocks data blocks just processed by
+// signalProcessor to the back frame, and publish it if the GUI has taken the last frame.
+void DisplayFrameBuffer::publish(const SignalProcessor *signalProcessor, const DisplayStatus &status)
+{
+    DisplayFrame &frame = frames[backIndex];
+    int numBlocks = status.numBlocks;
+    if (frame.status.numBlocks + numBlocks > DISPLAY_MAX_BLOCKS) {
+        numBlocksDropped.fetch_add(frame.status.numBlocks, memory_order_relaxed);
+        frame.status.numBlocks = 0;
+    }
+
+    int offset = frame.status.numBlocks * SAMPLES_PER_DATA_BLOCK;
+    int numSamples = numBlocks * SAMPLES_PER_DATA_BLOCK;
+    appendDisplayData(frame.amplifierPostFilter, signalProcessor->amplifierPostFilter, offset, numSamples);
+    appendDisplayData(frame.dcAmplifier, signalProcessor->dcAmplifier, offset, numSamples);
+    appendDisplayData(frame.boardAdc, signalProcessor->boardAdc, offset, numSamples);
+    appendDisplayData(frame.boardDac, signalProcessor->boardDac, offset, numSamples);
+    appendDisplayData(frame.boardDigIn, signalProcessor->boardDigIn, offset, numSamples);
+    appendDisplayData(frame.boardDigOut, signalProcessor->boardDigOut, offset, numSamples);
+    appendDisplayData(frame.ampSettle, signalProcessor->ampSettle, offset, numSamples);
+    appendDisplayData(frame.chargeRecov, signalProcessor->chargeRecov, offset, numSamples);
+    appendDisplayData(frame.stimOn, signalProcessor->stimOn, offset, numSamples);
+    appendDisplayData(frame.complianceLimit, signalProcessor->complianceLimit, offset, numSamples);
+
+    // Keep the FPGA FIFO values from an earlier batch of the frame if this one has none.
+    DisplayStatus accumulatedStatus = status;
+    accumulatedStatus.numBlocks = frame.status.numBlocks + numBlocks;
+    if (!status.fifoStatusUpdated && offset > 0 && frame.status.fifoStatusUpdated) {
+        accumulatedStatus.fifoStatusUpdated = true;
+        accumulatedStatus.fifoLatencyMs = frame.status.fifoLatencyMs;
+        accumulatedStatus.fifoPercentFull = frame.status.fifoPercentFull;
+    }
+    frame.status = accumulatedStatus;
+    numPublished.fetch_add(1, memory_order_relaxed);
+
+    if (middleIndex.load(memory_order_acquire) & NewFrame) {
+        return;     // the GUI has yet to take the last frame; keep accumulating
+    }
+    int previous = middleIndex.exchange(backIndex | NewFrame, memory_order_acq_rel);
+    backIndex = previous & ~NewFrame;
+    frames[backIndex].status.numBlocks = 0;
+}
+
+bool DisplayFrameBuffer::hasNewFrame() const
+{
+    return (middleIndex.load(memory_order_acquire) & NewFrame) != 0;
+}
+
+// If a frame was published since the last call, swap its waveforms into displayProcessor (the
+// SignalProcessor WavePlot and the Spike Scope draw from), copy its status and return true.
+// The waveforms then hold status.numBlocks data blocks.
+bool DisplayFrameBuffer::takeLatest(SignalProcessor *displayProcessor, DisplayStatus &status)
+{
+    if (!hasNewFrame()) {
+        return false;
+    }
+    frontIndex = middleIndex.exchange(frontIndex, memory_order_acq_rel) & ~NewFrame;
+
+    // Swapping keeps displayProcessor's old arrays in the front frame, to be refilled later.
+    DisplayFrame &frame = frames[frontIndex];
+    displayProcessor->amplifierPostFilter.swap(frame.amplifierPostFilter);
+    displayProcessor->dcAmplifier.swap(frame.dcAmplifier);
+    displayProcessor->boardAdc.swap(frame.boardAdc);
+    displayProcessor->boardDac.swap(frame.boardDac);
+    displayProcessor->boardDigIn.swap(frame.boardDigIn);
+    displayProcessor->boardDigOut.swap(frame.boardDigOut);
+    displayProcessor->ampSettle.swap(frame.ampSettle);
+    displayProcessor->chargeRecov.swap(frame.chargeRecov);
+    displayProcessor->stimOn.swap(frame.stimOn);
+    displayProcessor->complianceLimit.swap(frame.complianceLimit);
+    status = frame.status;
+    return true;
+}
+
+unsigned long long DisplayFrameBuffer::getNumPublished() const
+{
+    return numPublished.load(memory_order_relaxed);
+}
+
+// Data blocks dropped because the GUI took no frame while DISPLAY_MAX_BLOCKS accumulated.
+unsigned long long DisplayFrameBuffer::getNumBlocksDropped() const
+{
+    return numBlocksDropped.load(memory_order_relaxed);
+}
@@ -0,0 +1,89 @@
+#ifndef DISPLAYFRAMEBUFFER_H
+#define DISPLAYFRAMEBUFFER_H
+
+#include <atomic>
+#include "globalconstants.h"
+#include "signalprocessor.h"
+#include "usbheaderscanner.h"
+
+using namespace std;
+
+// Longest run of data blocks a display frame accumulates while the GUI is not taking frames
+// (SpikePlot buffers 10000 samples per update).
+#define DISPLAY_MAX_BLOCKS 64
+
+// The GUI takes and draws a display frame on a timer, whatever the USB read rate.  A frame that
+// takes longer than the budget to draw is followed by skipped refreshes, during which data
+// accumulates, so drawing takes at most about half the GUI thread under load.
+#define DISPLAY_REFRESH_RATE 40         // Hz
+#define DISPLAY_FRAME_BUDGET_MS 12
+
+// Acquisition status shown next to the waveforms.
+struct DisplayStatus
+{
+    int numBlocks;                      // data blocks in the frame (in the batch, when publishing)
+    double usbBufferPercentFull;        // host DataStreamFifo
+    bool fifoStatusUpdated;             // true if the two FPGA FIFO values below are fresh
+    double fifoLatencyMs;               // FPGA FIFO
+    double fifoPercentFull;
+    bool cpuWarning;                    // processing did not keep up with the data
+    bool recording;
+    bool waitingForTrigger;
+    double totalElapsedRecordTimeSeconds;
+    UsbGlitchStatistics usbGlitches;    // since the start of the run
+};
+
+// Copy of the SignalProcessor waveforms shown by WavePlot and the Spike Scope for the data blocks
+// read since the last frame the GUI took, plus the latest status.
+struct DisplayFrame
+{
+    decltype(SignalProcessor::amplifierPostFilter) amplifierPostFilter;
+    decltype(SignalProcessor::dcAmplifier) dcAmplifier;
+    decltype(SignalProcessor::boardAdc) boardAdc;
+    decltype(SignalProcessor::boardDac) boardDac;
+    decltype(SignalProcessor::boardDigIn) boardDigIn;
+    decltype(SignalProcessor::boardDigOut) boardDigOut;
+    decltype(SignalProcessor::ampSettle) ampSettle;
+    decltype(SignalProcessor::chargeRecov) chargeRecov;
+    decltype(SignalProcessor::stimOn) stimOn;
+    decltype(SignalProcessor::complianceLimit) complianceLimit;
+    DisplayStatus status;
+};
+
+// Lock-free triple buffer handing display frames from the processing thread to the GUI thread.
+// The processing thread always has a back frame to fill and never waits for the GUI.  Each batch
+// is appended to the back frame, which is published once the GUI has taken the previous frame,
+// so the GUI can take frames at its own refresh rate and still draw every sample.  If it falls
+// more than DISPLAY_MAX_BLOCKS behind, the accumulated blocks are dropped.
+
+class DisplayFrameBuffer
+{
+
+public:
+    DisplayFrameBuffer();
+
+    void reset();
+
+    // Processing thread
+    void publish(const SignalProcessor *signalProcessor, const DisplayStatus &status);
+
+    // GUI thread
+    bool hasNewFrame() const;
+    bool takeLatest(SignalProcessor *displayProcessor, DisplayStatus &status);
+
+    unsigned long long getNumPublished() const;
+    unsigned long long getNumBlocksDropped() const;
+
+private:
+    static const int NewFrame = 4;      // flag in middleIndex: the middle frame has not been taken
+
+    DisplayFrame frames[3];
+    int backIndex;                      // owned by the processing thread
+    int frontIndex;                     // owned by the GUI thread
+    atomic<int> middleIndex;            // index of the frame in between, plus NewFrame
+
+    atomic<unsigned long long> numPublished;
+    atomic<unsigned long long> numBlocksDropped;
+};
+
+#endif // DISPLAYFRAMEBUFFER_H
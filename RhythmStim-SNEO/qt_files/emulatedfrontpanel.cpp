@@ -0,0 +1,586 @@
+#include <cstring>
+#include <cmath>
+#include <thread>
+
+#include "emulatedfrontpanel.h"
+#include "rhs2000evalboard.h"
+#include "rhs2000datablock.h"
+#include "globalconstants.h"
+#include "usbheaderscanner.h"
+
+// Emulated Opal Kelly XEM6010 running the Rhythm Stim + SNEO spike detector bitfile.
+// Data blocks are produced in real time at the programmed sample rate, accumulate in a FIFO
+// of FIFO_CAPACITY_WORDS words (the oldest samples are dropped on overflow, like a stalled
+// host would cause), and are framed with the RHS2000 magic number and a running timestamp.
+// Spikes are drawn as independent Poisson processes per channel and served on pipe 0xa1.
+// A chip answering the ROM reads of the register configuration sequence is emulated on each
+// stream of port A, or on each stream of the replayed recording.
+
+static const double DefaultUsbBytesPerSecond = 40.0e6;     // typical XEM6010 pipe throughput
+static const double DefaultSpikeRate = 10.0;                // spikes/s/channel at a 5.5x threshold
+static const double AmplifierNoiseLsb = 50.0;              // ~10 uV rms at 0.195 uV/LSB
+
+ReplaySource *okCFrontPanel::defaultReplaySource = nullptr;
+double okCFrontPanel::defaultReplaySpeed = 1.0;
+
+bool okFrontPanelDLL_LoadLib(const char *libname)
+{
+    Q_UNUSED(libname);
+    return true;
+}
+
+void okFrontPanelDLL_GetVersion(char *date, char *time)
+{
+    strcpy(date, "emulated");
+    strcpy(time, "emulated");
+}
+
+double okCPLL22393::GetOutputFrequency(int output) const
+{
+    Q_UNUSED(output);
+    return 100.0;
+}
+
+okCFrontPanel::okCFrontPanel() :
+    randomGenerator(5489u)
+{
+    sampleBuffer = new unsigned char [2 * Rhs2000DataBlock::calculateDataBlockSizeInWords(MAX_NUM_DATA_STREAMS) /
+                                      SAMPLES_PER_DATA_BLOCK];
+    usbBytesPerSecond = DefaultUsbBytesPerSecond;
+    spikeRate = DefaultSpikeRate;
+    replaySource = defaultReplaySource;
+    replaySpeed = defaultReplaySpeed;
+
+    for (int i = 0; i < NumWireIns; ++i) {
+        wireInPending[i] = 0;
+        wireIn[i] = 0;
+    }
+    resetState();
+}
+
+okCFrontPanel::~okCFrontPanel()
+{
+    delete [] sampleBuffer;
+}
+
+int okCFrontPanel::GetDeviceCount()
+{
+    return 1;
+}
+
+int okCFrontPanel::GetDeviceListModel(int num)
+{
+    return (num == 0) ? OK_PRODUCT_XEM6010LX45 : OK_PRODUCT_UNKNOWN;
+}
+
+string okCFrontPanel::GetDeviceListSerial(int num)
+{
+    return (num == 0) ? GetSerialNumber() : "";
+}
+
+okCFrontPanel::ErrorCode okCFrontPanel::OpenBySerial(string serial)
+{
+    return (serial.empty() || serial == GetSerialNumber()) ? NoError : DeviceNotOpen;
+}
+
+okCFrontPanel::ErrorCode okCFrontPanel::LoadDefaultPLLConfiguration()
+{
+    return NoError;
+}
+
+okCFrontPanel::ErrorCode okCFrontPanel::GetEepromPLL22393Configuration(okCPLL22393 &pll)
+{
+    Q_UNUSED(pll);
+    return NoError;
+}
+
+int okCFrontPanel::GetDeviceMajorVersion()
+{
+    return 1;
+}
+
+int okCFrontPanel::GetDeviceMinorVersion()
+{
+    return 0;
+}
+
+string okCFrontPanel::GetSerialNumber()
+{
+    return "EMULATED";
+}
+
+string okCFrontPanel::GetDeviceID()
+{
+    return "Rhythm Stim emulator";
+}
+
+okCFrontPanel::ErrorCode okCFrontPanel::ConfigureFPGA(const string strFilename)
+{
+    Q_UNUSED(strFilename);
+    resetState();
+    return NoError;
+}
+
+bool okCFrontPanel::IsFrontPanelEnabled()
+{
+    return true;
+}
+
+okCFrontPanel::ErrorCode okCFrontPanel::ResetFPGA()
+{
+    resetState();
+    return NoError;
+}
+
+// Power-on state of the bitfile: stopped, empty FIFOs, 30 kS/s.
+void okCFrontPanel::resetState()
+{
+    spiRunning = false;
+    dataClockRate = 30000.0;
+    samplesAtRunStart = 0;
+    samplesGenerated = 0;
+    samplesRead = 0;
+    fifoOverflowSamples = 0;
+    sampleBytesPending = 0;
+    sampleBytesOffset = 0;
+    spikeFifoRead = 0;
+    spikeFifoCount = 0;
+    blindUntil = 0;
+    lastManualTrigger = false;
+    replaying = false;
+    replaySamplesLeft = 0;
+
+    for (int i = 0; i < NumWireOuts; ++i) {
+        wireOut[i] = 0;
+    }
+    wireOut[0x3e - 0x20] = RHYTHM_BOARD_ID;
+    wireOut[0x3f - 0x20] = 1;
+}
+
+okCFrontPanel::ErrorCode okCFrontPanel::SetWireInValue(int ep, UINT32 val, UINT32 mask)
+{
+    if (ep < 0 || ep >= NumWireIns) {
+        return InvalidEndpoint;
+    }
+    wireInPending[ep] = (wireInPending[ep] & ~mask) | (val & mask);
+    return NoError;
+}
+
+okCFrontPanel::ErrorCode okCFrontPanel::UpdateWireIns()
+{
+    advance();
+
+    for (int i = 0; i < NumWireIns; ++i) {
+        wireIn[i] = wireInPending[i];
+    }
+
+    // WireInResetRun bit 0: hold the board in reset.
+    if (wireIn[0x00] & 0x01) {
+        double rate = dataClockRate;
+        resetState();
+        dataClockRate = rate;
+    }
+
+    // A rising edge on manual trigger 0 (the one used for UDP stimulation) starts the blind window.
+    bool manualTrigger = (wireIn[0x12] & 0x01) != 0;
+    if (manualTrigger && !lastManualTrigger) {
+        unsigned int blindWindowMs = (wireIn[0x15] >> 8) & 0xff;
+        blindUntil = (unsigned int)(samplesGenerated + blindWindowMs * sampleRate() / 1000.0);
+    }
+    lastManualTrigger = manualTrigger;
+    return NoError;
+}
+
+okCFrontPanel::ErrorCode okCFrontPanel::UpdateWireOuts()
+{
+    advance();
+
+    unsigned long long numWords = (samplesGenerated - samplesRead) * sampleSizeInWords() + sampleBytesPending / 2;
+    wireOut[0x20 - 0x20] = (UINT32)(numWords & 0xffff);
+    wireOut[0x21 - 0x20] = (UINT32)(numWords >> 16);
+    wireOut[0x22 - 0x20] = spiRunning ? 1 : 0;
+    wireOut[0x24 - 0x20] = 0x0003;             // DCM programming done, data clock locked
+    wireOut[0x25 - 0x20] = RHS_BOARD_MODE;
+    wireOut[0x3d - 0x20] = (UINT32) spikeFifoCount;
+    return NoError;
+}
+
+UINT32 okCFrontPanel::GetWireOutValue(int epAddr)
+{
+    if (epAddr < 0x20 || epAddr >= 0x20 + NumWireOuts) {
+        return 0;
+    }
+    return wireOut[epAddr - 0x20];
+}
+
+okCFrontPanel::ErrorCode okCFrontPanel::ActivateTriggerIn(int epAddr, int bit)
+{
+    advance();
+
+    switch (epAddr) {
+    case 0x40:  // TrigInDcmProg: per-channel rate = 100 MHz * (M/D) / 2 / 2800
+    {
+        double M = (wireIn[0x03] >> 8) & 0xff;
+        double D = wireIn[0x03] & 0xff;
+        if (D > 0.0) {
+            dataClockRate = 100.0e6 * (M / D) / 2.0 / 2800.0;
+        }
+        break;
+    }
+    case 0x41:  // TrigInSpiStart
+        if (bit == 0) {
+            spiRunning = true;
+            runStart = chrono::steady_clock::now();
+            samplesAtRunStart = samplesGenerated;
+            replaying = replaySource && (wireIn[0x00] & 0x02);
+            if (replaying) {
+                replaySamplesLeft = replaySource->getNumSamples() - replaySource->position();
+                if (qAbs(replaySource->getSampleRate() - sampleRate()) > 1.0) {
+                    cerr << "Warning in okCFrontPanel: replaying a " << replaySource->getSampleRate() <<
+                            " S/s recording at " << sampleRate() << " S/s." << endl;
+                }
+            }
+        }
+        break;
+    default:
+        break;
+    }
+    return NoError;
+}
+
+long okCFrontPanel::WriteToPipeIn(int epAddr, long length, unsigned char *data)
+{
+    Q_UNUSED(data);
+    if (epAddr < 0x80 || epAddr > 0x87) {
+        return ok_InvalidEndpoint;
+    }
+    emulateTransferTime(length);
+    return length;
+}
+
+long okCFrontPanel::ReadFromPipeOut(int epAddr, long length, unsigned char *data)
+{
+    advance();
+
+    if (epAddr == 0xa1) {
+        int numWords = qMin((int)(length / 2), spikeFifoCount);
+        for (int i = 0; i < numWords; ++i) {
+            unsigned short word = spikeFifo[spikeFifoRead];
+            data[2 * i] = (unsigned char)(word & 0xff);
+            data[2 * i + 1] = (unsigned char)(word >> 8);
+            spikeFifoRead = (spikeFifoRead + 1) % SpikeFifoDepthWords;
+        }
+        spikeFifoCount -= numWords;
+        emulateTransferTime(2 * numWords);
+        return 2 * numWords;
+    }
+
+    if (epAddr != 0xa0) {
+        return ok_InvalidEndpoint;
+    }
+    if (length % 2 != 0) {
+        return ok_InvalidBlockSize;
+    }
+
+    unsigned int sampleBytes = 2 * sampleSizeInWords();
+    long numBytesRead = 0;
+    while (numBytesRead < length) {
+        if (sampleBytesPending == 0) {
+            if (samplesRead == samplesGenerated) {
+                break;  // FIFO empty
+            }
+            generateSample(sampleBuffer);
+            samplesRead++;
+            sampleBytesPending = sampleBytes;
+            sampleBytesOffset = 0;
+        }
+        unsigned int numBytes = (unsigned int) qMin((long) sampleBytesPending, length - numBytesRead);
+        memcpy(data + numBytesRead, sampleBuffer + sampleBytesOffset, numBytes);
+        sampleBytesOffset += numBytes;
+        sampleBytesPending -= numBytes;
+        numBytesRead += numBytes;
+    }
+
+    emulateTransferTime(numBytesRead);
+    return numBytesRead;
+}
+
+// Limit emulated pipe throughput (bytes/s).  Zero makes transfers instantaneous.
+void okCFrontPanel::setUsbBandwidth(double bytesPerSecond)
+{
+    usbBytesPerSecond = bytesPerSecond;
+}
+
+// Set the mean firing rate of every emulated channel at the default 5.5x threshold.
+void okCFrontPanel::setSpikeRate(double spikesPerSecondPerChannel)
+{
+    spikeRate = spikesPerSecondPerChannel;
+}
+
+// Play back source (already open) in the continuous runs of every emulated board opened from now
+// on, at speed times real time, or as fast as the host reads the data if speed is zero.  In real
+// time, like the FPGA, the FIFO drops samples the host does not read in time; as fast as
+// possible, it never drops any.  Recorded detections are never dropped.  Null stops replay.
+void okCFrontPanel::setReplaySource(ReplaySource *source, double speed)
+{
+    defaultReplaySource = source;
+    defaultReplaySpeed = qMax(speed, 0.0);
+}
+
+double okCFrontPanel::sampleRate() const
+{
+    return dataClockRate;
+}
+
+int okCFrontPanel::numEnabledStreams() const
+{
+    int numStreams = 0;
+    for (int stream = 0; stream < MAX_NUM_DATA_STREAMS; ++stream) {
+        if (wireIn[0x14] & (1 << stream)) {
+            numStreams++;
+        }
+    }
+    return numStreams;
+}
+
+// Fill streams with the enabled data streams in USB frame order, and return how many there are.
+int okCFrontPanel::enabledStreams(int *streams) const
+{
+    int numStreams = 0;
+    for (int stream = 0; stream < MAX_NUM_DATA_STREAMS; ++stream) {
+        if (wireIn[0x14] & (1 << stream)) {
+            streams[numStreams++] = stream;
+        }
+    }
+    return numStreams;
+}
+
+// True if an RHS2116 answers on data stream stream.
+bool okCFrontPanel::chipPresent(int stream) const
+{
+    return replaySource ? replaySource->hasChipOnStream(stream) : (stream < 2);
+}
+
+unsigned int okCFrontPanel::sampleSizeInWords() const
+{
+    return Rhs2000DataBlock::calculateDataBlockSizeInWords(numEnabledStreams()) / SAMPLES_PER_DATA_BLOCK;
+}
+
+// Bring the sample counter up to the current time, drop samples the FIFO cannot hold, and
+// run the spike detector over the newly acquired samples.
+void okCFrontPanel::advance()
+{
+    if (!spiRunning) {
+        return;
+    }
+
+    unsigned long long capacitySamples = FIFO_CAPACITY_WORDS / sampleSizeInWords();
+    unsigned long long target;
+    if (replaying && replaySpeed == 0.0) {
+        // As fast as possible: keep the FIFO half full, so it never overflows.
+        target = qMax(samplesGenerated, samplesRead + capacitySamples / 2);
+    } else {
+        double speed = replaying ? replaySpeed : 1.0;
+        double elapsed = chrono::duration<double>(chrono::steady_clock::now() - runStart).count();
+        target = samplesAtRunStart + (unsigned long long)(elapsed * sampleRate() * speed);
+    }
+    if (replaying) {
+        target = qMin(target, samplesAtRunStart + replaySamplesLeft);
+    }
+
+    bool continuousMode = (wireIn[0x00] & 0x02) != 0;
+    if (!continuousMode) {
+        unsigned long long maxTimeStep = ((unsigned long long) wireIn[0x02] << 16) + wireIn[0x01];
+        if (target >= samplesAtRunStart + maxTimeStep) {
+            target = samplesAtRunStart + maxTimeStep;
+            spiRunning = false;
+        }
+    }
+
+    unsigned long long previous = samplesGenerated;
+    samplesGenerated = target;
+    detectSpikes((unsigned int) previous);
+
+    if (samplesGenerated - samplesRead > capacitySamples) {
+        unsigned long long numDropped = samplesGenerated - samplesRead - capacitySamples;
+        fifoOverflowSamples += numDropped;
+        samplesRead += numDropped;
+        if (replaying) {
+            replaySource->skipSamples(numDropped);
+        }
+    }
+}
+
+// Channel numbering follows Rhs2000EvalBoard::setDeactiveChannels.
+bool okCFrontPanel::channelDeactivated(int channel) const
+{
+    if (channel < 16) {
+        return (wireIn[0x0b] & (1 << (15 - channel))) != 0;
+    }
+    return (wireIn[0x0e] & (1 << (31 - channel))) != 0;
+}
+
+// Emit detections for the samples acquired since firstSample.  Each channel fires as a Poisson
+// process whose rate scales with the inverse square of the threshold multiplier (wire-in 0x15).
+void okCFrontPanel::detectSpikes(unsigned int firstSample)
+{
+    bool detectorRunning = (wireIn[0x00] & 0x20) != 0;
+    if (replaying || !detectorRunning || samplesGenerated <= firstSample) {
+        return;
+    }
+
+    unsigned int thresholdMult = wireIn[0x15] & 0xff;
+    double rate = spikeRate * pow(11.0 / qMax(thresholdMult, 1u), 2.0);
+    double meanSpikes = rate * (samplesGenerated - firstSample) / sampleRate();
+    if (!(meanSpikes > 0.0)) {
+        return;     // poisson_distribution needs a positive mean
+    }
+
+    for (int channel = 0; channel < 32; ++channel) {
+        if (channelDeactivated(channel)) {
+            continue;
+        }
+        poisson_distribution<int> numSpikesDistribution(meanSpikes);
+        uniform_int_distribution<unsigned int> timeDistribution(firstSample, (unsigned int)(samplesGenerated - 1));
+        uniform_int_distribution<int> amplitudeDistribution(200, 2000);
+        int numSpikes = numSpikesDistribution(randomGenerator);
+        for (int i = 0; i < numSpikes; ++i) {
+            unsigned int timestamp = timeDistribution(randomGenerator);
+            if (timestamp < blindUntil) {
+                continue;
+            }
+            pushSpikeRecord(timestamp, channel, amplitudeDistribution(randomGenerator));
+        }
+    }
+}
+
+// Queue one 4-word detection record (VAL, MT/ID, DT high word, DT low word); dropped if the
+// 2048-word spike FIFO is full.
+void okCFrontPanel::pushSpikeRecord(unsigned int timestamp, int channel, int amplitude)
+{
+    if (spikeFifoCount + 4 > SpikeFifoDepthWords) {
+        return;
+    }
+
+    unsigned short record[4];
+    record[0] = (unsigned short) amplitude;
+    record[1] = (unsigned short)((channel << 8) | (wireIn[0x15] & 0xff));
+    record[2] = (unsigned short)(timestamp >> 16);
+    record[3] = (unsigned short)(timestamp & 0xffff);
+    pushSpikeRecordWords(record);
+}
+
+void okCFrontPanel::pushSpikeRecordWords(const unsigned short *record)
+{
+    for (int i = 0; i < 4; ++i) {
+        spikeFifo[(spikeFifoRead + spikeFifoCount) % SpikeFifoDepthWords] = record[i];
+        spikeFifoCount++;
+    }
+}
+
+// Move the recorded detections from before beforeTimeStamp to the spike FIFO, as far as it has
+// room; the rest wait for the next sample.  Detections made while the detector is off are
+// discarded.
+void okCFrontPanel::replayDetections(unsigned int beforeTimeStamp)
+{
+    bool detectorRunning = (wireIn[0x00] & 0x20) != 0;
+    unsigned short record[4];
+
+    if (!detectorRunning) {
+        while (replaySource->takeDetections(beforeTimeStamp, record, 1) > 0) {}
+        return;
+    }
+    while (spikeFifoCount + 4 <= SpikeFifoDepthWords &&
+           replaySource->takeDetections(beforeTimeStamp, record, 1) > 0) {
+        pushSpikeRecordWords(record);
+    }
+}
+
+static inline void putUsbWord(unsigned char *buffer, unsigned int word)
+{
+    buffer[0] = (unsigned char)(word & 0xff);
+    buffer[1] = (unsigned char)((word >> 8) & 0xff);
+}
+
+// Result of the auxiliary command 0 sequence (register configuration) at commandIndex: the
+// ROM reads that identify an RHS2116, as BoardSetup::deviceId() expects them.
+static unsigned int romResult(unsigned int commandIndex)
+{
+    switch (commandIndex) {
+    case 57:
+        return CHIP_ID_RHS2116;
+    case 59:
+        return ('N' << 8);
+    case 60:
+        return ('T' << 8) | 'A';
+    case 61:
+        return ('I' << 8) | 'N';
+    default:
+        return 0;
+    }
+}
+
+// Fill one USB sample frame: magic number, timestamp, auxiliary command 1-3 results, DC/AC
+// amplifier word pairs channel by channel across streams, auxiliary command 0 results and
+// stimulation flags.  Amplifier data and stimulation flags come from the recording when
+// replaying, and are noise and zero otherwise.  Auxiliary command 1-3 results, DACs, ADCs and
+// TTL are left at zero.
+void okCFrontPanel::generateSample(unsigned char *sample)
+{
+    unsigned int sampleBytes = 2 * sampleSizeInWords();
+    int streams[MAX_NUM_DATA_STREAMS];
+    int numStreams = enabledStreams(streams);
+    normal_distribution<double> noise(0.0, AmplifierNoiseLsb);
+    bool fromReplay = replaying && replaySource->nextSample(replaySample);
+
+    memset(sample, 0, sampleBytes);
+
+    for (int i = 0; i < 8; ++i) {
+        sample[i] = (unsigned char)((RHS_USB_HEADER_MAGIC_NUMBER >> (8 * i)) & 0xff);
+    }
+    unsigned int timestamp = fromReplay ? replaySample.timeStamp : (unsigned int) samplesRead;
+    for (int i = 0; i < 4; ++i) {
+        sample[8 + i] = (unsigned char)((timestamp >> (8 * i)) & 0xff);
+    }
+
+    unsigned int index = 12 + 12 * numStreams;
+    for (int channel = 0; channel < CHANNELS_PER_STREAM; ++channel) {
+        for (int k = 0; k < numStreams; ++k) {
+            if (fromReplay) {
+                putUsbWord(sample + index, replaySample.dcAmplifier[streams[k]][channel]);
+                putUsbWord(sample + index + 2, replaySample.amplifier[streams[k]][channel]);
+            } else {
+                putUsbWord(sample + index, 512);
+                putUsbWord(sample + index + 2, qBound(0, 32768 + (int) noise(randomGenerator), 65535));
+            }
+            index += 4;
+        }
+    }
+
+    unsigned int romWord = romResult((unsigned int)((samplesRead - samplesAtRunStart) % SAMPLES_PER_DATA_BLOCK));
+    for (int k = 0; k < numStreams; ++k) {
+        if (chipPresent(streams[k])) {
+            putUsbWord(sample + index + 4 * k, romWord);
+        }
+    }
+    index += 4 * numStreams;
+
+    if (fromReplay) {
+        for (int k = 0; k < numStreams; ++k) {
+            putUsbWord(sample + index + 2 * k, replaySample.stimOn[streams[k]]);
+            putUsbWord(sample + index + 2 * (numStreams + k), replaySample.stimPolarity[streams[k]]);
+            putUsbWord(sample + index + 2 * (2 * numStreams + k), replaySample.ampSettle[streams[k]]);
+            putUsbWord(sample + index + 2 * (3 * numStreams + k), replaySample.chargeRecovery[streams[k]]);
+        }
+        replayDetections(timestamp + 1);
+    }
+}
+
+// Transfers scale with the replay speed, and are instantaneous when replaying as fast as possible.
+void okCFrontPanel::emulateTransferTime(long length) const
+{
+    double bytesPerSecond = usbBytesPerSecond * (replaying ? replaySpeed : 1.0);
+    if (bytesPerSecond > 0.0 && length > 0) {
+        this_thread::sleep_for(chrono::duration<double>(length / bytesPerSecond));
+    }
+}
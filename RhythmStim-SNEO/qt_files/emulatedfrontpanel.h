@@ -0,0 +1,184 @@
+#ifndef EMULATEDFRONTPANEL_H
+#define EMULATEDFRONTPANEL_H
+
+// Software stand-in for the Opal Kelly FrontPanel API, used instead of okFrontPanelDLL.h
+// when the application is built with RHYTHM_EMULATOR defined (DEFINES += RHYTHM_EMULATOR).
+// It implements the subset of okCFrontPanel used by Rhs2000EvalBoard and emulates the
+// Rhythm Stim bitfile with the SNEO spike detector, so the acquisition and detection code
+// paths can run on machines without an FPGA attached.  Continuous runs either generate noise
+// and random spikes or, after setReplaySource(), play back a recorded session.
+
+#include <QtGlobal>
+#include <string>
+#include <random>
+#include <chrono>
+#include "replaysource.h"
+
+using namespace std;
+
+typedef unsigned int UINT32;
+
+enum ok_ErrorCode {
+    ok_NoError = 0,
+    ok_Failed = -1,
+    ok_Timeout = -2,
+    ok_DoneNotHigh = -3,
+    ok_TransferError = -4,
+    ok_CommunicationError = -5,
+    ok_InvalidBitstream = -6,
+    ok_FileError = -7,
+    ok_DeviceNotOpen = -8,
+    ok_InvalidEndpoint = -9,
+    ok_InvalidBlockSize = -10,
+    ok_UnsupportedFeature = -15
+};
+
+enum ok_ProductCode {
+    OK_PRODUCT_UNKNOWN = 0,
+    OK_PRODUCT_XEM3001V1,
+    OK_PRODUCT_XEM3001V2,
+    OK_PRODUCT_XEM3010,
+    OK_PRODUCT_XEM3005,
+    OK_PRODUCT_XEM3001CL,
+    OK_PRODUCT_XEM3020,
+    OK_PRODUCT_XEM3050,
+    OK_PRODUCT_XEM9002,
+    OK_PRODUCT_XEM3001RB,
+    OK_PRODUCT_XEM5010,
+    OK_PRODUCT_XEM6110LX45,
+    OK_PRODUCT_XEM6001,
+    OK_PRODUCT_XEM6010LX45,
+    OK_PRODUCT_XEM6010LX150,
+    OK_PRODUCT_XEM6110LX150,
+    OK_PRODUCT_XEM6006LX9,
+    OK_PRODUCT_XEM6006LX16,
+    OK_PRODUCT_XEM6006LX25,
+    OK_PRODUCT_XEM5010LX110,
+    OK_PRODUCT_ZEM4310,
+    OK_PRODUCT_XEM6310LX45,
+    OK_PRODUCT_XEM6310LX150,
+    OK_PRODUCT_XEM6110V2LX45,
+    OK_PRODUCT_XEM6110V2LX150,
+    OK_PRODUCT_XEM6002LX9,
+    OK_PRODUCT_XEM6310MTLX45,
+    OK_PRODUCT_XEM6320LX130T
+};
+
+bool okFrontPanelDLL_LoadLib(const char *libname);
+void okFrontPanelDLL_GetVersion(char *date, char *time);
+
+class okCPLL22393
+{
+public:
+    double GetOutputFrequency(int output) const;
+};
+
+class okCFrontPanel
+{
+
+public:
+    enum ErrorCode {
+        NoError = ok_NoError,
+        Failed = ok_Failed,
+        Timeout = ok_Timeout,
+        DoneNotHigh = ok_DoneNotHigh,
+        TransferError = ok_TransferError,
+        CommunicationError = ok_CommunicationError,
+        InvalidBitstream = ok_InvalidBitstream,
+        FileError = ok_FileError,
+        DeviceNotOpen = ok_DeviceNotOpen,
+        InvalidEndpoint = ok_InvalidEndpoint,
+        InvalidBlockSize = ok_InvalidBlockSize,
+        UnsupportedFeature = ok_UnsupportedFeature
+    };
+
+    okCFrontPanel();
+    ~okCFrontPanel();
+
+    int GetDeviceCount();
+    int GetDeviceListModel(int num);
+    string GetDeviceListSerial(int num);
+    ErrorCode OpenBySerial(string serial = "");
+    ErrorCode LoadDefaultPLLConfiguration();
+    ErrorCode GetEepromPLL22393Configuration(okCPLL22393 &pll);
+    int GetDeviceMajorVersion();
+    int GetDeviceMinorVersion();
+    string GetSerialNumber();
+    string GetDeviceID();
+    ErrorCode ConfigureFPGA(const string strFilename);
+    bool IsFrontPanelEnabled();
+    ErrorCode ResetFPGA();
+
+    ErrorCode SetWireInValue(int ep, UINT32 val, UINT32 mask = 0xffffffff);
+    ErrorCode UpdateWireIns();
+    ErrorCode UpdateWireOuts();
+    UINT32 GetWireOutValue(int epAddr);
+    ErrorCode ActivateTriggerIn(int epAddr, int bit);
+    long WriteToPipeIn(int epAddr, long length, unsigned char *data);
+    long ReadFromPipeOut(int epAddr, long length, unsigned char *data);
+
+    // Emulation settings (not part of the FrontPanel API).
+    void setUsbBandwidth(double bytesPerSecond);
+    void setSpikeRate(double spikesPerSecondPerChannel);
+    static void setReplaySource(ReplaySource *source, double speed);
+
+private:
+    static const int NumWireIns = 32;
+    static const int NumWireOuts = 32;
+    static const int SpikeFifoDepthWords = 2048;
+
+    void resetState();
+    void advance();
+    double sampleRate() const;
+    int numEnabledStreams() const;
+    int enabledStreams(int *streams) const;
+    bool chipPresent(int stream) const;
+    unsigned int sampleSizeInWords() const;
+    bool channelDeactivated(int channel) const;
+    void generateSample(unsigned char *sample);
+    void detectSpikes(unsigned int firstSample);
+    void pushSpikeRecord(unsigned int timestamp, int channel, int amplitude);
+    void pushSpikeRecordWords(const unsigned short *record);
+    void replayDetections(unsigned int beforeTimeStamp);
+    void emulateTransferTime(long length) const;
+
+    UINT32 wireInPending[NumWireIns];
+    UINT32 wireIn[NumWireIns];
+    UINT32 wireOut[NumWireOuts];
+
+    // Acquisition state
+    bool spiRunning;
+    double dataClockRate;
+    chrono::steady_clock::time_point runStart;
+    unsigned long long samplesAtRunStart;
+    unsigned long long samplesGenerated;
+    unsigned long long samplesRead;
+    unsigned long long fifoOverflowSamples;
+
+    // Partially read sample (pipe reads need not be sample aligned)
+    unsigned char *sampleBuffer;
+    unsigned int sampleBytesPending;
+    unsigned int sampleBytesOffset;
+
+    // Spike detector state
+    unsigned short spikeFifo[SpikeFifoDepthWords];
+    int spikeFifoRead;
+    int spikeFifoCount;
+    unsigned int blindUntil;
+    bool lastManualTrigger;
+    double spikeRate;
+
+    // Replay of a recording (continuous runs only; setup runs still generate data)
+    static ReplaySource *defaultReplaySource;
+    static double defaultReplaySpeed;
+    ReplaySource *replaySource;
+    double replaySpeed;                 // x real time; 0 for as fast as the host reads
+    bool replaying;
+    unsigned long long replaySamplesLeft;
+    ReplaySample replaySample;
+
+    double usbBytesPerSecond;
+    mt19937 randomGenerator;
+};
+
+#endif // EMULATEDFRONTPANEL_H
@@ -0,0 +1,730 @@
+#include <QCoreApplication>
+#include <QThread>
+#include <QFile>
+#include <QFileInfo>
+#include <QDateTime>
+#include <QDataStream>
+#include <QUdpSocket>
+#include <QHostAddress>
+#include <iostream>
+
+#include "headlessacquisition.h"
+#include "globalconstants.h"
+#include "rhs2000evalboard.h"
+#include "boardconfigtransaction.h"
+#include "boardsetup.h"
+#include "signalsources.h"
+#include "signalgroup.h"
+#include "signalchannel.h"
+#include "signalprocessor.h"
+#include "referencesource.h"
+#include "datastreamfifo.h"
+#include "usbdatathread.h"
+#include "usbheaderscanner.h"
+#include "savefilewriter.h"
+#include "spikeforwarder.h"
+#include "hostspikedetector.h"
+#include "detectioncomparator.h"
+#include "metricsregistry.h"
+
+// Sampled gauges; they read this object's members, so each is removed again in the destructor.
+static const char* const ParseQueueDepthGauge = "pipeline.parse.queue_depth";
+static const char* const HostFifoPercentFullGauge = "host_fifo.percent_full";
+
+// Headless acquisition daemon
+
+HeadlessAcquisition::HeadlessAcquisition(const HeadlessConfig &config_) :
+    config(config_),
+    running(false)
+{
+    evalBoard = nullptr;
+    evalBoardMode = 0;
+    numSpiPorts = 0;
+    boardSampleRate = 30000.0;
+    numUsbBlocksToRead = MAX_NUM_BLOCKS_TO_READ;
+    stimStep = (Rhs2000Registers::StimStepSize)(config.stimStepIndex + 1);
+
+    actualDspCutoffFreq = 0.0;
+    actualLowerBandwidth = 0.0;
+    actualLowerSettleBandwidth = 0.0;
+    actualUpperBandwidth = 0.0;
+
+    signalSources = nullptr;
+    signalProcessor = new SignalProcessor();
+    usbStreamFifo = nullptr;
+    usbDataThread = nullptr;
+
+    MetricsRegistry* metrics = MetricsRegistry::global();
+    parseStage = new PipelineStage("parse");
+    processStage = new PipelineStage("process", &parsedBatches);
+    parseStage->setServiceTimeHistogram(metrics->histogram("pipeline.parse.service_time", "us"));
+    processStage->setServiceTimeHistogram(metrics->histogram("pipeline.process.service_time", "us"));
+    metrics->setSampledGauge(ParseQueueDepthGauge, [this] { return (double) parsedBatches.depth(); });
+    hostSpikeDetector = new HostSpikeDetector();
+
+    saveFileWriter = new SaveFileWriter();
+    saveFile = nullptr;
+    saveStream = nullptr;
+}
+
+HeadlessAcquisition::~HeadlessAcquisition()
+{
+    MetricsRegistry* metrics = MetricsRegistry::global();
+    metrics->removeSampledGauge(ParseQueueDepthGauge);
+    metrics->removeSampledGauge(HostFifoPercentFullGauge);
+
+    if (usbDataThread) {
+        usbDataThread->close();
+        usbDataThread->wait();
+        delete usbDataThread;
+    }
+    if (evalBoard) {
+        int ledArray[8] = {0, 0, 0, 0, 0, 0, 0, 0};
+        evalBoard->setSpiLedDisplay(ledArray);
+    }
+    delete usbStreamFifo;
+    delete saveFileWriter;
+    delete hostSpikeDetector;
+    delete parseStage;
+    delete processStage;
+    delete signalProcessor;
+    delete signalSources;
+    delete evalBoard;
+}
+
+// Open the interface board, upload the FPGA bitfile, configure the amplifiers and find the
+// connected RHS2000 chips.  Returns false (and prints why) on error.
+bool HeadlessAcquisition::openBoard()
+{
+    evalBoard = new Rhs2000EvalBoard;
+
+    int errorCode = evalBoard->open();
+    if (errorCode == -1) {
+        cerr << "Error in HeadlessAcquisition::openBoard: cannot load Opal Kelly FrontPanel DLL." << endl;
+        return false;
+    } else if (errorCode < 1) {
+        cerr << "Error in HeadlessAcquisition::openBoard: Intan Stimulation / Recording Controller not found "
+                "on any USB port." << endl;
+        return false;
+    }
+
+    if (!evalBoard->uploadFpgaBitfile(config.bitfileName.toStdString())) {
+        cerr << "Error in HeadlessAcquisition::openBoard: cannot upload configuration file " <<
+                config.bitfileName.toStdString() << endl;
+        return false;
+    }
+
+    evalBoard->resetBoard();
+    evalBoardMode = evalBoard->getBoardMode();
+    if (evalBoardMode != RHS_BOARD_MODE) {
+        cerr << "Error in HeadlessAcquisition::openBoard: the device connected to the USB port is not an "
+                "Intan Stimulation / Recording Controller." << endl;
+        return false;
+    }
+
+    bool expanderBoardDetected;
+    evalBoard->readDigitalInManual(expanderBoardDetected);
+    evalBoard->readDigitalInExpManual();
+    numSpiPorts = 4;
+
+    // Host FIFO and USB data thread, sized as in MainWindow
+    int maxPossibleDataStreams = 2 * numSpiPorts;
+    int usbBufferSize = MAX_NUM_BLOCKS_TO_READ * 2 * Rhs2000DataBlock::calculateDataBlockSizeInWords(maxPossibleDataStreams);
+    unsigned int maxSpanBytes = qMax((unsigned int) (2 * usbBufferSize),
+            (unsigned int) (BUFFER_SIZE_IN_BLOCKS * 2 * Rhs2000DataBlock::calculateDataBlockSizeInWords(MAX_NUM_DATA_STREAMS)));
+    const unsigned int numSeconds = 10;
+    const unsigned int maxSamplingRate = 40000;
+    unsigned int fifoBufferSize =
+            numSeconds * maxSamplingRate * 2 * (Rhs2000DataBlock::calculateDataBlockSizeInWords(maxPossibleDataStreams) / SAMPLES_PER_DATA_BLOCK);
+    usbStreamFifo = new DataStreamFifo(fifoBufferSize, maxSpanBytes);
+    usbDataThread = new UsbDataThread(evalBoard, usbStreamFifo);
+    MetricsRegistry::global()->setSampledGauge(HostFifoPercentFullGauge, [this] { return usbStreamFifo->percentFull(); });
+
+    signalSources = new SignalSources(numSpiPorts);
+
+    initializeBoard();
+    findConnectedAmplifiers();
+    signalProcessor->allocateMemory(evalBoard->getNumEnabledDataStreams());
+
+    // Turn on the LEDs of the ports with amplifiers.
+    int ledArray[8] = {0, 0, 0, 0, 0, 0, 0, 0};
+    for (int i = 0; i < MAX_NUM_SPI_PORTS; i++) {
+        if (signalSources->signalPort[i].enabled) {
+            ledArray[2 * i] = 1;
+        }
+    }
+    evalBoard->setSpiLedDisplay(ledArray);
+    return true;
+}
+
+// Acquire (and record, and forward spikes, if configured) until stop() is called.  Runs the
+// application event loop meanwhile.  Returns false if acquisition stopped because of an error.
+bool HeadlessAcquisition::run()
+{
+    unsigned int dataBlockSize = Rhs2000DataBlock::calculateDataBlockSizeInWords(evalBoard->getNumEnabledDataStreams());
+    unsigned int sampleSizeInBytes = 2 * dataBlockSize / SAMPLES_PER_DATA_BLOCK;
+    unsigned int numBytesToRead = numUsbBlocksToRead * 2 * dataBlockSize;
+    double recordTimeIncrementSeconds = numUsbBlocksToRead * Rhs2000DataBlock::getSamplesPerDataBlock() / boardSampleRate;
+    double fifoCapacity = Rhs2000EvalBoard::fifoCapacityInWords();
+    ReferenceSource referenceSource = {0, 0, false};
+    UsbGlitchStatistics usbGlitchStatistics = {0, 0, 0};
+    bool recording = !config.saveBaseFileName.isEmpty();
+    atomic<bool> failed(false);
+
+    // SignalProcessor wants a stream even when nothing is saved.
+    QDataStream unusedStream;
+
+    if (recording) {
+        signalProcessor->createSaveList(signalSources, false, 0, Rhs2000Registers::stimStepSizeToDouble(stimStep) / 1.0e-6);
+        saveFileWriter->resetStatistics();
+        if (!startNewSaveFile()) {
+            return false;
+        }
+    }
+
+    if (config.spikeDetectorEnabled) {
+        BoardConfigTransaction transaction(evalBoard);
+        evalBoard->setThresholdMult(config.thresholdMult);
+        evalBoard->setBlindWindowLength(config.blindWindowLength);
+        evalBoard->setDeactiveChannels(config.deactiveChannels.data());
+        transaction.commit();
+    }
+
+    // The host detector takes the hardware detector's settings; its disabled channels are port D's.
+    bool hostDetecting = false;
+    if (config.hostDetectorEnabled) {
+        unsigned int disabledChannels = 0;
+        for (int channel = 0; channel < config.deactiveChannels.size(); ++channel) {
+            if (config.deactiveChannels[channel]) {
+                disabledChannels |= 1u << channel;
+            }
+        }
+        hostSpikeDetector->setThresholdMult(qRound(config.thresholdMult * 2) & 0xff);
+        hostSpikeDetector->setBlindWindow(config.blindWindowLength & 0xff);
+        hostSpikeDetector->setDisabledChannels(MAX_NUM_SPI_PORTS - 1, disabledChannels);
+        hostDetecting = hostSpikeDetector->start(hardwareStreams, numUsbBlocksToRead * SAMPLES_PER_DATA_BLOCK,
+                                                 config.hostDetectorThreads);
+        if (hostDetecting) {
+            cout << "Host spike detector: " << hostSpikeDetector->getNumShards() << " ports in " <<
+                    hostSpikeDetector->getNumThreads() << " threads" << endl;
+        }
+    }
+
+    dataBlockPool.allocate(PIPELINE_DEPTH_IN_READS * numUsbBlocksToRead, evalBoard->getNumEnabledDataStreams());
+    parsedBatches.setCapacity(PIPELINE_DEPTH_IN_READS);
+    freeBatches.setCapacity(PIPELINE_DEPTH_IN_READS);
+    for (int i = 0; i < PIPELINE_DEPTH_IN_READS; ++i) {
+        freeBatches.push(i * numUsbBlocksToRead);
+    }
+    parseStage->reset();
+    processStage->reset();
+
+    // Enable the hardware detector before the board runs, so that it starts from reset at the
+    // first sample, as the host detector does.
+    running = true;
+    if (config.spikeDetectorEnabled) {
+        evalBoard->runSpikeDetector(true);
+    }
+    usbDataThread->setNumUsbBlocksToRead(numUsbBlocksToRead);
+    usbDataThread->start();
+    usbDataThread->startRunning();
+
+    // Same parse stage as MainWindow::runInterfaceBoard().
+    QThread *parseThread = QThread::create([&] {
+        DataBlockBatch batch;
+        int extraCycles = 0;
+        unsigned int numBytesConsumed;
+        unsigned char* usbData;
+
+        batch.numBlocks = numUsbBlocksToRead;
+        while (running && freeBatches.pop(batch.firstBlock)) {
+            // Wait for a certain amount of data to be ready from the USB interface board.
+            usbData = usbStreamFifo->peekRead(numBytesToRead);
+            while (!usbData && running) {
+                extraCycles++;
+                QThread::usleep(100);
+                usbData = usbStreamFifo->peekRead(numBytesToRead);
+            }
+            if (!usbData) {
+                break;
+            }
+            parseStage->startService();
+            numBytesConsumed = numBytesToRead;
+
+            batch.usbBufferPercentFull = usbStreamFifo->percentFull();
+            batch.cpuWarning = (extraCycles == 0);
+            extraCycles = 0;
+
+            usbData = UsbHeaderScanner::repairGlitches(usbStreamFifo, usbData, numBytesToRead, sampleSizeInBytes,
+                                                       numBytesConsumed, usbGlitchStatistics, running);
+            if (!usbData) {
+                break;
+            }
+
+            if (hostDetecting) {
+                hostSpikeDetector->submit(usbData, numUsbBlocksToRead * SAMPLES_PER_DATA_BLOCK);
+            }
+            for (unsigned int j = 0; j < numUsbBlocksToRead; ++j) {
+                dataBlockPool.block(batch.firstBlock + j)->fillFromUsbBuffer(usbData, j, evalBoard->getNumEnabledDataStreams());
+            }
+            usbStreamFifo->releaseRead(numBytesConsumed);
+            batch.usbGlitches = usbGlitchStatistics;
+            parseStage->finishService();
+
+            if (!parsedBatches.push(batch)) {
+                break;
+            }
+        }
+    });
+
+    // Process stage: loading and saving only; with nothing to display, data is not filtered.
+    QThread *processingThread = QThread::create([&] {
+        DataBlockBatch batch;
+        queue<Rhs2000DataBlock> dataQueue;
+        queue<Rhs2000DataBlock> bufferQueue;
+        int triggerIndex;
+        int fifoNearlyFull = 0;
+        bool hasBeenUpdated;
+        double totalRecordTimeSeconds = 0.0;
+
+        while (running && parsedBatches.pop(batch)) {
+            processStage->startService();
+
+            queueDataBlockBatch(batch.firstBlock, dataQueue);
+            freeBatches.push(batch.firstBlock);
+
+            signalProcessor->loadAmplifierData(dataQueue, (int) numUsbBlocksToRead, false, 0, 0, triggerIndex,
+                                               false, bufferQueue, recording, recording ? *saveStream : unusedStream,
+                                               SaveFormatIntan, false, false, 0, referenceSource);
+
+            // Start a new save file every newSaveFilePeriodMinutes minutes.
+            if (recording) {
+                totalRecordTimeSeconds += recordTimeIncrementSeconds;
+                if (totalRecordTimeSeconds >= (60 * config.newSaveFilePeriodMinutes)) {
+                    closeSaveFile();
+                    if (!startNewSaveFile()) {
+                        recording = false;
+                        failed = true;
+                        stop();
+                        break;
+                    }
+                    totalRecordTimeSeconds = 0.0;
+                }
+            }
+
+            // Stop if the USB interface FIFO (on the FPGA board) is over 95% full three times in
+            // a row, as MainWindow does.
+            unsigned int wordsInFifo = evalBoard->getLastNumWordsInFifo(hasBeenUpdated);
+            if (hasBeenUpdated) {
+                if (100.0 * wordsInFifo / fifoCapacity > 95.0) {
+                    if (++fifoNearlyFull > 2) {
+                        cerr << "Error in HeadlessAcquisition::run: acquisition stopped because the USB FIFO "
+                                "buffer on the interface board reached maximum capacity." << endl;
+                        failed = true;
+                        stop();
+                        break;
+                    }
+                } else {
+                    fifoNearlyFull = 0;
+                }
+            }
+
+            processStage->finishService();
+        }
+    });
+
+    QThread *spikeThread = nullptr;
+    if (config.spikeDetectorEnabled || hostDetecting) {
+        spikeThread = QThread::create([this] { runSpikeDetector(); });
+    }
+
+    parseThread->start(QThread::HighPriority);
+    processingThread->start(QThread::HighPriority);
+    if (spikeThread) {
+        spikeThread->start(QThread::HighPriority);
+    }
+
+    QCoreApplication::exec();
+
+    // Turn away stages still waiting on each other.
+    running = false;
+    parsedBatches.close();
+    freeBatches.close();
+    processingThread->wait();
+    parseThread->wait();
+    delete processingThread;
+    delete parseThread;
+    // Only once the parse stage is done submitting reads; the spike thread saves the last
+    // detections after this.
+    hostSpikeDetector->stop();
+    if (spikeThread) {
+        spikeThread->wait();
+        delete spikeThread;
+        if (config.spikeDetectorEnabled) {
+            evalBoard->runSpikeDetector(false);
+        }
+    }
+
+    // Important!  Must wait for usbDataThread to fully stop before we reset usbStreamFifo buffer!
+    usbDataThread->stopRunning();
+    while (usbDataThread->isRunning()) {
+        QThread::msleep(1);
+    }
+    usbStreamFifo->resetBuffer();
+    evalBoard->resetSequencers();
+
+    if (recording) {
+        closeSaveFile();
+    }
+
+    cout << "HeadlessAcquisition: " << usbGlitchStatistics.numBadHeaders << " bad USB headers, " <<
+            usbGlitchStatistics.numWordsSkipped << " words skipped, " <<
+            usbGlitchStatistics.numRealignStalls << " realignment stalls" << endl;
+    parseStage->printStatistics();
+    processStage->printStatistics();
+    if (hostDetecting) {
+        hostSpikeDetector->printStatistics();
+    }
+    if (!config.saveBaseFileName.isEmpty()) {
+        saveFileWriter->printStatistics();
+    }
+    return !failed;
+}
+
+// Stop acquisition.  May be called from any thread.
+void HeadlessAcquisition::stop()
+{
+    running = false;
+    QMetaObject::invokeMethod(QCoreApplication::instance(), "quit", Qt::QueuedConnection);
+}
+
+// Initialize the interface board as MainWindow::initializeInterfaceBoard() does.
+// (Private method.)
+void HeadlessAcquisition::initializeBoard()
+{
+    evalBoard->initialize();
+
+    evalBoard->enableDcAmpConvert(true);
+    evalBoard->setExtraStates(0);
+
+    // Set sample rate and upload all auxiliary SPI command sequences.
+    configureAmplifiers();
+
+    // Run the SPI interface once for 128 samples, to configure the RHS2000 amplifier chips
+    // and to run ADC calibration.
+    evalBoard->setMaxTimeStep(SAMPLES_PER_DATA_BLOCK);
+    evalBoard->setContinuousRunMode(false);
+    BoardSetup::runOnce(evalBoard);
+
+    Rhs2000DataBlock *dataBlock = new Rhs2000DataBlock(evalBoard->getNumEnabledDataStreams());
+    evalBoard->readDataBlock(dataBlock);
+    delete dataBlock;
+
+    // All eight DACs off, as MainWindow leaves them.
+    BoardConfigTransaction dacTransaction(evalBoard);
+    for (int dac = 0; dac < 8; ++dac) {
+        evalBoard->enableDac(dac, false);
+        evalBoard->selectDacDataStream(dac, 8);   // DacManual1 input
+        evalBoard->selectDacDataChannel(dac, (dac == 1) ? 1 : 0);
+    }
+    evalBoard->setDacManual(32768);
+    evalBoard->setDacGain(0);
+    evalBoard->setAudioNoiseSuppress(0);
+    dacTransaction.commit();
+}
+
+// Set the sample rate and amplifier bandwidth and upload the auxiliary command sequences; the
+// board part of MainWindow::changeSampleRate().  Cable delays are set by the amplifier scan.
+// (Private method.)
+void HeadlessAcquisition::configureAmplifiers()
+{
+    Rhs2000EvalBoard::AmplifierSampleRate sampleRate = Rhs2000EvalBoard::SampleRate30000Hz;
+
+    switch (config.sampleRateIndex) {
+    case 0:
+        sampleRate = Rhs2000EvalBoard::SampleRate20000Hz;
+        boardSampleRate = 20000.0;
+        numUsbBlocksToRead = 5;
+        break;
+    case 1:
+        sampleRate = Rhs2000EvalBoard::SampleRate25000Hz;
+        boardSampleRate = 25000.0;
+        numUsbBlocksToRead = 6;
+        break;
+    case 2:
+        sampleRate = Rhs2000EvalBoard::SampleRate30000Hz;
+        boardSampleRate = 30000.0;
+        numUsbBlocksToRead = MAX_NUM_BLOCKS_TO_READ;
+        break;
+    }
+    evalBoard->setSampleRate(sampleRate);
+
+    Rhs2000Registers chipRegisters(boardSampleRate, stimStep);
+    int commandSequenceLength;
+    vector<unsigned int> commandList;
+
+    chipRegisters.setDigOutLow(Rhs2000Registers::DigOut::DigOut1);   // Take auxiliary output out of HiZ mode.
+    chipRegisters.setDigOutLow(Rhs2000Registers::DigOut::DigOut2);   // Take auxiliary output out of HiZ mode.
+    chipRegisters.setDigOutLow(Rhs2000Registers::DigOut::DigOutOD);   // Take auxiliary output out of HiZ mode.
+
+    actualDspCutoffFreq = chipRegisters.setDspCutoffFreq(config.desiredDspCutoffFreq);
+    actualLowerBandwidth = chipRegisters.setLowerBandwidth(config.desiredLowerBandwidth, 0);
+    actualLowerSettleBandwidth = chipRegisters.setLowerBandwidth(config.desiredLowerSettleBandwidth, 1);
+    actualUpperBandwidth = chipRegisters.setUpperBandwidth(config.desiredUpperBandwidth);
+    chipRegisters.enableDsp(config.dspEnabled);
+
+    cout << "Bandwidth: " << actualLowerBandwidth << " Hz - " << actualUpperBandwidth << " Hz, DSP cutoff " <<
+            (config.dspEnabled ? actualDspCutoffFreq : 0.0) << " Hz" << endl;
+
+    commandSequenceLength = chipRegisters.createCommandListRegisterConfig(commandList, true);
+    evalBoard->uploadCommandList(commandList, Rhs2000EvalBoard::AuxCmd1);
+    evalBoard->selectAuxCommandLength(Rhs2000EvalBoard::AuxCmd1, 0, commandSequenceLength - 1);
+
+    // Fill the other three command slots with dummy commands.
+    chipRegisters.createCommandListDummy(commandList, 8192, chipRegisters.createRhs2000Command(Rhs2000Registers::Rhs2000CommandRegRead, 255));
+    evalBoard->uploadCommandList(commandList, Rhs2000EvalBoard::AuxCmd2);
+    chipRegisters.createCommandListDummy(commandList, 8192, chipRegisters.createRhs2000Command(Rhs2000Registers::Rhs2000CommandRegRead, 254));
+    evalBoard->uploadCommandList(commandList, Rhs2000EvalBoard::AuxCmd3);
+    chipRegisters.createCommandListDummy(commandList, 8192, chipRegisters.createRhs2000Command(Rhs2000Registers::Rhs2000CommandRegRead, 253));
+    evalBoard->uploadCommandList(commandList, Rhs2000EvalBoard::AuxCmd4);
+}
+
+// Find the RHS2000 chips on ports A-D, enable their data streams in consecutive order and
+// create an amplifier channel for each of their inputs, all enabled.
+// (Private method.)
+void HeadlessAcquisition::findConnectedAmplifiers()
+{
+    QVector<int> chipId, portDelay;
+    int numChannelsOnPort[MAX_NUM_SPI_PORTS] = {0, 0, 0, 0};
+
+    BoardSetup::scanCableDelays(evalBoard, chipId, portDelay);
+
+    // Two data streams per SPI port; the streams of the chips found are renumbered consecutively.
+    int stream = 0;
+    hardwareStreams.clear();
+    for (int oldStream = 0; oldStream < MAX_NUM_DATA_STREAMS; ++oldStream) {
+        int port = oldStream / 2;
+        if (chipId[oldStream] == CHIP_ID_RHS2116) {
+            evalBoard->enableDataStream(oldStream, true);
+            for (int i = 0; i < 16; ++i) {
+                int channel = numChannelsOnPort[port]++;
+                signalSources->signalPort[port].addAmplifierChannel(channel, i, stream);
+                signalSources->signalPort[port].channel[channel].commandStream = oldStream;
+            }
+            hardwareStreams.push_back(oldStream);
+            stream++;
+        } else {
+            evalBoard->enableDataStream(oldStream, false);
+        }
+    }
+
+    for (int port = 0; port < MAX_NUM_SPI_PORTS; ++port) {
+        signalSources->signalPort[port].enabled = (numChannelsOnPort[port] > 0);
+        cout << "Port " << (char) ('A' + port) << ": " << numChannelsOnPort[port] << " amplifier channels" << endl;
+    }
+    if (stream == 0) {
+        cerr << "Warning in HeadlessAcquisition::findConnectedAmplifiers: no RHS2000 stim/amp chips detected." << endl;
+    }
+}
+
+// Open a new Intan format save file named after the base file name and the current time, and
+// write its header.  (Private method.)
+bool HeadlessAcquisition::startNewSaveFile()
+{
+    QFileInfo fileInfo(config.saveBaseFileName);
+    QDateTime dateTime = QDateTime::currentDateTime();
+
+    QString fileName = fileInfo.path() + "/" + fileInfo.baseName() + "_" +
+            dateTime.toString("yyMMdd") + "_" + dateTime.toString("HHmmss") + ".rhs";
+
+    saveFile = new QFile(fileName);
+    if (!saveFile->open(QIODevice::WriteOnly)) {
+        cerr << "Error in HeadlessAcquisition::startNewSaveFile: cannot open " << fileName.toStdString() <<
+                " for writing." << endl;
+        delete saveFile;
+        saveFile = nullptr;
+        return false;
+    }
+
+    saveFileWriter->startWriting(saveFile);
+    saveStream = new QDataStream(saveFileWriter);
+    saveStream->setVersion(QDataStream::Qt_4_8);
+    saveStream->setByteOrder(QDataStream::LittleEndian);
+    saveStream->setFloatingPointPrecision(QDataStream::SinglePrecision);
+    writeSaveFileHeader(*saveStream);
+
+    {
+        lock_guard<mutex> lock(saveFileNameMutex);
+        saveFileName = fileName;
+    }
+    cout << "Recording to " << fileName.toStdString() << endl;
+    return true;
+}
+
+// (Private method.)
+void HeadlessAcquisition::closeSaveFile()
+{
+    {
+        lock_guard<mutex> lock(saveFileNameMutex);
+        saveFileName.clear();
+    }
+    saveFileWriter->finishWriting();
+    if (saveFileWriter->hadWriteError()) {
+        cerr << "Error in HeadlessAcquisition::closeSaveFile: could not write all data to " <<
+                saveFile->fileName().toStdString() << endl;
+    }
+    saveFile->close();
+    delete saveStream;
+    delete saveFile;
+    saveStream = nullptr;
+    saveFile = nullptr;
+}
+
+// Write the Intan format save file header, as MainWindow::writeSaveFileHeader() does with the
+// GUI's default settings for everything the daemon does not configure.  (Private method.)
+void HeadlessAcquisition::writeSaveFileHeader(QDataStream &outStream)
+{
+    for (int i = 0; i < 16; ++i) {
+        signalSources->signalPort[numSpiPorts + 3].channel[i].enabled = false;   // TTL outputs not saved
+    }
+
+    outStream << (quint32) DATA_FILE_MAGIC_NUMBER;
+    outStream << (qint16) DATA_FILE_MAIN_VERSION_NUMBER;
+    outStream << (qint16) DATA_FILE_SECONDARY_VERSION_NUMBER;
+
+    outStream << boardSampleRate;
+
+    outStream << (qint16) config.dspEnabled;
+    outStream << actualDspCutoffFreq;
+    outStream << actualLowerBandwidth;
+    outStream << actualLowerSettleBandwidth;
+    outStream << actualUpperBandwidth;
+
+    outStream << config.desiredDspCutoffFreq;
+    outStream << config.desiredLowerBandwidth;
+    outStream << config.desiredLowerSettleBandwidth;
+    outStream << config.desiredUpperBandwidth;
+
+    outStream << (qint16) 0;            // notch filter off
+
+    outStream << 1000.0;                // desired impedance test frequency
+    outStream << 0.0;                   // actual impedance test frequency (not measured)
+
+    outStream << (qint16) false;        // amp fast settle
+    outStream << (qint16) false;        // charge recovery mode
+
+    outStream << Rhs2000Registers::stimStepSizeToDouble(stimStep);
+    outStream << Rhs2000Registers::chargeRecoveryCurrentLimitToDouble(Rhs2000Registers::ChargeRecoveryCurrentLimit::CurrentLimit10nA);
+    outStream << 0.0;                   // charge recovery target voltage
+
+    outStream << QString("headless");
+    outStream << QString("");
+    outStream << QString("");
+
+    outStream << (qint16) false;        // DC amplifier data saved
+
+    outStream << (qint16) evalBoardMode;
+
+    outStream << QString("n/a");        // hardware reference
+
+    outStream << *signalSources;
+}
+
+// Name of the current save file, or empty if not recording.  (Private method.)
+QString HeadlessAcquisition::getSaveFileName()
+{
+    lock_guard<mutex> lock(saveFileNameMutex);
+    return saveFileName;
+}
+
+// Append copies of the numUsbBlocksToRead data blocks of the batch starting at firstBlock to
+// blockQueue, for SignalProcessor.  (Private method.)
+void HeadlessAcquisition::queueDataBlockBatch(DataBlockHandle firstBlock, queue<Rhs2000DataBlock> &blockQueue)
+{
+    for (unsigned int j = 0; j < numUsbBlocksToRead; ++j) {
+        blockQueue.push(*dataBlockPool.block(firstBlock + j));
+    }
+}
+
+// Spike thread: read the hardware spike detector, forward its events over UDP and save them
+// next to the current save file, as SpikeDetectorDialog::runSpikeDetector() does.  Also saves
+// the host detector's events, which are not forwarded, and in shadow mode matches them against
+// the hardware's.  (Private method.)
+void HeadlessAcquisition::runSpikeDetector()
+{
+    SpikeForwarder spikeForwarder(evalBoard->getSpikeEventBuffer());
+    SpikeForwarder hostSpikeForwarder(hostSpikeDetector->getSpikeEventBuffer());
+    QUdpSocket sendSocket;      // created on this thread, which uses it
+    QString prevFileName, hwDetectorFileName, hostDetectorFileName;
+
+    if (config.spikeDetectorEnabled && !config.udpDestAddress.isEmpty()) {
+        QHostAddress hostAddress = config.udpHostAddress.isEmpty() ?
+                    QHostAddress(QHostAddress::AnyIPv4) : QHostAddress(config.udpHostAddress);
+        if (sendSocket.bind(hostAddress, 0)) {
+            spikeForwarder.setDestination(&sendSocket, QHostAddress(config.udpDestAddress), config.udpDestPort);
+            cout << "Sending spikes from " << hostAddress.toString().toStdString() << " to " <<
+                    config.udpDestAddress.toStdString() << ":" << config.udpDestPort << endl;
+        } else {
+            cerr << "Error in HeadlessAcquisition::runSpikeDetector: cannot send from " <<
+                    hostAddress.toString().toStdString() << endl;
+        }
+    }
+
+    DetectionComparator *comparator = nullptr;
+    if (config.shadowCompareEnabled) {
+        if (config.spikeDetectorEnabled && hostSpikeDetector->isRunning()) {
+            comparator = new DetectionComparator(evalBoard->getSpikeEventBuffer(),
+                                                 hostSpikeDetector->getSpikeEventBuffer(),
+                                                 (MAX_NUM_SPI_PORTS - 1) * SPIKE_DETECTOR_NUM_CHANNELS);
+            comparator->setTolerance(config.shadowCompareTolerance);
+        } else {
+            cerr << "Warning in HeadlessAcquisition::runSpikeDetector: shadow comparison needs both the hardware "
+                    "and the host spike detector." << endl;
+        }
+    }
+
+    spikeForwarder.reset();
+    hostSpikeForwarder.reset();
+    // Keep going until the host detector has stopped too, so that its last detections are saved.
+    while (running || hostSpikeDetector->isRunning()) {
+        long spikesRead = 0;
+        if (config.spikeDetectorEnabled) {
+            spikesRead = evalBoard->readSpike();
+            spikeForwarder.forwardEvents();
+        }
+        if (comparator) {
+            comparator->compare();
+        }
+
+        QString fileName = getSaveFileName();
+        if (prevFileName != fileName) {
+            prevFileName = fileName;
+            hwDetectorFileName = fileName.left(fileName.size() - 4) + "_HW_detections.rhs";
+            hostDetectorFileName = fileName.left(fileName.size() - 4) + "_SW_detections.rhs";
+        }
+        if (fileName.isEmpty()) {
+            hostSpikeForwarder.skipSavedEvents();
+        } else {
+            hostSpikeForwarder.saveEvents(hostDetectorFileName);
+        }
+
+        if (!fileName.isEmpty() && spikesRead > 0) {
+            spikeForwarder.saveEvents(hwDetectorFileName);
+        } else {
+            if (fileName.isEmpty()) {
+                spikeForwarder.skipSavedEvents();
+            }
+            QThread::msleep(1);
+        }
+    }
+
+    // Detections the host workers added after the last pass above.
+    if (!prevFileName.isEmpty()) {
+        hostSpikeForwarder.saveEvents(hostDetectorFileName);
+    }
+
+    if (comparator) {
+        comparator->printStatistics();
+        delete comparator;
+    }
+}
@@ -0,0 +1,94 @@
+#ifndef HEADLESSACQUISITION_H
+#define HEADLESSACQUISITION_H
+
+#include <QString>
+#include <queue>
+#include <mutex>
+#include <atomic>
+#include "rhs2000datablock.h"
+#include "rhs2000registers.h"
+#include "datablockpool.h"
+#include "pipeline.h"
+#include "headlessconfig.h"
+
+using namespace std;
+
+class QFile;
+class QDataStream;
+class Rhs2000EvalBoard;
+class SignalSources;
+class SignalProcessor;
+class DataStreamFifo;
+class UsbDataThread;
+class SaveFileWriter;
+class HostSpikeDetector;
+
+// Acquisition without any widgets, for long closed-loop sessions.  Brings up the interface board
+// as MainWindow does, then streams the data through the same parse and process stages, recording
+// it in Intan format, while a third thread reads the hardware spike detector and forwards its
+// events over UDP.  Optionally, HostSpikeDetector runs the same detection on every port, fed by
+// the parse stage; its events are saved next to the hardware's.  Nothing is displayed and no
+// display data is prepared, so the cores MainWindow uses for filtering and painting are left to
+// acquisition.  Needs an interface board, or the RHYTHM_EMULATOR build, which can also replay a
+// recording (see okCFrontPanel::setReplaySource).
+
+class HeadlessAcquisition
+{
+
+public:
+    HeadlessAcquisition(const HeadlessConfig &config_);
+    ~HeadlessAcquisition();
+
+    bool openBoard();
+    bool run();
+    void stop();
+
+private:
+    void initializeBoard();
+    void configureAmplifiers();
+    void findConnectedAmplifiers();
+    bool startNewSaveFile();
+    void closeSaveFile();
+    void writeSaveFileHeader(QDataStream &outStream);
+    QString getSaveFileName();
+    void queueDataBlockBatch(DataBlockHandle firstBlock, queue<Rhs2000DataBlock> &blockQueue);
+    void runSpikeDetector();
+
+    HeadlessConfig config;
+
+    Rhs2000EvalBoard *evalBoard;
+    int evalBoardMode;
+    int numSpiPorts;
+    double boardSampleRate;
+    unsigned int numUsbBlocksToRead;
+    Rhs2000Registers::StimStepSize stimStep;
+
+    double actualDspCutoffFreq;
+    double actualLowerBandwidth;
+    double actualLowerSettleBandwidth;
+    double actualUpperBandwidth;
+
+    SignalSources *signalSources;
+    SignalProcessor *signalProcessor;
+    DataStreamFifo *usbStreamFifo;
+    UsbDataThread *usbDataThread;
+
+    DataBlockPool dataBlockPool;
+    PipelineQueue<DataBlockBatch> parsedBatches;
+    PipelineQueue<DataBlockHandle> freeBatches;     // first block of each unused batch
+    PipelineStage *parseStage;
+    PipelineStage *processStage;
+
+    vector<int> hardwareStreams;                    // hardware data stream (0-7) of each enabled one
+    HostSpikeDetector *hostSpikeDetector;
+
+    SaveFileWriter *saveFileWriter;
+    QFile *saveFile;
+    QDataStream *saveStream;
+    mutex saveFileNameMutex;                        // the spike thread names its files after it
+    QString saveFileName;
+
+    atomic<bool> running;
+};
+
+#endif // HEADLESSACQUISITION_H
@@ -0,0 +1,186 @@
+#include <QCoreApplication>
+#include <QFile>
+#include <QXmlStreamReader>
+#include <QStringList>
+#include <iostream>
+
+#include "headlessconfig.h"
+#include "spikeforwarder.h"
+
+// Headless acquisition daemon settings
+
+static const double SampleRates[] = { 20000.0, 25000.0, 30000.0 };
+static const double StimStepsNanoAmps[] = { 10.0, 20.0, 50.0, 100.0, 200.0, 500.0, 1000.0, 2000.0, 5000.0, 10000.0 };
+
+HeadlessConfig::HeadlessConfig()
+{
+    bitfileName = QCoreApplication::applicationDirPath() + "/main.bit";
+    sampleRateIndex = 2;
+    stimStepIndex = 5;
+
+    // Default amplifier bandwidth settings, as in MainWindow
+    dspEnabled = true;
+    desiredDspCutoffFreq = 1.0;
+    desiredLowerBandwidth = 1.0;
+    desiredLowerSettleBandwidth = 1000.0;
+    desiredUpperBandwidth = 7500.0;
+
+    newSaveFilePeriodMinutes = 1;
+    durationSeconds = 0.0;
+
+    // Default spike detector settings, as in SpikeDetectorDialog
+    spikeDetectorEnabled = true;
+    thresholdMult = 5.5;
+    blindWindowLength = 10;
+    deactiveChannels.fill(false, SPIKE_DETECTOR_NUM_CHANNELS);
+
+    hostDetectorEnabled = false;
+    hostDetectorThreads = 0;
+    shadowCompareEnabled = false;
+    shadowCompareTolerance = 2;
+
+    udpDestPort = 10000;
+}
+
+// Read settings from the XML file fileName.  Returns false (and prints why) on error.
+bool HeadlessConfig::load(const QString &fileName)
+{
+    QFile file(fileName);
+    if (!file.open(QIODevice::ReadOnly | QIODevice::Text)) {
+        cerr << "Error in HeadlessConfig::load: cannot open " << fileName.toStdString() << endl;
+        return false;
+    }
+
+    bool ok = true;
+    QXmlStreamReader xml(&file);
+    while (ok && xml.readNextStartElement()) {
+        if (xml.name() == "rhythmstim-headless") {
+            continue;   // descend into the root element
+        }
+        QXmlStreamAttributes attributes = xml.attributes();
+        if (xml.name() == "board") {
+            if (attributes.hasAttribute("bitfile")) {
+                bitfileName = attributes.value("bitfile").toString();
+            }
+            if (attributes.hasAttribute("sampleRate")) {
+                ok = setSampleRate(attributes.value("sampleRate").toDouble());
+            }
+            if (ok && attributes.hasAttribute("stimStep")) {
+                ok = setStimStep(attributes.value("stimStep").toDouble());
+            }
+        } else if (xml.name() == "bandwidth") {
+            if (attributes.hasAttribute("dspCutoff")) {
+                desiredDspCutoffFreq = attributes.value("dspCutoff").toDouble();
+                dspEnabled = (desiredDspCutoffFreq > 0.0);
+            }
+            if (attributes.hasAttribute("lower")) {
+                desiredLowerBandwidth = attributes.value("lower").toDouble();
+            }
+            if (attributes.hasAttribute("lowerSettle")) {
+                desiredLowerSettleBandwidth = attributes.value("lowerSettle").toDouble();
+            }
+            if (attributes.hasAttribute("upper")) {
+                desiredUpperBandwidth = attributes.value("upper").toDouble();
+            }
+        } else if (xml.name() == "recording") {
+            if (attributes.hasAttribute("baseName")) {
+                saveBaseFileName = attributes.value("baseName").toString();
+            }
+            if (attributes.hasAttribute("filePeriodMinutes")) {
+                newSaveFilePeriodMinutes = qMax(1, attributes.value("filePeriodMinutes").toInt());
+            }
+            if (attributes.hasAttribute("duration")) {
+                durationSeconds = attributes.value("duration").toDouble();
+            }
+        } else if (xml.name() == "spikeDetector") {
+            if (attributes.hasAttribute("enabled")) {
+                spikeDetectorEnabled = (attributes.value("enabled") == "true" || attributes.value("enabled") == "1");
+            }
+            if (attributes.hasAttribute("threshold")) {
+                thresholdMult = attributes.value("threshold").toDouble();
+            }
+            if (attributes.hasAttribute("blindWindow")) {
+                blindWindowLength = attributes.value("blindWindow").toInt();
+            }
+            if (attributes.hasAttribute("disabledChannels")) {
+                ok = setDisabledChannels(attributes.value("disabledChannels").toString());
+            }
+        } else if (xml.name() == "hostDetector") {
+            if (attributes.hasAttribute("enabled")) {
+                hostDetectorEnabled = (attributes.value("enabled") == "true" || attributes.value("enabled") == "1");
+            }
+            if (attributes.hasAttribute("threads")) {
+                hostDetectorThreads = qMax(0, attributes.value("threads").toInt());
+            }
+            if (attributes.hasAttribute("compare")) {
+                shadowCompareEnabled = (attributes.value("compare") == "true" || attributes.value("compare") == "1");
+            }
+            if (attributes.hasAttribute("tolerance")) {
+                shadowCompareTolerance = qMax(0, attributes.value("tolerance").toInt());
+            }
+        } else if (xml.name() == "udp") {
+            if (attributes.hasAttribute("host")) {
+                udpHostAddress = attributes.value("host").toString();
+            }
+            if (attributes.hasAttribute("destination")) {
+                udpDestAddress = attributes.value("destination").toString();
+            }
+            if (attributes.hasAttribute("port")) {
+                udpDestPort = attributes.value("port").toUShort();
+            }
+        } else {
+            cerr << "Warning in HeadlessConfig::load: ignoring element " << xml.name().toString().toStdString() << endl;
+        }
+        xml.skipCurrentElement();
+    }
+
+    if (xml.hasError()) {
+        cerr << "Error in HeadlessConfig::load: " << fileName.toStdString() << " line " << xml.lineNumber() <<
+                ": " << xml.errorString().toStdString() << endl;
+        return false;
+    }
+    return ok;
+}
+
+// Select one of the sample rates offered by StartUpDialog.
+bool HeadlessConfig::setSampleRate(double sampleRateHz)
+{
+    for (int i = 0; i < (int) (sizeof(SampleRates) / sizeof(SampleRates[0])); ++i) {
+        if (sampleRateHz == SampleRates[i]) {
+            sampleRateIndex = i;
+            return true;
+        }
+    }
+    cerr << "Error in HeadlessConfig::setSampleRate: unsupported sample rate " << sampleRateHz <<
+            " S/s (use 20000, 25000 or 30000)." << endl;
+    return false;
+}
+
+// Select one of the stimulation step sizes offered by StartUpDialog.
+bool HeadlessConfig::setStimStep(double stimStepNanoAmps)
+{
+    for (int i = 0; i < (int) (sizeof(StimStepsNanoAmps) / sizeof(StimStepsNanoAmps[0])); ++i) {
+        if (stimStepNanoAmps == StimStepsNanoAmps[i]) {
+            stimStepIndex = i;
+            return true;
+        }
+    }
+    cerr << "Error in HeadlessConfig::setStimStep: unsupported step size " << stimStepNanoAmps << " nA." << endl;
+    return false;
+}
+
+// Disable spike detection on a comma-separated list of probe channels (1-32).
+bool HeadlessConfig::setDisabledChannels(const QString &probeChannels)
+{
+    QVector<quint32> channelsOrdered = SpikeForwarder::probeChannelOrder();
+    deactiveChannels.fill(false, SPIKE_DETECTOR_NUM_CHANNELS);
+    for (const QString &item : probeChannels.split(',', QString::SkipEmptyParts)) {
+        int hwChannel = channelsOrdered.indexOf(item.trimmed().toUInt());
+        if (hwChannel < 0) {
+            cerr << "Error in HeadlessConfig::setDisabledChannels: no probe channel " << item.toStdString() << endl;
+            return false;
+        }
+        deactiveChannels[hwChannel] = true;
+    }
+    return true;
+}
@@ -0,0 +1,66 @@
+#ifndef HEADLESSCONFIG_H
+#define HEADLESSCONFIG_H
+
+#include <QString>
+#include <QVector>
+
+using namespace std;
+
+// Settings of the headless acquisition daemon, read from an XML file such as
+//
+//     <rhythmstim-headless>
+//         <board bitfile="/opt/intan/main.bit" sampleRate="30000" stimStep="500"/>
+//         <bandwidth dspCutoff="1.0" lower="1.0" lowerSettle="1000" upper="7500"/>
+//         <recording baseName="/data/rat12" filePeriodMinutes="1" duration="43200"/>
+//         <spikeDetector enabled="true" threshold="5.5" blindWindow="10" disabledChannels="3,17"/>
+//         <hostDetector enabled="true" threads="2" compare="true" tolerance="2"/>
+//         <udp host="10.0.0.2" destination="10.0.0.5" port="10000"/>
+//     </rhythmstim-headless>
+//
+// Every element and attribute is optional; missing ones keep the defaults of the GUI.  Sample
+// rate is in S/s, stimulation step size in nA, bandwidths in Hz, blind window in ms and
+// duration in seconds (0 runs until SIGINT/SIGTERM).  disabledChannels lists probe channels
+// (1-32).  The host detector runs the hardware detector's algorithm on every port, with its
+// threshold and blind window, in threads worker threads (0: one per port); with compare, its port
+// D events are matched against the hardware's within tolerance samples (DetectionComparator).
+// Without a recording baseName nothing is saved; without a UDP destination no spikes are
+// forwarded.
+
+struct HeadlessConfig
+{
+    HeadlessConfig();
+    bool load(const QString &fileName);
+    bool setSampleRate(double sampleRateHz);
+    bool setStimStep(double stimStepNanoAmps);
+    bool setDisabledChannels(const QString &probeChannels);
+
+    QString bitfileName;
+    int sampleRateIndex;                // as in StartUpDialog
+    int stimStepIndex;                  // as in StartUpDialog
+
+    bool dspEnabled;
+    double desiredDspCutoffFreq;
+    double desiredLowerBandwidth;
+    double desiredLowerSettleBandwidth;
+    double desiredUpperBandwidth;
+
+    QString saveBaseFileName;
+    int newSaveFilePeriodMinutes;
+    double durationSeconds;
+
+    bool spikeDetectorEnabled;
+    double thresholdMult;
+    int blindWindowLength;
+    QVector<bool> deactiveChannels;     // by hardware detector channel
+
+    bool hostDetectorEnabled;
+    int hostDetectorThreads;
+    bool shadowCompareEnabled;
+    int shadowCompareTolerance;         // samples
+
+    QString udpHostAddress;
+    QString udpDestAddress;
+    quint16 udpDestPort;
+};
+
+#endif // HEADLESSCONFIG_H
@@ -0,0 +1,185 @@
+#include <QCoreApplication>
+#include <QCommandLineParser>
+#include <QTimer>
+#include <csignal>
+#include <iostream>
+
+#include "headlessconfig.h"
+#include "headlessacquisition.h"
+#include "metricsexporter.h"
+#ifdef RHYTHM_EMULATOR
+#include "emulatedfrontpanel.h"
+#include "replaysource.h"
+#endif
+
+// Headless acquisition daemon.  Built from the same sources as the GUI, with headlessmain.cpp
+// in place of main.cpp (QT += core network; no widget is ever created), e.g.
+//     rhythmstim-headless --config rig2.xml --record /data/rat12 --duration 43200
+// Command line options override the configuration file.  The RHYTHM_EMULATOR build can also
+// replay a recording through the emulated board (--replay), stopping when it has been played.
+
+static volatile sig_atomic_t stopRequested = 0;
+
+static void requestStop(int)
+{
+    stopRequested = 1;
+}
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Intan Stimulation / Recording Controller acquisition without a GUI.");
+    parser.addHelpOption();
+    QCommandLineOption configOption("config", "Read settings from XML file <file>.", "file");
+    QCommandLineOption bitfileOption("bitfile", "Upload FPGA bitfile <file>.", "file");
+    QCommandLineOption sampleRateOption("sample-rate", "Amplifier sample rate (20000, 25000 or 30000 S/s).", "rate");
+    QCommandLineOption stimStepOption("stim-step", "Stimulation current step size in nA.", "nA");
+    QCommandLineOption recordOption("record", "Record to <base>_yyMMdd_HHmmss.rhs files.", "base");
+    QCommandLineOption durationOption("duration", "Stop after <seconds> seconds (0: until SIGINT/SIGTERM).", "seconds");
+    QCommandLineOption thresholdOption("threshold", "Hardware spike detector threshold multiplier.", "mult");
+    QCommandLineOption blindWindowOption("blind-window", "Hardware spike detector blind window length.", "ms");
+    QCommandLineOption disableChannelsOption("disable-channels",
+            "Comma-separated probe channels (1-32) to exclude from spike detection.", "channels");
+    QCommandLineOption noSpikeDetectorOption("no-spike-detector", "Do not run the hardware spike detector.");
+    QCommandLineOption hostDetectorOption("host-detector",
+            "Also detect spikes on the host, on every port, in <threads> threads (0: one per port).", "threads", "0");
+    QCommandLineOption shadowCompareOption("shadow-compare",
+            "Run the host detector and match its port D spikes against the hardware's within <samples>.", "samples");
+    QCommandLineOption udpHostOption("udp-host", "Send spike events from local address <address>.", "address");
+    QCommandLineOption udpDestOption("udp-dest", "Send spike events to <address>.", "address");
+    QCommandLineOption udpPortOption("udp-port", "Send spike events to UDP port <port>.", "port");
+    QCommandLineOption metricsFileOption("metrics-file",
+            "Append performance metrics to <file> (CSV if it ends in .csv, JSON lines otherwise).", "file");
+    QCommandLineOption metricsSocketOption("metrics-socket",
+            "Serve the latest performance metrics as JSON on local socket <name>.", "name");
+    QCommandLineOption metricsIntervalOption("metrics-interval",
+            "Export performance metrics every <seconds> seconds.", "seconds",
+            QString::number(METRICS_DEFAULT_INTERVAL_SECONDS));
+    parser.addOptions({configOption, bitfileOption, sampleRateOption, stimStepOption, recordOption,
+                       durationOption, thresholdOption, blindWindowOption, disableChannelsOption,
+                       noSpikeDetectorOption, hostDetectorOption, shadowCompareOption, udpHostOption,
+                       udpDestOption, udpPortOption, metricsFileOption, metricsSocketOption, metricsIntervalOption});
+#ifdef RHYTHM_EMULATOR
+    QCommandLineOption replayOption("replay", "Play back recording <file.rhs> through the emulated board.", "file");
+    QCommandLineOption replaySpeedOption("replay-speed",
+            "Replay at <x> times real time (0: as fast as possible, without dropping data).", "x", "1");
+    parser.addOptions({replayOption, replaySpeedOption});
+#endif
+    parser.process(app);
+
+    HeadlessConfig config;
+    if (parser.isSet(configOption) && !config.load(parser.value(configOption))) {
+        return 1;
+    }
+    if (parser.isSet(bitfileOption)) {
+        config.bitfileName = parser.value(bitfileOption);
+    }
+    if (parser.isSet(sampleRateOption) && !config.setSampleRate(parser.value(sampleRateOption).toDouble())) {
+        return 1;
+    }
+    if (parser.isSet(stimStepOption) && !config.setStimStep(parser.value(stimStepOption).toDouble())) {
+        return 1;
+    }
+    if (parser.isSet(recordOption)) {
+        config.saveBaseFileName = parser.value(recordOption);
+    }
+    if (parser.isSet(durationOption)) {
+        config.durationSeconds = parser.value(durationOption).toDouble();
+    }
+    if (parser.isSet(thresholdOption)) {
+        config.thresholdMult = parser.value(thresholdOption).toDouble();
+    }
+    if (parser.isSet(blindWindowOption)) {
+        config.blindWindowLength = parser.value(blindWindowOption).toInt();
+    }
+    if (parser.isSet(disableChannelsOption) && !config.setDisabledChannels(parser.value(disableChannelsOption))) {
+        return 1;
+    }
+    if (parser.isSet(noSpikeDetectorOption)) {
+        config.spikeDetectorEnabled = false;
+    }
+    if (parser.isSet(hostDetectorOption)) {
+        config.hostDetectorEnabled = true;
+        config.hostDetectorThreads = qMax(0, parser.value(hostDetectorOption).toInt());
+    }
+    if (parser.isSet(shadowCompareOption)) {
+        config.hostDetectorEnabled = true;
+        config.shadowCompareEnabled = true;
+        config.shadowCompareTolerance = qMax(0, parser.value(shadowCompareOption).toInt());
+    }
+    if (parser.isSet(udpHostOption)) {
+        config.udpHostAddress = parser.value(udpHostOption);
+    }
+    if (parser.isSet(udpDestOption)) {
+        config.udpDestAddress = parser.value(udpDestOption);
+    }
+    if (parser.isSet(udpPortOption)) {
+        config.udpDestPort = (quint16) parser.value(udpPortOption).toUInt();
+    }
+
+#ifdef RHYTHM_EMULATOR
+    // Unless told otherwise, replay at the rate the recording was made at.
+    ReplaySource replaySource;
+    if (parser.isSet(replayOption)) {
+        if (!replaySource.open(parser.value(replayOption))) {
+            return 1;
+        }
+        if (!parser.isSet(sampleRateOption) && !config.setSampleRate(replaySource.getSampleRate())) {
+            return 1;
+        }
+        okCFrontPanel::setReplaySource(&replaySource, parser.value(replaySpeedOption).toDouble());
+    }
+#endif
+
+    MetricsExporter metricsExporter(MetricsRegistry::global());
+    metricsExporter.setOutputFile(parser.value(metricsFileOption));
+    metricsExporter.setSocketName(parser.value(metricsSocketOption));
+    metricsExporter.setInterval(parser.value(metricsIntervalOption).toDouble());
+    if (metricsExporter.isConfigured()) {
+        metricsExporter.start();
+    }
+
+    HeadlessAcquisition acquisition(config);
+    if (!acquisition.openBoard()) {
+        metricsExporter.stop();
+        return 1;
+    }
+
+    // Stop cleanly (closing the save file) on SIGINT/SIGTERM or when the duration is up.  The
+    // handler only sets a flag; the event loop polls it.
+    signal(SIGINT, requestStop);
+    signal(SIGTERM, requestStop);
+    QTimer signalTimer;
+    QObject::connect(&signalTimer, &QTimer::timeout, [&acquisition] {
+        if (stopRequested) {
+            acquisition.stop();
+        }
+    });
+    signalTimer.start(100);
+    if (config.durationSeconds > 0.0) {
+        QTimer::singleShot((int) (1000.0 * config.durationSeconds), [&acquisition] { acquisition.stop(); });
+    }
+#ifdef RHYTHM_EMULATOR
+    // Give the last replayed samples a second to get through the pipeline before stopping.
+    QTimer replayEndTimer;
+    if (replaySource.isOpen()) {
+        QObject::connect(&replayEndTimer, &QTimer::timeout, [&acquisition, &replaySource, &replayEndTimer] {
+            if (replaySource.atEnd()) {
+                replayEndTimer.stop();
+                QTimer::singleShot(1000, [&acquisition] { acquisition.stop(); });
+            }
+        });
+        replayEndTimer.start(100);
+    }
+#endif
+
+    bool ok = acquisition.run();
+    signalTimer.stop();
+#ifdef RHYTHM_EMULATOR
+    okCFrontPanel::setReplaySource(nullptr, 1.0);
+#endif
+    metricsExporter.stop();
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,342 @@
+#include <iostream>
+#include <iomanip>
+#include <algorithm>
+
+#include "hostspikedetector.h"
+#include "metricsregistry.h"
+
+// Host-side spike detection on all data streams
+
+HostSpikeDetector::Shard::Shard() :
+    port(0),
+    firstStream(0),
+    firstStreamOfPort(0),
+    numStreams(0),
+    worker(0),
+    stage(nullptr),
+    latencyHistogram(nullptr),
+    totalLatencyNs(0),
+    maxLatencyNs(0),
+    numEvents(0)
+{
+}
+
+// Settings start as the board's wire-ins do (zero, so the detectors keep their power-up values)
+// until the set methods are called.
+HostSpikeDetector::HostSpikeDetector() :
+    numShards(0),
+    numDataStreams(0),
+    samplesPerRead(0),
+    running(false),
+    thresholdMult(0),
+    blindWindow(0)
+{
+    for (int port = 0; port < HOST_DETECTOR_MAX_SHARDS; ++port) {
+        disabledChannels[port] = 0;
+    }
+    eventMetric = MetricsRegistry::global()->counter("host_detector.events");
+}
+
+HostSpikeDetector::~HostSpikeDetector()
+{
+    stop();
+    for (int i = 0; i < HOST_DETECTOR_MAX_SHARDS; ++i) {
+        delete shards[i].stage;
+    }
+}
+
+// Start detecting on data streams whose hardware data streams (0-7; port * 2 + stream of the port,
+// in USB order) are given by hardwareStreams, in reads of samplesPerRead samples.  Uses numThreads
+// worker threads, or one per shard if numThreads is not positive.  Detector state starts from
+// reset, as when the FPGA detector is enabled.  Returns false if the streams do not fit.
+bool HostSpikeDetector::start(const vector<int> &hardwareStreams, int samplesPerRead_, int numThreads)
+{
+    stop();
+
+    numDataStreams = (int) hardwareStreams.size();
+    samplesPerRead = samplesPerRead_;
+    numShards = 0;
+    for (int stream = 0; stream < numDataStreams; ++stream) {
+        int port = hardwareStreams[stream] / SPIKE_MODEL_PORTS;
+        if (hardwareStreams[stream] < 0 || port >= HOST_DETECTOR_MAX_SHARDS) {
+            cerr << "Error in HostSpikeDetector::start: data stream " << stream << " is unknown hardware stream " <<
+                    hardwareStreams[stream] << endl;
+            return false;
+        }
+        if (numShards > 0 && shards[numShards - 1].port == port) {
+            if (++shards[numShards - 1].numStreams > SPIKE_MODEL_PORTS) {
+                cerr << "Error in HostSpikeDetector::start: more than " << SPIKE_MODEL_PORTS <<
+                        " data streams on port " << (char) ('A' + port) << endl;
+                return false;
+            }
+        } else {
+            if (numShards == HOST_DETECTOR_MAX_SHARDS) {
+                cerr << "Error in HostSpikeDetector::start: data streams of a port are not consecutive." << endl;
+                return false;
+            }
+            shards[numShards].port = port;
+            shards[numShards].firstStream = stream;
+            shards[numShards].firstStreamOfPort = hardwareStreams[stream] % SPIKE_MODEL_PORTS;
+            shards[numShards].numStreams = 1;
+            numShards++;
+        }
+    }
+    if (numShards == 0) {
+        return false;
+    }
+
+    int numWorkers = (numThreads > 0) ? min(numThreads, numShards) : numShards;
+    MetricsRegistry* metrics = MetricsRegistry::global();
+
+    for (int i = 0; i < numShards; ++i) {
+        Shard &shard = shards[i];
+        shard.worker = i % numWorkers;
+        // A port's only stream is the FPGA detector's port 0 or 1, as it is the port's first or second.
+        shard.model.setPortEnabled(0, shard.firstStreamOfPort == 0);
+        shard.model.setPortEnabled(1, shard.numStreams > 1 || shard.firstStreamOfPort == 1);
+        shard.model.reset();
+        shard.detector.reset();
+        shard.records.clear();
+        shard.records.reserve(SPIKE_FIFO_DEPTH_WORDS);
+        shard.stimTriggers.assign(samplesPerRead, 0);
+
+        string portName(1, (char) ('a' + shard.port));
+        if (!shard.stage) {
+            shard.stageName = "host detector port " + string(1, (char) ('A' + shard.port));
+            shard.stage = new PipelineStage(shard.stageName.c_str(), &workQueues[shard.worker]);
+        }
+        shard.stage->reset();
+        shard.stage->setServiceTimeHistogram(metrics->histogram("host_detector.port_" + portName + ".service_time", "us"));
+        shard.latencyHistogram = metrics->histogram("host_detector.port_" + portName + ".latency", "us");
+        shard.totalLatencyNs = 0;
+        shard.maxLatencyNs = 0;
+        shard.numEvents = 0;
+    }
+
+    spikeEvents.reset();
+    freeReadBuffers.setCapacity(PIPELINE_DEPTH_IN_READS);
+    for (int i = 0; i < PIPELINE_DEPTH_IN_READS; ++i) {
+        readBuffers[i].planes.allocate(numDataStreams, samplesPerRead);
+        freeReadBuffers.push(i);
+    }
+    for (int worker = 0; worker < numWorkers; ++worker) {
+        workQueues[worker].setCapacity(PIPELINE_DEPTH_IN_READS);
+    }
+
+    running = true;
+    for (int worker = 0; worker < numWorkers; ++worker) {
+        workers.push_back(thread(&HostSpikeDetector::runWorker, this, worker));
+    }
+    return true;
+}
+
+// Let the workers finish the reads already submitted, then stop them.
+void HostSpikeDetector::stop()
+{
+    if (!running) {
+        return;
+    }
+    freeReadBuffers.close();
+    for (unsigned int worker = 0; worker < workers.size(); ++worker) {
+        workQueues[worker].close();
+    }
+    for (unsigned int worker = 0; worker < workers.size(); ++worker) {
+        workers[worker].join();
+    }
+    workers.clear();
+    running = false;
+}
+
+bool HostSpikeDetector::isRunning() const
+{
+    return running;
+}
+
+// Threshold multiplier times two, as Rhs2000EvalBoard::setThresholdMult() writes it.  Zero is
+// ignored, as by the board.
+void HostSpikeDetector::setThresholdMult(int thresholdMult_)
+{
+    thresholdMult = thresholdMult_;
+}
+
+// Blind window after stimulation, in milliseconds.  Zero is ignored, as by the board.
+void HostSpikeDetector::setBlindWindow(int blindWindow_)
+{
+    blindWindow = blindWindow_;
+}
+
+// Channels of port that never report, one bit per channel (bit stream of the port * 16 + channel),
+// as SpikeDetectorModel::setDisabledChannels() takes them.
+void HostSpikeDetector::setDisabledChannels(int port, unsigned int channels)
+{
+    if (port < 0 || port >= HOST_DETECTOR_MAX_SHARDS) {
+        cerr << "Error in HostSpikeDetector::setDisabledChannels: port out of range." << endl;
+        return;
+    }
+    disabledChannels[port] = channels;
+}
+
+// Queue one USB read of numSamples sample frames for all shards.  Called by the parse stage,
+// after UsbHeaderScanner has checked the headers.  Waits while all read buffers are in use;
+// returns false if the detector was stopped.
+bool HostSpikeDetector::submit(const unsigned char* usbBuffer, int numSamples)
+{
+    if (!running) {
+        return false;
+    }
+    if (numSamples != samplesPerRead) {
+        cerr << "Error in HostSpikeDetector::submit: read of " << numSamples << " samples, expected " <<
+                samplesPerRead << endl;
+        return false;
+    }
+
+    int index;
+    if (!freeReadBuffers.pop(index)) {
+        return false;
+    }
+    ReadBuffer &readBuffer = readBuffers[index];
+    readBuffer.submitTime = chrono::steady_clock::now();
+    UsbDeinterleaver::deinterleave(usbBuffer, numSamples, readBuffer.planes);
+    readBuffer.pendingShards = numShards;
+
+    for (unsigned int worker = 0; worker < workers.size(); ++worker) {
+        if (!workQueues[worker].push(index)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Events of all shards, for SpikeForwarder.
+SpikeEventBuffer* HostSpikeDetector::getSpikeEventBuffer()
+{
+    return &spikeEvents;
+}
+
+int HostSpikeDetector::getNumShards() const
+{
+    return numShards;
+}
+
+int HostSpikeDetector::getNumThreads() const
+{
+    return (int) workers.size();
+}
+
+void HostSpikeDetector::printStatistics() const
+{
+    for (int i = 0; i < numShards; ++i) {
+        const Shard &shard = shards[i];
+        unsigned long long numReads = shard.stage->getStatistics().numItems;
+        shard.stage->printStatistics();
+        cout << "Host detector port " << (char) ('A' + shard.port) << ": " << shard.numStreams << " data streams, " <<
+                shard.numEvents << " detections, latency " << fixed << setprecision(2) <<
+                ((numReads > 0) ? 1.0e-6 * shard.totalLatencyNs / numReads : 0.0) << " ms mean, " <<
+                1.0e-6 * shard.maxLatencyNs << " ms max" << endl;
+        cout.unsetf(ios::fixed);
+    }
+    cout << "Host detector: " << freeReadBuffers.numBlockedPops() << " reads waited for a free buffer, " <<
+            spikeEvents.getNumLostEvents() << " events lost" << endl;
+}
+
+// Worker thread: run each submitted read through the worker's shards, in order, and hand the
+// read buffer back after the last shard of all workers is done with it.  (Private method.)
+void HostSpikeDetector::runWorker(int worker)
+{
+    int index;
+    while (workQueues[worker].pop(index)) {
+        ReadBuffer &readBuffer = readBuffers[index];
+        for (int i = 0; i < numShards; ++i) {
+            if (shards[i].worker == worker) {
+                detect(shards[i], readBuffer);
+                if (readBuffer.pendingShards.fetch_sub(1) == 1) {
+                    freeReadBuffers.push(index);
+                }
+            }
+        }
+    }
+}
+
+// Run one read through a shard and publish its detections.  (Private method.)
+void HostSpikeDetector::detect(Shard &shard, const ReadBuffer &readBuffer)
+{
+    const SamplePlanes &planes = readBuffer.planes;
+
+    shard.stage->startService();
+
+    shard.records.clear();
+    int numRecords;
+    if (shard.numStreams == SPIKE_MODEL_PORTS) {
+        shard.detector.setThresholdMult(thresholdMult);
+        shard.detector.setBlindWindow(blindWindow);
+        shard.detector.setDisabledChannels(disabledChannels[shard.port]);
+        numRecords = shard.detector.process(planes, shard.firstStream, shard.records);
+    } else {
+        numRecords = detectOneStream(shard, planes);
+    }
+
+    // Shard channel IDs to host channel IDs.
+    unsigned short idOffset = (unsigned short) ((shard.port * SPIKE_MODEL_CHANNELS) << 8);
+    for (int i = 0; i < numRecords; ++i) {
+        shard.records[i * SPIKE_MODEL_RECORD_WORDS + 1] += idOffset;
+    }
+    if (numRecords > 0) {
+        publish(shard.records);
+        shard.numEvents += numRecords;
+        eventMetric->add(numRecords);
+    }
+
+    shard.stage->finishService();
+
+    long long latencyNs = chrono::duration_cast<chrono::nanoseconds>(
+                chrono::steady_clock::now() - readBuffer.submitTime).count();
+    shard.totalLatencyNs += latencyNs;
+    if (latencyNs > shard.maxLatencyNs) {
+        shard.maxLatencyNs = latencyNs;     // only the shard's worker writes it
+    }
+    shard.latencyHistogram->record(latencyNs / 1000);
+}
+
+// Append detection records to the event buffer as pipe 0xa1 bytes (little-endian words), at most
+// one FIFO's worth at a time.  (Private method.)
+void HostSpikeDetector::publish(const vector<unsigned short> &records)
+{
+    lock_guard<mutex> lock(publishMutex);
+    int maxWords = spikeEvents.pipeBufferSize() / 2;
+    maxWords -= maxWords % SPIKE_MODEL_RECORD_WORDS;
+
+    for (size_t first = 0; first < records.size(); first += maxWords) {
+        int numWords = (int) min(records.size() - first, (size_t) maxWords);
+        unsigned char* pipeData = spikeEvents.pipeBuffer();
+        for (int i = 0; i < numWords; ++i) {
+            pipeData[2 * i] = (unsigned char) (records[first + i] & 0xff);
+            pipeData[2 * i + 1] = (unsigned char) (records[first + i] >> 8);
+        }
+        spikeEvents.commitPipeRead(2 * numWords);
+    }
+}
+
+// Run one read through the model of a shard with a single data stream, fed to the model port of
+// the stream's place on its SPI port; the other model port is disabled.  (Private method.)
+int HostSpikeDetector::detectOneStream(Shard &shard, const SamplePlanes &planes)
+{
+    const short* samples[SPIKE_MODEL_CHANNELS];
+
+    shard.model.setThresholdMult(thresholdMult);
+    shard.model.setBlindWindow(blindWindow);
+    shard.model.setDisabledChannels(disabledChannels[shard.port]);
+
+    int firstChannel = shard.firstStreamOfPort * SPIKE_MODEL_CHANNELS_PER_PORT;
+    for (int channel = 0; channel < SPIKE_MODEL_CHANNELS; ++channel) {
+        int chipChannel = channel - firstChannel;
+        samples[channel] = (chipChannel >= 0 && chipChannel < SPIKE_MODEL_CHANNELS_PER_PORT) ?
+                    planes.amplifierPlane(shard.firstStream, chipChannel) : nullptr;
+    }
+    const unsigned short* stimOn = planes.stimFlagPlane(shard.firstStream, StimFlagOn);
+    for (int t = 0; t < planes.numSamples; ++t) {
+        shard.stimTriggers[t] = stimOn[t] != 0;
+    }
+
+    return shard.model.process(samples, planes.timeStamp.data(), shard.stimTriggers.data(), planes.numSamples,
+                               shard.records);
+}
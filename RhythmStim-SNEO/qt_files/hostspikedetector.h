@@ -0,0 +1,119 @@
+#ifndef HOSTSPIKEDETECTOR_H
+#define HOSTSPIKEDETECTOR_H
+
+#include <vector>
+#include <string>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include "pipeline.h"
+#include "spikeeventbuffer.h"
+#include "spikedetectormodel.h"
+#include "sneodetector.h"
+#include "usbdeinterleaver.h"
+
+using namespace std;
+
+class MetricCounter;
+class LatencyHistogram;
+
+// One detector shard per SPI port, each with the port's (up to) two data streams.
+#define HOST_DETECTOR_MAX_SHARDS 4
+
+// Spike detection on the host for every SPI port, with the algorithm of the FPGA detector, which
+// only sees the two data streams of port D.  Each port with amplifiers is one shard: a
+// SpikeDetectorModel with the port's data streams as its two ports, so that the shard of port D
+// reports exactly what pipe 0xa1 does; shards with both streams run the channel-parallel
+// SneoDetector, which gives the same records faster.  Shards are spread over a small pool of
+// worker threads, each shard always on the same thread, so that its samples stay in order.
+//
+// The parse stage hands every USB read to submit(), which deinterleaves it once into one of
+// PIPELINE_DEPTH_IN_READS preallocated sample buffers and queues it for all workers; the buffer is
+// reused when the last shard is done with it.  If all buffers are still in use, submit() waits,
+// holding back the parse stage like any other slow pipeline stage.
+//
+// Detections are published to a SpikeEventBuffer as pipe 0xa1 records, with channel IDs
+// port * 32 + stream of the port * 16 + channel (0-127; port D's are the hardware IDs plus 96),
+// so SpikeForwarder can forward and save them as it does the hardware's.  The latency from
+// submit() to the end of each shard's detection is kept per shard.
+
+class HostSpikeDetector
+{
+
+public:
+    HostSpikeDetector();
+    ~HostSpikeDetector();
+
+    bool start(const vector<int> &hardwareStreams, int samplesPerRead, int numThreads = 0);
+    void stop();
+    bool isRunning() const;
+
+    void setThresholdMult(int thresholdMult_);
+    void setBlindWindow(int blindWindow_);
+    void setDisabledChannels(int port, unsigned int channels);
+
+    bool submit(const unsigned char* usbBuffer, int numSamples);
+
+    SpikeEventBuffer* getSpikeEventBuffer();
+    int getNumShards() const;
+    int getNumThreads() const;
+    void printStatistics() const;
+
+private:
+    struct Shard
+    {
+        Shard();
+
+        int port;
+        int firstStream;                    // in the USB data
+        int firstStreamOfPort;              // 0 or 1, its hardware stream's place on the SPI port
+        int numStreams;
+        int worker;                         // index of the thread that runs the shard
+        SpikeDetectorModel model;           // ports with one data stream
+        SneoDetector detector;              // ports with two, channel-parallel
+        vector<unsigned short> records;     // reused from read to read
+        vector<unsigned char> stimTriggers;
+
+        string stageName;
+        PipelineStage *stage;
+        LatencyHistogram *latencyHistogram;
+        atomic<long long> totalLatencyNs;
+        atomic<long long> maxLatencyNs;
+        atomic<unsigned long long> numEvents;
+    };
+
+    struct ReadBuffer
+    {
+        SamplePlanes planes;
+        chrono::steady_clock::time_point submitTime;
+        atomic<int> pendingShards;
+    };
+
+    void runWorker(int worker);
+    void detect(Shard &shard, const ReadBuffer &readBuffer);
+    int detectOneStream(Shard &shard, const SamplePlanes &planes);
+    void publish(const vector<unsigned short> &records);
+
+    Shard shards[HOST_DETECTOR_MAX_SHARDS];
+    int numShards;
+    int numDataStreams;
+    int samplesPerRead;
+
+    ReadBuffer readBuffers[PIPELINE_DEPTH_IN_READS];
+    PipelineQueue<int> freeReadBuffers;
+    PipelineQueue<int> workQueues[HOST_DETECTOR_MAX_SHARDS];   // read buffers, one queue per worker
+    vector<thread> workers;
+    atomic<bool> running;
+
+    // Settings as written to the board's wire-ins; the shards pick them up before each read.
+    atomic<int> thresholdMult;
+    atomic<int> blindWindow;
+    atomic<unsigned int> disabledChannels[HOST_DETECTOR_MAX_SHARDS];
+
+    mutex publishMutex;                     // SpikeEventBuffer takes one producer at a time
+    SpikeEventBuffer spikeEvents;
+    MetricCounter *eventMetric;
+};
+
+#endif // HOSTSPIKEDETECTOR_H
@@ -22,15 +22,63 @@
 #include <QSplashScreen>
 #include <QStyleFactory>
 #include <QDesktopWidget>
+#include <QCommandLineParser>
 
 #include "startupdialog.h"
 #include "mainwindow.h"
+#include "metricsexporter.h"
+#ifdef RHYTHM_EMULATOR
+#include "emulatedfrontpanel.h"
+#include "replaysource.h"
+#endif
 
 
 int main(int argc, char *argv[])
 {
     QApplication app(argc, argv);
 
+    // Optional export of performance metrics, for monitoring long sessions
+    QCommandLineParser parser;
+    parser.addHelpOption();
+    QCommandLineOption metricsFileOption("metrics-file",
+            QObject::tr("Append performance metrics to <file> (CSV if it ends in .csv, JSON lines otherwise)."), "file");
+    QCommandLineOption metricsSocketOption("metrics-socket",
+            QObject::tr("Serve the latest performance metrics as JSON on local socket <name>."), "name");
+    QCommandLineOption metricsIntervalOption("metrics-interval",
+            QObject::tr("Export performance metrics every <seconds> seconds."), "seconds",
+            QString::number(METRICS_DEFAULT_INTERVAL_SECONDS));
+    parser.addOption(metricsFileOption);
+    parser.addOption(metricsSocketOption);
+    parser.addOption(metricsIntervalOption);
+#ifdef RHYTHM_EMULATOR
+    // Optional playback of a recording through the emulated interface board
+    QCommandLineOption replayOption("replay",
+            QObject::tr("Play back recording <file.rhs> through the emulated board."), "file");
+    QCommandLineOption replaySpeedOption("replay-speed",
+            QObject::tr("Replay at <x> times real time (0: as fast as possible, without dropping data)."), "x", "1");
+    parser.addOption(replayOption);
+    parser.addOption(replaySpeedOption);
+#endif
+    parser.process(app);
+
+#ifdef RHYTHM_EMULATOR
+    ReplaySource replaySource;
+    if (parser.isSet(replayOption)) {
+        if (!replaySource.open(parser.value(replayOption))) {
+            return 1;
+        }
+        okCFrontPanel::setReplaySource(&replaySource, parser.value(replaySpeedOption).toDouble());
+    }
+#endif
+
+    MetricsExporter metricsExporter(MetricsRegistry::global());
+    metricsExporter.setOutputFile(parser.value(metricsFileOption));
+    metricsExporter.setSocketName(parser.value(metricsSocketOption));
+    metricsExporter.setInterval(parser.value(metricsIntervalOption).toDouble());
+    if (metricsExporter.isConfigured()) {
+        metricsExporter.start();
+    }
+
     QSplashScreen *splash = new QSplashScreen();
     splash->setPixmap(QPixmap(":/images/splash.png"));
 
@@ -61,6 +109,11 @@ int main(int argc, char *argv[])
     splash->finish(&mainWin);
     delete splash;
     delete startUpDialog;
-    return app.exec();
+    int result = app.exec();
+    metricsExporter.stop();
+#ifdef RHYTHM_EMULATOR
+    okCFrontPanel::setReplaySource(nullptr, 1.0);
+#endif
+    return result;
 }
 
@@ -32,6 +32,7 @@
 #include <QSound>
 #include <iostream>
 #include <fstream>
+#include <cstring>
 #include <vector>
 #include <queue>
 
@@ -62,9 +63,20 @@
 #include "setsaveformatdialog.h"
 #include "cabledelaydialog.h"
 #include "rhs2000evalboard.h"
+#include "boardconfigtransaction.h"
+#include "allocationcounter.h"
+#include "displayframebuffer.h"
+#include "usbheaderscanner.h"
+#include "boardsetup.h"
+#include "savefilewriter.h"
+#include "metricsregistry.h"
 #include "rhs2000registers.h"
 #include "rhs2000datablock.h"
+#ifdef RHYTHM_EMULATOR
+#include "emulatedfrontpanel.h"
+#else
 #include "okFrontPanelDLL.h"
+#endif
 #include "stimparamdialog.h"
 #include "stimparameters.h"
 #include "digoutdialog.h"
@@ -72,6 +84,11 @@
 #include "ampsettledialog.h"
 #include "chargerecoverydialog.h"
 
+// Sampled gauges; they read this window's members, so each is removed again in the destructor.
+static const char* const ParseQueueDepthGauge = "pipeline.parse.queue_depth";
+static const char* const DisplayBlocksDroppedGauge = "display.blocks_dropped";
+static const char* const HostFifoPercentFullGauge = "host_fifo.percent_full";
+
 // Main Window of RHS2000 USB interface application.
 
 // Constructor.
@@ -131,13 +148,15 @@ MainWindow::MainWindow(int sampleRateIndex_, int stimStepIndex)
 
     int maxPossibleDataStreams = 2 * numSpiPorts;
     int usbBufferSize = MAX_NUM_BLOCKS_TO_READ * 2 * Rhs2000DataBlock::calculateDataBlockSizeInWords(maxPossibleDataStreams);
-    cout << "MainWindow: Allocating " << usbBufferSize / 1.0e6 << " MBytes for USB read buffer." << endl;
-    usbReadBuffer = new unsigned char [usbBufferSize];
+    // USB data is parsed in place in the FIFO, so its spans must hold a full read plus the words
+    // pulled in to realign after USB glitches, and the largest transfer of the USB data thread.
+    unsigned int maxSpanBytes = qMax((unsigned int) (2 * usbBufferSize),
+            (unsigned int) (BUFFER_SIZE_IN_BLOCKS * 2 * Rhs2000DataBlock::calculateDataBlockSizeInWords(MAX_NUM_DATA_STREAMS)));
     const unsigned int numSeconds = 10;  // size of RAM buffer, in seconds, assuming maximum sampling rate of...
     const unsigned int maxSamplingRate = 40000; // in Samples/s
     unsigned int fifoBufferSize =
             numSeconds * maxSamplingRate * 2 * (Rhs2000DataBlock::calculateDataBlockSizeInWords(maxPossibleDataStreams) / SAMPLES_PER_DATA_BLOCK);
-    usbStreamFifo = new DataStreamFifo(fifoBufferSize);
+    usbStreamFifo = new DataStreamFifo(fifoBufferSize, maxSpanBytes);
     if (!synthMode) {
         usbDataThread = new UsbDataThread(evalBoard, usbStreamFifo, this);
         connect(usbDataThread, SIGNAL(finished()), usbDataThread, SLOT(deleteLater()));
@@ -176,6 +195,25 @@ MainWindow::MainWindow(int sampleRateIndex_, int stimStepIndex)
     }
 
     signalProcessor = new SignalProcessor();
+    displayProcessor = new SignalProcessor();
+    displayFrames = new DisplayFrameBuffer();
+    parseStage = new PipelineStage("parse");
+    processStage = new PipelineStage("process", &parsedBatches);
+    displayStage = new PipelineStage("display");
+    saveFileWriter = new SaveFileWriter();
+
+    MetricsRegistry* metrics = MetricsRegistry::global();
+    parseStage->setServiceTimeHistogram(metrics->histogram("pipeline.parse.service_time", "us"));
+    processStage->setServiceTimeHistogram(metrics->histogram("pipeline.process.service_time", "us"));
+    displayStage->setServiceTimeHistogram(metrics->histogram("pipeline.display.service_time", "us"));
+    metrics->setSampledGauge(ParseQueueDepthGauge, [this] { return (double) parsedBatches.depth(); });
+    metrics->setSampledGauge(DisplayBlocksDroppedGauge, [this] { return (double) displayFrames->getNumBlocksDropped(); });
+    displayFramesSkippedMetric = metrics->counter("display.frames_skipped");
+    displayTimer = new QTimer(this);
+    displayTimer->setTimerType(Qt::PreciseTimer);
+    displayTimer->setInterval(1000 / DISPLAY_REFRESH_RATE);
+    connect(displayTimer, SIGNAL(timeout()), this, SLOT(updateDisplay()));
+    metrics->setSampledGauge(HostFifoPercentFullGauge, [this] { return usbStreamFifo->percentFull(); });
     notchFilterFrequency = 60.0;
     notchFilterBandwidth = 10.0;
     notchFilterEnabled = false;
@@ -194,7 +232,7 @@ MainWindow::MainWindow(int sampleRateIndex_, int stimStepIndex)
     validFilename = false;
 
 
-    wavePlot = new WavePlot(signalProcessor, signalSources, this, this);
+    wavePlot = new WavePlot(displayProcessor, signalSources, this, this);
 
     connect(wavePlot, SIGNAL(selectedChannelChanged(SignalChannel*)),
             this, SLOT(newSelectedChannel(SignalChannel*)));
@@ -283,7 +321,10 @@ MainWindow::MainWindow(int sampleRateIndex_, int stimStepIndex)
 
 MainWindow::~MainWindow()
 {
-    delete [] usbReadBuffer;
+    MetricsRegistry* metrics = MetricsRegistry::global();
+    metrics->removeSampledGauge(ParseQueueDepthGauge);
+    metrics->removeSampledGauge(DisplayBlocksDroppedGauge);
+    metrics->removeSampledGauge(HostFifoPercentFullGauge);
 }
 
 // Scan SPI Ports to identify all connected RHS2000 amplifier chips.
@@ -301,9 +342,11 @@ void MainWindow::scanPorts()
     // Configure SignalProcessor object for the required number of data streams.
     if (!synthMode) {
         signalProcessor->allocateMemory(evalBoard->getNumEnabledDataStreams());
+        displayProcessor->allocateMemory(evalBoard->getNumEnabledDataStreams());
         setWindowTitle(tr("Intan Technologies Stimulation / Recording Controller"));
     } else {
         signalProcessor->allocateMemory(1);
+        displayProcessor->allocateMemory(1);
         setWindowTitle(tr("Intan Technologies Stimulation / Recording Controller "
                           "(Demonstration Mode with Synthesized Biopotentials)"));
     }
@@ -1353,6 +1396,8 @@ void MainWindow::createStatusBar()
 {
     statusBarLabel = new QLabel(tr(""));
     statusBar()->addWidget(statusBarLabel, 1);
+    usbGlitchLabel = new QLabel(tr(""));
+    statusBar()->addPermanentWidget(usbGlitchLabel);
     statusBar()->setSizeGripEnabled(false);  // fixed window size
 }
 
@@ -1864,8 +1909,10 @@ void MainWindow::changeNotchFilter(int notchFilterIndex)
         notchFilterEnabled = true;
         break;
     }
+    signalProcessorMutex.lock();
     signalProcessor->setNotchFilter(notchFilterFrequency, notchFilterBandwidth, boardSampleRate);
     signalProcessor->setNotchFilterEnabled(notchFilterEnabled);
+    signalProcessorMutex.unlock();
     wavePlot->setFocus();
 }
 
@@ -1873,7 +1920,9 @@ void MainWindow::changeNotchFilter(int notchFilterIndex)
 void MainWindow::enableHighpassFilter(bool enable)
 {
     highpassFilterEnabled = enable;
+    signalProcessorMutex.lock();
     signalProcessor->setHighpassFilterEnabled(enable);
+    signalProcessorMutex.unlock();
     if (!synthMode) {
         evalBoard->enableDacHighpassFilter(enable);
     }
@@ -1890,7 +1939,9 @@ void MainWindow::highpassFilterLineEditChanged()
 void MainWindow::setHighpassFilterCutoff(double cutoff)
 {
     highpassFilterFrequency = cutoff;
+    signalProcessorMutex.lock();
     signalProcessor->setHighpassFilter(cutoff , boardSampleRate);
+    signalProcessorMutex.unlock();
     if (!synthMode) {
         evalBoard->setDacHighpassFilter(cutoff);
     }
@@ -2166,6 +2217,7 @@ void MainWindow::initializeInterfaceBoard()
     delete dataBlock;
 
     // Set default configuration for all eight DACs on interface board.
+    BoardConfigTransaction dacTransaction(evalBoard);
     evalBoard->enableDac(0, false);
     evalBoard->enableDac(1, false);
     evalBoard->enableDac(2, false);
@@ -2193,6 +2245,7 @@ void MainWindow::initializeInterfaceBoard()
     evalBoard->setDacManual(32768);
     evalBoard->setDacGain(0);
     evalBoard->setAudioNoiseSuppress(0);
+    dacTransaction.commit();
 
     evalBoard->setCableLengthMeters(Rhs2000EvalBoard::PortA, 0.0);
     evalBoard->setCableLengthMeters(Rhs2000EvalBoard::PortB, 0.0);
@@ -2207,7 +2260,7 @@ void MainWindow::initializeInterfaceBoard()
 // is inferred from this.
 void MainWindow::findConnectedAmplifiers()
 {
-    int delay, stream, id, i, channel, port;
+    int stream, i, channel, port;
     // int auxName, vddName;
     int numChannelsOnPort[MAX_NUM_SPI_PORTS] = {0, 0, 0, 0};
     QVector<int> portIndex, portIndexOld, chipIdOld, commandStream;
@@ -2236,105 +2289,14 @@ void MainWindow::findConnectedAmplifiers()
         portIndexOld[6]  = 3;
         portIndexOld[7]  = 3;
 
-        // Enable all data streams
-        for (i = 0; i < MAX_NUM_DATA_STREAMS; i++) {
-            evalBoard->enableDataStream(i, true);
-        }
-
-//        evalBoard->selectAuxCommandBank(Rhs2000EvalBoard::PortA,
-//                                        Rhs2000EvalBoard::AuxCmd3, 0);
-//        evalBoard->selectAuxCommandBank(Rhs2000EvalBoard::PortB,
-//                                        Rhs2000EvalBoard::AuxCmd3, 0);
-//        evalBoard->selectAuxCommandBank(Rhs2000EvalBoard::PortC,
-//                                        Rhs2000EvalBoard::AuxCmd3, 0);
-//        evalBoard->selectAuxCommandBank(Rhs2000EvalBoard::PortD,
-//                                        Rhs2000EvalBoard::AuxCmd3, 0);
-
-        // Since our longest command sequence is 128 commands, we run the SPI
-        // interface for 128 samples.
-        evalBoard->setMaxTimeStep(SAMPLES_PER_DATA_BLOCK);
-        evalBoard->setContinuousRunMode(false);
-
-        Rhs2000DataBlock *dataBlock =
-                new Rhs2000DataBlock(evalBoard->getNumEnabledDataStreams());
-
-        QVector<int> sumGoodDelays(MAX_NUM_DATA_STREAMS, 0);
-        QVector<int> indexFirstGoodDelay(MAX_NUM_DATA_STREAMS, -1);
-        QVector<int> indexSecondGoodDelay(MAX_NUM_DATA_STREAMS, -1);
-
-        // Run SPI command sequence at all 16 possible FPGA MISO delay settings
-        // to find optimum delay for each SPI interface cable.
-        for (delay = 0; delay < 16; ++delay) {
-            evalBoard->setCableDelay(Rhs2000EvalBoard::PortA, delay);
-            evalBoard->setCableDelay(Rhs2000EvalBoard::PortB, delay);
-            evalBoard->setCableDelay(Rhs2000EvalBoard::PortC, delay);
-            evalBoard->setCableDelay(Rhs2000EvalBoard::PortD, delay);
-
-            // Start SPI interface.
-            evalBoard->run();
-
-            // Wait for the 128-sample run to complete.
-            while (evalBoard->isRunning()) {
-                qApp->processEvents();
-            }
-
-            // Read the resulting single data block from the USB interface.
-            evalBoard->readDataBlock(dataBlock);
-
-            // Read the Intan chip ID number from each RHS2000 chip found.
-            // Record delay settings that yield good communication with the chip.
-            for (stream = 0; stream < MAX_NUM_DATA_STREAMS; ++stream) {
-                id = deviceId(dataBlock, stream);
-
-                if (id == CHIP_ID_RHS2116) {
-                    // cout << "Delay: " << delay << " on stream " << stream << " is good." << endl;
-                    sumGoodDelays[stream] = sumGoodDelays[stream] + 1;
-                    if (indexFirstGoodDelay[stream] == -1) {
-                        indexFirstGoodDelay[stream] = delay;
-                        chipIdOld[stream] = id;
-                    } else if (indexSecondGoodDelay[stream] == -1) {
-                        indexSecondGoodDelay[stream] = delay;
-                        chipIdOld[stream] = id;
-                    }
-                }
-            }
-        }
-
-        // Set cable delay settings that yield good communication with each
-        // RHS2000 chip.
-        QVector<int> optimumDelay(MAX_NUM_DATA_STREAMS, 0);
-        for (stream = 0; stream < MAX_NUM_DATA_STREAMS; ++stream) {
-            if (sumGoodDelays[stream] == 1 || sumGoodDelays[stream] == 2) {
-                optimumDelay[stream] = indexFirstGoodDelay[stream];
-            } else if (sumGoodDelays[stream] > 2) {
-                optimumDelay[stream] = indexSecondGoodDelay[stream];
-            }
-        }
+        // Find the RHS2000 chips and the optimum cable delay on each SPI port.
+        QVector<int> portDelay;
+        BoardSetup::scanCableDelays(evalBoard, chipIdOld, portDelay);
 
-        evalBoard->setCableDelay(Rhs2000EvalBoard::PortA,
-                                 qMax(optimumDelay[0], optimumDelay[1]));
-        evalBoard->setCableDelay(Rhs2000EvalBoard::PortB,
-                                 qMax(optimumDelay[2], optimumDelay[3]));
-        evalBoard->setCableDelay(Rhs2000EvalBoard::PortC,
-                                 qMax(optimumDelay[4], optimumDelay[5]));
-        evalBoard->setCableDelay(Rhs2000EvalBoard::PortD,
-                                 qMax(optimumDelay[6], optimumDelay[7]));
-
-        cout << "Port A cable delay: " << qMax(optimumDelay[0], optimumDelay[1]) << endl;
-        cout << "Port B cable delay: " << qMax(optimumDelay[2], optimumDelay[3]) << endl;
-        cout << "Port C cable delay: " << qMax(optimumDelay[4], optimumDelay[5]) << endl;
-        cout << "Port D cable delay: " << qMax(optimumDelay[6], optimumDelay[7]) << endl;
-
-        cableLengthPortA =
-                evalBoard->estimateCableLengthMeters(qMax(optimumDelay[0], optimumDelay[1]));
-        cableLengthPortB =
-                evalBoard->estimateCableLengthMeters(qMax(optimumDelay[2], optimumDelay[3]));
-        cableLengthPortC =
-                evalBoard->estimateCableLengthMeters(qMax(optimumDelay[4], optimumDelay[5]));
-        cableLengthPortD =
-                evalBoard->estimateCableLengthMeters(qMax(optimumDelay[6], optimumDelay[7]));
-
-        delete dataBlock;
+        cableLengthPortA = evalBoard->estimateCableLengthMeters(portDelay[0]);
+        cableLengthPortB = evalBoard->estimateCableLengthMeters(portDelay[1]);
+        cableLengthPortC = evalBoard->estimateCableLengthMeters(portDelay[2]);
+        cableLengthPortD = evalBoard->estimateCableLengthMeters(portDelay[3]);
 
     } else {
         // If we are running with synthetic data (i.e., no interface board), just assume
@@ -2486,30 +2448,6 @@ void MainWindow::findConnectedAmplifiers()
 
 }
 
-// Return the Intan chip ID stored in ROM register 255.  If the data is invalid
-// (due to a SPI communication channel with the wrong delay or a chip not present)
-// then return -1.
-int MainWindow::deviceId(Rhs2000DataBlock *dataBlock, int stream)
-{
-    bool intanChipPresent;
-
-    // First, check ROM registers 251-253 to verify that they hold 'INTAN'.
-    // This is just used to verify that we are getting good data over the SPI
-    // communication channel.
-    intanChipPresent = ((char) ((dataBlock->auxiliaryData[stream][0][61] & 0xff00) >> 8) == 'I' &&
-                        (char) ((dataBlock->auxiliaryData[stream][0][61] & 0x00ff) >> 0) == 'N' &&
-                        (char) ((dataBlock->auxiliaryData[stream][0][60] & 0xff00) >> 8) == 'T' &&
-                        (char) ((dataBlock->auxiliaryData[stream][0][60] & 0x00ff) >> 0) == 'A' &&
-                        (char) ((dataBlock->auxiliaryData[stream][0][59] & 0xff00) >> 8) == 'N' &&
-                        (char) ((dataBlock->auxiliaryData[stream][0][59] & 0x00ff) >> 0) == 0);
-
-    if (!intanChipPresent) {
-        return -1;
-    } else {
-        return dataBlock->auxiliaryData[stream][0][57]; // chip ID (Register 255)
-    }
-}
-
 // Start recording data from USB interface board to disk.
 void MainWindow::recordInterfaceBoard()
 {
@@ -2689,25 +2627,30 @@ void MainWindow::runInterfaceBoard()
     int triggerIndex;
     QTime timer;
     int timestampOffset = 0;
-    unsigned int preTriggerBufferQueueLength = 0;
+    int numPreTriggerBatches = 0;
     queue<Rhs2000DataBlock> bufferQueue;
-    Rhs2000DataBlock* dataBlock = nullptr;
     static int fifoNearlyFull = 0;
     static int triggerEndCounter = 0;
     int triggerEndThreshold;
     bool hasBeenUpdated = false;
-    int index;
-    unsigned int sample;
+    UsbGlitchStatistics usbGlitchStatistics = {0, 0, 0};
+
+    MetricsRegistry* metrics = MetricsRegistry::global();
+    LatencyHistogram* hostFifoFillMetric = metrics->histogram("host_fifo.fill", "%");
+    LatencyHistogram* fpgaFifoLagMetric = metrics->histogram("fpga_fifo.latency", "us");
+    MetricGauge* fpgaFifoPercentFullMetric = metrics->gauge("fpga_fifo.percent_full");
 
     triggerEndThreshold = qCeil(postTriggerTime * boardSampleRate / (numUsbBlocksToRead * SAMPLES_PER_DATA_BLOCK)) - 1;
 
     if (triggerSet) {
-        preTriggerBufferQueueLength = numUsbBlocksToRead *
-                (qCeil(recordTriggerBuffer / (numUsbBlocksToRead * Rhs2000DataBlock::getSamplesPerDataBlock() / boardSampleRate)) + 1);
+        numPreTriggerBatches =
+                qCeil(recordTriggerBuffer / (numUsbBlocksToRead * Rhs2000DataBlock::getSamplesPerDataBlock() / boardSampleRate)) + 1;
     }
+    int numBatches = PIPELINE_DEPTH_IN_READS + numPreTriggerBatches;
 
-    QSound triggerBeep(QDir::tempPath() + "/triggerbeep.wav");
-    QSound triggerEndBeep(QDir::tempPath() + "/triggerendbeep.wav");
+    // Pre-trigger store: the most recent batches of data blocks, kept in the pool until a trigger
+    // arrives or they are more than recordTriggerBuffer seconds old.
+    DataBlockQueue preTriggerBatches(numPreTriggerBatches);
 
     running = true;
     wavePlot->setFocus();
@@ -2734,11 +2677,15 @@ void MainWindow::runInterfaceBoard()
 
     unsigned int dataBlockSize;
     unsigned int numBytesToRead;
+    unsigned int numBytesConsumed;
+    unsigned char* usbData;
 
     if (synthMode) {
         dataBlockSize = Rhs2000DataBlock::calculateDataBlockSizeInWords(1);
     } else {
-        dataBlock = new Rhs2000DataBlock(evalBoard->getNumEnabledDataStreams());
+        // Blocks are parsed into a preallocated pool, in one batch of consecutive blocks per
+        // USB read in the pipeline or in the pre-trigger store.
+        dataBlockPool.allocate(numBatches * numUsbBlocksToRead, evalBoard->getNumEnabledDataStreams());
         dataBlockSize = Rhs2000DataBlock::calculateDataBlockSizeInWords(
                     evalBoard->getNumEnabledDataStreams());
     }
@@ -2754,7 +2701,7 @@ void MainWindow::runInterfaceBoard()
 
     // Calculate the number of bytes per minute that we will be saving to disk
     // if recording data (excluding headers).
-    double bytesPerMinute = Rhs2000DataBlock::getSamplesPerDataBlock() *
+    recordBytesPerMinute = Rhs2000DataBlock::getSamplesPerDataBlock() *
             ((double) signalProcessor->bytesPerBlock(saveFormat, saveTtlOut) /
              (double) Rhs2000DataBlock::getSamplesPerDataBlock()) * boardSampleRate;
 
@@ -2762,7 +2709,7 @@ void MainWindow::runInterfaceBoard()
     fifoCapacity = Rhs2000EvalBoard::fifoCapacityInWords();
 
     if (recording) {
-        setStatusBarRecording(bytesPerMinute, totalElapsedRecordTimeSeconds);
+        setStatusBarRecording(recordBytesPerMinute, totalElapsedRecordTimeSeconds);
     } else if (triggerSet) {
         setStatusBarWaitForTrigger();
     } else {
@@ -2770,50 +2717,78 @@ void MainWindow::runInterfaceBoard()
     }
 
     if (!synthMode) {
+        usbGlitchLabel->setText(tr("USB glitches: 0"));
+        usbGlitchLabel->setToolTip("");
+        usbGlitchLabel->setStyleSheet("color: black");
         usbDataThread->start();
         usbDataThread->startRunning();
     } else {
         timer.start();
     }
 
-    // Timers to measure performance
-    QElapsedTimer readTimer, loopTimer, processingTimer;
-    int extraCycles = 0;
-    readTimer.start();
-    loopTimer.start();
-    processingTimer.start();
-    qint64 readTime, loopTime, processingTime, idleTime;
-    double dutyCycle, cpuFree;
-
-    while (running) {
-        if (recording) {
-            setStatusBarRecording(bytesPerMinute, totalElapsedRecordTimeSeconds);
+    // Heap allocations on the parse and processing threads in steady state (from the second
+    // read on).
+    unsigned long long numSteadyStateBlocks = 0;
+    unsigned long long parseAllocations = 0;
+    unsigned long long steadyStateAllocations = 0;
+
+    DisplayStatus displayStatus;
+    displayStatus.fifoStatusUpdated = false;
+    displayStatus.cpuWarning = false;
+    displayStatus.usbBufferPercentFull = 0.0;
+    displayStatus.usbGlitches = usbGlitchStatistics;
+    displayFrames->reset();
+    displayRefreshesToSkip = 0;
+
+    parseStage->reset();
+    processStage->reset();
+    displayStage->reset();
+    saveFileWriter->resetStatistics();
+
+    // Acquisition runs as a pipeline of stages, each on its own thread, so that a slow repaint,
+    // a modal dialog or a slow disk cannot hold up the data, and the work is spread over cores:
+    //   parse   - USB header checks and realignment, parsing into pooled data blocks
+    //   process - loading, trigger detection and filtering (SignalProcessor), file rollover
+    //   save    - writing Intan format save files (SaveFileWriter)
+    //   display - drawing the DisplayFrame accumulated since the last refresh, on a GUI thread timer
+    //             (see updateDisplay())
+    // Parse and process are joined by bounded queues of data block batches: a stage that falls
+    // behind holds back the stages before it, and finally the USB data thread, whose
+    // DataStreamFifo absorbs the delay.  Loading, detection and filtering share SignalProcessor
+    // state, so they stay in one stage.
+    QThread *parseThread = nullptr;
+    if (!synthMode) {
+        parsedBatches.setCapacity(PIPELINE_DEPTH_IN_READS);
+        freeBatches.setCapacity(numBatches);
+        for (int i = 0; i < numBatches; ++i) {
+            freeBatches.push(i * numUsbBlocksToRead);
         }
-
-        // If we are running in demo mode, use a timer to periodically generate more synthetic
-        // data.  If not, wait for a certain amount of data to be ready from the USB interface board.
-        if (synthMode) {
-            newDataReady = (timer.elapsed() >=
-                            ((int) (1000.0 * SAMPLES_PER_DATA_BLOCK * (double) numUsbBlocksToRead / boardSampleRate)));
-        } else {
-            readTimer.restart();
-            usbDataThread->setNumUsbBlocksToRead(numUsbBlocksToRead);
-            numBytesToRead = numUsbBlocksToRead * 2 * Rhs2000DataBlock::calculateDataBlockSizeInWords(evalBoard->getNumEnabledDataStreams());
-            newDataReady = usbStreamFifo->readFromBuffer(usbReadBuffer, numBytesToRead);
-
-            if (newDataReady) {
-                bufferFullLabel->setText(QString::number(usbStreamFifo->percentFull(), 'f', 0) + "%");
-                if (usbStreamFifo->percentFull() > 75.0) {
-                    bufferFullLabel->setStyleSheet("color: red");
-                } else {
-                    bufferFullLabel->setStyleSheet("color: black");
+        usbDataThread->setNumUsbBlocksToRead(numUsbBlocksToRead);
+        numBytesToRead = numUsbBlocksToRead * 2 * dataBlockSize;
+
+        parseThread = QThread::create([&] {
+            DataBlockBatch batch;
+            int extraCycles = 0;
+            bool firstRead = true;
+
+            batch.numBlocks = numUsbBlocksToRead;
+            while (running && freeBatches.pop(batch.firstBlock)) {
+                // Wait for a certain amount of data to be ready from the USB interface board.
+                usbData = usbStreamFifo->peekRead(numBytesToRead);
+                while (!usbData && running) {
+                    extraCycles++;
+                    QThread::usleep(100);
+                    usbData = usbStreamFifo->peekRead(numBytesToRead);
                 }
-
-                if (extraCycles == 0) {
-                    cpuWarningLabel->show();
-                } else {
-                    cpuWarningLabel->hide();
+                if (!usbData) {
+                    break;
                 }
+                parseStage->startService();
+                numBytesConsumed = numBytesToRead;
+
+                batch.usbBufferPercentFull = usbStreamFifo->percentFull();
+                hostFifoFillMetric->record((unsigned long long) batch.usbBufferPercentFull);
+                batch.cpuWarning = (extraCycles == 0);
                 extraCycles = 0;
 
                 // USB data error checking
@@ -2830,104 +2805,100 @@ void MainWindow::runInterfaceBoard()
                     unsigned int glitchPosition = 1000;
 
                     // Throw away some words from the USB buffer...
-                    for (unsigned int i = glitchPosition; i < numBytesToRead - 2 * numWordsToSwallow; ++i) {
-                        usbReadBuffer[i] = usbReadBuffer[i + 2 * numWordsToSwallow];
-                    }
+                    memmove(&usbData[glitchPosition], &usbData[glitchPosition + 2 * numWordsToSwallow],
+                            numBytesToRead - 2 * numWordsToSwallow - glitchPosition);
                     // ...and fill the buffer back up from the USB port.
 
-                    while (usbStreamFifo->bytesAvailable() < 2 * numWordsToSwallow) {    // ...wait for data word to become available...
-                        qApp->processEvents();  // Stay responsive to GUI events during this loop
+                    while (usbStreamFifo->bytesAvailable() < numBytesConsumed + 2 * numWordsToSwallow) {    // ...wait for data word to become available...
+                        QThread::usleep(100);
                     }
 
-                    // ...and read N more words (2N more bytes) from USB read buffer, and append it to the end.
-                    usbStreamFifo->readFromBuffer(&usbReadBuffer[numBytesToRead - 2 * numWordsToSwallow], 2 * numWordsToSwallow);
+                    // ...and extend the span by N more words (2N more bytes), moving them to the end.
+                    usbData = usbStreamFifo->peekRead(numBytesConsumed + 2 * numWordsToSwallow);
+                    memcpy(&usbData[numBytesToRead - 2 * numWordsToSwallow], &usbData[numBytesConsumed], 2 * numWordsToSwallow);
+                    numBytesConsumed += 2 * numWordsToSwallow;
                 }
                 */
 
                 // Look for proper 'magic number' header in all data blocks to check for USB glitches
-
-                index = 0;
-                for (sample = 0; sample < numUsbBlocksToRead * SAMPLES_PER_DATA_BLOCK; ++sample) {
-                    if (!(dataBlock->checkUsbHeader(usbReadBuffer, index))) {
-                        if (sample > 0) {
-                            // If we have a bad data sample header on any sample but the first, we shouldn't trust
-                            // the integrity of the prior sample, since it is likely contains a "hole" where missing
-                            // USB data should be.  Jump back one sample and try to fix that one.
-                            sample--;
-                            index -= sampleSizeInBytes;
-                        }
-
-                        // Search for correct header throughout the sample.
-                        int lag = sampleSizeInBytes / 2;
-                        for (unsigned int i = 1; i < sampleSizeInBytes / 2; ++i) {
-                            if (dataBlock->checkUsbHeader(usbReadBuffer, index + 2 * i)) {
-                                lag = i;
-                                break;
-                            }
-                        }
-                        // Realign data and read additional words from the USB to refill buffer.
-
-                        unsigned int numBytes = 2 * lag;
-                        // Shift all data beyond error point back by N words (2N bytes)...
-                        for (unsigned int i = index; i < numBytesToRead - numBytes; i += 2) {
-                            usbReadBuffer[i] = usbReadBuffer[i + numBytes];
-                            usbReadBuffer[i + 1] = usbReadBuffer[i + numBytes + 1];
-                        }
-
-                        while (usbStreamFifo->bytesAvailable() < numBytes) {    // ...wait for data word to become available...
-                            qApp->processEvents();  // Stay responsive to GUI events during this loop
-                        }
-
-                        // ...and read N more words (2N more bytes) from USB read buffer, and append it to the end.
-                        usbStreamFifo->readFromBuffer(&usbReadBuffer[numBytesToRead - numBytes], numBytes);
-                    }
-                    index += sampleSizeInBytes;
+                usbData = UsbHeaderScanner::repairGlitches(usbStreamFifo, usbData, numBytesToRead, sampleSizeInBytes,
+                                                           numBytesConsumed, usbGlitchStatistics, running);
+                if (!usbData) {
+                    break;
                 }
 
                 /*
                 // Re-check USB headers (for debugging purposes only)
-                index = 0;
-                for (sample = 0; sample < numUsbBlocksToRead * SAMPLES_PER_DATA_BLOCK; ++sample) {
-                    if (!(dataBlock->checkUsbHeader(usbReadBuffer, index))) {
-                        cerr << "Unfixed header error at sample " << sample << endl;
-                    }
-                    index += sampleSizeInBytes;
+                int badSample = UsbHeaderScanner::findBadHeader(usbData, 0, numBytesToRead / sampleSizeInBytes,
+                                                                 sampleSizeInBytes);
+                if (badSample >= 0) {
+                    cerr << "Unfixed header error at sample " << badSample << endl;
                 }
                 */
 
                 // End of USB error checking
 
+                if (firstRead) {
+                    parseAllocations = AllocationCounter::threadAllocations();
+                    firstRead = false;
+                }
+
                 for (unsigned int j = 0; j < numUsbBlocksToRead; ++j) {
-                    dataBlock->fillFromUsbBuffer(usbReadBuffer, j, evalBoard->getNumEnabledDataStreams());
-                    dataQueue.push(*dataBlock);
+                    dataBlockPool.block(batch.firstBlock + j)->fillFromUsbBuffer(usbData, j, evalBoard->getNumEnabledDataStreams());
                 }
+                usbStreamFifo->releaseRead(numBytesConsumed);
+                batch.usbGlitches = usbGlitchStatistics;
+                parseStage->finishService();
 
-                readTime = readTimer.restart();
-                loopTime = loopTimer.restart();
-                idleTime = loopTime - readTime - processingTime;
-                dutyCycle = 100.0 * ((double)readTime) / ((double)loopTime);
-                cpuFree = 100.0 * ((double)idleTime) / ((double)loopTime);
-                // cout << "Loop: " << loopTime << "ms.  Processing: " << processingTime << " ms.  USB: " << readTime << " ms " <<
-                //         (int)dutyCycle << "%.  " << "CPU idle: " << (int)cpuFree << "%" << endl;
-            } else {
-                extraCycles++;
+                if (!parsedBatches.push(batch)) {
+                    break;
+                }
             }
-        }
+            parseAllocations = AllocationCounter::threadAllocations() - parseAllocations;
+        });
+    }
+
+    QThread *processingThread = QThread::create([&] {
+        DataBlockBatch batch;
+        bool firstRead = true;
+
+        while (running) {
+            // If we are running in demo mode, use a timer to periodically generate more synthetic
+            // data.  If not, wait for the parse stage to hand over the next batch of data blocks.
+            if (synthMode) {
+                newDataReady = (timer.elapsed() >=
+                                ((int) (1000.0 * SAMPLES_PER_DATA_BLOCK * (double) numUsbBlocksToRead / boardSampleRate)));
+                if (!newDataReady) {
+                    QThread::usleep(100);
+                    continue;
+                }
+            } else if (!parsedBatches.pop(batch)) {
+                break;
+            }
+            processStage->startService();
 
-        // If new data is ready, then read it.
-        if (newDataReady) {
-            processingTimer.start();
+            if (firstRead) {
+                steadyStateAllocations = AllocationCounter::threadAllocations();
+                firstRead = false;
+            } else {
+                numSteadyStateBlocks += numUsbBlocksToRead;
+            }
 
             if (synthMode) {
                 timer.start();  // restart timer
                 fifoPercentageFull = 0.0;
 
                 // Generate synthetic data
+                lock_guard<mutex> lockSignalProcessor(signalProcessorMutex);
                 totalBytesWritten +=
                         signalProcessor->loadSyntheticData(numUsbBlocksToRead,
                                                            boardSampleRate, recording,
                                                            *saveStream, saveFormat, saveTtlOut, saveDcAmps, referenceSource);
             } else {
+                displayStatus.usbBufferPercentFull = batch.usbBufferPercentFull;
+                displayStatus.cpuWarning = batch.cpuWarning;
+                displayStatus.usbGlitches = batch.usbGlitches;
+
                 // Check the number of words stored in the Opal Kelly USB interface FIFO.
                 wordsInFifo = evalBoard->getLastNumWordsInFifo(hasBeenUpdated);
                 if (hasBeenUpdated) {
@@ -2936,35 +2907,43 @@ void MainWindow::runInterfaceBoard()
 
                     fifoPercentageFull = 100.0 * wordsInFifo / fifoCapacity;
 
-                    // Alert the user if the number of words in the FIFO is getting to be significant
-                    // or nearing FIFO capacity.
+                    displayStatus.fifoLatencyMs = latency;
+                    displayStatus.fifoPercentFull = fifoPercentageFull;
+                    fpgaFifoLagMetric->record((unsigned long long) (1000.0 * latency));
+                    fpgaFifoPercentFullMetric->set(fifoPercentageFull);
+                    displayStatus.fifoStatusUpdated = true;
+                }
 
-                    fifoLagLabel->setText(QString::number(latency, 'f', 0) + " ms");
-                    if (latency > 200.0) {
-                        fifoLagLabel->setStyleSheet("color: red");
-                    } else {
-                        fifoLagLabel->setStyleSheet("color: green");
-                    }
+                // SignalProcessor takes its data blocks by value, so this hand-off is the one place
+                // blocks are still copied.
+                queueDataBlockBatches(&batch.firstBlock, 1, dataQueue);
 
-                    fifoFullLabel->setText(QString::number(fifoPercentageFull, 'f', 0) + "%");
-                    if (fifoPercentageFull > 75.0) {
-                        fifoFullLabel->setStyleSheet("color: red");
-                    } else {
-                        fifoFullLabel->setStyleSheet("color: black");
+                // While waiting for a trigger, keep the batch in the pre-trigger store, and send
+                // the oldest batch in the store back to the parse stage once it is full.
+                // Otherwise the batch goes back right away.
+                if (triggerSet && preTriggerBatches.capacity() > 0) {
+                    if (preTriggerBatches.full()) {
+                        freeBatches.push(preTriggerBatches.pop());
                     }
+                    preTriggerBatches.push(batch.firstBlock);
+                } else {
+                    freeBatches.push(batch.firstBlock);
                 }
 
+                // The pre-trigger data handed to the save stage must be in the file before this
+                // batch, and shares SignalProcessor's save buffers with it.
+                saveFileWriter->waitForDeferredWrites();
+
                 // Read waveform data from USB interface board.
-                totalBytesWritten +=
-                        signalProcessor->loadAmplifierData(dataQueue, (int) numUsbBlocksToRead,
-                                                           (triggerSet | triggered), recordTriggerChannel,
-                                                           (triggered ? (1 - recordTriggerPolarity) : recordTriggerPolarity),
-                                                           triggerIndex, triggerSet, bufferQueue,
-                                                           recording, *saveStream, saveFormat,
-                                                           saveTtlOut, saveDcAmps, timestampOffset, referenceSource);
-
-                while (bufferQueue.size() > preTriggerBufferQueueLength) {
-                    bufferQueue.pop();
+                {
+                    lock_guard<mutex> lockSignalProcessor(signalProcessorMutex);
+                    totalBytesWritten +=
+                            signalProcessor->loadAmplifierData(dataQueue, (int) numUsbBlocksToRead,
+                                                               (triggerSet | triggered), recordTriggerChannel,
+                                                               (triggered ? (1 - recordTriggerPolarity) : recordTriggerPolarity),
+                                                               triggerIndex, false, bufferQueue,
+                                                               recording, *saveStream, saveFormat,
+                                                               saveTtlOut, saveDcAmps, timestampOffset, referenceSource);
                 }
 
                 if (triggerSet && (triggerIndex != -1)) {
@@ -2974,24 +2953,56 @@ void MainWindow::runInterfaceBoard()
                     timestampOffset = triggerIndex;
 
                     // Play trigger sound
-                    triggerBeep.play();
+                    QMetaObject::invokeMethod(this, [] {
+                        QSound::play(QDir::tempPath() + "/triggerbeep.wav");
+                    }, Qt::QueuedConnection);
 
-                    if (!startNewSaveFile(saveFormat)) {
-                        stopInterfaceBoard();
-                        return;
+                    if (!openSaveFileFromProcessingThread()) {
+                        running = false;
+                        recording = false;
+                        break;
                     }
 
-                    // Write save file header information.
-                    writeSaveFileHeader(*saveStream, *infoStream, saveFormat);
-
-                    setStatusBarRecording(bytesPerMinute, totalElapsedRecordTimeSeconds);
-
-                    totalRecordTimeSeconds = bufferQueue.size() * Rhs2000DataBlock::getSamplesPerDataBlock() / boardSampleRate;
+                    totalRecordTimeSeconds = preTriggerBatches.size() * numUsbBlocksToRead *
+                            Rhs2000DataBlock::getSamplesPerDataBlock() / boardSampleRate;
                     totalElapsedRecordTimeSeconds = totalRecordTimeSeconds;
 
-                    // Write contents of pre-trigger buffer to file.
-                    totalBytesWritten += signalProcessor->saveBufferedData(bufferQueue, *saveStream, saveFormat,
-                                                                           saveTtlOut, saveDcAmps, timestampOffset);
+                    // Write contents of pre-trigger buffer to file.  The store is handed over as its
+                    // two contiguous runs, oldest first.  In Intan format the save stage copies the
+                    // blocks out for SignalProcessor and writes them on its own thread, and only then
+                    // returns the batches to the parse stage; other formats are written here.
+                    const DataBlockHandle *firstBatches, *secondBatches;
+                    int numFirstBatches, numSecondBatches;
+                    preTriggerBatches.spans(firstBatches, numFirstBatches, secondBatches, numSecondBatches);
+                    if (saveFormat == SaveFormatIntan) {
+                        vector<DataBlockHandle> batches(firstBatches, firstBatches + numFirstBatches);
+                        batches.insert(batches.end(), secondBatches, secondBatches + numSecondBatches);
+                        preTriggerBatches.clear();
+                        bool ttlOut = saveTtlOut, dcAmps = saveDcAmps;
+                        int offset = timestampOffset;
+                        saveFileWriter->writeDeferred([this, batches, ttlOut, dcAmps, offset](QFile *file) {
+                            queue<Rhs2000DataBlock> preTriggerQueue;
+                            queueDataBlockBatches(batches.data(), (int) batches.size(), preTriggerQueue);
+                            for (DataBlockHandle batch : batches) {
+                                freeBatches.push(batch);
+                            }
+                            QDataStream out(file);
+                            out.setVersion(QDataStream::Qt_4_8);
+                            out.setByteOrder(QDataStream::LittleEndian);
+                            out.setFloatingPointPrecision(QDataStream::SinglePrecision);
+                            lock_guard<mutex> lockSignalProcessor(signalProcessorMutex);
+                            signalProcessor->saveBufferedData(preTriggerQueue, out, SaveFormatIntan, ttlOut, dcAmps, offset);
+                            return out.status() == QDataStream::Ok;
+                        });
+                    } else {
+                        queueDataBlockBatches(firstBatches, numFirstBatches, bufferQueue);
+                        queueDataBlockBatches(secondBatches, numSecondBatches, bufferQueue);
+                        while (!preTriggerBatches.empty()) {
+                            freeBatches.push(preTriggerBatches.pop());
+                        }
+                        totalBytesWritten += signalProcessor->saveBufferedData(bufferQueue, *saveStream, saveFormat,
+                                                                               saveTtlOut, saveDcAmps, timestampOffset);
+                    }
                 } else if (triggered && (triggerIndex != -1)) { // Episodic triggered recording
                     triggerEndCounter++;
                     if (triggerEndCounter > triggerEndThreshold) {
@@ -3005,10 +3016,10 @@ void MainWindow::runInterfaceBoard()
                         totalRecordTimeSeconds = 0.0;
                         totalElapsedRecordTimeSeconds = 0.0;
 
-                        setStatusBarWaitForTrigger();
-
                         // Play trigger end sound
-                        triggerEndBeep.play();
+                        QMetaObject::invokeMethod(this, [] {
+                            QSound::play(QDir::tempPath() + "/triggerendbeep.wav");
+                        }, Qt::QueuedConnection);
                     }
                 } else if (triggered) {
                     triggerEndCounter = 0;          // Ignore brief (< 1 second) trigger-off events.
@@ -3016,15 +3027,9 @@ void MainWindow::runInterfaceBoard()
             }
 
             // Apply notch filter to amplifier data.
+            signalProcessorMutex.lock();
             signalProcessor->filterData(numUsbBlocksToRead, channelVisible);
-
-            // Trigger WavePlot widget to display new waveform data.
-            wavePlot->passFilteredData();
-
-            // Trigger Spike Scope to update with new waveform data.
-            if (spikeScopeDialog) {
-                spikeScopeDialog->updateWaveform(numUsbBlocksToRead);
-            }
+            signalProcessorMutex.unlock();
 
             // If we are recording in Intan format and our data file has reached its specified
             // maximum length (e.g., 1 minute), close the current data file and open a new one.
@@ -3036,16 +3041,12 @@ void MainWindow::runInterfaceBoard()
                 if (saveFormat == SaveFormatIntan) {
                     if (totalRecordTimeSeconds >= (60 * newSaveFilePeriodMinutes)) {
                         closeSaveFile(saveFormat);
-                        if (!startNewSaveFile(saveFormat)) {
-                            stopInterfaceBoard();
-                            return;
+                        if (!openSaveFileFromProcessingThread()) {
+                            running = false;
+                            recording = false;
+                            break;
                         }
 
-                        // Write save file header information.
-                        writeSaveFileHeader(*saveStream, *infoStream, saveFormat);
-
-                        setStatusBarRecording(bytesPerMinute, totalElapsedRecordTimeSeconds);
-
                         totalRecordTimeSeconds = 0.0;
                     }
                 }
@@ -3072,20 +3073,56 @@ void MainWindow::runInterfaceBoard()
                         triggered = false;
                     }
 
-                    QMessageBox::critical(this, tr("USB Buffer Overrun Error"),
-                                          tr("Recording was stopped because the USB FIFO buffer on the interface "
-                                             "board reached maximum capacity.  This happens when the host computer "
-                                             "cannot keep up with the data streaming from the interface board."
-                                             "<p>Try lowering the sample rate, disabling the notch filter, or reducing "
-                                             "the number of waveforms on the screen to reduce CPU load."));
+                    QMetaObject::invokeMethod(this, [this] {
+                        QMessageBox::critical(this, tr("USB Buffer Overrun Error"),
+                                              tr("Recording was stopped because the USB FIFO buffer on the interface "
+                                                 "board reached maximum capacity.  This happens when the host computer "
+                                                 "cannot keep up with the data streaming from the interface board."
+                                                 "<p>Try lowering the sample rate, disabling the notch filter, or reducing "
+                                                 "the number of waveforms on the screen to reduce CPU load."));
+                    }, Qt::QueuedConnection);
                 }
             } else if (hasBeenUpdated) {
                 fifoNearlyFull = 0;
             }
 
-            processingTime = processingTimer.elapsed();
+            // Hand the new waveforms and status to the GUI thread.
+            displayStatus.numBlocks = numUsbBlocksToRead;
+            displayStatus.recording = recording;
+            displayStatus.waitingForTrigger = triggerSet;
+            displayStatus.totalElapsedRecordTimeSeconds = totalElapsedRecordTimeSeconds;
+            signalProcessorMutex.lock();
+            displayFrames->publish(signalProcessor, displayStatus);
+            signalProcessorMutex.unlock();
+            displayStatus.fifoStatusUpdated = false;
+
+            processStage->finishService();
         }
-        qApp->processEvents();  // Stay responsive to GUI events during this loop
+        steadyStateAllocations = AllocationCounter::threadAllocations() - steadyStateAllocations;
+        QMetaObject::invokeMethod(this, [] {}, Qt::QueuedConnection);   // wake up the GUI thread
+    });
+
+    if (parseThread) {
+        parseThread->start(QThread::HighPriority);
+    }
+    processingThread->start(QThread::HighPriority);
+    displayTimer->start();
+    while (running) {
+        qApp->processEvents(QEventLoop::WaitForMoreEvents);
+    }
+    displayTimer->stop();
+    // Turn away stages still waiting on each other.
+    parsedBatches.close();
+    freeBatches.close();
+    // The processing thread may be waiting for the GUI thread to open a save file.
+    while (!processingThread->wait(10)) {
+        qApp->processEvents();
+    }
+    delete processingThread;
+    if (parseThread) {
+        parseThread->wait();
+        delete parseThread;
+        steadyStateAllocations += parseAllocations;
     }
 
     // Stop data acquisition (when running == false)
@@ -3096,6 +3133,14 @@ void MainWindow::runInterfaceBoard()
         }
         usbStreamFifo->resetBuffer();
         evalBoard->resetSequencers();   // reset sequencers
+
+        if (AllocationCounter::isEnabled() && numSteadyStateBlocks > 0) {
+            cout << "MainWindow: " << steadyStateAllocations << " heap allocations for " << numSteadyStateBlocks <<
+                    " data blocks (" << (double) steadyStateAllocations / numSteadyStateBlocks << " per block)" << endl;
+        }
+        cout << "MainWindow: " << usbGlitchStatistics.numBadHeaders << " bad USB headers, " <<
+                usbGlitchStatistics.numWordsSkipped << " words skipped, " <<
+                usbGlitchStatistics.numRealignStalls << " realignment stalls" << endl;
     }
 
     // Close save file, if recording.
@@ -3104,6 +3149,13 @@ void MainWindow::runInterfaceBoard()
         recording = false;
     }
 
+    if (!synthMode) {
+        parseStage->printStatistics();
+    }
+    processStage->printStatistics();
+    saveFileWriter->printStatistics();
+    displayStage->printStatistics();
+
     // Reset trigger
     triggerSet = false;
     triggered = false;
@@ -3139,8 +3191,6 @@ void MainWindow::runInterfaceBoard()
     while (bufferQueue.size() > 0) {
         bufferQueue.pop();
     }
-
-    delete dataBlock;
 }
 
 // Stop SPI data acquisition.
@@ -3150,6 +3200,117 @@ void MainWindow::stopInterfaceBoard()
     wavePlot->setFocus();
 }
 
+// Draw the waveforms and status published by the processing thread since the last refresh.
+// Called by displayTimer; after a frame over DISPLAY_FRAME_BUDGET_MS, skips refreshes in
+// proportion, leaving the data to accumulate for the next frame.
+void MainWindow::updateDisplay()
+{
+    DisplayStatus status;
+
+    if (displayRefreshesToSkip > 0) {
+        displayRefreshesToSkip--;
+        displayFramesSkippedMetric->add();
+        return;
+    }
+    if (!running || !displayFrames->takeLatest(displayProcessor, status)) {
+        return;
+    }
+    displayStage->startService();
+    QElapsedTimer frameTime;
+    frameTime.start();
+
+    bufferFullLabel->setText(QString::number(status.usbBufferPercentFull, 'f', 0) + "%");
+    DataStreamFifoStatistics fifoStatistics = usbStreamFifo->getStatistics();
+    bufferFullLabel->setToolTip(tr("Peak ") +
+                                QString::number(100.0 * fifoStatistics.highWaterBytes / usbStreamFifo->getBufferSize(), 'f', 0) +
+                                tr("%, ") + QString::number(fifoStatistics.numOverruns) + tr(" overruns"));
+    if (status.usbBufferPercentFull > 75.0 || fifoStatistics.numOverruns > 0) {
+        bufferFullLabel->setStyleSheet("color: red");
+    } else {
+        bufferFullLabel->setStyleSheet("color: black");
+    }
+
+    if (!synthMode) {
+        usbGlitchLabel->setText(tr("USB glitches: ") + QString::number(status.usbGlitches.numBadHeaders));
+        usbGlitchLabel->setToolTip(QString::number(status.usbGlitches.numWordsSkipped) + tr(" words skipped, ") +
+                                   QString::number(status.usbGlitches.numRealignStalls) + tr(" realignment stalls"));
+        if (status.usbGlitches.numBadHeaders > 0) {
+            usbGlitchLabel->setStyleSheet("color: red");
+        }
+    }
+
+    if (status.cpuWarning) {
+        cpuWarningLabel->show();
+    } else {
+        cpuWarningLabel->hide();
+    }
+
+    // Alert the user if the number of words in the FIFO is getting to be significant
+    // or nearing FIFO capacity.
+    if (status.fifoStatusUpdated) {
+        fifoLagLabel->setText(QString::number(status.fifoLatencyMs, 'f', 0) + " ms");
+        if (status.fifoLatencyMs > 200.0) {
+            fifoLagLabel->setStyleSheet("color: red");
+        } else {
+            fifoLagLabel->setStyleSheet("color: green");
+        }
+
+        fifoFullLabel->setText(QString::number(status.fifoPercentFull, 'f', 0) + "%");
+        if (status.fifoPercentFull > 75.0) {
+            fifoFullLabel->setStyleSheet("color: red");
+        } else {
+            fifoFullLabel->setStyleSheet("color: black");
+        }
+    }
+
+    if (status.recording) {
+        setStatusBarRecording(recordBytesPerMinute, status.totalElapsedRecordTimeSeconds);
+    } else if (status.waitingForTrigger) {
+        setStatusBarWaitForTrigger();
+    }
+
+    // Trigger WavePlot widget to display new waveform data.
+    wavePlot->setNumUsbBlocksToPlot(status.numBlocks);
+    wavePlot->passFilteredData();
+
+    // Trigger Spike Scope to update with new waveform data.
+    if (spikeScopeDialog) {
+        spikeScopeDialog->updateWaveform(status.numBlocks);
+    }
+    displayStage->finishService();
+
+    displayRefreshesToSkip = (int) (frameTime.elapsed() / DISPLAY_FRAME_BUDGET_MS);
+}
+
+// Open a new save file and write its header, for the processing thread.  This runs on the GUI
+// thread, since the header records widget settings and errors are reported in message boxes;
+// the processing thread waits, while the USB data thread keeps filling the USB FIFO.
+bool MainWindow::openSaveFileFromProcessingThread()
+{
+    bool opened = false;
+
+    QMetaObject::invokeMethod(this, [this, &opened] {
+        opened = startNewSaveFile(saveFormat);
+        if (opened) {
+            // Write save file header information.
+            writeSaveFileHeader(*saveStream, *infoStream, saveFormat);
+        }
+    }, Qt::BlockingQueuedConnection);
+    return opened;
+}
+
+// Append copies of the data blocks in numBatches batches of the pipeline (each numUsbBlocksToRead
+// consecutive blocks of dataBlockPool, given by its first block) to blockQueue.  This copy, for
+// SignalProcessor, is the one place the process stage allocates per block.
+void MainWindow::queueDataBlockBatches(const DataBlockHandle* batches, int numBatches, queue<Rhs2000DataBlock> &blockQueue)
+{
+    for (int i = 0; i < numBatches; ++i) {
+        for (unsigned int j = 0; j < numUsbBlocksToRead; ++j) {
+            blockQueue.push(*dataBlockPool.block(batches[i] + j));
+        }
+    }
+}
+
 void MainWindow::selectBaseFilenameSlot()
 {
     selectBaseFilename(saveFormat);
@@ -3206,7 +3367,7 @@ void MainWindow::setNumWaveformsComboBox(int index)
 void MainWindow::spikeScope()
 {
     if (!spikeScopeDialog) {
-        spikeScopeDialog = new SpikeScopeDialog(signalProcessor, signalSources,
+        spikeScopeDialog = new SpikeScopeDialog(displayProcessor, signalSources,
                                                 wavePlot->selectedChannel(), this);
         // add any 'connect' statements here
     }
@@ -3400,6 +3561,8 @@ void MainWindow::loadSettings()
     QVector<QString> dacNamesTemp;
     dacNamesTemp.resize(8);
 
+    // Send all eight DAC configurations to the board in one wire-in update.
+    BoardConfigTransaction dacTransaction(evalBoard);
     for (int i = 0; i < 8; ++i) {
         inStream >> tempQint16;
         dacEnabled[i] = (bool) tempQint16;
@@ -3426,6 +3589,7 @@ void MainWindow::loadSettings()
             }
         }
     }
+    dacTransaction.commit();
     dacButton1->setChecked(true);
     dacEnableCheckBox->setChecked(dacEnabled[0]);
 
@@ -4174,7 +4338,9 @@ bool MainWindow::startNewSaveFile(SaveFormat format)
             return false;
         }
 
-        saveStream = new QDataStream(saveFile);
+        // Data is written to the file by the save stage of the acquisition pipeline.
+        saveFileWriter->startWriting(saveFile);
+        saveStream = new QDataStream(saveFileWriter);
         saveStream->setVersion(QDataStream::Qt_4_8);
 
         // Set to little endian mode for compatibilty with MATLAB,
@@ -4296,6 +4462,10 @@ bool MainWindow::startNewSaveFile(SaveFormat format)
 void MainWindow::closeSaveFile(SaveFormat format) {
     switch (format) {
     case SaveFormatIntan:
+        saveFileWriter->finishWriting();
+        if (saveFileWriter->hadWriteError()) {
+            cerr << "Error in MainWindow::closeSaveFile: could not write all data to " << saveFileName.toStdString() << endl;
+        }
         saveFile->close();
         delete saveStream;
         delete saveFile;
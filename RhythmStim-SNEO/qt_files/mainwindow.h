@@ -24,11 +24,16 @@
 
 #include <QMainWindow>
 #include <queue>
+#include <atomic>
+#include <mutex>
 #include "rhs2000datablock.h"
 #include "rhs2000evalboard.h"
 #include "rhs2000registers.h"
 #include "globalconstants.h"
 #include "stimparameters.h"
+#include "pipeline.h"
+#include "datablockpool.h"
+#include "referencesource.h"
 
 class QAction;
 class QPushButton;
@@ -44,6 +49,10 @@ class QLabel;
 class QFile;
 class WavePlot;
 class SignalProcessor;
+class DisplayFrameBuffer;
+class QTimer;
+class MetricCounter;
+class SaveFileWriter;
 class Rhs2000EvalBoard;
 class SignalSources;
 class SignalGroup;
@@ -70,12 +79,6 @@ class ChargeRecoveryDialog;
 
 using namespace std;
 
-struct ReferenceSource {
-    int stream;
-    int channel;
-    bool softwareMode;
-};
-
 class MainWindow : public QMainWindow
 {
     Q_OBJECT
@@ -135,6 +138,7 @@ private slots:
     void recordInterfaceBoard();
     void triggerRecordInterfaceBoard();
     void stopInterfaceBoard();
+    void updateDisplay();
     void selectBaseFilenameSlot();
     void changeNumFrames(int index);
     void changeYScale(int index);
@@ -204,7 +208,6 @@ private:
     int openInterfaceBoard(bool &expanderBoardDetected);
     void initializeInterfaceBoard();
     void findConnectedAmplifiers();
-    int deviceId(Rhs2000DataBlock *dataBlock, int stream);
 
     void selectBaseFilename(SaveFormat format);
     void updateImpedanceFrequency();
@@ -225,6 +228,8 @@ private:
 
     void setSaveFormat(SaveFormat format);
     bool startNewSaveFile(SaveFormat format);
+    bool openSaveFileFromProcessingThread();
+    void queueDataBlockBatches(const DataBlockHandle* batches, int numBatches, queue<Rhs2000DataBlock> &blockQueue);
     void closeSaveFile(SaveFormat format);
 
     void setHighpassFilterCutoff(double cutoff);
@@ -249,10 +254,11 @@ private:
     int numSpiPorts;
     bool expanderBoardConnected;
 
-    bool running;
-    bool recording;
-    bool triggerSet;
-    bool triggered;
+    // Shared between the GUI thread and the processing thread while running.
+    atomic<bool> running;
+    atomic<bool> recording;
+    atomic<bool> triggerSet;
+    atomic<bool> triggered;
 
     bool saveTtlOut;
     bool saveDcAmps;
@@ -323,13 +329,28 @@ private:
     QVector<int> chipId;
 
     queue<Rhs2000DataBlock> dataQueue;
+    DataBlockPool dataBlockPool;
 
     WavePlot *wavePlot;
     SignalProcessor *signalProcessor;
+    SignalProcessor *displayProcessor;      // waveforms drawn by WavePlot and the Spike Scope
+    DisplayFrameBuffer *displayFrames;
+    QTimer *displayTimer;                   // drives updateDisplay() at DISPLAY_REFRESH_RATE
+    int displayRefreshesToSkip;
+    MetricCounter *displayFramesSkippedMetric;
+    mutex signalProcessorMutex;             // filter settings vs. the processing thread
+    double recordBytesPerMinute;
+
+    // Acquisition pipeline (see runInterfaceBoard())
+    PipelineQueue<DataBlockBatch> parsedBatches;
+    PipelineQueue<DataBlockHandle> freeBatches;     // first block of each unused batch
+    PipelineStage *parseStage;
+    PipelineStage *processStage;
+    PipelineStage *displayStage;
+    SaveFileWriter *saveFileWriter;
 
     UsbDataThread *usbDataThread;
     DataStreamFifo *usbStreamFifo;
-    unsigned char* usbReadBuffer;
 
     SpikeScopeDialog *spikeScopeDialog;
     SpikeDetectorDialog *spikeDetectorDialog; //---
@@ -470,6 +491,7 @@ private:
     QLabel *voltageScaleLabel;
     QLabel *ampTypeLabel;
     QLabel *statusBarLabel;
+    QLabel *usbGlitchLabel;
     QLabel *fifoLagLabel;
     QLabel *fifoFullLabel;
     QLabel *bufferFullLabel;
@@ -0,0 +1,188 @@
+#include <QFile>
+#include <QTimer>
+#include <QDateTime>
+#include <QJsonObject>
+#include <QJsonDocument>
+#include <QLocalServer>
+#include <QLocalSocket>
+#include <iostream>
+
+#include "metricsexporter.h"
+
+// Metrics export thread
+
+MetricsExporter::MetricsExporter(MetricsRegistry *registry_, QObject *parent) :
+    QThread(parent),
+    registry(registry_),
+    intervalSeconds(METRICS_DEFAULT_INTERVAL_SECONDS),
+    csvFormat(false),
+    lastExportMs(0)
+{
+}
+
+MetricsExporter::~MetricsExporter()
+{
+    stop();
+}
+
+// Append exports to fileName_ (CSV if it ends in .csv, JSON lines otherwise).  Call before start().
+void MetricsExporter::setOutputFile(const QString &fileName_)
+{
+    fileName = fileName_;
+    csvFormat = fileName.endsWith(".csv", Qt::CaseInsensitive);
+}
+
+// Serve the latest export on the local socket socketName_.  Call before start().
+void MetricsExporter::setSocketName(const QString &socketName_)
+{
+    socketName = socketName_;
+}
+
+void MetricsExporter::setInterval(double intervalSeconds_)
+{
+    if (intervalSeconds_ <= 0.0) {
+        cerr << "Error in MetricsExporter::setInterval: interval must be positive." << endl;
+        return;
+    }
+    intervalSeconds = intervalSeconds_;
+}
+
+// True if there is anywhere to export to.
+bool MetricsExporter::isConfigured() const
+{
+    return !fileName.isEmpty() || !socketName.isEmpty();
+}
+
+// Export one last time and stop the thread.
+void MetricsExporter::stop()
+{
+    if (QThread::isRunning()) {
+        quit();
+        wait();
+    }
+}
+
+QByteArray MetricsExporter::latestSnapshot() const
+{
+    lock_guard<mutex> lock(snapshotMutex);
+    return snapshot;
+}
+
+void MetricsExporter::run()
+{
+    QFile file(fileName);
+    QFile *outputFile = nullptr;
+    if (!fileName.isEmpty()) {
+        if (file.open(QIODevice::WriteOnly | QIODevice::Append | QIODevice::Text)) {
+            outputFile = &file;
+            if (csvFormat && file.size() == 0) {
+                file.write("time,metric,statistic,value\n");
+            }
+        } else {
+            cerr << "Error in MetricsExporter::run: cannot open " << fileName.toStdString() << " for writing." << endl;
+        }
+    }
+
+    QLocalServer server;
+    if (!socketName.isEmpty()) {
+        QLocalServer::removeServer(socketName);     // left over from a crashed run
+        if (server.listen(socketName)) {
+            connect(&server, &QLocalServer::newConnection, &server, [this, &server] {
+                while (QLocalSocket *client = server.nextPendingConnection()) {
+                    connect(client, &QLocalSocket::disconnected, client, &QObject::deleteLater);
+                    client->write(latestSnapshot());
+                    client->disconnectFromServer();
+                }
+            });
+        } else {
+            cerr << "Error in MetricsExporter::run: cannot listen on " << socketName.toStdString() << ": " <<
+                    server.errorString().toStdString() << endl;
+        }
+    }
+
+    QTimer timer;
+    connect(&timer, &QTimer::timeout, &timer, [this, outputFile] { exportSnapshot(outputFile); });
+    lastExportMs = QDateTime::currentMSecsSinceEpoch();
+    exportSnapshot(outputFile);
+    timer.start((int) (1000.0 * intervalSeconds));
+
+    exec();
+
+    timer.stop();
+    exportSnapshot(outputFile);
+    server.close();
+}
+
+// Read every metric, append the result to file (if not null) and keep it for socket clients.
+// (Private method.)
+void MetricsExporter::exportSnapshot(QFile *file)
+{
+    QDateTime now = QDateTime::currentDateTime();
+    QByteArray time = now.toString(Qt::ISODateWithMs).toUtf8();
+    qint64 nowMs = now.toMSecsSinceEpoch();
+    QJsonObject counters, gauges, histograms;
+    QByteArray csv;
+    vector<unsigned long long> counts;
+
+    auto addCsvRow = [&csv, &time](const string &metric, const char* statistic, double value) {
+        csv += time + "," + QByteArray::fromStdString(metric) + "," + statistic + "," +
+                QByteArray::number(value, 'g', 10) + "\n";
+    };
+
+    registry->visit(
+        [&](const MetricCounter &counter) {
+            counters[QString::fromStdString(counter.getName())] = (double) counter.value();
+            addCsvRow(counter.getName(), "count", (double) counter.value());
+        },
+        [&](const string &name, double value) {
+            gauges[QString::fromStdString(name)] = value;
+            addCsvRow(name, "value", value);
+        },
+        [&](const LatencyHistogram &histogram) {
+            vector<unsigned long long> &previous = previousCounts[histogram.getName()];
+            histogram.snapshot(counts);
+            HistogramSummary interval = LatencyHistogram::summarize(counts, previous);
+            HistogramSummary total = LatencyHistogram::summarize(counts, vector<unsigned long long>());
+            previous.swap(counts);
+
+            QJsonObject summary;
+            summary["unit"] = QString::fromStdString(histogram.getUnit());
+            summary["total"] = (double) total.count;
+            summary["count"] = (double) interval.count;
+            summary["mean"] = interval.mean;
+            summary["p50"] = interval.p50;
+            summary["p90"] = interval.p90;
+            summary["p99"] = interval.p99;
+            summary["p999"] = interval.p999;
+            summary["max"] = interval.max;
+            histograms[QString::fromStdString(histogram.getName())] = summary;
+
+            addCsvRow(histogram.getName(), "total", (double) total.count);
+            addCsvRow(histogram.getName(), "count", (double) interval.count);
+            addCsvRow(histogram.getName(), "mean", interval.mean);
+            addCsvRow(histogram.getName(), "p50", interval.p50);
+            addCsvRow(histogram.getName(), "p90", interval.p90);
+            addCsvRow(histogram.getName(), "p99", interval.p99);
+            addCsvRow(histogram.getName(), "p999", interval.p999);
+            addCsvRow(histogram.getName(), "max", interval.max);
+        });
+
+    QJsonObject root;
+    root["time"] = QString::fromUtf8(time);
+    root["interval_s"] = 0.001 * (nowMs - lastExportMs);
+    root["counters"] = counters;
+    root["gauges"] = gauges;
+    root["histograms"] = histograms;
+    QByteArray json = QJsonDocument(root).toJson(QJsonDocument::Compact) + "\n";
+    lastExportMs = nowMs;
+
+    {
+        lock_guard<mutex> lock(snapshotMutex);
+        snapshot = json;
+    }
+
+    if (file) {
+        file->write(csvFormat ? csv : json);
+        file->flush();
+    }
+}
@@ -0,0 +1,61 @@
+#ifndef METRICSEXPORTER_H
+#define METRICSEXPORTER_H
+
+#include <QThread>
+#include <QString>
+#include <QByteArray>
+#include <map>
+#include <mutex>
+#include <vector>
+#include <string>
+#include "metricsregistry.h"
+
+using namespace std;
+
+class QFile;
+
+#define METRICS_DEFAULT_INTERVAL_SECONDS 10.0
+
+// Thread that exports a MetricsRegistry every few seconds, so that a rig can be monitored over
+// long sessions without looking at the GUI.  Each export is appended to the output file, either
+// as CSV rows (time,metric,statistic,value) if the file name ends in .csv or as one JSON object
+// per line otherwise, and kept as the JSON text served to every client that connects to the
+// local socket (a Unix domain socket; a named pipe on Windows), e.g.
+//     socat - UNIX-CONNECT:/tmp/rhythmstim-metrics
+// Histograms are summarized over the interval since the previous export, with the total count.
+
+class MetricsExporter : public QThread
+{
+
+public:
+    explicit MetricsExporter(MetricsRegistry *registry_, QObject *parent = nullptr);
+    ~MetricsExporter();
+
+    void setOutputFile(const QString &fileName_);
+    void setSocketName(const QString &socketName_);
+    void setInterval(double intervalSeconds_);
+    bool isConfigured() const;
+    void stop();
+
+    QByteArray latestSnapshot() const;
+
+protected:
+    void run() override;
+
+private:
+    void exportSnapshot(QFile *file);
+
+    MetricsRegistry *registry;
+    QString fileName;
+    QString socketName;
+    double intervalSeconds;
+    bool csvFormat;
+
+    map<string, vector<unsigned long long> > previousCounts;    // histogram buckets at the last export
+    qint64 lastExportMs;
+
+    mutable mutex snapshotMutex;
+    QByteArray snapshot;                // latest export, as JSON
+};
+
+#endif // METRICSEXPORTER_H
@@ -0,0 +1,229 @@
+#include "metricsregistry.h"
+
+// Performance metrics registry
+
+MetricCounter::MetricCounter(const string &name_) :
+    name(name_),
+    count(0)
+{
+}
+
+void MetricCounter::add(unsigned long long n)
+{
+    count.fetch_add(n, memory_order_relaxed);
+}
+
+unsigned long long MetricCounter::value() const
+{
+    return count.load(memory_order_relaxed);
+}
+
+const string& MetricCounter::getName() const
+{
+    return name;
+}
+
+MetricGauge::MetricGauge(const string &name_) :
+    name(name_),
+    level(0.0)
+{
+}
+
+void MetricGauge::set(double newValue)
+{
+    level.store(newValue, memory_order_relaxed);
+}
+
+double MetricGauge::value() const
+{
+    return level.load(memory_order_relaxed);
+}
+
+const string& MetricGauge::getName() const
+{
+    return name;
+}
+
+LatencyHistogram::LatencyHistogram(const string &name_, const string &unit_) :
+    name(name_),
+    unit(unit_)
+{
+    for (int i = 0; i < HISTOGRAM_NUM_BUCKETS; ++i) {
+        buckets[i] = 0;
+    }
+}
+
+void LatencyHistogram::record(unsigned long long value)
+{
+    buckets[bucketIndex(value)].fetch_add(1, memory_order_relaxed);
+}
+
+// Copy the current bucket counts (cumulative since the histogram was created) into counts.
+void LatencyHistogram::snapshot(vector<unsigned long long> &counts) const
+{
+    counts.resize(HISTOGRAM_NUM_BUCKETS);
+    for (int i = 0; i < HISTOGRAM_NUM_BUCKETS; ++i) {
+        counts[i] = buckets[i].load(memory_order_relaxed);
+    }
+}
+
+const string& LatencyHistogram::getName() const
+{
+    return name;
+}
+
+const string& LatencyHistogram::getUnit() const
+{
+    return unit;
+}
+
+// Summarize the values recorded between two snapshots (previousCounts may be empty, for
+// everything recorded up to counts).  Values are reported as bucket midpoints.
+HistogramSummary LatencyHistogram::summarize(const vector<unsigned long long> &counts,
+                                             const vector<unsigned long long> &previousCounts)
+{
+    HistogramSummary summary = HistogramSummary();
+    const double quantiles[4] = { 0.5, 0.9, 0.99, 0.999 };
+    double* results[4] = { &summary.p50, &summary.p90, &summary.p99, &summary.p999 };
+    double total = 0.0;
+
+    for (int i = 0; i < (int) counts.size(); ++i) {
+        unsigned long long n = counts[i] - (previousCounts.empty() ? 0 : previousCounts[i]);
+        summary.count += n;
+        total += n * bucketValue(i);
+    }
+    if (summary.count == 0) {
+        return summary;
+    }
+    summary.mean = total / summary.count;
+
+    unsigned long long seen = 0;
+    int quantile = 0;
+    for (int i = 0; i < (int) counts.size(); ++i) {
+        unsigned long long n = counts[i] - (previousCounts.empty() ? 0 : previousCounts[i]);
+        if (n == 0) {
+            continue;
+        }
+        seen += n;
+        while (quantile < 4 && seen >= quantiles[quantile] * summary.count) {
+            *results[quantile++] = bucketValue(i);
+        }
+        summary.max = bucketValue(i);
+    }
+    return summary;
+}
+
+int LatencyHistogram::bucketIndex(unsigned long long value)
+{
+    if (value < 32) {
+        return (int) value;
+    }
+    int shift = 63 - __builtin_clzll(value) - 4;
+    return 16 * shift + (int) (value >> shift);
+}
+
+// Midpoint of the values falling in bucket index.
+double LatencyHistogram::bucketValue(int index)
+{
+    if (index < 32) {
+        return index;
+    }
+    int shift = index / 16 - 1;
+    double lowerBound = (double) (index % 16 + 16) * (double) (1ULL << shift);
+    return lowerBound + 0.5 * ((double) (1ULL << shift) - 1.0);
+}
+
+MetricsRegistry::MetricsRegistry()
+{
+}
+
+MetricsRegistry* MetricsRegistry::global()
+{
+    static MetricsRegistry registry;
+    return &registry;
+}
+
+// Return the counter called name, creating it if needed.
+MetricCounter* MetricsRegistry::counter(const string &name)
+{
+    lock_guard<mutex> lock(registryMutex);
+    for (unsigned int i = 0; i < counters.size(); ++i) {
+        if (counters[i]->getName() == name) {
+            return counters[i].get();
+        }
+    }
+    counters.emplace_back(new MetricCounter(name));
+    return counters.back().get();
+}
+
+// Return the gauge called name, creating it if needed.
+MetricGauge* MetricsRegistry::gauge(const string &name)
+{
+    lock_guard<mutex> lock(registryMutex);
+    for (unsigned int i = 0; i < gauges.size(); ++i) {
+        if (gauges[i]->getName() == name) {
+            return gauges[i].get();
+        }
+    }
+    gauges.emplace_back(new MetricGauge(name));
+    return gauges.back().get();
+}
+
+// Return the histogram called name, creating it with the given unit if needed.
+LatencyHistogram* MetricsRegistry::histogram(const string &name, const string &unit)
+{
+    lock_guard<mutex> lock(registryMutex);
+    for (unsigned int i = 0; i < histograms.size(); ++i) {
+        if (histograms[i]->getName() == name) {
+            return histograms[i].get();
+        }
+    }
+    histograms.emplace_back(new LatencyHistogram(name, unit));
+    return histograms.back().get();
+}
+
+// Export the value returned by sample as the gauge called name (replacing any earlier callback).
+// sample is called on the exporter's thread and must stay valid until removeSampledGauge().
+void MetricsRegistry::setSampledGauge(const string &name, const function<double()> &sample)
+{
+    lock_guard<mutex> lock(registryMutex);
+    for (unsigned int i = 0; i < sampledGauges.size(); ++i) {
+        if (sampledGauges[i].first == name) {
+            sampledGauges[i].second = sample;
+            return;
+        }
+    }
+    sampledGauges.push_back(make_pair(name, sample));
+}
+
+void MetricsRegistry::removeSampledGauge(const string &name)
+{
+    lock_guard<mutex> lock(registryMutex);
+    for (unsigned int i = 0; i < sampledGauges.size(); ++i) {
+        if (sampledGauges[i].first == name) {
+            sampledGauges.erase(sampledGauges.begin() + i);
+            return;
+        }
+    }
+}
+
+// Call the visitors for every metric, in order of creation.  Gauges and sampled gauges are
+// both passed to visitGauge.
+void MetricsRegistry::visit(const function<void(const MetricCounter&)> &visitCounter,
+                            const function<void(const string&, double)> &visitGauge,
+                            const function<void(const LatencyHistogram&)> &visitHistogram)
+{
+    lock_guard<mutex> lock(registryMutex);
+    for (unsigned int i = 0; i < counters.size(); ++i) {
+        visitCounter(*counters[i]);
+    }
+    for (unsigned int i = 0; i < gauges.size(); ++i) {
+        visitGauge(gauges[i]->getName(), gauges[i]->value());
+    }
+    for (unsigned int i = 0; i < sampledGauges.size(); ++i) {
+        visitGauge(sampledGauges[i].first, sampledGauges[i].second());
+    }
+    for (unsigned int i = 0; i < histograms.size(); ++i) {
+        visitHistogram(*histograms[i]);
+    }
+}
@@ -0,0 +1,119 @@
+#ifndef METRICSREGISTRY_H
+#define METRICSREGISTRY_H
+
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <functional>
+#include <memory>
+
+using namespace std;
+
+// Log-linear buckets: values 0-31 exactly, then 16 buckets per power of two, so every
+// recorded value is within 1/16 (6%) of its bucket, up to 2^64.
+#define HISTOGRAM_NUM_BUCKETS 976
+
+// Monotonic event count.
+class MetricCounter
+{
+
+public:
+    MetricCounter(const string &name_);
+
+    void add(unsigned long long n = 1);
+    unsigned long long value() const;
+    const string& getName() const;
+
+private:
+    string name;
+    atomic<unsigned long long> count;
+};
+
+// Last value of a level, e.g. a buffer fill.
+class MetricGauge
+{
+
+public:
+    MetricGauge(const string &name_);
+
+    void set(double newValue);
+    double value() const;
+    const string& getName() const;
+
+private:
+    string name;
+    atomic<double> level;
+};
+
+// Summary of the values recorded in a histogram over some period.
+struct HistogramSummary
+{
+    unsigned long long count;
+    double mean;
+    double p50;
+    double p90;
+    double p99;
+    double p999;
+    double max;
+};
+
+// HDR-style histogram of non-negative integer values (latencies in microseconds, backlogs in
+// words, ...).  record() is wait-free and may be called from any thread; readers copy the
+// bucket counts with snapshot() and summarize the difference between two snapshots.
+
+class LatencyHistogram
+{
+
+public:
+    LatencyHistogram(const string &name_, const string &unit_);
+
+    void record(unsigned long long value);
+    void snapshot(vector<unsigned long long> &counts) const;
+    const string& getName() const;
+    const string& getUnit() const;
+
+    static HistogramSummary summarize(const vector<unsigned long long> &counts,
+                                      const vector<unsigned long long> &previousCounts);
+    static int bucketIndex(unsigned long long value);
+    static double bucketValue(int index);
+
+private:
+    string name;
+    string unit;
+    atomic<unsigned long long> buckets[HISTOGRAM_NUM_BUCKETS];
+};
+
+// Process-wide set of named metrics.  Metrics are created on first use and live until the
+// program exits, so components look them up once (e.g. in their constructor) and keep the
+// pointer; updating a metric then takes no lock.  Sampled gauges are read through a callback
+// each time the registry is exported, for levels that already live in another object.
+
+class MetricsRegistry
+{
+
+public:
+    static MetricsRegistry* global();
+
+    MetricCounter* counter(const string &name);
+    MetricGauge* gauge(const string &name);
+    LatencyHistogram* histogram(const string &name, const string &unit);
+    void setSampledGauge(const string &name, const function<double()> &sample);
+    void removeSampledGauge(const string &name);
+
+    // For exporters
+    void visit(const function<void(const MetricCounter&)> &visitCounter,
+               const function<void(const string&, double)> &visitGauge,
+               const function<void(const LatencyHistogram&)> &visitHistogram);
+
+private:
+    MetricsRegistry();
+
+    mutex registryMutex;
+    vector<unique_ptr<MetricCounter> > counters;
+    vector<unique_ptr<MetricGauge> > gauges;
+    vector<unique_ptr<LatencyHistogram> > histograms;
+    vector<pair<string, function<double()> > > sampledGauges;
+};
+
+#endif // METRICSREGISTRY_H
@@ -0,0 +1,509 @@
+#include <QFileInfo>
+#include <QDir>
+#include <iostream>
+#include <iomanip>
+#include <thread>
+#include <chrono>
+#include <algorithm>
+#include <cmath>
+
+#include "offlineredetector.h"
+#include "replaysource.h"
+#include "usbdeinterleaver.h"
+
+// Offline spike re-detection in recorded data files
+
+#define DEFAULT_CHUNK_SECONDS 60.0
+#define DEFAULT_WARM_UP_WINDOWS 8
+#define PORT_D 3
+
+long long OfflineRedetector::GroupDetector::getThreshold(int channel) const
+{
+    return channelParallel ? detector.getThreshold(channel) : model.getThreshold(channel);
+}
+
+// Settings start as the defaults of SpikeDetectorDialog: threshold 5.5 times the RMS, 10 ms blind
+// window, all channels enabled.
+OfflineRedetector::OfflineRedetector()
+{
+    thresholdMult = 11;
+    blindWindow = 10;
+    for (int port = 0; port < REDETECT_MAX_GROUPS; ++port) {
+        disabledChannels[port] = 0;
+    }
+    hardwareIds = false;
+    chunkSeconds = DEFAULT_CHUNK_SECONDS;
+    warmUpWindows = DEFAULT_WARM_UP_WINDOWS;
+    overwrite = false;
+
+    channelSamples = 0;
+    warmUpChannelSamples = 0;
+    busyNs = 0;
+    recordingSeconds = 0.0;
+    wallSeconds = 0.0;
+    numWorkers = 0;
+}
+
+OfflineRedetector::~OfflineRedetector()
+{
+    for (Recording *recording : recordings) {
+        delete recording;
+    }
+}
+
+// Threshold multiplier times two, as written to wire-in 0x15.
+void OfflineRedetector::setThresholdMult(int thresholdMult_)
+{
+    thresholdMult = thresholdMult_ & 0xff;
+}
+
+// Blind window after stimulation, in milliseconds.
+void OfflineRedetector::setBlindWindow(int blindWindow_)
+{
+    blindWindow = blindWindow_ & 0xff;
+}
+
+// Channels of SPI port port (0-3) whose spikes are not reported, one bit per channel numbered
+// as in the port's detector (stream of the port * 16 + channel).
+void OfflineRedetector::setDisabledChannels(int port, unsigned int channels)
+{
+    if (port >= 0 && port < REDETECT_MAX_GROUPS) {
+        disabledChannels[port] = channels;
+    }
+}
+
+// Detect on port D only, with the channel IDs and file name of the FPGA detector's records.
+void OfflineRedetector::setHardwareIds(bool hardwareIds_)
+{
+    hardwareIds = hardwareIds_;
+}
+
+// Length of the time chunks recordings are split into, rounded to whole RMS windows; zero or
+// less runs each file's detector groups from start to end without splitting.
+void OfflineRedetector::setChunkSeconds(double seconds)
+{
+    chunkSeconds = seconds;
+}
+
+// RMS windows (2^15 samples) run before each chunk to settle the detector.
+void OfflineRedetector::setWarmUpWindows(int windows)
+{
+    warmUpWindows = qMax(1, windows);
+}
+
+// Write the detection files to directory rather than next to the recordings.
+void OfflineRedetector::setOutputDirectory(const QString &directory)
+{
+    outputDirectory = directory;
+}
+
+// Replace existing detection files; otherwise a file whose output exists is skipped.
+void OfflineRedetector::setOverwrite(bool overwrite_)
+{
+    overwrite = overwrite_;
+}
+
+// Re-detect spikes in every file of fileNames, on numThreads worker threads (0: one per core).
+// Returns false if any file could not be read or written; the others are still done.
+bool OfflineRedetector::run(const QStringList &fileNames, int numThreads)
+{
+    if (hardwareIds && outputDirectory.isEmpty()) {
+        cerr << "Error in OfflineRedetector::run: detections with hardware channel IDs need an output directory." <<
+                endl;
+        return false;
+    }
+
+    bool ok = true;
+    recordingSeconds = 0.0;
+    for (const QString &fileName : fileNames) {
+        Recording *recording = new Recording();
+        recording->fileName = fileName;
+        recording->firstTask = (int) tasks.size();
+        recording->numChunks = 0;
+        recording->nextChunkToWrite = 0;
+        recording->failed = false;
+        recording->numEvents = 0;
+        recording->numBoundaries = 0;
+        recording->numUnsettledBoundaries = 0;
+        recording->maxThresholdDeviation = 0.0;
+        recordings.push_back(recording);
+        if (!prepare(*recording)) {
+            recording->failed = true;
+            ok = false;
+            continue;
+        }
+        recordingSeconds += recording->numSamples / recording->sampleRate;
+    }
+    if (tasks.empty()) {
+        return ok;
+    }
+
+    numWorkers = (numThreads > 0) ? numThreads : (int) qMax(1u, thread::hardware_concurrency());
+    numWorkers = qMin(numWorkers, (int) tasks.size());
+    taskQueue.setCapacity((int) tasks.size());
+    for (int i = 0; i < (int) tasks.size(); ++i) {
+        taskQueue.push(i);
+    }
+    taskQueue.close();
+
+    auto start = chrono::steady_clock::now();
+    vector<thread> workers;
+    for (int i = 0; i < numWorkers; ++i) {
+        workers.push_back(thread(&OfflineRedetector::runWorker, this));
+    }
+    for (thread &worker : workers) {
+        worker.join();
+    }
+    wallSeconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+    for (Recording *recording : recordings) {
+        recording->outputFile.close();
+        if (recording->failed || recording->nextChunkToWrite < recording->numChunks) {
+            ok = false;
+        }
+    }
+    return ok;
+}
+
+void OfflineRedetector::printStatistics() const
+{
+    for (const Recording *recording : recordings) {
+        if (recording->numChunks == 0) {
+            continue;
+        }
+        cout << recording->outputFileName.toStdString() << ": " << recording->numEvents << " detections, " <<
+                recording->numChunks << " chunks of " << recording->numGroups << " detector groups" <<
+                (recording->failed ? " (FAILED)" : "") << endl;
+        if (recording->numBoundaries > 0) {
+            cout << "    thresholds after warm-up off at " << recording->numUnsettledBoundaries << " of " <<
+                    recording->numBoundaries << " chunk boundaries, by up to " <<
+                    100.0 * recording->maxThresholdDeviation << "%" << endl;
+        }
+    }
+
+    double busySeconds = 1.0e-9 * busyNs;
+    unsigned long long runChannelSamples = channelSamples + warmUpChannelSamples;
+    cout << "Re-detected " << recordingSeconds << " s of recordings in " << wallSeconds << " s on " << numWorkers <<
+            " threads (" << fixed << setprecision(1) << ((wallSeconds > 0.0) ? recordingSeconds / wallSeconds : 0.0) <<
+            " x real time): " << ((wallSeconds > 0.0) ? 1.0e-6 * channelSamples / wallSeconds : 0.0) <<
+            " million channel samples/s, " << ((busySeconds > 0.0) ? 1.0e-6 * channelSamples / busySeconds : 0.0) <<
+            " million per core, " << ((runChannelSamples > 0) ? 100.0 * warmUpChannelSamples / runChannelSamples : 0.0) <<
+            "% of samples run for warm-up" << endl;
+    cout.unsetf(ios::fixed);
+}
+
+// Read the header of a recording, find its detector groups, create its tasks and open its
+// output file.  Returns false (and prints why) on error.  (Private method.)
+bool OfflineRedetector::prepare(Recording &recording)
+{
+    ReplaySource source;
+    if (!source.open(recording.fileName, true)) {
+        return false;
+    }
+    recording.sampleRate = source.getSampleRate();
+    recording.numSamples = source.getNumSamples();
+
+    // The two data streams of each SPI port, as in HeadlessAcquisition::findConnectedAmplifiers().
+    recording.numGroups = 0;
+    for (int port = hardwareIds ? PORT_D : 0; port < REDETECT_MAX_GROUPS; ++port) {
+        int firstStream = -1, numStreams = 0;
+        for (int stream = 2 * port; stream < 2 * port + SPIKE_MODEL_PORTS; ++stream) {
+            if (source.hasChipOnStream(stream)) {
+                if (firstStream < 0) {
+                    firstStream = stream;
+                }
+                numStreams++;
+            }
+        }
+        if (numStreams > 0) {
+            recording.groupPort[recording.numGroups] = port;
+            recording.groupFirstStream[recording.numGroups] = firstStream;
+            recording.groupNumStreams[recording.numGroups] = numStreams;
+            recording.numGroups++;
+        }
+    }
+    if (recording.numGroups == 0) {
+        cerr << "Error in OfflineRedetector::prepare: " << recording.fileName.toStdString() << " has no amplifier " <<
+                (hardwareIds ? "channels on port D." : "channels.") << endl;
+        return false;
+    }
+
+    QFileInfo fileInfo(recording.fileName);
+    QString outputName = fileInfo.completeBaseName() + (hardwareIds ? "_HW_detections.rhs" : "_SW_detections.rhs");
+    recording.outputFileName = QDir(outputDirectory.isEmpty() ? fileInfo.path() : outputDirectory).filePath(outputName);
+    if (!overwrite && QFileInfo::exists(recording.outputFileName)) {
+        cerr << "Error in OfflineRedetector::prepare: " << recording.outputFileName.toStdString() <<
+                " exists; not overwritten." << endl;
+        return false;
+    }
+    recording.outputFile.setFileName(recording.outputFileName);
+    if (!recording.outputFile.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+        cerr << "Error in OfflineRedetector::prepare: cannot open " << recording.outputFileName.toStdString() << endl;
+        return false;
+    }
+
+    const unsigned long long window = 1ULL << SPIKE_MODEL_RMS_SAMPLES_EXP;
+    unsigned long long chunkSamples = qMax(1LL, qRound64(chunkSeconds * recording.sampleRate / window)) * window;
+    if (chunkSeconds <= 0.0) {
+        chunkSamples = qMax(recording.numSamples, 1ULL);
+    }
+    recording.numChunks = (int) qMax(1ULL, (recording.numSamples + chunkSamples - 1) / chunkSamples);
+
+    for (int chunk = 0; chunk < recording.numChunks; ++chunk) {
+        for (int group = 0; group < recording.numGroups; ++group) {
+            Task task;
+            task.recording = (int) recordings.size() - 1;
+            task.group = group;
+            task.chunk = chunk;
+            task.startSample = chunk * chunkSamples;
+            task.endSample = qMin(task.startSample + chunkSamples, recording.numSamples);
+            task.done = false;
+            task.ok = false;
+            task.firstTimeStamp = 0;
+            for (int channel = 0; channel < SPIKE_MODEL_CHANNELS; ++channel) {
+                task.startThresholds[channel] = 0;
+                task.endThresholds[channel] = 0;
+            }
+            tasks.push_back(task);
+        }
+    }
+
+    cout << "Re-detecting " << recording.fileName.toStdString() << ": " << source.getNumAmplifierChannels() <<
+            " amplifier channels in " << recording.numGroups << " detector groups, " <<
+            recording.numSamples / recording.sampleRate << " s at " << recording.sampleRate << " S/s, " <<
+            recording.numChunks << " chunks" << endl;
+    return true;
+}
+
+// Worker thread: run tasks until none are left, writing out each recording's chunks as they
+// complete in order.  (Private method.)
+void OfflineRedetector::runWorker()
+{
+    SamplePlanes planes;
+    GroupDetector detector;
+    int index;
+
+    while (taskQueue.pop(index)) {
+        auto start = chrono::steady_clock::now();
+        Task &task = tasks[index];
+        Recording &recording = *recordings[task.recording];
+
+        resetDetector(recording, task.group, detector);
+        bool ok = runTask(task, detector, planes);
+
+        lock_guard<mutex> lock(recording.writeMutex);
+        task.ok = ok;
+        task.done = true;
+        finishChunks(recording);
+        busyNs += chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - start).count();
+    }
+}
+
+// Run a task's chunk through detector, after the warm-up, keeping the thresholds at both ends.
+// Records go to task.records.  Returns false (and prints why) if the recording could not be
+// read.  (Private method.)
+bool OfflineRedetector::runTask(Task &task, GroupDetector &detector, SamplePlanes &planes)
+{
+    const Recording &recording = *recordings[task.recording];
+    int numStreams = recording.groupNumStreams[task.group];
+    unsigned long long numChannels = numStreams * SPIKE_MODEL_CHANNELS_PER_PORT;
+    unsigned short idOffset = hardwareIds ? 0 : (unsigned short) ((recording.groupPort[task.group] *
+                                                                   SPIKE_MODEL_CHANNELS) << 8);
+
+    ReplaySource source;
+    if (!source.open(recording.fileName, true)) {
+        return false;
+    }
+    unsigned long long warmUpSamples = (unsigned long long) warmUpWindows << SPIKE_MODEL_RMS_SAMPLES_EXP;
+    unsigned long long sample = (task.startSample > warmUpSamples) ? task.startSample - warmUpSamples : 0;
+    source.skipSamples(sample);
+    planes.allocate(numStreams, REDETECT_READ_SAMPLES);
+
+    // Warm-up: detections are dropped.
+    task.records.clear();
+    while (sample < task.startSample) {
+        int numSamples = (int) qMin((unsigned long long) REDETECT_READ_SAMPLES, task.startSample - sample);
+        if (source.readPlanes(planes, recording.groupFirstStream[task.group], numSamples) < numSamples) {
+            cerr << "Error in OfflineRedetector::runTask: cannot read " << recording.fileName.toStdString() << endl;
+            return false;
+        }
+        detect(detector, planes, numSamples, task.records);
+        task.records.clear();
+        sample += numSamples;
+        warmUpChannelSamples += numSamples * numChannels;
+    }
+    for (int channel = 0; channel < SPIKE_MODEL_CHANNELS; ++channel) {
+        task.startThresholds[channel] = detector.getThreshold(channel);
+    }
+
+    while (sample < task.endSample) {
+        int numSamples = (int) qMin((unsigned long long) REDETECT_READ_SAMPLES, task.endSample - sample);
+        if (source.readPlanes(planes, recording.groupFirstStream[task.group], numSamples) < numSamples) {
+            cerr << "Error in OfflineRedetector::runTask: cannot read " << recording.fileName.toStdString() << endl;
+            return false;
+        }
+        if (sample == task.startSample) {
+            task.firstTimeStamp = planes.timeStamp[0];
+        }
+        size_t firstRecord = task.records.size();
+        detect(detector, planes, numSamples, task.records);
+        for (size_t i = firstRecord + 1; i < task.records.size(); i += SPIKE_MODEL_RECORD_WORDS) {
+            task.records[i] += idOffset;
+        }
+        sample += numSamples;
+        channelSamples += numSamples * numChannels;
+    }
+    for (int channel = 0; channel < SPIKE_MODEL_CHANNELS; ++channel) {
+        task.endThresholds[channel] = detector.getThreshold(channel);
+    }
+    return true;
+}
+
+// Set detector up from reset for a group of recording, with the run's settings.
+// (Private method.)
+void OfflineRedetector::resetDetector(const Recording &recording, int group, GroupDetector &detector) const
+{
+    int port = recording.groupPort[group];
+
+    detector = GroupDetector();
+    detector.channelParallel = (recording.groupNumStreams[group] == SPIKE_MODEL_PORTS);
+    detector.firstPort = recording.groupFirstStream[group] % SPIKE_MODEL_PORTS;
+    if (detector.channelParallel) {
+        detector.detector.setThresholdMult(thresholdMult);
+        detector.detector.setBlindWindow(blindWindow);
+        detector.detector.setDisabledChannels(disabledChannels[port]);
+    } else {
+        // A port's only stream is the FPGA detector's port 0 or 1, as it is the port's first or second.
+        detector.model.setPortEnabled(0, detector.firstPort == 0);
+        detector.model.setPortEnabled(1, detector.firstPort == 1);
+        detector.model.setThresholdMult(thresholdMult);
+        detector.model.setBlindWindow(blindWindow);
+        detector.model.setDisabledChannels(disabledChannels[port]);
+        detector.model.reset();
+    }
+    detector.stimTriggers.assign(REDETECT_READ_SAMPLES, 0);
+}
+
+// Run the first numSamples samples of planes (the group's streams) through detector, appending
+// its records.  Stimulation on any of the group's streams starts the blind window, as on the
+// FPGA.  Returns the number of records.  (Private method.)
+int OfflineRedetector::detect(GroupDetector &detector, const SamplePlanes &planes, int numSamples,
+                              vector<unsigned short> &records)
+{
+    const short* samples[SPIKE_MODEL_CHANNELS];
+
+    for (int port = 0; port < SPIKE_MODEL_PORTS; ++port) {
+        int stream = port - detector.firstPort;
+        for (int channel = 0; channel < SPIKE_MODEL_CHANNELS_PER_PORT; ++channel) {
+            samples[port * SPIKE_MODEL_CHANNELS_PER_PORT + channel] = (stream >= 0 && stream < planes.numDataStreams) ?
+                        planes.amplifierPlane(stream, channel) : nullptr;
+        }
+    }
+    const unsigned short* stimOn0 = planes.stimFlagPlane(0, StimFlagOn);
+    const unsigned short* stimOn1 = planes.stimFlagPlane(planes.numDataStreams - 1, StimFlagOn);
+    for (int t = 0; t < numSamples; ++t) {
+        detector.stimTriggers[t] = (stimOn0[t] | stimOn1[t]) != 0;
+    }
+
+    if (detector.channelParallel) {
+        return detector.detector.process(samples, planes.timeStamp.data(), detector.stimTriggers.data(), numSamples,
+                                         records);
+    }
+    return detector.model.process(samples, planes.timeStamp.data(), detector.stimTriggers.data(), numSamples,
+                                  records);
+}
+
+// Write out the chunks of recording whose tasks are all done, in order, and note how far each
+// chunk's thresholds after its warm-up are from those the chunk before ended with.  Called with
+// writeMutex held.  (Private method.)
+void OfflineRedetector::finishChunks(Recording &recording)
+{
+    while (recording.nextChunkToWrite < recording.numChunks) {
+        int chunk = recording.nextChunkToWrite;
+        Task* chunkTasks = &tasks[recording.firstTask + chunk * recording.numGroups];
+        for (int group = 0; group < recording.numGroups; ++group) {
+            if (!chunkTasks[group].done) {
+                return;
+            }
+        }
+
+        for (int group = 0; group < recording.numGroups; ++group) {
+            const Task &task = chunkTasks[group];
+            if (!task.ok) {
+                recording.failed = true;
+            }
+            if (chunk == 0 || recording.failed) {
+                continue;
+            }
+            const Task &previous = chunkTasks[group - recording.numGroups];
+            bool settled = true;
+            for (int channel = 0; channel < SPIKE_MODEL_CHANNELS; ++channel) {
+                long long expected = previous.endThresholds[channel];
+                if (task.startThresholds[channel] != expected) {
+                    settled = false;
+                    double deviation = fabs((double) (task.startThresholds[channel] - expected)) / qMax(1LL, expected);
+                    recording.maxThresholdDeviation = qMax(recording.maxThresholdDeviation, deviation);
+                }
+            }
+            recording.numBoundaries++;
+            if (!settled) {
+                recording.numUnsettledBoundaries++;
+            }
+        }
+
+        if (!recording.failed && !writeChunk(recording, chunk)) {
+            recording.failed = true;
+        }
+        for (int group = 0; group < recording.numGroups; ++group) {
+            vector<unsigned short>().swap(chunkTasks[group].records);
+        }
+        recording.nextChunkToWrite++;
+    }
+    recording.outputFile.close();
+}
+
+// Append the records of a chunk to the recording's output file as little-endian words, the
+// groups merged in sample order (each group's records already are).  (Private method.)
+bool OfflineRedetector::writeChunk(Recording &recording, int chunk)
+{
+    const Task* chunkTasks = &tasks[recording.firstTask + chunk * recording.numGroups];
+    size_t position[REDETECT_MAX_GROUPS];
+    size_t numWords = 0;
+    for (int group = 0; group < recording.numGroups; ++group) {
+        position[group] = 0;
+        numWords += chunkTasks[group].records.size();
+    }
+
+    // Samples since the chunk's first, from the DT words (timestamp - 1).
+    unsigned int base = chunkTasks[0].firstTimeStamp - 1;
+    auto sampleOf = [base](const unsigned short* record) -> unsigned int {
+        return ((((unsigned int) record[2]) << 16) | record[3]) - base;
+    };
+
+    vector<char> bytes(2 * numWords);
+    for (size_t word = 0; word < numWords; word += SPIKE_MODEL_RECORD_WORDS) {
+        int next = -1;
+        for (int group = 0; group < recording.numGroups; ++group) {
+            const vector<unsigned short> &records = chunkTasks[group].records;
+            if (position[group] < records.size() &&
+                    (next < 0 || sampleOf(&records[position[group]]) <
+                     sampleOf(&chunkTasks[next].records[position[next]]))) {
+                next = group;
+            }
+        }
+        const unsigned short* record = &chunkTasks[next].records[position[next]];
+        for (int i = 0; i < SPIKE_MODEL_RECORD_WORDS; ++i) {
+            bytes[2 * (word + i)] = (char) (record[i] & 0xff);
+            bytes[2 * (word + i) + 1] = (char) (record[i] >> 8);
+        }
+        position[next] += SPIKE_MODEL_RECORD_WORDS;
+    }
+
+    recording.numEvents += numWords / SPIKE_MODEL_RECORD_WORDS;
+    if (recording.outputFile.write(bytes.data(), (qint64) bytes.size()) != (qint64) bytes.size()) {
+        cerr << "Error in OfflineRedetector::writeChunk: cannot write " << recording.outputFileName.toStdString() <<
+                endl;
+        return false;
+    }
+    return true;
+}
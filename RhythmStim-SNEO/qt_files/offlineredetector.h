@@ -0,0 +1,151 @@
+#ifndef OFFLINEREDETECTOR_H
+#define OFFLINEREDETECTOR_H
+
+#include <QString>
+#include <QStringList>
+#include <QFile>
+#include <vector>
+#include <mutex>
+#include <atomic>
+#include "pipeline.h"
+#include "spikedetectormodel.h"
+#include "sneodetector.h"
+
+using namespace std;
+
+struct SamplePlanes;
+
+// Detector groups of a recording: one per SPI port, as in HostSpikeDetector.
+#define REDETECT_MAX_GROUPS 4
+// Samples read from a recording at a time.
+#define REDETECT_READ_SAMPLES (1 << SPIKE_MODEL_RMS_SAMPLES_EXP)
+
+// Batch re-detection of spikes in recorded Intan format (.rhs) files, with the FPGA detector's
+// algorithm and any threshold, blind window and disabled channels.  As in HostSpikeDetector, each
+// SPI port with amplifiers is one detector group: a SneoDetector for a port with two data streams,
+// a SpikeDetectorModel for a port with one.  Detector state starts from reset at the first sample
+// of each file, as if the FPGA detector had been enabled when recording started.
+//
+// Work is split three ways and run on a pool of worker threads: across files, across the detector
+// groups of a file, and across time chunks of a group.  A chunk starts at a multiple of the 2^15
+// sample RMS window, so thresholds are renewed at the same samples as in one continuous run.  It
+// is preceded by a warm-up of a few RMS windows, run through the detector but not reported, which
+// settles the filters and the RMS threshold.  The settling is close but not exact: the fixed-point
+// high-pass keeps LSB differences for a long time, and each threshold feeds into the next through
+// the energy above it.  With the default eight windows, thresholds after the warm-up are
+// typically within a fraction of a percent of those of a continuous run (fewer windows may leave
+// them far off), and detections with peaks that close to threshold may differ.  Each chunk's
+// thresholds after its warm-up are compared with those the chunk before ended with, and the
+// largest difference is reported.  Without chunks (chunk length zero), each file's groups run
+// from start to end and the records are exactly those of the FPGA detector started with the
+// recording.
+//
+// Chunks are written in order as they complete, the groups of a chunk merged by sample, so memory
+// stays bounded on long recordings.  Records are in the pipe 0xa1 format of _HW_detections.rhs
+// files, with the channel IDs of HostSpikeDetector (port * 32 + stream of the port * 16 +
+// channel), saved as <name>_SW_detections.rhs.  With hardware IDs, only port D is detected and
+// its records carry the FPGA detector's channel IDs 0-31, in <name>_HW_detections.rhs; give an
+// output directory then, so that the recording's own hardware detections are not replaced.
+
+class OfflineRedetector
+{
+
+public:
+    OfflineRedetector();
+    ~OfflineRedetector();
+
+    void setThresholdMult(int thresholdMult_);
+    void setBlindWindow(int blindWindow_);
+    void setDisabledChannels(int port, unsigned int channels);
+    void setHardwareIds(bool hardwareIds_);
+    void setChunkSeconds(double seconds);
+    void setWarmUpWindows(int windows);
+    void setOutputDirectory(const QString &directory);
+    void setOverwrite(bool overwrite_);
+
+    bool run(const QStringList &fileNames, int numThreads = 0);
+    void printStatistics() const;
+
+private:
+    // The detector of one group, for the length of one chunk.
+    struct GroupDetector
+    {
+        long long getThreshold(int channel) const;
+
+        bool channelParallel;               // SneoDetector; otherwise a one-stream SpikeDetectorModel
+        int firstPort;                      // detector port of the group's first stream
+        SneoDetector detector;
+        SpikeDetectorModel model;
+        vector<unsigned char> stimTriggers;
+    };
+
+    struct Recording
+    {
+        QString fileName;
+        QString outputFileName;
+        double sampleRate;
+        unsigned long long numSamples;
+        int numGroups;
+        int groupPort[REDETECT_MAX_GROUPS];
+        int groupFirstStream[REDETECT_MAX_GROUPS];  // hardware data stream
+        int groupNumStreams[REDETECT_MAX_GROUPS];
+        int numChunks;
+        int firstTask;
+
+        mutex writeMutex;                   // guards the fields below and the tasks' results
+        QFile outputFile;
+        int nextChunkToWrite;
+        bool failed;
+        unsigned long long numEvents;
+        int numBoundaries;                  // chunk boundaries of all groups
+        int numUnsettledBoundaries;         // with thresholds off after the warm-up
+        double maxThresholdDeviation;       // relative to the continuous run's threshold
+    };
+
+    // One group of one recording over one chunk.
+    struct Task
+    {
+        int recording;
+        int group;
+        int chunk;
+        unsigned long long startSample;
+        unsigned long long endSample;
+
+        bool done;
+        bool ok;
+        unsigned int firstTimeStamp;
+        long long startThresholds[SPIKE_MODEL_CHANNELS];    // after the warm-up
+        long long endThresholds[SPIKE_MODEL_CHANNELS];
+        vector<unsigned short> records;
+    };
+
+    bool prepare(Recording &recording);
+    void runWorker();
+    bool runTask(Task &task, GroupDetector &detector, SamplePlanes &planes);
+    void resetDetector(const Recording &recording, int group, GroupDetector &detector) const;
+    int detect(GroupDetector &detector, const SamplePlanes &planes, int numSamples, vector<unsigned short> &records);
+    void finishChunks(Recording &recording);
+    bool writeChunk(Recording &recording, int chunk);
+
+    int thresholdMult;
+    int blindWindow;
+    unsigned int disabledChannels[REDETECT_MAX_GROUPS];
+    bool hardwareIds;
+    double chunkSeconds;
+    int warmUpWindows;
+    QString outputDirectory;
+    bool overwrite;
+
+    vector<Recording*> recordings;
+    vector<Task> tasks;
+    PipelineQueue<int> taskQueue;
+
+    atomic<unsigned long long> channelSamples;          // reported, over all groups
+    atomic<unsigned long long> warmUpChannelSamples;    // run, not reported
+    atomic<long long> busyNs;                           // summed over worker threads
+    double recordingSeconds;
+    double wallSeconds;
+    int numWorkers;
+};
+
+#endif // OFFLINEREDETECTOR_H
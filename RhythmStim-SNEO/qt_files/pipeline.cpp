@@ -0,0 +1,143 @@
+#include <iostream>
+#include <iomanip>
+
+#include "pipeline.h"
+#include "metricsregistry.h"
+
+// Acquisition pipeline queues and stage statistics
+
+PipelineQueueBase::PipelineQueueBase()
+{
+    queueCapacity = 0;
+    count = 0;
+    highWater = 0;
+    blockedPushes = 0;
+    blockedPops = 0;
+    closed = false;
+}
+
+// Wake up and turn away all waiting stages, e.g. when acquisition stops.
+void PipelineQueueBase::close()
+{
+    lock_guard<mutex> lock(queueMutex);
+    closed = true;
+    notEmpty.notify_all();
+    notFull.notify_all();
+}
+
+bool PipelineQueueBase::isClosed() const
+{
+    lock_guard<mutex> lock(queueMutex);
+    return closed;
+}
+
+int PipelineQueueBase::capacity() const
+{
+    lock_guard<mutex> lock(queueMutex);
+    return queueCapacity;
+}
+
+int PipelineQueueBase::depth() const
+{
+    lock_guard<mutex> lock(queueMutex);
+    return count;
+}
+
+int PipelineQueueBase::maxDepth() const
+{
+    lock_guard<mutex> lock(queueMutex);
+    return highWater;
+}
+
+// Number of pushes that found the queue full (the consumer was the bottleneck).
+unsigned long long PipelineQueueBase::numBlockedPushes() const
+{
+    lock_guard<mutex> lock(queueMutex);
+    return blockedPushes;
+}
+
+// Number of pops that found the queue empty (the consumer was waiting for work).
+unsigned long long PipelineQueueBase::numBlockedPops() const
+{
+    lock_guard<mutex> lock(queueMutex);
+    return blockedPops;
+}
+
+PipelineStage::PipelineStage(const char* name_, const PipelineQueueBase* inputQueue_) :
+    name(name_),
+    inputQueue(inputQueue_),
+    serviceTimeHistogram(nullptr)
+{
+    reset();
+}
+
+void PipelineStage::reset()
+{
+    numItems = 0;
+    totalServiceTimeNs = 0;
+    maxServiceTimeNs = 0;
+}
+
+// Also record each service time, in microseconds, in histogram (none if null).
+void PipelineStage::setServiceTimeHistogram(LatencyHistogram *histogram)
+{
+    serviceTimeHistogram = histogram;
+}
+
+void PipelineStage::startService()
+{
+    serviceStart = chrono::steady_clock::now();
+}
+
+void PipelineStage::finishService()
+{
+    long long serviceTimeNs =
+            chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - serviceStart).count();
+    totalServiceTimeNs.fetch_add(serviceTimeNs, memory_order_relaxed);
+    if (serviceTimeNs > maxServiceTimeNs.load(memory_order_relaxed)) {
+        maxServiceTimeNs.store(serviceTimeNs, memory_order_relaxed);     // only this stage's thread writes it
+    }
+    numItems.fetch_add(1, memory_order_release);
+    if (serviceTimeHistogram) {
+        serviceTimeHistogram->record(serviceTimeNs / 1000);
+    }
+}
+
+const char* PipelineStage::getName() const
+{
+    return name;
+}
+
+PipelineStageStatistics PipelineStage::getStatistics() const
+{
+    PipelineStageStatistics statistics;
+    statistics.numItems = numItems.load(memory_order_acquire);
+    statistics.meanServiceTimeMs = (statistics.numItems > 0) ?
+                1.0e-6 * totalServiceTimeNs.load(memory_order_relaxed) / statistics.numItems : 0.0;
+    statistics.maxServiceTimeMs = 1.0e-6 * maxServiceTimeNs.load(memory_order_relaxed);
+    if (inputQueue) {
+        statistics.queueDepth = inputQueue->depth();
+        statistics.maxQueueDepth = inputQueue->maxDepth();
+        statistics.queueCapacity = inputQueue->capacity();
+        statistics.numBlockedPushes = inputQueue->numBlockedPushes();
+    } else {
+        statistics.queueDepth = 0;
+        statistics.maxQueueDepth = 0;
+        statistics.queueCapacity = 0;
+        statistics.numBlockedPushes = 0;
+    }
+    return statistics;
+}
+
+void PipelineStage::printStatistics() const
+{
+    PipelineStageStatistics statistics = getStatistics();
+    cout << "Pipeline stage " << name << ": " << statistics.numItems << " items, service time " << fixed <<
+            setprecision(2) << statistics.meanServiceTimeMs << " ms mean, " << statistics.maxServiceTimeMs << " ms max";
+    if (inputQueue) {
+        cout << ", queue depth " << statistics.queueDepth << " (max " << statistics.maxQueueDepth << " of " <<
+                statistics.queueCapacity << "), " << statistics.numBlockedPushes << " blocked pushes";
+    }
+    cout << endl;
+    cout.unsetf(ios::fixed);
+}
@@ -0,0 +1,154 @@
+#ifndef PIPELINE_H
+#define PIPELINE_H
+
+#include <vector>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <chrono>
+
+using namespace std;
+
+class LatencyHistogram;
+
+// Number of USB reads that may be in flight between the parse and process stages.
+#define PIPELINE_DEPTH_IN_READS 4
+
+// Statistics for one stage of the acquisition pipeline.
+struct PipelineStageStatistics
+{
+    unsigned long long numItems;            // items the stage has finished
+    double meanServiceTimeMs;
+    double maxServiceTimeMs;
+    int queueDepth;                         // items waiting in the stage's input queue
+    int maxQueueDepth;
+    int queueCapacity;
+    unsigned long long numBlockedPushes;    // times the stage before had to wait for this one
+};
+
+// Bounded queue between two pipeline stages.  A push into a full queue waits until the
+// consumer takes an item, so a slow stage holds back the stages before it instead of letting
+// memory grow; the wait is counted.  The counters live in this base class so that a
+// PipelineStage can report them without knowing the item type.
+
+class PipelineQueueBase
+{
+
+public:
+    PipelineQueueBase();
+
+    void close();
+    bool isClosed() const;
+
+    int capacity() const;
+    int depth() const;
+    int maxDepth() const;
+    unsigned long long numBlockedPushes() const;
+    unsigned long long numBlockedPops() const;
+
+protected:
+    mutable mutex queueMutex;
+    condition_variable notEmpty;
+    condition_variable notFull;
+    int queueCapacity;
+    int count;
+    int highWater;
+    unsigned long long blockedPushes;
+    unsigned long long blockedPops;
+    bool closed;
+};
+
+template <typename T>
+class PipelineQueue : public PipelineQueueBase
+{
+
+public:
+    // Empty the queue, reopen it and preallocate room for capacity_ items.  Only call while no
+    // stage is using the queue.
+    void setCapacity(int capacity_)
+    {
+        lock_guard<mutex> lock(queueMutex);
+        items.assign(capacity_, T());
+        queueCapacity = capacity_;
+        head = 0;
+        count = 0;
+        highWater = 0;
+        blockedPushes = 0;
+        blockedPops = 0;
+        closed = false;
+    }
+
+    // Append item, waiting while the queue is full.  Returns false if the queue was closed.
+    bool push(const T &item)
+    {
+        unique_lock<mutex> lock(queueMutex);
+        if (count == queueCapacity && !closed) {
+            blockedPushes++;
+            notFull.wait(lock, [this] { return count < queueCapacity || closed; });
+        }
+        if (closed) {
+            return false;
+        }
+        items[(head + count) % queueCapacity] = item;
+        count++;
+        if (count > highWater) {
+            highWater = count;
+        }
+        notEmpty.notify_one();
+        return true;
+    }
+
+    // Take the oldest item, waiting while the queue is empty.  Items pushed before the queue
+    // was closed are still returned; after that, returns false.
+    bool pop(T &item)
+    {
+        unique_lock<mutex> lock(queueMutex);
+        if (count == 0 && !closed) {
+            blockedPops++;
+            notEmpty.wait(lock, [this] { return count > 0 || closed; });
+        }
+        if (count == 0) {
+            return false;
+        }
+        item = items[head];
+        head = (head + 1) % queueCapacity;
+        count--;
+        notFull.notify_one();
+        return true;
+    }
+
+private:
+    vector<T> items;
+    int head = 0;
+};
+
+// Service time bookkeeping for one pipeline stage.  startService() and finishService() are
+// called by the stage's thread around each item; the statistics may be read from any thread.
+
+class PipelineStage
+{
+
+public:
+    PipelineStage(const char* name_, const PipelineQueueBase* inputQueue_ = nullptr);
+
+    void reset();
+    void setServiceTimeHistogram(LatencyHistogram *histogram);
+    void startService();
+    void finishService();
+
+    const char* getName() const;
+    PipelineStageStatistics getStatistics() const;
+    void printStatistics() const;
+
+private:
+    const char* name;
+    const PipelineQueueBase* inputQueue;
+    LatencyHistogram *serviceTimeHistogram;
+
+    chrono::steady_clock::time_point serviceStart;
+    atomic<unsigned long long> numItems;
+    atomic<long long> totalServiceTimeNs;
+    atomic<long long> maxServiceTimeNs;
+};
+
+#endif // PIPELINE_H
@@ -0,0 +1,87 @@
+#include <QCoreApplication>
+#include <QCommandLineParser>
+#include <iostream>
+
+#include "headlessconfig.h"
+#include "offlineredetector.h"
+
+// Offline spike re-detection tool.  Built from the same sources as the headless daemon, with
+// redetectmain.cpp in place of main.cpp (QT += core network; no board is opened), e.g.
+//     rhythmstim-redetect --threshold 4.5 --threads 16 /data/rat12_*.rhs
+// Detector settings come from the <spikeDetector> element of a headless configuration file and
+// from the same options as the daemon's, which override it; disabled channels apply to port D.
+
+#define PORT_D 3
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Re-run spike detection over recorded Intan data files (.rhs), writing "
+                                     "<name>_SW_detections.rhs files.");
+    parser.addHelpOption();
+    parser.addPositionalArgument("files", "Intan data files to re-detect.", "<file.rhs>...");
+    QCommandLineOption configOption("config", "Read spike detector settings from XML file <file>.", "file");
+    QCommandLineOption thresholdOption("threshold", "Spike detector threshold multiplier.", "mult");
+    QCommandLineOption blindWindowOption("blind-window", "Spike detector blind window length.", "ms");
+    QCommandLineOption disableChannelsOption("disable-channels",
+            "Comma-separated probe channels (1-32) of port D to exclude from spike detection.", "channels");
+    QCommandLineOption threadsOption("threads", "Run <threads> worker threads (0: one per core).", "threads", "0");
+    QCommandLineOption chunkOption("chunk-seconds",
+            "Split recordings into chunks of about <seconds> seconds (0: do not split, for exact results).",
+            "seconds", "60");
+    QCommandLineOption warmUpOption("warm-up", "Run <windows> RMS windows of 2^15 samples before each chunk.",
+            "windows", "8");
+    QCommandLineOption outputDirOption("output-dir", "Write detection files to <dir> (default: next to the recording).",
+            "dir");
+    QCommandLineOption hardwareIdsOption("hardware-ids",
+            "Detect on port D only, with the hardware detector's channel IDs, into <name>_HW_detections.rhs "
+            "(needs --output-dir).");
+    QCommandLineOption overwriteOption("overwrite", "Replace existing detection files.");
+    parser.addOptions({configOption, thresholdOption, blindWindowOption, disableChannelsOption, threadsOption,
+                       chunkOption, warmUpOption, outputDirOption, hardwareIdsOption, overwriteOption});
+    parser.process(app);
+
+    QStringList fileNames = parser.positionalArguments();
+    if (fileNames.isEmpty()) {
+        parser.showHelp(1);
+    }
+
+    HeadlessConfig config;
+    if (parser.isSet(configOption) && !config.load(parser.value(configOption))) {
+        return 1;
+    }
+    if (parser.isSet(thresholdOption)) {
+        config.thresholdMult = parser.value(thresholdOption).toDouble();
+    }
+    if (parser.isSet(blindWindowOption)) {
+        config.blindWindowLength = parser.value(blindWindowOption).toInt();
+    }
+    if (parser.isSet(disableChannelsOption) && !config.setDisabledChannels(parser.value(disableChannelsOption))) {
+        return 1;
+    }
+
+    // The settings the daemon would write to the board for its detector.
+    unsigned int disabledChannels = 0;
+    for (int channel = 0; channel < config.deactiveChannels.size(); ++channel) {
+        if (config.deactiveChannels[channel]) {
+            disabledChannels |= 1u << channel;
+        }
+    }
+    OfflineRedetector redetector;
+    redetector.setThresholdMult(qRound(config.thresholdMult * 2));
+    redetector.setBlindWindow(config.blindWindowLength);
+    redetector.setDisabledChannels(PORT_D, disabledChannels);
+    redetector.setChunkSeconds(parser.value(chunkOption).toDouble());
+    redetector.setWarmUpWindows(parser.value(warmUpOption).toInt());
+    redetector.setOutputDirectory(parser.value(outputDirOption));
+    redetector.setHardwareIds(parser.isSet(hardwareIdsOption));
+    redetector.setOverwrite(parser.isSet(overwriteOption));
+
+    cout << "Threshold " << config.thresholdMult << " x RMS, blind window " << config.blindWindowLength << " ms" <<
+            endl;
+    bool ok = redetector.run(fileNames, qMax(0, parser.value(threadsOption).toInt()));
+    redetector.printStatistics();
+    return ok ? 0 : 1;
+}
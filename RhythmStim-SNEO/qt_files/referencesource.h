@@ -0,0 +1,12 @@
+#ifndef REFERENCESOURCE_H
+#define REFERENCESOURCE_H
+
+// Amplifier channel used as the reference for amplifier data, in software if softwareMode.  In its
+// own header so that the headless daemon can use it without MainWindow and Qt widgets.
+struct ReferenceSource {
+    int stream;
+    int channel;
+    bool softwareMode;
+};
+
+#endif // REFERENCESOURCE_H
@@ -0,0 +1,404 @@
+#include <QDataStream>
+#include <QFileInfo>
+#include <iostream>
+#include <cstring>
+
+#include "replaysource.h"
+#include "usbdeinterleaver.h"
+#include "globalconstants.h"
+
+// Intan data file replay
+
+// Signal types in the saved signal sources
+#define SIGNAL_TYPE_AMPLIFIER 0
+#define SIGNAL_TYPE_BOARD_ADC 3
+#define SIGNAL_TYPE_BOARD_DAC 4
+#define SIGNAL_TYPE_BOARD_DIGITAL_IN 5
+#define SIGNAL_TYPE_BOARD_DIGITAL_OUT 6
+
+// Stimulation data word of a saved amplifier channel
+#define STIM_DATA_CHARGE_RECOVERY 0x4000
+#define STIM_DATA_AMP_SETTLE 0x2000
+#define STIM_DATA_POLARITY 0x0100
+#define STIM_DATA_AMPLITUDE 0x00ff
+
+ReplaySource::ReplaySource()
+{
+    sampleRate = 0.0;
+    dcAmplifierDataSaved = false;
+    numBoardAdcChannels = 0;
+    numBoardDacChannels = 0;
+    digitalInSaved = false;
+    digitalOutSaved = false;
+    headerSizeInBytes = 0;
+    blockSizeInBytes = 0;
+    numSamples = 0;
+    blockSample = SAMPLES_PER_DATA_BLOCK;
+    samplePosition = 0;
+    detectionPending = false;
+}
+
+ReplaySource::~ReplaySource()
+{
+    close();
+}
+
+// Open an Intan format data file, and <name>_HW_detections.rhs next to it if it exists, and
+// read the header.  Unless quiet, prints what the file holds.  Returns false (and prints why) on
+// error.
+bool ReplaySource::open(const QString &fileName, bool quiet)
+{
+    close();
+
+    dataFile.setFileName(fileName);
+    if (!dataFile.open(QIODevice::ReadOnly)) {
+        cerr << "Error in ReplaySource::open: cannot open " << fileName.toStdString() << endl;
+        return false;
+    }
+    if (!readHeader()) {
+        close();
+        return false;
+    }
+
+    QString detectionFileName = fileName.left(fileName.size() - QFileInfo(fileName).suffix().size() - 1) +
+            "_HW_detections.rhs";
+    detectionFile.setFileName(detectionFileName);
+    if (QFileInfo::exists(detectionFileName) && !detectionFile.open(QIODevice::ReadOnly)) {
+        cerr << "Error in ReplaySource::open: cannot open " << detectionFileName.toStdString() << endl;
+    }
+
+    if (quiet) {
+        return true;
+    }
+    cout << "Replaying " << fileName.toStdString() << ": " << channelStream.size() << " amplifier channels, " <<
+            numSamples / sampleRate << " s at " << sampleRate << " S/s" <<
+            (hasDetections() ? ", with hardware spike detections" : "") << endl;
+    return true;
+}
+
+void ReplaySource::close()
+{
+    dataFile.close();
+    detectionFile.close();
+    channelStream.clear();
+    channelChip.clear();
+    numSamples = 0;
+    block.clear();
+    blockSample = SAMPLES_PER_DATA_BLOCK;
+    samplePosition = 0;
+    detectionPending = false;
+}
+
+bool ReplaySource::isOpen() const
+{
+    return dataFile.isOpen();
+}
+
+double ReplaySource::getSampleRate() const
+{
+    return sampleRate;
+}
+
+int ReplaySource::getNumAmplifierChannels() const
+{
+    return channelStream.size();
+}
+
+unsigned long long ReplaySource::getNumSamples() const
+{
+    return numSamples;
+}
+
+// True if the recording has channels from hardware data stream stream.
+bool ReplaySource::hasChipOnStream(int stream) const
+{
+    return channelStream.contains(stream);
+}
+
+bool ReplaySource::hasDetections() const
+{
+    return detectionFile.isOpen();
+}
+
+// Number of samples returned or skipped so far.  May be called from any thread.
+unsigned long long ReplaySource::position() const
+{
+    return samplePosition.load(memory_order_relaxed);
+}
+
+// True once every sample has been returned or skipped.  May be called from any thread.
+bool ReplaySource::atEnd() const
+{
+    return isOpen() && position() >= numSamples;
+}
+
+// Read the file header written by MainWindow::writeSaveFileHeader() (Intan format), down to the
+// signal sources, and work out the size of a data block.  (Private method.)
+bool ReplaySource::readHeader()
+{
+    QDataStream inStream(&dataFile);
+    inStream.setVersion(QDataStream::Qt_4_8);
+    inStream.setByteOrder(QDataStream::LittleEndian);
+    inStream.setFloatingPointPrecision(QDataStream::SinglePrecision);
+
+    quint32 magicNumber;
+    qint16 mainVersion, secondaryVersion, tempQint16;
+    double tempDouble;
+    QString tempQString;
+
+    inStream >> magicNumber;
+    if (magicNumber != DATA_FILE_MAGIC_NUMBER) {
+        cerr << "Error in ReplaySource::readHeader: " << dataFile.fileName().toStdString() <<
+                " is not an Intan format data file." << endl;
+        return false;
+    }
+    inStream >> mainVersion >> secondaryVersion;
+    inStream >> sampleRate;
+
+    inStream >> tempQint16;                     // DSP enabled
+    for (int i = 0; i < 8; ++i) {
+        inStream >> tempDouble;                 // actual and desired DSP cutoff and bandwidths
+    }
+    inStream >> tempQint16;                     // notch filter mode
+    inStream >> tempDouble >> tempDouble;       // desired and actual impedance test frequency
+    inStream >> tempQint16 >> tempQint16;       // amp fast settle, charge recovery mode
+    inStream >> tempDouble >> tempDouble >> tempDouble;     // stim step, charge recovery limit and target
+    inStream >> tempQString >> tempQString >> tempQString;  // notes
+    inStream >> tempQint16;
+    dcAmplifierDataSaved = (tempQint16 != 0);
+    inStream >> tempQint16;                     // board mode
+    inStream >> tempQString;                    // reference channel
+
+    // Signal sources: every channel of every port, enabled or not.
+    qint16 numGroups;
+    inStream >> numGroups;
+    for (int group = 0; group < numGroups; ++group) {
+        qint16 groupEnabled, numChannels, numAmplifierChannels;
+        inStream >> tempQString >> tempQString;     // name, prefix
+        inStream >> groupEnabled >> numChannels >> numAmplifierChannels;
+        for (int channel = 0; channel < numChannels; ++channel) {
+            qint16 signalType, channelEnabled, chipChannel, commandStream, boardStream;
+            inStream >> tempQString >> tempQString;     // native and custom names
+            inStream >> tempQint16 >> tempQint16;       // native and custom order
+            inStream >> signalType >> channelEnabled >> chipChannel >> commandStream >> boardStream;
+            inStream >> tempQint16 >> tempQint16 >> tempQint16 >> tempQint16;     // spike scope trigger settings
+            inStream >> tempDouble >> tempDouble;       // impedance magnitude and phase
+
+            if (!groupEnabled || !channelEnabled) {
+                continue;
+            }
+            switch (signalType) {
+            case SIGNAL_TYPE_AMPLIFIER:
+                channelStream.append((commandStream >= 0) ? commandStream : boardStream);
+                channelChip.append(chipChannel);
+                break;
+            case SIGNAL_TYPE_BOARD_ADC:
+                numBoardAdcChannels++;
+                break;
+            case SIGNAL_TYPE_BOARD_DAC:
+                numBoardDacChannels++;
+                break;
+            case SIGNAL_TYPE_BOARD_DIGITAL_IN:
+                digitalInSaved = true;
+                break;
+            case SIGNAL_TYPE_BOARD_DIGITAL_OUT:
+                digitalOutSaved = true;
+                break;
+            }
+        }
+    }
+
+    if (inStream.status() != QDataStream::Ok) {
+        cerr << "Error in ReplaySource::readHeader: header of " << dataFile.fileName().toStdString() <<
+                " is truncated or from an unsupported version (" << mainVersion << "." << secondaryVersion << ")." << endl;
+        return false;
+    }
+    for (int i = 0; i < channelStream.size(); ++i) {
+        if (channelStream[i] < 0 || channelStream[i] >= REPLAY_MAX_STREAMS ||
+                channelChip[i] < 0 || channelChip[i] >= REPLAY_CHANNELS_PER_STREAM) {
+            cerr << "Error in ReplaySource::readHeader: amplifier channel " << i << " has no valid data stream." << endl;
+            return false;
+        }
+    }
+
+    headerSizeInBytes = dataFile.pos();
+    int wordsPerSample = channelStream.size() * (dcAmplifierDataSaved ? 3 : 2) + numBoardAdcChannels +
+            numBoardDacChannels + (digitalInSaved ? 1 : 0) + (digitalOutSaved ? 1 : 0);
+    blockSizeInBytes = SAMPLES_PER_DATA_BLOCK * (4 + 2 * wordsPerSample);
+    numSamples = (unsigned long long) ((dataFile.size() - headerSizeInBytes) / blockSizeInBytes) * SAMPLES_PER_DATA_BLOCK;
+    return true;
+}
+
+// Read the next data block into block.  (Private method.)
+bool ReplaySource::readBlock()
+{
+    block = dataFile.read(blockSizeInBytes);
+    blockSample = 0;
+    return block.size() == blockSizeInBytes;
+}
+
+// Return the next sample of the recording in sample; false at the end of the file.
+bool ReplaySource::nextSample(ReplaySample &sample)
+{
+    if (blockSample == SAMPLES_PER_DATA_BLOCK && !readBlock()) {
+        return false;
+    }
+
+    const unsigned char* data = (const unsigned char*) block.constData();
+    int numChannels = channelStream.size();
+    int t = blockSample;
+    auto word = [data](int index) -> unsigned short {
+        return (unsigned short) (data[2 * index] | (data[2 * index + 1] << 8));
+    };
+
+    memcpy(&sample.timeStamp, data + 4 * t, 4);     // little endian, as the FPGA and the file
+
+    for (int stream = 0; stream < REPLAY_MAX_STREAMS; ++stream) {
+        for (int channel = 0; channel < REPLAY_CHANNELS_PER_STREAM; ++channel) {
+            sample.amplifier[stream][channel] = 32768;
+            sample.dcAmplifier[stream][channel] = 512;
+        }
+        sample.stimOn[stream] = 0;
+        sample.stimPolarity[stream] = 0;
+        sample.ampSettle[stream] = 0;
+        sample.chargeRecovery[stream] = 0;
+    }
+
+    // Word indices of this sample's amplifier, DC amplifier and stimulation data
+    int amplifierIndex = 2 * SAMPLES_PER_DATA_BLOCK + t;
+    int dcIndex = amplifierIndex + numChannels * SAMPLES_PER_DATA_BLOCK;
+    int stimIndex = (dcAmplifierDataSaved ? dcIndex : amplifierIndex) + numChannels * SAMPLES_PER_DATA_BLOCK;
+
+    for (int i = 0; i < numChannels; ++i) {
+        int stream = channelStream[i];
+        int chipChannel = channelChip[i];
+        unsigned short bit = (unsigned short) (1 << chipChannel);
+        sample.amplifier[stream][chipChannel] = word(amplifierIndex + i * SAMPLES_PER_DATA_BLOCK);
+        if (dcAmplifierDataSaved) {
+            sample.dcAmplifier[stream][chipChannel] = word(dcIndex + i * SAMPLES_PER_DATA_BLOCK);
+        }
+        unsigned short stimData = word(stimIndex + i * SAMPLES_PER_DATA_BLOCK);
+        if (stimData & STIM_DATA_AMPLITUDE) sample.stimOn[stream] |= bit;
+        if (stimData & STIM_DATA_POLARITY) sample.stimPolarity[stream] |= bit;
+        if (stimData & STIM_DATA_AMP_SETTLE) sample.ampSettle[stream] |= bit;
+        if (stimData & STIM_DATA_CHARGE_RECOVERY) sample.chargeRecovery[stream] |= bit;
+    }
+
+    blockSample++;
+    samplePosition.fetch_add(1, memory_order_relaxed);
+    return true;
+}
+
+// Read the next numSamples_ samples (at most planes.numSamples) of hardware data streams
+// firstStream to firstStream + planes.numDataStreams - 1 into planes, as UsbDeinterleaver would
+// have: amplifier samples as signed values, stimulation flags one bit per chip channel.  Channels
+// not in the recording read as zero.  DC amplifier and auxiliary planes are not touched.
+// Returns the number of samples read, fewer than numSamples_ only at the end of the file.
+int ReplaySource::readPlanes(SamplePlanes &planes, int firstStream, int numSamples_)
+{
+    numSamples_ = qMin(numSamples_, planes.numSamples);
+    for (int stream = 0; stream < planes.numDataStreams; ++stream) {
+        for (int channel = 0; channel < REPLAY_CHANNELS_PER_STREAM; ++channel) {
+            memset(planes.amplifierPlane(stream, channel), 0, numSamples_ * sizeof(short));
+        }
+        for (int flag = 0; flag < DEINTERLEAVER_STIM_FLAGS; ++flag) {
+            memset(planes.stimFlagPlane(stream, (StimFlag) flag), 0, numSamples_ * sizeof(unsigned short));
+        }
+    }
+
+    int numChannels = channelStream.size();
+    int numRead = 0;
+    while (numRead < numSamples_) {
+        if (blockSample == SAMPLES_PER_DATA_BLOCK && !readBlock()) {
+            break;
+        }
+        const unsigned char* data = (const unsigned char*) block.constData();
+        int count = qMin(numSamples_ - numRead, SAMPLES_PER_DATA_BLOCK - blockSample);
+        memcpy(planes.timeStamp.data() + numRead, data + 4 * blockSample, 4 * count);
+
+        // Byte offsets of this stretch's amplifier, DC amplifier and stimulation data
+        int amplifierOffset = 2 * (2 * SAMPLES_PER_DATA_BLOCK + blockSample);
+        int dcOffset = amplifierOffset + 2 * numChannels * SAMPLES_PER_DATA_BLOCK;
+        int stimOffset = (dcAmplifierDataSaved ? dcOffset : amplifierOffset) + 2 * numChannels * SAMPLES_PER_DATA_BLOCK;
+
+        for (int i = 0; i < numChannels; ++i) {
+            int stream = channelStream[i] - firstStream;
+            if (stream < 0 || stream >= planes.numDataStreams) {
+                continue;
+            }
+            int chipChannel = channelChip[i];
+            unsigned short bit = (unsigned short) (1 << chipChannel);
+            const unsigned char* amplifierData = data + amplifierOffset + 2 * i * SAMPLES_PER_DATA_BLOCK;
+            const unsigned char* stimData = data + stimOffset + 2 * i * SAMPLES_PER_DATA_BLOCK;
+            short* amplifier = planes.amplifierPlane(stream, chipChannel) + numRead;
+            unsigned short* stimOn = planes.stimFlagPlane(stream, StimFlagOn) + numRead;
+            unsigned short* stimPolarity = planes.stimFlagPlane(stream, StimFlagPolarity) + numRead;
+            unsigned short* ampSettle = planes.stimFlagPlane(stream, StimFlagAmpSettle) + numRead;
+            unsigned short* chargeRecovery = planes.stimFlagPlane(stream, StimFlagChargeRecovery) + numRead;
+            for (int t = 0; t < count; ++t) {
+                amplifier[t] = (short) ((amplifierData[2 * t] | (amplifierData[2 * t + 1] << 8)) - 32768);
+                unsigned short stim = (unsigned short) (stimData[2 * t] | (stimData[2 * t + 1] << 8));
+                if (stim & STIM_DATA_AMPLITUDE) stimOn[t] |= bit;
+                if (stim & STIM_DATA_POLARITY) stimPolarity[t] |= bit;
+                if (stim & STIM_DATA_AMP_SETTLE) ampSettle[t] |= bit;
+                if (stim & STIM_DATA_CHARGE_RECOVERY) chargeRecovery[t] |= bit;
+            }
+        }
+
+        blockSample += count;
+        numRead += count;
+    }
+    samplePosition.fetch_add(numRead, memory_order_relaxed);
+    return numRead;
+}
+
+// Skip numSamples_ samples, e.g. ones the emulated FPGA FIFO dropped.
+void ReplaySource::skipSamples(unsigned long long numSamples_)
+{
+    unsigned long long samplesLeftInBlock = SAMPLES_PER_DATA_BLOCK - blockSample;
+    if (numSamples_ <= samplesLeftInBlock) {
+        blockSample += (int) numSamples_;
+        samplePosition.fetch_add(numSamples_, memory_order_relaxed);
+        return;
+    }
+
+    numSamples_ -= samplesLeftInBlock;
+    unsigned long long numBlocks = numSamples_ / SAMPLES_PER_DATA_BLOCK;
+    dataFile.seek(dataFile.pos() + (qint64) numBlocks * blockSizeInBytes);
+    blockSample = SAMPLES_PER_DATA_BLOCK;
+    samplePosition.fetch_add(samplesLeftInBlock + numBlocks * SAMPLES_PER_DATA_BLOCK, memory_order_relaxed);
+
+    unsigned long long remainder = numSamples_ - numBlocks * SAMPLES_PER_DATA_BLOCK;
+    if (remainder > 0 && readBlock()) {
+        blockSample = (int) remainder;
+        samplePosition.fetch_add(remainder, memory_order_relaxed);
+    }
+}
+
+// Copy the saved detection records (four words each: amplitude, channel and threshold, DT high
+// word, DT low word) with timestamps before beforeTimeStamp into records, up to maxRecords, and
+// return how many were copied.
+int ReplaySource::takeDetections(unsigned int beforeTimeStamp, unsigned short *records, int maxRecords)
+{
+    int numRecords = 0;
+    while (numRecords < maxRecords && detectionFile.isOpen()) {
+        if (!detectionPending) {
+            unsigned char bytes[8];
+            if (detectionFile.read((char*) bytes, 8) != 8) {
+                break;
+            }
+            for (int i = 0; i < 4; ++i) {
+                pendingDetection[i] = (unsigned short) (bytes[2 * i] | (bytes[2 * i + 1] << 8));
+            }
+            detectionPending = true;
+        }
+        unsigned int timeStamp = ((unsigned int) pendingDetection[2] << 16) | pendingDetection[3];
+        if (timeStamp >= beforeTimeStamp) {
+            break;
+        }
+        memcpy(records + 4 * numRecords, pendingDetection, sizeof(pendingDetection));
+        detectionPending = false;
+        numRecords++;
+    }
+    return numRecords;
+}
@@ -0,0 +1,92 @@
+#ifndef REPLAYSOURCE_H
+#define REPLAYSOURCE_H
+
+#include <QString>
+#include <QFile>
+#include <QByteArray>
+#include <QVector>
+#include <atomic>
+
+using namespace std;
+
+struct SamplePlanes;
+
+#define REPLAY_MAX_STREAMS 8
+#define REPLAY_CHANNELS_PER_STREAM 16
+
+// One sample of a replayed recording, by hardware data stream (the command stream of each
+// channel) and chip channel.  Channels not in the recording hold a mid-scale amplifier value,
+// a mid-scale DC value and no stimulation flags.
+struct ReplaySample
+{
+    unsigned int timeStamp;
+    unsigned short amplifier[REPLAY_MAX_STREAMS][REPLAY_CHANNELS_PER_STREAM];
+    unsigned short dcAmplifier[REPLAY_MAX_STREAMS][REPLAY_CHANNELS_PER_STREAM];
+    unsigned short stimOn[REPLAY_MAX_STREAMS];          // one bit per chip channel
+    unsigned short stimPolarity[REPLAY_MAX_STREAMS];
+    unsigned short ampSettle[REPLAY_MAX_STREAMS];
+    unsigned short chargeRecovery[REPLAY_MAX_STREAMS];
+};
+
+// A recorded Intan format (.rhs) data file, with its hardware spike detections
+// (<name>_HW_detections.rhs) if present, read sample by sample for the emulated interface board
+// to play back in place of generated data.  Samples and detection records come out exactly as
+// saved, so a replay run reproduces the session's data through the whole acquisition path.
+// Only amplifier, DC amplifier and stimulation data are replayed; board ADC, DAC and digital
+// I/O are skipped.  readPlanes() reads the amplifier and stimulation data of whole stretches
+// instead, for offline processing.  Not thread safe, except position() and atEnd().
+
+class ReplaySource
+{
+
+public:
+    ReplaySource();
+    ~ReplaySource();
+
+    bool open(const QString &fileName, bool quiet = false);
+    void close();
+    bool isOpen() const;
+
+    double getSampleRate() const;
+    int getNumAmplifierChannels() const;
+    unsigned long long getNumSamples() const;
+    bool hasChipOnStream(int stream) const;
+    bool hasDetections() const;
+
+    bool nextSample(ReplaySample &sample);
+    int readPlanes(SamplePlanes &planes, int firstStream, int numSamples_);
+    void skipSamples(unsigned long long numSamples);
+    unsigned long long position() const;
+    bool atEnd() const;
+
+    int takeDetections(unsigned int beforeTimeStamp, unsigned short *records, int maxRecords);
+
+private:
+    bool readHeader();
+    bool readBlock();
+
+    QFile dataFile;
+    QFile detectionFile;
+
+    double sampleRate;
+    bool dcAmplifierDataSaved;
+    QVector<int> channelStream;         // hardware data stream of each saved amplifier channel
+    QVector<int> channelChip;           // chip channel of each saved amplifier channel
+    int numBoardAdcChannels;
+    int numBoardDacChannels;
+    bool digitalInSaved;
+    bool digitalOutSaved;
+
+    qint64 headerSizeInBytes;
+    qint64 blockSizeInBytes;
+    unsigned long long numSamples;
+
+    QByteArray block;                   // current data block
+    int blockSample;                    // next sample of block to return
+    atomic<unsigned long long> samplePosition;
+
+    unsigned short pendingDetection[4]; // next detection record, read ahead
+    bool detectionPending;
+};
+
+#endif // REPLAYSOURCE_H
@@ -24,17 +24,28 @@
 #include <vector>
 #include <queue>
 #include <cmath>
+#include <algorithm>
 #include <mutex>
 #include <QtCore>
 
 #include "rhs2000evalboard.h"
+#include "boardioscheduler.h"
+#include "boardconfigtransaction.h"
 #include "rhs2000datablock.h"
 #include "rhs2000registers.h"
+#include "metricsregistry.h"
 
+#ifdef RHYTHM_EMULATOR
+#include "emulatedfrontpanel.h"
+#else
 #include "okFrontPanelDLL.h"
+#endif
 
 using namespace std;
 
+// Sampled gauge reading spikeEvents; removed again in the destructor.
+static const char* const LostSpikeEventsGauge = "spike.lost_events";
+
 // This class provides access to and control of the Opal Kelly XEM6010 USB/FPGA
 // interface board running the Rhythm interface Verilog code.
 
@@ -55,10 +66,24 @@ Rhs2000EvalBoard::Rhs2000EvalBoard()
     cableDelay.resize(MAX_NUM_SPI_PORTS, -1);
     lastNumWordsInFifo = 0;
     numWordsHasBeenUpdated = false;
+
+    wireOutSnapshot = WireOutSnapshot();
+    wireOutMaxAgeUs = WIRE_OUT_MAX_AGE_US;
+    numWireOutUpdates = 0;
+
+    bulkReadChunkSize = BULK_READ_CHUNK_BYTES;
+    ioScheduler = new BoardIoScheduler(okMutex);
+
+    MetricsRegistry* metrics = MetricsRegistry::global();
+    spikeBacklogMetric = metrics->histogram("spike.pipe_backlog", "words");
+    spikeEventMetric = metrics->counter("spike.events");
+    metrics->setSampledGauge(LostSpikeEventsGauge, [this] { return (double) spikeEvents.getNumLostEvents(); });
 }
 
 Rhs2000EvalBoard::~Rhs2000EvalBoard()
 {
+    MetricsRegistry::global()->removeSampledGauge(LostSpikeEventsGauge);
+    delete ioScheduler;
     delete [] usbBuffer;
 }
 
@@ -214,6 +239,9 @@ void Rhs2000EvalBoard::initialize()
     setStimCmdMode(false);
 	setMaxTimeStep(4294967295);  // 4294967295 == (2^32 - 1)
 
+    // Stage the default wire-in settings below and send them to the board together.
+    BoardConfigTransaction transaction(this);
+
 	setCableLengthFeet(PortA, 3.0);  // assume 3 ft cables
 	setCableLengthFeet(PortB, 3.0);
 	setCableLengthFeet(PortC, 3.0);
@@ -222,8 +250,7 @@ void Rhs2000EvalBoard::initialize()
 	setDspSettle(false);
 
     // Must first force all data streams off
-    dev->SetWireInValue(WireInDataStreamEn, 0x0000);
-    dev->UpdateWireIns();
+    transaction.setWireInValue(WireInDataStreamEn, 0x0000);
 
 	enableDataStream(0, true);        // start with only one data stream enabled
 	for (i = 1; i < MAX_NUM_DATA_STREAMS; i++) {
@@ -276,6 +303,8 @@ void Rhs2000EvalBoard::initialize()
 
     setAnalogInTriggerThreshold(1.65); // +1.65 V
 
+    transaction.commit();
+
     const int NEVER = 65535;
     int stream = 0;
     int channel = 0;
@@ -332,8 +361,6 @@ void Rhs2000EvalBoard::initialize()
 // Set the per-channel sampling rate of the RHS2116 chips connected to the FPGA.
 bool Rhs2000EvalBoard::setSampleRate(AmplifierSampleRate newSampleRate)
 {
-    lock_guard<mutex> lockOk(okMutex);
-
 	// Assuming a 100 MHz reference clock is provided to the FPGA, the programmable FPGA clock frequency
 	// is given by:
 	//
@@ -471,16 +498,31 @@ bool Rhs2000EvalBoard::setSampleRate(AmplifierSampleRate newSampleRate)
 
 	sampleRate = newSampleRate;
 
+    // Each poll of the clock status is its own scheduler operation, so other board I/O is
+    // served while the PLL settles.
+    bool ready = false;
+
 	// Wait for DcmProgDone = 1 before reprogramming clock synthesizer
-	while (isDcmProgDone() == false) {}
+    while (!ready) {
+        ioScheduler->execute(BoardIoScheduler::WireUpdate, [&] {
+            ready = isDcmProgDone();
+        });
+    }
 
 	// Reprogram clock synthesizer
-	dev->SetWireInValue(WireInDataFreqPll, (256 * M + D));
-	dev->UpdateWireIns();
-	dev->ActivateTriggerIn(TrigInDcmProg, 0);
+    ioScheduler->execute(BoardIoScheduler::WireUpdate, [&] {
+        dev->SetWireInValue(WireInDataFreqPll, (256 * M + D));
+        dev->UpdateWireIns();
+        dev->ActivateTriggerIn(TrigInDcmProg, 0);
+    });
 
 	// Wait for DataClkLocked = 1 before allowing data acquisition to continue
-	while (isDataClockLocked() == false) {}
+    ready = false;
+    while (!ready) {
+        ioScheduler->execute(BoardIoScheduler::WireUpdate, [&] {
+            ready = isDataClockLocked();
+        });
+    }
 
 	return(true);
 }
@@ -601,7 +643,6 @@ void Rhs2000EvalBoard::printCommandList(const vector<unsigned int> &commandList)
 // auxiliary command slots (AuxCmd1, AuxCmd2, AuxCmd3, and AuxCmd4).
 void Rhs2000EvalBoard::selectAuxCommandLength(AuxCmdSlot auxCommandSlot, int loopIndex, int endIndex)
 {
-    lock_guard<mutex> lockOk(okMutex);
 	if (loopIndex < 0 || loopIndex > 8191) {
 		cerr << "Error in Rhs2000EvalBoard::selectAuxCommandLength: loopIndex out of range." << endl;
 		return;
@@ -617,100 +658,93 @@ void Rhs2000EvalBoard::selectAuxCommandLength(AuxCmdSlot auxCommandSlot, int loo
         cerr << "Error in Rhs2000EvalBoard::selectAuxCommandLength: auxCommandSlot out of range." << endl;
     }
 
-    dev->SetWireInValue(WireInMultiUse, loopIndex);
-    dev->UpdateWireIns();
-    dev->ActivateTriggerIn(TrigInAuxCmdLength, auxCommandIndex + 4);
-    dev->SetWireInValue(WireInMultiUse, endIndex);
-    dev->UpdateWireIns();
-    dev->ActivateTriggerIn(TrigInAuxCmdLength, auxCommandIndex);
+    ioScheduler->execute(BoardIoScheduler::StimTrigger, [&] {
+        dev->SetWireInValue(WireInMultiUse, loopIndex);
+        dev->UpdateWireIns();
+        dev->ActivateTriggerIn(TrigInAuxCmdLength, auxCommandIndex + 4);
+        dev->SetWireInValue(WireInMultiUse, endIndex);
+        dev->UpdateWireIns();
+        dev->ActivateTriggerIn(TrigInAuxCmdLength, auxCommandIndex);
+    });
 }
 
 // Reset FPGA.  This clears all auxiliary command RAM banks, clears the USB FIFO, and resets the
 // per-channel sampling rate to 30.0 kS/s/ch.
 void Rhs2000EvalBoard::resetBoard()
 {
-    lock_guard<mutex> lockOk(okMutex);
-
-	dev->SetWireInValue(WireInResetRun, 0x01, 0x01);
-	dev->UpdateWireIns();
-	dev->SetWireInValue(WireInResetRun, 0x00, 0x01);
-	dev->UpdateWireIns();
+    ioScheduler->execute(BoardIoScheduler::WireUpdate, [&] {
+        dev->SetWireInValue(WireInResetRun, 0x01, 0x01);
+        dev->UpdateWireIns();
+        dev->SetWireInValue(WireInResetRun, 0x00, 0x01);
+        dev->UpdateWireIns();
+        invalidateWireOuts();
+    });
 }
 
 // Low-level FPGA reset.  Call when closing application to make sure everything has stopped.
 void Rhs2000EvalBoard::resetFpga()
 {
-    lock_guard<mutex> lockOk(okMutex);
-
-    dev->ResetFPGA();
+    ioScheduler->execute(BoardIoScheduler::WireUpdate, [&] {
+        dev->ResetFPGA();
+    });
 }
 
 // Set the FPGA to run continuously once started (if continuousMode == true) or to run until
 // maxTimeStep is reached (if continuousMode == false).
 void Rhs2000EvalBoard::setContinuousRunMode(bool continuousMode)
 {
-    lock_guard<mutex> lockOk(okMutex);
-
+    BoardConfigTransaction transaction(this);
     if (continuousMode) {
-		dev->SetWireInValue(WireInResetRun, 0x02, 0x02);
-	}
-	else {
-		dev->SetWireInValue(WireInResetRun, 0x00, 0x02);
-	}
-	dev->UpdateWireIns();
+        transaction.setWireInValue(WireInResetRun, 0x02, 0x02);
+    }
+    else {
+        transaction.setWireInValue(WireInResetRun, 0x00, 0x02);
+    }
+    transaction.commit();
 }
 
 // Set maxTimeStep for cases where continuousMode == false.
 void Rhs2000EvalBoard::setMaxTimeStep(unsigned int maxTimeStep)
 {
-    lock_guard<mutex> lockOk(okMutex);
-
     unsigned int maxTimeStepLsb, maxTimeStepMsb;
 
 	maxTimeStepLsb = maxTimeStep & 0x0000ffff;
 	maxTimeStepMsb = maxTimeStep & 0xffff0000;
 
-	dev->SetWireInValue(WireInMaxTimeStepLsb, maxTimeStepLsb);
-	dev->SetWireInValue(WireInMaxTimeStepMsb, maxTimeStepMsb >> 16);
-	dev->UpdateWireIns();
+    BoardConfigTransaction transaction(this);
+    transaction.setWireInValue(WireInMaxTimeStepLsb, maxTimeStepLsb);
+    transaction.setWireInValue(WireInMaxTimeStepMsb, maxTimeStepMsb >> 16);
+    transaction.commit();
 }
 
 // Initiate SPI data acquisition.
 void Rhs2000EvalBoard::run()
 {
-    lock_guard<mutex> lockOk(okMutex);
-
-    dev->ActivateTriggerIn(TrigInSpiStart, 0);
+    ioScheduler->execute(BoardIoScheduler::WireUpdate, [&] {
+        dev->ActivateTriggerIn(TrigInSpiStart, 0);
+        invalidateWireOuts();
+    });
 }
 
 // Is the FPGA currently running?
 bool Rhs2000EvalBoard::isRunning()
 {
-    lock_guard<mutex> lockOk(okMutex);
-    int value;
-
-	dev->UpdateWireOuts();
-	value = dev->GetWireOutValue(WireOutSpiRunning);
+    WireOutSnapshot snapshot = getWireOutSnapshot();
 
     // update number of words in FIFO while we're at it
-    lastNumWordsInFifo = (dev->GetWireOutValue(WireOutNumWordsMsb) << 16) + dev->GetWireOutValue(WireOutNumWordsLsb);
+    lastNumWordsInFifo = snapshot.numWordsInFifo;
     numWordsHasBeenUpdated = true;
 
-	if ((value & 0x01) == 0) {
-		return false;
-	}
-	else {
-		return true;
-	}
+    return snapshot.spiRunning;
 }
 
 // Returns the number of 16-bit words in the USB FIFO.  The user should never attempt to read
 // more data than the FIFO currently contains, as it is not protected against underflow.
+// The count may be up to the wire-out staleness bound old, which can only underestimate it.
 // (Private method.)
 unsigned int Rhs2000EvalBoard::numWordsInFifo()
 {
-	dev->UpdateWireOuts();
-    lastNumWordsInFifo = (dev->GetWireOutValue(WireOutNumWordsMsb) << 16) + dev->GetWireOutValue(WireOutNumWordsLsb);
+    lastNumWordsInFifo = currentWireOuts().numWordsInFifo;
     numWordsHasBeenUpdated = true;
     return lastNumWordsInFifo;
 }
@@ -720,9 +754,9 @@ unsigned int Rhs2000EvalBoard::numWordsInFifo()
 // (Public, threadsafe method.)
 unsigned int Rhs2000EvalBoard::getNumWordsInFifo()
 {
-    lock_guard<mutex> lockOk(okMutex);
-
-    return numWordsInFifo();
+    lastNumWordsInFifo = getWireOutSnapshot().numWordsInFifo;
+    numWordsHasBeenUpdated = true;
+    return lastNumWordsInFifo;
 }
 
 // Returns the most recently mesaured number of 16-bit words in the USB FIFO.  Does not directly
@@ -759,7 +793,7 @@ unsigned int Rhs2000EvalBoard::fifoCapacityInWords()
 // based on the clock frequency!
 void Rhs2000EvalBoard::setCableDelay(BoardPort port, int delay)
 {
-    lock_guard<mutex> lockOk(okMutex);
+    BoardConfigTransaction transaction(this);
     int bitShift;
 
 	if (delay < 0 || delay > 15) {
@@ -790,8 +824,8 @@ void Rhs2000EvalBoard::setCableDelay(BoardPort port, int delay)
         cerr << "Error in Rhs2000EvalBoard::setCableDelay: unknown port." << endl;
 	}
 
-	dev->SetWireInValue(WireInMisoDelay, delay << bitShift, 0x000f << bitShift);
-	dev->UpdateWireIns();
+	transaction.setWireInValue(WireInMisoDelay, delay << bitShift, 0x000f << bitShift);
+    transaction.commit();
 }
 
 // Set the delay for sampling the MISO line on a particular SPI port (PortA - PortD) based on the length
@@ -858,16 +892,16 @@ double Rhs2000EvalBoard::estimateCableLengthFeet(int delay) const
 // Turn on or off DSP settle function in the FPGA.  (Only executes when CONVERT commands are sent.)
 void Rhs2000EvalBoard::setDspSettle(bool enabled)
 {
-    lock_guard<mutex> lockOk(okMutex);
+    BoardConfigTransaction transaction(this);
 
-    dev->SetWireInValue(WireInResetRun, (enabled ? 0x04 : 0x00), 0x04);
-	dev->UpdateWireIns();
+    transaction.setWireInValue(WireInResetRun, (enabled ? 0x04 : 0x00), 0x04);
+    transaction.commit();
 }
 
 // Enable or disable one of the eight available USB data streams (0-7).
 void Rhs2000EvalBoard::enableDataStream(int stream, bool enabled)
 {
-    lock_guard<mutex> lockOk(okMutex);
+    BoardConfigTransaction transaction(this);
 
     if (stream < 0 || stream >(MAX_NUM_DATA_STREAMS - 1)) {
         cerr << "Error in Rhs2000EvalBoard::enableDataStream: stream out of range." << endl;
@@ -876,20 +910,19 @@ void Rhs2000EvalBoard::enableDataStream(int stream, bool enabled)
 
 	if (enabled) {
 		if (dataStreamEnabled[stream] == 0) {
-			dev->SetWireInValue(WireInDataStreamEn, 0x0001 << stream, 0x0001 << stream);
-			dev->UpdateWireIns();
+			transaction.setWireInValue(WireInDataStreamEn, 0x0001 << stream, 0x0001 << stream);
 			dataStreamEnabled[stream] = 1;
 			numDataStreams++;
 		}
 	}
 	else {
 		if (dataStreamEnabled[stream] == 1) {
-			dev->SetWireInValue(WireInDataStreamEn, 0x0000 << stream, 0x0001 << stream);
-			dev->UpdateWireIns();
+			transaction.setWireInValue(WireInDataStreamEn, 0x0000 << stream, 0x0001 << stream);
 			dataStreamEnabled[stream] = 0;
 			numDataStreams--;
 		}
 	}
+    transaction.commit();
 }
 
 // Returns the number of enabled data streams.
@@ -901,11 +934,9 @@ int Rhs2000EvalBoard::getNumEnabledDataStreams() const
 // Read the 16 bits of the digital TTL input lines on the FPGA into an integer array.
 void Rhs2000EvalBoard::getTtlIn(int ttlInArray[])
 {
-    lock_guard<mutex> lockOk(okMutex);
     int i, ttlIn;
 
-	dev->UpdateWireOuts();
-	ttlIn = dev->GetWireOutValue(WireOutTtlIn);
+	ttlIn = getWireOutSnapshot().ttlIn;
 
 	for (i = 0; i < 16; ++i) {
 		ttlInArray[i] = 0;
@@ -917,20 +948,20 @@ void Rhs2000EvalBoard::getTtlIn(int ttlInArray[])
 // Set manual value for DACs.
 void Rhs2000EvalBoard::setDacManual(int value)
 {
-    lock_guard<mutex> lockOk(okMutex);
+    BoardConfigTransaction transaction(this);
     if (value < 0 || value > 65535) {
 		cerr << "Error in Rhs2000EvalBoard::setDacManual: value out of range." << endl;
 		return;
 	}
 
-	dev->SetWireInValue(WireInDacManual, value);
-	dev->UpdateWireIns();
+	transaction.setWireInValue(WireInDacManual, value);
+    transaction.commit();
 }
 
 // Set the eight red LEDs on the XEM6010 board according to integer array.
 void Rhs2000EvalBoard::setLedDisplay(int ledArray[])
 {
-    lock_guard<mutex> lockOk(okMutex);
+    BoardConfigTransaction transaction(this);
     int i, ledOut;
 
 	ledOut = 0;
@@ -938,14 +969,14 @@ void Rhs2000EvalBoard::setLedDisplay(int ledArray[])
 		if (ledArray[i] > 0)
 			ledOut += 1 << i;
 	}
-    dev->SetWireInValue(WireInLedDisplay, ledOut, 0x00ff);
-	dev->UpdateWireIns();
+    transaction.setWireInValue(WireInLedDisplay, ledOut, 0x00ff);
+    transaction.commit();
 }
 
 // Set the eight red LEDs on the front panel SPI ports according to integer array.
 void Rhs2000EvalBoard::setSpiLedDisplay(int ledArray[])
 {
-    lock_guard<mutex> lockOk(okMutex);
+    BoardConfigTransaction transaction(this);
     int i, ledOut;
 
     ledOut = 0;
@@ -953,14 +984,14 @@ void Rhs2000EvalBoard::setSpiLedDisplay(int ledArray[])
         if (ledArray[i] > 0)
             ledOut += 1 << i;
     }
-    dev->SetWireInValue(WireInLedDisplay, (ledOut << 8), 0xff00);
-    dev->UpdateWireIns();
+    transaction.setWireInValue(WireInLedDisplay, (ledOut << 8), 0xff00);
+    transaction.commit();
 }
 
 // Enable or disable AD5662 DAC channel (0-7)
 void Rhs2000EvalBoard::enableDac(int dacChannel, bool enabled)
 {
-    lock_guard<mutex> lockOk(okMutex);
+    BoardConfigTransaction transaction(this);
     if (dacChannel < 0 || dacChannel > 7) {
 		cerr << "Error in Rhs2000EvalBoard::enableDac: dacChannel out of range." << endl;
 		return;
@@ -968,66 +999,66 @@ void Rhs2000EvalBoard::enableDac(int dacChannel, bool enabled)
 
 	switch (dacChannel) {
 	case 0:
-		dev->SetWireInValue(WireInDacSource1, (enabled ? 0x0200 : 0x0000), 0x0200);
+		transaction.setWireInValue(WireInDacSource1, (enabled ? 0x0200 : 0x0000), 0x0200);
 		break;
 	case 1:
-		dev->SetWireInValue(WireInDacSource2, (enabled ? 0x0200 : 0x0000), 0x0200);
+		transaction.setWireInValue(WireInDacSource2, (enabled ? 0x0200 : 0x0000), 0x0200);
 		break;
 	case 2:
-		dev->SetWireInValue(WireInDacSource3, (enabled ? 0x0200 : 0x0000), 0x0200);
+		transaction.setWireInValue(WireInDacSource3, (enabled ? 0x0200 : 0x0000), 0x0200);
 		break;
 	case 3:
-		dev->SetWireInValue(WireInDacSource4, (enabled ? 0x0200 : 0x0000), 0x0200);
+		transaction.setWireInValue(WireInDacSource4, (enabled ? 0x0200 : 0x0000), 0x0200);
 		break;
 	case 4:
-		dev->SetWireInValue(WireInDacSource5, (enabled ? 0x0200 : 0x0000), 0x0200);
+		transaction.setWireInValue(WireInDacSource5, (enabled ? 0x0200 : 0x0000), 0x0200);
 		break;
 	case 5:
-		dev->SetWireInValue(WireInDacSource6, (enabled ? 0x0200 : 0x0000), 0x0200);
+		transaction.setWireInValue(WireInDacSource6, (enabled ? 0x0200 : 0x0000), 0x0200);
 		break;
 	case 6:
-		dev->SetWireInValue(WireInDacSource7, (enabled ? 0x0200 : 0x0000), 0x0200);
+		transaction.setWireInValue(WireInDacSource7, (enabled ? 0x0200 : 0x0000), 0x0200);
 		break;
 	case 7:
-		dev->SetWireInValue(WireInDacSource8, (enabled ? 0x0200 : 0x0000), 0x0200);
+		transaction.setWireInValue(WireInDacSource8, (enabled ? 0x0200 : 0x0000), 0x0200);
 		break;
 	}
-	dev->UpdateWireIns();
+    transaction.commit();
 }
 
 // Set the gain level of all eight DAC channels to 2^gain (gain = 0-7).
 void Rhs2000EvalBoard::setDacGain(int gain)
 {
-    lock_guard<mutex> lockOk(okMutex);
+    BoardConfigTransaction transaction(this);
     if (gain < 0 || gain > 7) {
 		cerr << "Error in Rhs2000EvalBoard::setDacGain: gain out of range." << endl;
 		return;
 	}
 
-	dev->SetWireInValue(WireInResetRun, gain << 13, 0xe000);
-	dev->UpdateWireIns();
+	transaction.setWireInValue(WireInResetRun, gain << 13, 0xe000);
+    transaction.commit();
 }
 
 // Suppress the noise on DAC channels 0 and 1 (the audio channels) between
 // +16*noiseSuppress and -16*noiseSuppress LSBs.  (noiseSuppress = 0-127).
 void Rhs2000EvalBoard::setAudioNoiseSuppress(int noiseSuppress)
 {
-    lock_guard<mutex> lockOk(okMutex);
+    BoardConfigTransaction transaction(this);
 
     if (noiseSuppress < 0 || noiseSuppress > 127) {
 		cerr << "Error in Rhs2000EvalBoard::setAudioNoiseSuppress: noiseSuppress out of range." << endl;
 		return;
 	}
 
-	dev->SetWireInValue(WireInResetRun, noiseSuppress << 6, 0x1fc0);
-	dev->UpdateWireIns();
+	transaction.setWireInValue(WireInResetRun, noiseSuppress << 6, 0x1fc0);
+    transaction.commit();
 }
 
 // Assign a particular data stream (0-7) to a DAC channel (0-7).  Setting stream
 // to 8 selects DacManual value.
 void Rhs2000EvalBoard::selectDacDataStream(int dacChannel, int stream)
 {
-    lock_guard<mutex> lockOk(okMutex);
+    BoardConfigTransaction transaction(this);
 
     if (dacChannel < 0 || dacChannel > 7) {
 		cerr << "Error in Rhs2000EvalBoard::selectDacDataStream: dacChannel out of range." << endl;
@@ -1041,37 +1072,37 @@ void Rhs2000EvalBoard::selectDacDataStream(int dacChannel, int stream)
 
 	switch (dacChannel) {
 	case 0:
-		dev->SetWireInValue(WireInDacSource1, stream << 5, 0x01e0);
+		transaction.setWireInValue(WireInDacSource1, stream << 5, 0x01e0);
 		break;
 	case 1:
-		dev->SetWireInValue(WireInDacSource2, stream << 5, 0x01e0);
+		transaction.setWireInValue(WireInDacSource2, stream << 5, 0x01e0);
 		break;
 	case 2:
-		dev->SetWireInValue(WireInDacSource3, stream << 5, 0x01e0);
+		transaction.setWireInValue(WireInDacSource3, stream << 5, 0x01e0);
 		break;
 	case 3:
-		dev->SetWireInValue(WireInDacSource4, stream << 5, 0x01e0);
+		transaction.setWireInValue(WireInDacSource4, stream << 5, 0x01e0);
 		break;
 	case 4:
-		dev->SetWireInValue(WireInDacSource5, stream << 5, 0x01e0);
+		transaction.setWireInValue(WireInDacSource5, stream << 5, 0x01e0);
 		break;
 	case 5:
-		dev->SetWireInValue(WireInDacSource6, stream << 5, 0x01e0);
+		transaction.setWireInValue(WireInDacSource6, stream << 5, 0x01e0);
 		break;
 	case 6:
-		dev->SetWireInValue(WireInDacSource7, stream << 5, 0x01e0);
+		transaction.setWireInValue(WireInDacSource7, stream << 5, 0x01e0);
 		break;
 	case 7:
-		dev->SetWireInValue(WireInDacSource8, stream << 5, 0x01e0);
+		transaction.setWireInValue(WireInDacSource8, stream << 5, 0x01e0);
 		break;
 	}
-	dev->UpdateWireIns();
+    transaction.commit();
 }
 
 // Assign a particular amplifier channel (0-31) to a DAC channel (0-7).
 void Rhs2000EvalBoard::selectDacDataChannel(int dacChannel, int dataChannel)
 {
-    lock_guard<mutex> lockOk(okMutex);
+    BoardConfigTransaction transaction(this);
 
     if (dacChannel < 0 || dacChannel > 7) {
 		cerr << "Error in Rhs2000EvalBoard::selectDacDataChannel: dacChannel out of range." << endl;
@@ -1085,47 +1116,47 @@ void Rhs2000EvalBoard::selectDacDataChannel(int dacChannel, int dataChannel)
 
 	switch (dacChannel) {
 	case 0:
-		dev->SetWireInValue(WireInDacSource1, dataChannel << 0, 0x001f);
+		transaction.setWireInValue(WireInDacSource1, dataChannel << 0, 0x001f);
 		break;
 	case 1:
-		dev->SetWireInValue(WireInDacSource2, dataChannel << 0, 0x001f);
+		transaction.setWireInValue(WireInDacSource2, dataChannel << 0, 0x001f);
 		break;
 	case 2:
-		dev->SetWireInValue(WireInDacSource3, dataChannel << 0, 0x001f);
+		transaction.setWireInValue(WireInDacSource3, dataChannel << 0, 0x001f);
 		break;
 	case 3:
-		dev->SetWireInValue(WireInDacSource4, dataChannel << 0, 0x001f);
+		transaction.setWireInValue(WireInDacSource4, dataChannel << 0, 0x001f);
 		break;
 	case 4:
-		dev->SetWireInValue(WireInDacSource5, dataChannel << 0, 0x001f);
+		transaction.setWireInValue(WireInDacSource5, dataChannel << 0, 0x001f);
 		break;
 	case 5:
-		dev->SetWireInValue(WireInDacSource6, dataChannel << 0, 0x001f);
+		transaction.setWireInValue(WireInDacSource6, dataChannel << 0, 0x001f);
 		break;
 	case 6:
-		dev->SetWireInValue(WireInDacSource7, dataChannel << 0, 0x001f);
+		transaction.setWireInValue(WireInDacSource7, dataChannel << 0, 0x001f);
 		break;
 	case 7:
-		dev->SetWireInValue(WireInDacSource8, dataChannel << 0, 0x001f);
+		transaction.setWireInValue(WireInDacSource8, dataChannel << 0, 0x001f);
 		break;
 	}
-	dev->UpdateWireIns();
+    transaction.commit();
 }
 
 void Rhs2000EvalBoard::enableDcAmpConvert(bool enable)
 {
-    lock_guard<mutex> lockOk(okMutex);
+    BoardConfigTransaction transaction(this);
 
-    dev->SetWireInValue(WireInDcAmpConvert, (enable ? 1 : 0));
-	dev->UpdateWireIns();
+    transaction.setWireInValue(WireInDcAmpConvert, (enable ? 1 : 0));
+    transaction.commit();
 }
 
 void Rhs2000EvalBoard::setExtraStates(unsigned int extraStates)
 {
-    lock_guard<mutex> lockOk(okMutex);
+    BoardConfigTransaction transaction(this);
 
-    dev->SetWireInValue(WireInExtraStates, extraStates);
-	dev->UpdateWireIns();
+    transaction.setWireInValue(WireInExtraStates, extraStates);
+    transaction.commit();
 }
 
 // Enable optional FPGA-implemented digital high-pass filters associated with DAC outputs
@@ -1135,11 +1166,11 @@ void Rhs2000EvalBoard::setExtraStates(unsigned int extraStates)
 // outputs, for example.
 void Rhs2000EvalBoard::enableDacHighpassFilter(bool enable)
 {
-    lock_guard<mutex> lockOk(okMutex);
+    BoardConfigTransaction transaction(this);
 
-    dev->SetWireInValue(WireInMultiUse, enable ? 1 : 0);
-	dev->UpdateWireIns();
-    dev->ActivateTriggerIn(TrigInDacHpf, 0);
+    transaction.setWireInValue(WireInMultiUse, enable ? 1 : 0);
+    transaction.activateTriggerIn(TrigInDacHpf, 0);
+    transaction.commit();
 }
 
 // Set cutoff frequency (in Hz) for optional FPGA-implemented digital high-pass filters
@@ -1149,7 +1180,7 @@ void Rhs2000EvalBoard::enableDacHighpassFilter(bool enable)
 // and produce digital pulses on the TTL outputs, for example.
 void Rhs2000EvalBoard::setDacHighpassFilter(double cutoff)
 {
-    lock_guard<mutex> lockOk(okMutex);
+    BoardConfigTransaction transaction(this);
 
     double b;
 	int filterCoefficient;
@@ -1169,9 +1200,9 @@ void Rhs2000EvalBoard::setDacHighpassFilter(double cutoff)
 		filterCoefficient = 65535;
 	}
 
-	dev->SetWireInValue(WireInMultiUse, filterCoefficient);
-	dev->UpdateWireIns();
-    dev->ActivateTriggerIn(TrigInDacHpf, 1);
+	transaction.setWireInValue(WireInMultiUse, filterCoefficient);
+    transaction.activateTriggerIn(TrigInDacHpf, 1);
+    transaction.commit();
 }
 
 // Set thresholds for DAC channels; threshold output signals appear on TTL outputs 0-7.
@@ -1181,7 +1212,7 @@ void Rhs2000EvalBoard::setDacHighpassFilter(double cutoff)
 // If trigPolarity is false, voltages equaling or falling below the threshold produce a high TTL output.
 void Rhs2000EvalBoard::setDacThreshold(int dacChannel, int threshold, bool trigPolarity)
 {
-    lock_guard<mutex> lockOk(okMutex);
+    BoardConfigTransaction transaction(this);
 
     if (dacChannel < 0 || dacChannel > 7) {
 		cerr << "Error in Rhs2000EvalBoard::setDacThreshold: dacChannel out of range." << endl;
@@ -1194,14 +1225,13 @@ void Rhs2000EvalBoard::setDacThreshold(int dacChannel, int threshold, bool trigP
 	}
 
 	// Set threshold level.
-	dev->SetWireInValue(WireInMultiUse, threshold);
-    dev->UpdateWireIns();
-    dev->ActivateTriggerIn(TrigInDacThresh, dacChannel);
+	transaction.setWireInValue(WireInMultiUse, threshold);
+    transaction.activateTriggerIn(TrigInDacThresh, dacChannel);
 
 	// Set threshold polarity.
-	dev->SetWireInValue(WireInMultiUse, (trigPolarity ? 1 : 0));
-	dev->UpdateWireIns();
-    dev->ActivateTriggerIn(TrigInDacThresh, dacChannel + 8);
+	transaction.setWireInValue(WireInMultiUse, (trigPolarity ? 1 : 0));
+    transaction.activateTriggerIn(TrigInDacThresh, dacChannel + 8);
+    transaction.commit();
 }
 
 // Is variable-frequency clock DCM programming done?
@@ -1230,22 +1260,26 @@ bool Rhs2000EvalBoard::isDataClockLocked() const
 // data acquisition has been stopped.)
 void Rhs2000EvalBoard::flush()
 {
-    lock_guard<mutex> lockOk(okMutex);
-
-    while (numWordsInFifo() >= USB_BUFFER_SIZE / 2) {
-		dev->ReadFromPipeOut(PipeOutData, USB_BUFFER_SIZE, usbBuffer);
-	}
-	while (numWordsInFifo() > 0) {
-		dev->ReadFromPipeOut(PipeOutData, 2 * numWordsInFifo(), usbBuffer);
-	}
+    lock_guard<mutex> lockPipe(pipeReadMutex);
+    unsigned int numWords;
+
+    ioScheduler->execute(BoardIoScheduler::BulkRead, [&] {
+        numWords = currentWireOuts(true).numWordsInFifo;
+    });
+    while (numWords > 0) {
+        if (readPipeOut(2 * (long) min(numWords, (unsigned int) (USB_BUFFER_SIZE / 2)), usbBuffer) <= 0)
+            break;
+        ioScheduler->execute(BoardIoScheduler::BulkRead, [&] {
+            numWords = currentWireOuts(true).numWordsInFifo;
+        });
+    }
 }
 
 // Read data block from the USB interface, if one is available.  Returns true if data block
 // was available.
 bool Rhs2000EvalBoard::readDataBlock(Rhs2000DataBlock *dataBlock)
 {
-    lock_guard<mutex> lockOk(okMutex);
-
+    lock_guard<mutex> lockPipe(pipeReadMutex);
     unsigned int numBytesToRead;
 
 	numBytesToRead = 2 * dataBlock->calculateDataBlockSizeInWords(numDataStreams);
@@ -1256,7 +1290,7 @@ bool Rhs2000EvalBoard::readDataBlock(Rhs2000DataBlock *dataBlock)
 		return false;
 	}
 
-	dev->ReadFromPipeOut(PipeOutData, numBytesToRead, usbBuffer);
+    readPipeOut(numBytesToRead, usbBuffer);
 
 	dataBlock->fillFromUsbBuffer(usbBuffer, 0, numDataStreams);
 
@@ -1267,14 +1301,17 @@ bool Rhs2000EvalBoard::readDataBlock(Rhs2000DataBlock *dataBlock)
 // to a buffer.  Returns total number of bytes read.
 long Rhs2000EvalBoard::readDataBlocksRaw(int numBlocks, unsigned char* buffer)
 {
-    lock_guard<mutex> lockOk(okMutex);
-
+    lock_guard<mutex> lockPipe(pipeReadMutex);
     unsigned int numWordsToRead = numBlocks * Rhs2000DataBlock::calculateDataBlockSizeInWords(numDataStreams);
+    bool dataAvailable;
 
-    if (numWordsInFifo() < numWordsToRead)
+    ioScheduler->execute(BoardIoScheduler::BulkRead, [&] {
+        dataAvailable = numWordsInFifo() >= numWordsToRead;
+    });
+    if (!dataAvailable)
         return 0;
 
-    long result = dev->ReadFromPipeOut(PipeOutData, 2 * numWordsToRead, buffer);
+    long result = readPipeOut(2 * (long) numWordsToRead, buffer);
 
     if (result >= 0) { }
     else if (result == ok_Failed) {
@@ -1286,19 +1323,46 @@ long Rhs2000EvalBoard::readDataBlocksRaw(int numBlocks, unsigned char* buffer)
     return result;
 }
 
+// Read numBytes from the data pipe into buffer as a series of bulk read operations of the I/O
+// scheduler, so that spike reads and stimulation triggers queued meanwhile are served after at
+// most one chunk instead of after the whole transfer.  Returns the number of bytes read, or the
+// negative error code of the failed pipe read.  Must be called with pipeReadMutex held, so that
+// the chunks of two reads never interleave.  (Private method.)
+long Rhs2000EvalBoard::readPipeOut(long numBytes, unsigned char* buffer)
+{
+    long numBytesRead = 0;
+    long result = 0;
+    while (numBytesRead < numBytes) {
+        long chunkSize = min(numBytes - numBytesRead, (long) bulkReadChunkSize);
+        ioScheduler->execute(BoardIoScheduler::BulkRead, [&] {
+            result = dev->ReadFromPipeOut(PipeOutData, chunkSize, buffer + numBytesRead);
+            if (result > 0)
+                consumeFifoWords(result / 2);
+        });
+        if (result <= 0)
+            break;
+        numBytesRead += result;
+    }
+
+    return (result < 0) ? result : numBytesRead;
+}
+
 // Reads a certain number of USB data blocks, if the specified number is available, and appends them
 // to queue.  Returns true if data blocks were available.
 bool Rhs2000EvalBoard::readDataBlocks(int numBlocks, queue<Rhs2000DataBlock> &dataQueue)
 {
-    lock_guard<mutex> lockOk(okMutex);
-
+    lock_guard<mutex> lockPipe(pipeReadMutex);
     unsigned int numWordsToRead, numBytesToRead;
 	int i;
 	Rhs2000DataBlock *dataBlock;
+    bool dataAvailable;
 
 	numWordsToRead = numBlocks * dataBlock->calculateDataBlockSizeInWords(numDataStreams);
 
-	if (numWordsInFifo() < numWordsToRead)
+    ioScheduler->execute(BoardIoScheduler::BulkRead, [&] {
+        dataAvailable = numWordsInFifo() >= numWordsToRead;
+    });
+    if (!dataAvailable)
 		return false;
 
 	numBytesToRead = 2 * numWordsToRead;
@@ -1309,7 +1373,7 @@ bool Rhs2000EvalBoard::readDataBlocks(int numBlocks, queue<Rhs2000DataBlock> &da
 		return false;
 	}
 
-	dev->ReadFromPipeOut(PipeOutData, numBytesToRead, usbBuffer);
+    readPipeOut(numBytesToRead, usbBuffer);
 
 	dataBlock = new Rhs2000DataBlock(numDataStreams);
 	for (i = 0; i < numBlocks; ++i) {
@@ -1402,11 +1466,12 @@ string Rhs2000EvalBoard::opalKellyModelName(int model) const
 // Return 4-bit "board mode" input.
 int Rhs2000EvalBoard::getBoardMode()
 {
-    lock_guard<mutex> lockOk(okMutex);
     int mode;
 
-	dev->UpdateWireOuts();
-	mode = dev->GetWireOutValue(WireOutBoardMode);
+    ioScheduler->execute(BoardIoScheduler::WireUpdate, [&] {
+        dev->UpdateWireOuts();
+        mode = dev->GetWireOutValue(WireOutBoardMode);
+    });
 
 	cout << "Board mode: " << mode << endl << endl;
 
@@ -1533,52 +1598,81 @@ void Rhs2000EvalBoard::configureRegister(Rhs2000Registers *chipRegisters, int re
 }
 
 // Upload an auxiliary command list to a particular auxiliary command slot (AuxCmd1, AuxCmd2,
-// AuxCmd3, or AuxCmd4) in the FPGA.
+// AuxCmd3, or AuxCmd4) in the FPGA.  The shared command buffers are filled on the I/O thread,
+// so that uploads from different threads cannot interleave.
 void Rhs2000EvalBoard::uploadCommandList(const vector<unsigned int> &commandList, AuxCmdSlot auxCommandSlot)
 {
-    lock_guard<mutex> lockOk(okMutex);
-	unsigned int i;
+    ioScheduler->execute(BoardIoScheduler::StimTrigger, [&] {
+        unsigned int i;
 
-	for (i = 0; i < commandList.size(); ++i) {
-		commandBufferMsw[2 * i] = (unsigned char)((commandList[i] & 0x00ff0000) >> 16);
-		commandBufferMsw[2 * i + 1] = (unsigned char)((commandList[i] & 0xff000000) >> 24);
-		commandBufferLsw[2 * i] = (unsigned char)((commandList[i] & 0x000000ff) >> 0);
-		commandBufferLsw[2 * i + 1] = (unsigned char)((commandList[i] & 0x0000ff00) >> 8);
-	}
+        for (i = 0; i < commandList.size(); ++i) {
+            commandBufferMsw[2 * i] = (unsigned char)((commandList[i] & 0x00ff0000) >> 16);
+            commandBufferMsw[2 * i + 1] = (unsigned char)((commandList[i] & 0xff000000) >> 24);
+            commandBufferLsw[2 * i] = (unsigned char)((commandList[i] & 0x000000ff) >> 0);
+            commandBufferLsw[2 * i + 1] = (unsigned char)((commandList[i] & 0x0000ff00) >> 8);
+        }
 
-	switch (auxCommandSlot) {
-	case AuxCmd1:
+        uploadCommandBuffers(commandBufferMsw, commandBufferLsw, commandList.size(), auxCommandSlot);
+    });
+}
+
+// Upload a command list already split into MSW and LSW byte buffers (2 bytes per command each,
+// laid out as in uploadCommandList) to one of the four command slots.
+void Rhs2000EvalBoard::uploadCommandBuffers(const unsigned char *commandMsw, const unsigned char *commandLsw,
+                                            int numCommands, AuxCmdSlot auxCommandSlot)
+{
+    int pipeMsw, pipeLsw;
+
+    switch (auxCommandSlot) {
+    case AuxCmd1:
+        pipeMsw = PipeInAuxCmd1Msw;
+        pipeLsw = PipeInAuxCmd1Lsw;
+        break;
+    case AuxCmd2:
+        pipeMsw = PipeInAuxCmd2Msw;
+        pipeLsw = PipeInAuxCmd2Lsw;
+        break;
+    case AuxCmd3:
+        pipeMsw = PipeInAuxCmd3Msw;
+        pipeLsw = PipeInAuxCmd3Lsw;
+        break;
+    case AuxCmd4:
+        pipeMsw = PipeInAuxCmd4Msw;
+        pipeLsw = PipeInAuxCmd4Lsw;
+        break;
+    default:
+        cerr << "Error in Rhs2000EvalBoard::uploadCommandBuffers: auxCommandSlot out of range." << endl;
+        return;
+    }
+
+    // The Opal Kelly API takes non-const buffers but does not write to pipe-in data.
+    ioScheduler->execute(BoardIoScheduler::StimTrigger, [&] {
         dev->ActivateTriggerIn(TrigInRamAddrReset, 0);
-		dev->WriteToPipeIn(PipeInAuxCmd1Msw, 2 * commandList.size(), commandBufferMsw);
-		dev->ActivateTriggerIn(TrigInRamAddrReset, 0);
-		dev->WriteToPipeIn(PipeInAuxCmd1Lsw, 2 * commandList.size(), commandBufferLsw);
-		break;
-	case AuxCmd2:
-		dev->ActivateTriggerIn(TrigInRamAddrReset, 0);
-		dev->WriteToPipeIn(PipeInAuxCmd2Msw, 2 * commandList.size(), commandBufferMsw);
-		dev->ActivateTriggerIn(TrigInRamAddrReset, 0);
-		dev->WriteToPipeIn(PipeInAuxCmd2Lsw, 2 * commandList.size(), commandBufferLsw);
-		break;
-	case AuxCmd3:
-		dev->ActivateTriggerIn(TrigInRamAddrReset, 0);
-		dev->WriteToPipeIn(PipeInAuxCmd3Msw, 2 * commandList.size(), commandBufferMsw);
-		dev->ActivateTriggerIn(TrigInRamAddrReset, 0);
-		dev->WriteToPipeIn(PipeInAuxCmd3Lsw, 2 * commandList.size(), commandBufferLsw);
-		break;
-	case AuxCmd4:
-		dev->ActivateTriggerIn(TrigInRamAddrReset, 0);
-		dev->WriteToPipeIn(PipeInAuxCmd4Msw, 2 * commandList.size(), commandBufferMsw);
-		dev->ActivateTriggerIn(TrigInRamAddrReset, 0);
-		dev->WriteToPipeIn(PipeInAuxCmd4Lsw, 2 * commandList.size(), commandBufferLsw);
-		break;
-	}
-	
+        dev->WriteToPipeIn(pipeMsw, 2 * numCommands, const_cast<unsigned char*>(commandMsw));
+        dev->ActivateTriggerIn(TrigInRamAddrReset, 0);
+        dev->WriteToPipeIn(pipeLsw, 2 * numCommands, const_cast<unsigned char*>(commandLsw));
+    });
+}
+
+// Reprogram the stimulation magnitudes of one stream from a pre-serialized AuxCmd1 command list:
+// leave stimulation command mode, route auxiliary commands to the stream, upload the list, set
+// its length and re-enter stimulation command mode, all in a single I/O scheduler operation.
+void Rhs2000EvalBoard::uploadStimMagnitudeCommands(int stream, const unsigned char *commandMsw, const unsigned char *commandLsw,
+                                                   int numCommands)
+{
+    ioScheduler->execute(BoardIoScheduler::StimTrigger, [&] {
+        setStimCmdMode(false);
+        enableAuxCommandsOnOneStream(stream);
+        uploadCommandBuffers(commandMsw, commandLsw, numCommands, AuxCmd1);
+        selectAuxCommandLength(AuxCmd1, 0, numCommands - 1);
+        setStimCmdMode(true);
+    });
 }
 
 // Selects an amplifier channel from a particular data stream to be subtracted from all DAC signals.
 void Rhs2000EvalBoard::setDacRerefSource(int stream, int channel)
 {
-    lock_guard<mutex> lockOk(okMutex);
+    BoardConfigTransaction transaction(this);
 
     if (stream < 0 || stream > (MAX_NUM_DATA_STREAMS - 1)) {
         cerr << "Error in Rhs2000EvalBoard::setDacRerefSource: stream out of range." << endl;
@@ -1590,37 +1684,37 @@ void Rhs2000EvalBoard::setDacRerefSource(int stream, int channel)
         return;
     }
 
-    dev->SetWireInValue(WireInDacReref, (stream << 5) + channel, 0x0000000ff);
-    dev->UpdateWireIns();
+    transaction.setWireInValue(WireInDacReref, (stream << 5) + channel, 0x0000000ff);
+    transaction.commit();
 }
 
 // Enables DAC rereferencing, where a selected amplifier channel is subtracted from all DACs in real time.
 void Rhs2000EvalBoard::enableDacReref(bool enabled)
 {
-    lock_guard<mutex> lockOk(okMutex);
+    BoardConfigTransaction transaction(this);
 
-    dev->SetWireInValue(WireInDacReref, (enabled ? 0x00000100 : 0x00000000), 0x00000100);
-    dev->UpdateWireIns();
+    transaction.setWireInValue(WireInDacReref, (enabled ? 0x00000100 : 0x00000000), 0x00000100);
+    transaction.commit();
 }
 
 // Turn on or off automatic stimulation command mode in the FPGA.
 void Rhs2000EvalBoard::setStimCmdMode(bool enabled)
 {
-    lock_guard<mutex> lockOk(okMutex);
-
-    dev->SetWireInValue(WireInStimCmdMode, (enabled ? 0x01 : 0x00), 0x01);
-    dev->UpdateWireIns();
+    ioScheduler->execute(BoardIoScheduler::StimTrigger, [&] {
+        dev->SetWireInValue(WireInStimCmdMode, (enabled ? 0x01 : 0x00), 0x01);
+        dev->UpdateWireIns();
+    });
 }
 
 // Set a particular stimulation control register.
 void Rhs2000EvalBoard::programStimReg(int stream, int channel, StimRegister reg, int value)
 {
-    lock_guard<mutex> lockOk(okMutex);
-
-    dev->SetWireInValue(WireInStimRegAddr, (stream << 8) + (channel << 4) + reg);
-    dev->SetWireInValue(WireInStimRegWord, value);
-    dev->UpdateWireIns();
-    dev->ActivateTriggerIn(TrigInRamAddrReset, 1);
+    ioScheduler->execute(BoardIoScheduler::StimTrigger, [&] {
+        dev->SetWireInValue(WireInStimRegAddr, (stream << 8) + (channel << 4) + reg);
+        dev->SetWireInValue(WireInStimRegWord, value);
+        dev->UpdateWireIns();
+        dev->ActivateTriggerIn(TrigInRamAddrReset, 1);
+    });
 }
 
 // Configure a particular stimulation trigger.
@@ -1943,7 +2037,7 @@ void Rhs2000EvalBoard::readDigitalInExpManual()
 // Set the voltage threshold to be used for digital triggers on Analog In ports.
 void Rhs2000EvalBoard::setAnalogInTriggerThreshold(double voltageThreshold)
 {
-    lock_guard<mutex> lockOk(okMutex);
+    BoardConfigTransaction transaction(this);
 
     int value = (int) (32768 * (voltageThreshold / 10.24) + 32768);
     if (value < 0) {
@@ -1952,32 +2046,32 @@ void Rhs2000EvalBoard::setAnalogInTriggerThreshold(double voltageThreshold)
         value = 65535;
     }
 
-    dev->SetWireInValue(WireInAdcThreshold, value);
-    dev->UpdateWireIns();
+    transaction.setWireInValue(WireInAdcThreshold, value);
+    transaction.commit();
 }
 
 // Set state of manual stimulation trigger 0-7 (e.g., from keypresses).
 void Rhs2000EvalBoard::setManualStimTrigger(int trigger, bool triggerOn)
 {
-    lock_guard<mutex> lockOk(okMutex);
-
     if (trigger < 0 || trigger > 7) {
         cerr << "Error in Rhs2000EvalBoard::setManualStimTrigger: trigger out of range." << endl;
         return;
     }
 
-    dev->SetWireInValue(WireInManualTriggers, (triggerOn ? 1 : 0) << trigger, 1 << trigger);
-    dev->UpdateWireIns();
+    ioScheduler->execute(BoardIoScheduler::StimTrigger, [&] {
+        dev->SetWireInValue(WireInManualTriggers, (triggerOn ? 1 : 0) << trigger, 1 << trigger);
+        dev->UpdateWireIns();
+    });
 }
 
 // Enable auxiliary commands slots 0-3 on all data streams (0-7).  This disables automatic stimulation
 // control on all data streams.
 void Rhs2000EvalBoard::enableAuxCommandsOnAllStreams()
 {
-    lock_guard<mutex> lockOk(okMutex);
+    BoardConfigTransaction transaction(this);
 
-    dev->SetWireInValue(WireInAuxEnable, 0x00ff, 0x00ff);
-    dev->UpdateWireIns();
+    transaction.setWireInValue(WireInAuxEnable, 0x00ff, 0x00ff);
+    transaction.commit();
 }
 
 // Enable auxiliary commands slots 0-3 on one selected data stream, and disable auxiliary command slots on
@@ -1985,15 +2079,15 @@ void Rhs2000EvalBoard::enableAuxCommandsOnAllStreams()
 // automatic stimulation control on all other streams.
 void Rhs2000EvalBoard::enableAuxCommandsOnOneStream(int stream)
 {
-    lock_guard<mutex> lockOk(okMutex);
-
     if (stream < 0 || stream >(MAX_NUM_DATA_STREAMS - 1)) {
         cerr << "Error in Rhs2000EvalBoard::enableAuxCommandsOnOneStream: stream out of range." << endl;
         return;
     }
 
-    dev->SetWireInValue(WireInAuxEnable, 0x0001 << stream, 0x00ff);
-    dev->UpdateWireIns();
+    ioScheduler->execute(BoardIoScheduler::StimTrigger, [&] {
+        dev->SetWireInValue(WireInAuxEnable, 0x0001 << stream, 0x00ff);
+        dev->UpdateWireIns();
+    });
 }
 
 // The first four boolean parameters determine if global settling should be applied to particular SPI ports A-D.
@@ -2004,15 +2098,15 @@ void Rhs2000EvalBoard::enableAuxCommandsOnOneStream(int stream)
 void Rhs2000EvalBoard::setGlobalSettlePolicy(bool settleWholeHeadstageA, bool settleWholeHeadstageB, bool settleWholeHeadstageC,
                                              bool settleWholeHeadstageD, bool settleAllHeadstages)
 {
-    lock_guard<mutex> lockOk(okMutex);
+    BoardConfigTransaction transaction(this);
 
     int value;
 
     value = (settleAllHeadstages ? 16 : 0) + (settleWholeHeadstageA ? 1 : 0) + (settleWholeHeadstageB ? 2 : 0) +
             (settleWholeHeadstageC ? 4 : 0) + (settleWholeHeadstageD ? 8 : 0);
 
-    dev->SetWireInValue(WireInGlobalSettleSelect, value, 0x001f);
-    dev->UpdateWireIns();
+    transaction.setWireInValue(WireInGlobalSettleSelect, value, 0x001f);
+    transaction.commit();
 }
 
 // Sets the function of Digital Out ports 1-8.
@@ -2021,7 +2115,7 @@ void Rhs2000EvalBoard::setGlobalSettlePolicy(bool settleWholeHeadstageA, bool se
 // Note: Digital Out ports 9-16 are always controlled by a digital sequencer.
 void Rhs2000EvalBoard::setTtlOutMode(bool mode1, bool mode2, bool mode3, bool mode4, bool mode5, bool mode6, bool mode7, bool mode8)
 {
-    lock_guard<mutex> lockOk(okMutex);
+    BoardConfigTransaction transaction(this);
 
     int value = 0;
     value += mode1 ? 1 : 0;
@@ -2033,8 +2127,8 @@ void Rhs2000EvalBoard::setTtlOutMode(bool mode1, bool mode2, bool mode3, bool mo
     value += mode7 ? 64 : 0;
     value += mode8 ? 128 : 0;
 
-    dev->SetWireInValue(WireInTtlOutMode, value, 0x000000ff);
-    dev->UpdateWireIns();
+    transaction.setWireInValue(WireInTtlOutMode, value, 0x000000ff);
+    transaction.commit();
 }
 
 // Select amp settle mode for all connected chips:
@@ -2042,10 +2136,10 @@ void Rhs2000EvalBoard::setTtlOutMode(bool mode1, bool mode2, bool mode3, bool mo
 // useFastSettle true = amplifier fast settle (legacy mode from RHD2000 series chips)
 void Rhs2000EvalBoard::setAmpSettleMode(bool useFastSettle)
 {
-    lock_guard<mutex> lockOk(okMutex);
+    BoardConfigTransaction transaction(this);
 
-    dev->SetWireInValue(WireInResetRun, (useFastSettle ? 0x08 : 0x00), 0x08); // set amp_settle_mode (0 = amplifier low frequency cutoff select; 1 = amplifier fast settle)
-    dev->UpdateWireIns();
+    transaction.setWireInValue(WireInResetRun, (useFastSettle ? 0x08 : 0x00), 0x08); // set amp_settle_mode (0 = amplifier low frequency cutoff select; 1 = amplifier fast settle)
+    transaction.commit();
 }
 
 // Select charge recovery mode for all connected chips:
@@ -2053,8 +2147,10 @@ void Rhs2000EvalBoard::setAmpSettleMode(bool useFastSettle)
 // useSwitch true = charge recovery switch
 void Rhs2000EvalBoard::setChargeRecoveryMode(bool useSwitch)
 {
-    dev->SetWireInValue(WireInResetRun, (useSwitch ? 0x10 : 0x00), 0x10); // set charge_recov_mode (0 = current-limited charge recovery drivers; 1 = charge recovery switch)
-    dev->UpdateWireIns();
+    BoardConfigTransaction transaction(this);
+
+    transaction.setWireInValue(WireInResetRun, (useSwitch ? 0x10 : 0x00), 0x10); // set charge_recov_mode (0 = current-limited charge recovery drivers; 1 = charge recovery switch)
+    transaction.commit();
 }
 
 // Reset stimulation sequencer units.  This is typically called when data acquisition is stopped.
@@ -2063,45 +2159,58 @@ void Rhs2000EvalBoard::setChargeRecoveryMode(bool useSwitch)
 // will resume after data acquisition is restarted.
 void Rhs2000EvalBoard::resetSequencers()
 {
-    lock_guard<mutex> lockOk(okMutex);
-
-    dev->ActivateTriggerIn(TrigInSpiStart, 1);
+    ioScheduler->execute(BoardIoScheduler::WireUpdate, [&] {
+        dev->ActivateTriggerIn(TrigInSpiStart, 1);
+    });
 }
 
 //-----------------------------------------------------------------------------
 
 void Rhs2000EvalBoard::runSpikeDetector(bool run)
 {
-    lock_guard<mutex> lockOk(okMutex);
-
+    BoardConfigTransaction transaction(this);
     if (run)
-        dev->SetWireInValue(0x00, 0x20, 0x20);
+        transaction.setWireInValue(0x00, 0x20, 0x20);
     else
-        dev->SetWireInValue(0x00, 0x00, 0x20);
-    dev->UpdateWireIns();
+        transaction.setWireInValue(0x00, 0x00, 0x20);
+    transaction.commit();
 }
 
 #include <bitset>
-// Read, if they exist, spikes from the USB interface
+// Read, if they exist, spikes from the USB interface into the spike event buffer.
+// Returns the number of new events, or a negative Opal Kelly error code.
 long Rhs2000EvalBoard::readSpike()
 {
-    lock_guard<mutex> lockOk(okMutex);
+    long result = 0;
 
-    dev->UpdateWireOuts();
-    int spikesToRead = dev->GetWireOutValue(0x3d) * 2;
-    spikesToRead = spikesToRead - (spikesToRead % 8);
+    // Spike reads have the highest priority: they only wait for the bulk chunk currently in flight.
+    ioScheduler->execute(BoardIoScheduler::SpikeRead, [&] {
+        unsigned int numSpikeWords = currentWireOuts().numSpikeWords;
+        spikeBacklogMetric->record(numSpikeWords);
+        int spikesToRead = numSpikeWords * 2;
+        spikesToRead = min(spikesToRead, spikeEvents.pipeBufferSize());
+        spikesToRead = spikesToRead - (spikesToRead % SPIKE_RECORD_BYTES);
 
-    //std::bitset<16> x(dev->GetWireOutValue(0x3c));
-    //std::cout << x << endl;
+        //std::bitset<16> x(dev->GetWireOutValue(0x3c));
+        //std::cout << x << endl;
 
-    if (spikesToRead < 8)
-        return 0;
-    //else
-        //std::cout << "Reading " << (float)spikesLength / 8 << " events" << endl; //
+        if (spikesToRead < SPIKE_RECORD_BYTES)
+            return;
+        //else
+            //std::cout << "Reading " << (float)spikesLength / 8 << " events" << endl; //
 
-    long result = dev->ReadFromPipeOut(0xa1, spikesToRead, spikesInfo);
+        result = dev->ReadFromPipeOut(0xa1, spikesToRead, spikeEvents.pipeBuffer());
+        if (result > 0) {
+            lock_guard<mutex> lockWireOuts(wireOutMutex);
+            wireOutSnapshot.numSpikeWords -= min(wireOutSnapshot.numSpikeWords, (unsigned int) result / 2);
+        }
+    });
 
-    if (result >= 0) { }
+    if (result >= 0) {
+        long numEvents = spikeEvents.commitPipeRead(result);
+        spikeEventMetric->add(numEvents);
+        return numEvents;
+    }
     else if (result == ok_Failed) {
         cerr << "CRITICAL (readSpike): Failure on pipe read.  Check buffer size." << endl;
     } else if (result == ok_InvalidEndpoint) {
@@ -2117,32 +2226,29 @@ long Rhs2000EvalBoard::readSpike()
     return result;
 }
 
-unsigned char* Rhs2000EvalBoard::getSpikesInfo()
+// Ring buffer holding the decoded hardware detections; consumers read it through their own cursor.
+SpikeEventBuffer* Rhs2000EvalBoard::getSpikeEventBuffer()
 {
-    return spikesInfo;
+    return &spikeEvents;
 }
 
 void Rhs2000EvalBoard::setThresholdMult(float mult)
 {
-    lock_guard<mutex> lockOk(okMutex);
-
-    dev->SetWireInValue(0x15, round(mult*2), 0x00ff);
-    dev->UpdateWireIns();
+    BoardConfigTransaction transaction(this);
+    transaction.setWireInValue(0x15, round(mult*2), 0x00ff);
+    transaction.commit();
 }
 
 // In milliseconds
 void Rhs2000EvalBoard::setBlindWindowLength(int length)
 {
-    lock_guard<mutex> lockOk(okMutex);
-
-    dev->SetWireInValue(0x15, length << 8, 0xff00);
-    dev->UpdateWireIns();
+    BoardConfigTransaction transaction(this);
+    transaction.setWireInValue(0x15, length << 8, 0xff00);
+    transaction.commit();
 }
 
 void Rhs2000EvalBoard::setDeactiveChannels(bool chs[32])
 {
-    lock_guard<mutex> lockOk(okMutex);
-
     int chsMaskA = 0;
     int chsMaskB = 0;
     for(int i=0; i<16; i++){
@@ -2152,7 +2258,111 @@ void Rhs2000EvalBoard::setDeactiveChannels(bool chs[32])
             chsMaskB |= quint32(1) << i;
     }
 
-    dev->SetWireInValue(0x0b, chsMaskA);
-    dev->SetWireInValue(0x0e, chsMaskB);
-    dev->UpdateWireIns();
+    BoardConfigTransaction transaction(this);
+    transaction.setWireInValue(0x0b, chsMaskA);
+    transaction.setWireInValue(0x0e, chsMaskB);
+    transaction.commit();
+}
+
+// Returns the shared wire-out snapshot, refreshing it over USB first if it is older than the
+// staleness bound (or if forceUpdate is true).  Must be called with okMutex held, i.e. from within
+// an I/O scheduler operation.  (Private method.)
+WireOutSnapshot Rhs2000EvalBoard::currentWireOuts(bool forceUpdate)
+{
+    if (!forceUpdate && isWireOutSnapshotFresh()) {
+        lock_guard<mutex> lockWireOuts(wireOutMutex);
+        return wireOutSnapshot;
+    }
+
+    WireOutSnapshot snapshot;
+    snapshot.timestamp = chrono::steady_clock::now();
+    dev->UpdateWireOuts();
+    numWireOutUpdates++;
+    snapshot.numWordsInFifo = (dev->GetWireOutValue(WireOutNumWordsMsb) << 16) + dev->GetWireOutValue(WireOutNumWordsLsb);
+    snapshot.numSpikeWords = dev->GetWireOutValue(WireOutNumSpikeWords);
+    snapshot.channelMaskEcho[0] = dev->GetWireOutValue(WireOutChannelMaskEchoA);
+    snapshot.channelMaskEcho[1] = dev->GetWireOutValue(WireOutChannelMaskEchoB);
+    snapshot.spiRunning = (dev->GetWireOutValue(WireOutSpiRunning) & 0x01) != 0;
+    snapshot.ttlIn = dev->GetWireOutValue(WireOutTtlIn);
+
+    lock_guard<mutex> lockWireOuts(wireOutMutex);
+    wireOutSnapshot = snapshot;
+    return snapshot;
+}
+
+// Is the snapshot younger than the staleness bound?  (Private method.)
+bool Rhs2000EvalBoard::isWireOutSnapshotFresh() const
+{
+    lock_guard<mutex> lockWireOuts(wireOutMutex);
+    return chrono::steady_clock::now() - wireOutSnapshot.timestamp < chrono::microseconds(wireOutMaxAgeUs);
+}
+
+// Force the next reader to refresh the snapshot, after a command that changes the wire-outs.
+// (Private method.)
+void Rhs2000EvalBoard::invalidateWireOuts()
+{
+    lock_guard<mutex> lockWireOuts(wireOutMutex);
+    wireOutSnapshot.timestamp = chrono::steady_clock::time_point();
+}
+
+// Account for words just read from the data pipe, so the snapshot never overstates the FIFO.
+// (Private method.)
+void Rhs2000EvalBoard::consumeFifoWords(unsigned int numWords)
+{
+    lock_guard<mutex> lockWireOuts(wireOutMutex);
+    wireOutSnapshot.numWordsInFifo -= min(wireOutSnapshot.numWordsInFifo, numWords);
+}
+
+// Returns the wire-outs polled during acquisition (FIFO depth, spike FIFO depth, channel mask echo,
+// run state, TTL inputs).  All callers share one snapshot, refreshed with a single USB transaction
+// when it is older than the staleness bound.  (Public, threadsafe method.)
+WireOutSnapshot Rhs2000EvalBoard::getWireOutSnapshot()
+{
+    if (isWireOutSnapshotFresh()) {
+        lock_guard<mutex> lockWireOuts(wireOutMutex);
+        return wireOutSnapshot;
+    }
+
+    WireOutSnapshot snapshot;
+    ioScheduler->execute(BoardIoScheduler::WireUpdate, [&] {
+        snapshot = currentWireOuts();
+    });
+    return snapshot;
+}
+
+// Set the staleness bound (in microseconds) of the wire-out snapshot.  Zero refreshes on every read.
+void Rhs2000EvalBoard::setWireOutMaxAge(int maxAgeUs)
+{
+    lock_guard<mutex> lockWireOuts(wireOutMutex);
+    wireOutMaxAgeUs = max(maxAgeUs, 0);
+}
+
+int Rhs2000EvalBoard::getWireOutMaxAge() const
+{
+    lock_guard<mutex> lockWireOuts(wireOutMutex);
+    return wireOutMaxAgeUs;
+}
+
+// Number of UpdateWireOuts() USB transactions issued through the snapshot.
+unsigned long long Rhs2000EvalBoard::getNumWireOutUpdates() const
+{
+    return numWireOutUpdates;
+}
+
+// Scheduler serializing USB traffic to the board; exposes per-class queueing delay statistics.
+BoardIoScheduler* Rhs2000EvalBoard::getIoScheduler() const
+{
+    return ioScheduler;
+}
+
+// Set the size (in bytes) of the pipe transfers bulk data reads are split into.  Smaller chunks
+// lower the worst-case wait of spike reads at the cost of more USB transactions per data block.
+void Rhs2000EvalBoard::setBulkReadChunkSize(unsigned int numBytes)
+{
+    numBytes -= numBytes % 16;
+    if (numBytes < 16) {
+        cerr << "Error in Rhs2000EvalBoard::setBulkReadChunkSize: chunk size out of range." << endl;
+        return;
+    }
+    bulkReadChunkSize = numBytes;
 }
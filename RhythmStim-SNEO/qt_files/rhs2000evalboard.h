@@ -28,6 +28,14 @@
 #define FIFO_CAPACITY_WORDS 67108864
 #define RHS_BOARD_MODE 14
 
+// Bulk data reads are split into transfers of this many bytes (multiple of 16), so that
+// latency-critical board I/O can be scheduled between them.
+#define BULK_READ_CHUNK_BYTES 32768
+
+// Wire-out values younger than this (in microseconds) are served from the shared snapshot
+// instead of issuing a new UpdateWireOuts() USB transaction.
+#define WIRE_OUT_MAX_AGE_US 250
+
 // The maximum number of Rhs2000DataBlock objects we will need is set by the need
 // to perform electrode impedance measurements at very low frequencies.
 // (Maximum command length = 1024 for one period; seven periods required in worst case.)
@@ -35,15 +43,34 @@
 
 #include <queue>
 #include <mutex>
+#include <atomic>
+#include <chrono>
+
+#include "spikeeventbuffer.h"
 
 using namespace std;
 
 class okCFrontPanel;
+class BoardIoScheduler;
 class Rhs2000DataBlock;
 class Rhs2000Registers;
+class MetricCounter;
+class LatencyHistogram;
+
+// All the wire-outs polled during acquisition, read with a single UpdateWireOuts().
+struct WireOutSnapshot
+{
+    unsigned int numWordsInFifo;        // 0x20/0x21, less the words read since the snapshot
+    unsigned int numSpikeWords;         // 0x3d, less the words read since the snapshot
+    unsigned int channelMaskEcho[2];    // 0x3b/0x3c, deactivated channel masks seen by the detector
+    bool spiRunning;                    // 0x22
+    int ttlIn;                          // 0x23
+    chrono::steady_clock::time_point timestamp;
+};
 
 class Rhs2000EvalBoard
 {
+    friend class BoardConfigTransaction;
 
 public:
 	Rhs2000EvalBoard();
@@ -93,6 +120,10 @@ public:
 	};
 
 	void uploadCommandList(const vector<unsigned int> &commandList, AuxCmdSlot auxCommandSlot);
+    void uploadCommandBuffers(const unsigned char *commandMsw, const unsigned char *commandLsw, int numCommands,
+                              AuxCmdSlot auxCommandSlot);
+    void uploadStimMagnitudeCommands(int stream, const unsigned char *commandMsw, const unsigned char *commandLsw,
+                                     int numCommands);
 	void printCommandList(const vector<unsigned int> &commandList) const;
     void selectAuxCommandLength(AuxCmdSlot auxCommandSlot, int loopIndex, int endIndex);
 
@@ -216,11 +247,19 @@ public:
 
     void runSpikeDetector(bool run);
     long readSpike();
-    unsigned char* getSpikesInfo();
+    SpikeEventBuffer* getSpikeEventBuffer();
     void setThresholdMult(float mult);
     void setDeactiveChannels(bool chs[32]);
     void setBlindWindowLength(int length);
 
+    WireOutSnapshot getWireOutSnapshot();
+    void setWireOutMaxAge(int maxAgeUs);
+    int getWireOutMaxAge() const;
+    unsigned long long getNumWireOutUpdates() const;
+
+    BoardIoScheduler* getIoScheduler() const;
+    void setBulkReadChunkSize(unsigned int numBytes);
+
 private:
 	okCFrontPanel *dev;
 	AmplifierSampleRate sampleRate;
@@ -230,8 +269,17 @@ private:
 	vector<int> cableDelay;
 
     // Methods in this class are designed to be thread-safe.  This variable is used to ensure that.
+    // The I/O scheduler holds it while running an operation.  Only open(), uploadFpgaBitfile(),
+    // readDigitalInManual() and readDigitalInExpManual() still lock it directly: they run once
+    // while the board is being opened and set up, before any acquisition or spike thread exists.
     std::mutex okMutex;
 
+    // All other USB traffic is funneled through this thread in priority order; bulk pipe reads
+    // go through readPipeOut() in chunks of bulkReadChunkSize bytes.
+    BoardIoScheduler *ioScheduler;
+    unsigned int bulkReadChunkSize;
+    mutex pipeReadMutex;    // held for a whole data pipe read, across its chunks
+
 	// Buffer for reading bytes from USB interface
     unsigned char* usbBuffer;
 
@@ -288,6 +336,9 @@ private:
 		WireOutDataClkLocked = 0x24,
 		WireOutBoardMode = 0x25,
         WireOutSerialDigitalIn = 0x26,
+        WireOutChannelMaskEchoA = 0x3b,
+        WireOutChannelMaskEchoB = 0x3c,
+        WireOutNumSpikeWords = 0x3d,
 		WireOutBoardId = 0x3e,
 		WireOutBoardVersion = 0x3f,
 
@@ -312,8 +363,22 @@ private:
     unsigned int lastNumWordsInFifo;
     bool numWordsHasBeenUpdated;
     unsigned int numWordsInFifo();
-
-    unsigned char spikesInfo[];
+    long readPipeOut(long numBytes, unsigned char* buffer);
+
+    // Wire-outs shared by all callers; refreshed at most once per WIRE_OUT_MAX_AGE_US.
+    WireOutSnapshot wireOutSnapshot;
+    mutable mutex wireOutMutex;
+    int wireOutMaxAgeUs;
+    atomic<unsigned long long> numWireOutUpdates;
+    WireOutSnapshot currentWireOuts(bool forceUpdate = false);
+    bool isWireOutSnapshotFresh() const;
+    void invalidateWireOuts();
+    void consumeFifoWords(unsigned int numWords);
+
+    SpikeEventBuffer spikeEvents;
+
+    LatencyHistogram *spikeBacklogMetric;
+    MetricCounter *spikeEventMetric;
 };
 
 #endif // RHS2000EVALBOARD_H
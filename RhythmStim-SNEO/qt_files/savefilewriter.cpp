@@ -0,0 +1,218 @@
+#include <QFile>
+#include <QThread>
+#include <iostream>
+#include <iomanip>
+#include <cstring>
+
+#include "savefilewriter.h"
+#include "metricsregistry.h"
+
+// Pipelined save file writer
+
+// Marks a deferred write in the queue of full chunks.
+#define DEFERRED_WRITE -1
+
+SaveFileWriter::SaveFileWriter(int chunkSize_, int numChunks_) :
+    chunkSize(chunkSize_),
+    numChunks(numChunks_),
+    chunks(numChunks_, vector<char>(chunkSize_)),
+    chunkBytes(numChunks_, 0),
+    file(nullptr),
+    writerThread(nullptr),
+    currentChunk(-1),
+    currentBytes(0),
+    stage("save", &fullChunks),
+    numStalls(0),
+    writeError(false),
+    numDeferredPending(0)
+{
+    stage.setServiceTimeHistogram(MetricsRegistry::global()->histogram("pipeline.save.service_time", "us"));
+}
+
+SaveFileWriter::~SaveFileWriter()
+{
+    finishWriting();
+}
+
+// Open the device for writing to file_ (already open) and start the writer thread.
+bool SaveFileWriter::startWriting(QFile *file_)
+{
+    if (writerThread) {
+        cerr << "Error in SaveFileWriter::startWriting: already writing a file." << endl;
+        return false;
+    }
+
+    file = file_;
+    writeError = false;
+    fullChunks.setCapacity(numChunks);
+    freeChunks.setCapacity(numChunks);
+    for (int i = 1; i < numChunks; ++i) {
+        freeChunks.push(i);
+    }
+    currentChunk = 0;
+    currentBytes = 0;
+
+    writerThread = QThread::create([this] { writeChunks(); });
+    writerThread->start();
+    return QIODevice::open(QIODevice::WriteOnly | QIODevice::Unbuffered);
+}
+
+// Write out all data still held in chunks, stop the writer thread and close the device.  The
+// file itself is left open.
+void SaveFileWriter::finishWriting()
+{
+    if (!writerThread) {
+        return;
+    }
+
+    if (currentBytes > 0) {
+        queueCurrentChunk();
+    }
+    fullChunks.close();
+    writerThread->wait();
+    delete writerThread;
+    writerThread = nullptr;
+
+    file->flush();
+    file = nullptr;
+    numStalls += freeChunks.numBlockedPops();
+    QIODevice::close();
+}
+
+// Have the writer thread call write with the file once everything written to the device so far is
+// in the file, and before anything written later.  write returns false if it could not write
+// all its data.  Anything write needs must stay valid until waitForDeferredWrites() returns.
+void SaveFileWriter::writeDeferred(const function<bool(QFile*)> &write)
+{
+    if (!writerThread) {
+        cerr << "Error in SaveFileWriter::writeDeferred: not writing a file." << endl;
+        return;
+    }
+
+    if (currentBytes > 0) {
+        queueCurrentChunk();
+    }
+    {
+        lock_guard<mutex> lock(deferredMutex);
+        deferredWrites.push(write);
+        numDeferredPending++;
+    }
+    fullChunks.push(DEFERRED_WRITE);
+}
+
+// Wait until the writer thread has run all deferred writes.  Returns at once if there are none.
+void SaveFileWriter::waitForDeferredWrites()
+{
+    if (numDeferredPending == 0) {
+        return;
+    }
+    unique_lock<mutex> lock(deferredMutex);
+    deferredDone.wait(lock, [this] { return numDeferredPending == 0; });
+}
+
+bool SaveFileWriter::isSequential() const
+{
+    return true;
+}
+
+// True if a write to the file failed since startWriting().
+bool SaveFileWriter::hadWriteError() const
+{
+    return writeError;
+}
+
+void SaveFileWriter::resetStatistics()
+{
+    stage.reset();
+    numStalls = 0;
+}
+
+// Service time is per chunk written; blocked pushes count the times the processing thread
+// waited for a free chunk.
+PipelineStageStatistics SaveFileWriter::getStatistics() const
+{
+    PipelineStageStatistics statistics = stage.getStatistics();
+    statistics.numBlockedPushes = numStalls + (writerThread ? freeChunks.numBlockedPops() : 0);
+    return statistics;
+}
+
+void SaveFileWriter::printStatistics() const
+{
+    PipelineStageStatistics statistics = getStatistics();
+    cout << "Pipeline stage " << stage.getName() << ": " << statistics.numItems << " chunks written, write time " << fixed <<
+            setprecision(2) << statistics.meanServiceTimeMs << " ms mean, " << statistics.maxServiceTimeMs << " ms max, queue depth max " <<
+            statistics.maxQueueDepth << " of " << numChunks << ", " << statistics.numBlockedPushes << " blocked pushes" << endl;
+    cout.unsetf(ios::fixed);
+}
+
+qint64 SaveFileWriter::readData(char *data, qint64 maxSize)
+{
+    Q_UNUSED(data);
+    Q_UNUSED(maxSize);
+    return -1;
+}
+
+// Copy data into the current chunk, queueing chunks for the writer thread as they fill.
+qint64 SaveFileWriter::writeData(const char *data, qint64 maxSize)
+{
+    qint64 bytesLeft = maxSize;
+    while (bytesLeft > 0) {
+        if (currentChunk < 0) {
+            return -1;  // writer stopped
+        }
+        int numBytes = (int) qMin(bytesLeft, (qint64) (chunkSize - currentBytes));
+        memcpy(chunks[currentChunk].data() + currentBytes, data, numBytes);
+        currentBytes += numBytes;
+        data += numBytes;
+        bytesLeft -= numBytes;
+        if (currentBytes == chunkSize) {
+            queueCurrentChunk();
+        }
+    }
+    return maxSize;
+}
+
+// Hand the current chunk to the writer thread and take a free one, waiting if there is none.
+// (Private method.)
+void SaveFileWriter::queueCurrentChunk()
+{
+    chunkBytes[currentChunk] = currentBytes;
+    fullChunks.push(currentChunk);
+    if (!freeChunks.pop(currentChunk)) {
+        currentChunk = -1;
+    }
+    currentBytes = 0;
+}
+
+// Writer thread: write full chunks, and run deferred writes, until the queue is closed.
+// (Private method.)
+void SaveFileWriter::writeChunks()
+{
+    int chunk;
+    while (fullChunks.pop(chunk)) {
+        if (chunk == DEFERRED_WRITE) {
+            function<bool(QFile*)> write;
+            {
+                lock_guard<mutex> lock(deferredMutex);
+                write = deferredWrites.front();
+                deferredWrites.pop();
+            }
+            stage.startService();
+            if (!write(file)) {
+                writeError = true;
+            }
+            stage.finishService();
+            lock_guard<mutex> lock(deferredMutex);
+            numDeferredPending--;
+            deferredDone.notify_all();
+            continue;
+        }
+
+        stage.startService();
+        if (file->write(chunks[chunk].data(), chunkBytes[chunk]) != chunkBytes[chunk]) {
+            writeError = true;
+        }
+        stage.finishService();
+        freeChunks.push(chunk);
+    }
+}
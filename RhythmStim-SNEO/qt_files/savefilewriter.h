@@ -0,0 +1,78 @@
+#ifndef SAVEFILEWRITER_H
+#define SAVEFILEWRITER_H
+
+#include <QIODevice>
+#include <vector>
+#include <queue>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include "pipeline.h"
+
+using namespace std;
+
+class QFile;
+class QThread;
+
+#define SAVE_CHUNK_SIZE (1 << 20)
+#define SAVE_NUM_CHUNKS 16
+
+// Save stage of the acquisition pipeline.  The save QDataStream writes into this device, which
+// copies the data into preallocated chunks and hands full chunks to a writer thread; only that
+// thread calls QFile::write(), so a slow disk stalls the processing thread only once all chunks
+// (16 MB, about a second of data at 8 streams) are waiting to be written.
+//
+// Data that is expensive to format, like the pre-trigger buffer, can be handed over as a deferred
+// write instead: a function the writer thread calls with the file, in order with the chunks.
+
+class SaveFileWriter : public QIODevice
+{
+
+public:
+    SaveFileWriter(int chunkSize_ = SAVE_CHUNK_SIZE, int numChunks_ = SAVE_NUM_CHUNKS);
+    ~SaveFileWriter();
+
+    bool startWriting(QFile *file_);
+    void finishWriting();
+    bool isSequential() const override;
+
+    void writeDeferred(const function<bool(QFile*)> &write);
+    void waitForDeferredWrites();
+
+    bool hadWriteError() const;
+    void resetStatistics();
+    PipelineStageStatistics getStatistics() const;
+    void printStatistics() const;
+
+protected:
+    qint64 readData(char *data, qint64 maxSize) override;
+    qint64 writeData(const char *data, qint64 maxSize) override;
+
+private:
+    int chunkSize;
+    int numChunks;
+    vector<vector<char> > chunks;
+    vector<int> chunkBytes;             // bytes used in each full chunk
+
+    QFile *file;
+    QThread *writerThread;
+    PipelineQueue<int> fullChunks;      // waiting for the writer thread
+    PipelineQueue<int> freeChunks;      // written, ready to be refilled
+    int currentChunk;                   // chunk being filled by the processing thread
+    int currentBytes;
+
+    PipelineStage stage;
+    unsigned long long numStalls;       // waits for a free chunk in files already closed
+    atomic<bool> writeError;
+
+    mutex deferredMutex;
+    condition_variable deferredDone;
+    queue<function<bool(QFile*)> > deferredWrites;     // queued as DEFERRED_WRITE in fullChunks
+    atomic<int> numDeferredPending;
+
+    void queueCurrentChunk();
+    void writeChunks();
+};
+
+#endif // SAVEFILEWRITER_H
@@ -0,0 +1,541 @@
+#include <iostream>
+#include <cstring>
+#include <climits>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define SNEO_DETECTOR_AVX2 1
+#endif
+
+#include "usbdeinterleaver.h"
+#include "sneodetector.h"
+
+// Channel-parallel spike detector kernels
+
+// 300 Hz 3rd order high-pass Butterworth, times 2^15 (filter.vhd), as in SpikeDetectorModel
+static const long long FilterA[SPIKE_MODEL_FILTER_ORDER] = { -93364, 88789, -28180 };
+static const long long FilterB[SPIKE_MODEL_FILTER_ORDER + 1] = { 30388, -91163, 91163, -30388 };
+
+// The Savitzky-Golay coefficients of SG_filt.vhd are 12483 times these, so the weighted sum
+// fits 32 bits and only the product with 12483 needs more.
+static const int SmootherFactor = 12483;
+static const int SmootherWeights[SPIKE_MODEL_SG_TAPS] = { -2, 3, 6, 7, 6, 3, -2 };
+
+// round(triang(4 * k + 1) * 2^16) (SNEO.vhd)
+static const long long Triangle[SPIKE_MODEL_WINDOW_LENGTH] = {
+    7282, 14564, 21845, 29127, 36409, 43691, 50972, 58254, 65536,
+    58254, 50972, 43691, 36409, 29127, 21845, 14564, 7282
+};
+
+#define NEO_RING_LENGTH (2 * SPIKE_MODEL_K_MAX + 1)
+#define MAX_THRESHOLD ((1LL << 34) - 1)
+
+// numeric_std resize() of a signed value to fewer bits: keeps the sign bit and the bits - 1
+// low bits.
+static inline long long resizeSigned(long long value, int bits)
+{
+    long long low = value & ((1LL << (bits - 1)) - 1);
+    return value < 0 ? low - (1LL << (bits - 1)) : low;
+}
+
+// Two's complement wrap to bits, as numeric_std + and - on signed operands of that width.
+static inline long long wrapSigned(long long value, int bits)
+{
+    unsigned long long mask = (1ULL << bits) - 1;
+    unsigned long long low = (unsigned long long) value & mask;
+    return (low >> (bits - 1)) ? (long long) (low | ~mask) : (long long) low;
+}
+
+// Row of the sample age samples older than the newest, in a ring whose newest row is index.
+static inline int ringRow(int index, int age, int length)
+{
+    return (index - age + length) % length;
+}
+
+// Lane of the RMS sums for a channel: the AVX2 kernel squares the even and the odd channels of
+// each group of 8 separately, into 4 lanes each.
+static inline int squaredSumSlot(int channel)
+{
+    return (channel & ~7) + ((channel & 1) << 2) + ((channel & 7) >> 1);
+}
+
+bool SneoDetector::isKernelSupported(Kernel kernel)
+{
+    switch (kernel) {
+    case KernelScalar:
+        return true;
+    case KernelAvx2:
+#ifdef SNEO_DETECTOR_AVX2
+        return __builtin_cpu_supports("avx2");
+#else
+        return false;
+#endif
+    }
+    return false;
+}
+
+SneoDetector::Kernel SneoDetector::fastestKernel()
+{
+    static const Kernel kernel = isKernelSupported(KernelAvx2) ? KernelAvx2 : KernelScalar;
+    return kernel;
+}
+
+const char* SneoDetector::kernelName(Kernel kernel)
+{
+    switch (kernel) {
+    case KernelScalar:
+        return "scalar";
+    case KernelAvx2:
+        return "AVX2";
+    }
+    return "unknown";
+}
+
+// Settings start as in the FPGA after configuration, as for SpikeDetectorModel.
+SneoDetector::SneoDetector()
+{
+    kernel = fastestKernel();
+    thresholdMultIn = 0;
+    blindWindowIn = 0;
+    disabledChannelsIn = 0;
+    thresholdMult = 11;
+    blindWindow = 10;
+    disabledChannels = 0;
+    reset();
+}
+
+// Use kernel_ from now on, or the scalar kernel if the CPU does not support it.  Both give the
+// same results, so this may be changed between calls to process().
+void SneoDetector::setKernel(Kernel kernel_)
+{
+    kernel = isKernelSupported(kernel_) ? kernel_ : KernelScalar;
+}
+
+SneoDetector::Kernel SneoDetector::getKernel() const
+{
+    return kernel;
+}
+
+// Clear the detector state, as SpikeDetectorModel::reset() does.  Settings are kept.
+void SneoDetector::reset()
+{
+    stimCounter = 0;
+    rmsCounter = 0;
+
+    memset(input, 0, sizeof(input));
+    memset(filterSumIn, 0, sizeof(filterSumIn));
+    memset(filterSumOut, 0, sizeof(filterSumOut));
+    memset(filtered, 0, sizeof(filtered));
+    memset(minRing, 0, sizeof(minRing));
+    minRingIndex = 0;
+    memset(minima, 0, sizeof(minima));
+    memset(smootherRing, 0, sizeof(smootherRing));
+    smootherRingIndex = 0;
+    memset(neoRing, 0, sizeof(neoRing));
+    neoRingIndex = 0;
+    memset(energyRing, 0, sizeof(energyRing));
+    energyRingIndex = 0;
+    memset(previousMneo, 0, sizeof(previousMneo));
+    memset(squaredSumLow, 0, sizeof(squaredSumLow));
+    memset(squaredSumHigh, 0, sizeof(squaredSumHigh));
+
+    for (int channel = 0; channel < SPIKE_MODEL_CHANNELS; ++channel) {
+        previousRms[channel] = -1;
+        previousRmsLanes[channel] = 1;
+        thresholds[channel] = MAX_THRESHOLD;
+        thresholdLanes[channel] = INT_MAX;
+    }
+}
+
+// Threshold multiplier times two, as written to wire-in 0x15.  Zero is ignored, as by the board.
+void SneoDetector::setThresholdMult(int thresholdMult)
+{
+    if ((thresholdMult & 0xff) != 0) {
+        thresholdMultIn = thresholdMult & 0xff;
+    }
+}
+
+// Blind window in milliseconds (25 samples each).  Zero is ignored, as by the board.
+void SneoDetector::setBlindWindow(int blindWindow)
+{
+    if ((blindWindow & 0xff) != 0) {
+        blindWindowIn = blindWindow & 0xff;
+    }
+}
+
+// One bit per channel (bit port * 16 + channel); a disabled channel is processed but never reports.
+void SneoDetector::setDisabledChannels(unsigned int disabledChannels)
+{
+    disabledChannelsIn = disabledChannels;
+}
+
+// Run numSamples samples through the detector, as SpikeDetectorModel::process() with both ports
+// enabled; samples[port * 16 + channel] must all be valid.  Returns the number of records
+// appended.
+int SneoDetector::process(const short* const* samples, const unsigned int* timeStamps,
+                          const unsigned char* stimTriggers, int numSamples, vector<unsigned short> &records)
+{
+    int numDetections = 0;
+
+    for (int t = 0; t < numSamples; ++t) {
+        unsigned int detectionTime = timeStamps[t] - 1;
+        bool stimTrigger = stimTriggers[t] != 0;
+
+        for (int channel = 0; channel < SPIKE_MODEL_CHANNELS; ++channel) {
+            input[channel] = samples[channel][t];
+        }
+
+        // All channels but the last are processed before the detector counts down the blind
+        // window and latches the settings; the last one, after.
+        if (stimTrigger) {
+            stimCounter = 25 * blindWindow;
+        }
+        int earlyStimCounter = stimCounter;
+        unsigned int earlyDisabledChannels = disabledChannels;
+        int earlyThresholdMult = thresholdMult;
+        if (stimCounter > 0) {
+            stimCounter--;
+        }
+        thresholdMult = thresholdMultIn;
+        blindWindow = blindWindowIn;
+        disabledChannels = disabledChannelsIn;
+        if (stimTrigger) {
+            stimCounter = 25 * blindWindow;
+        }
+
+        bool newThreshold = (rmsCounter == (1 << SPIKE_MODEL_RMS_SAMPLES_EXP) - 1);
+        rmsCounter = newThreshold ? 0 : rmsCounter + 1;
+
+        unsigned int spikes = (kernel == KernelAvx2) ? processSampleAvx2() : processSampleScalar();
+        if (newThreshold) {
+            renewThresholds(earlyThresholdMult);
+        }
+
+        // Report in the detector's order: each chip channel of port 0, then of port 1.
+        const unsigned int lastChannelBit = 1u << (SPIKE_MODEL_CHANNELS - 1);
+        unsigned int detected = (earlyStimCounter == 0) ? spikes & ~earlyDisabledChannels & ~lastChannelBit : 0;
+        if ((spikes & lastChannelBit) && !(disabledChannels & lastChannelBit) && stimCounter == 0) {
+            detected |= lastChannelBit;
+        }
+        for (int chipChannel = 0; detected != 0 && chipChannel < SPIKE_MODEL_CHANNELS_PER_PORT; ++chipChannel) {
+            for (int port = 0; port < SPIKE_MODEL_PORTS; ++port) {
+                int channel = port * SPIKE_MODEL_CHANNELS_PER_PORT + chipChannel;
+                if ((detected >> channel) & 1) {
+                    records.push_back((unsigned short) minima[channel]);
+                    records.push_back((unsigned short) ((channel << 8) | thresholdMultIn));
+                    records.push_back((unsigned short) (detectionTime >> 16));
+                    records.push_back((unsigned short) (detectionTime & 0xffff));
+                    numDetections++;
+                }
+            }
+        }
+    }
+    return numDetections;
+}
+
+// Run all samples of planes through the detector, with data streams firstStream and
+// firstStream + 1 as its two ports.
+int SneoDetector::process(const SamplePlanes &planes, int firstStream, vector<unsigned short> &records)
+{
+    const short* samples[SPIKE_MODEL_CHANNELS];
+
+    if (firstStream < 0 || firstStream + SPIKE_MODEL_PORTS > planes.numDataStreams) {
+        cerr << "Error in SneoDetector::process: data streams " << firstStream << " and " << firstStream + 1 <<
+                " not in sample planes." << endl;
+        return 0;
+    }
+    for (int port = 0; port < SPIKE_MODEL_PORTS; ++port) {
+        for (int channel = 0; channel < SPIKE_MODEL_CHANNELS_PER_PORT; ++channel) {
+            samples[port * SPIKE_MODEL_CHANNELS_PER_PORT + channel] = planes.amplifierPlane(firstStream + port, channel);
+        }
+    }
+
+    stimTriggerBuffer.resize(planes.numSamples);
+    const unsigned short* stimOn0 = planes.stimFlagPlane(firstStream, StimFlagOn);
+    const unsigned short* stimOn1 = planes.stimFlagPlane(firstStream + 1, StimFlagOn);
+    for (int t = 0; t < planes.numSamples; ++t) {
+        stimTriggerBuffer[t] = (stimOn0[t] | stimOn1[t]) != 0;
+    }
+
+    return process(samples, planes.timeStamp.data(), stimTriggerBuffer.data(), planes.numSamples, records);
+}
+
+// Current detection threshold of a channel, in the units of the smoothed energy.
+long long SneoDetector::getThreshold(int channel) const
+{
+    return thresholds[channel];
+}
+
+// One sample of every channel through all stages, one channel at a time.  Returns the channels
+// whose smoothed energy had a peak above threshold at the previous sample, one bit each.
+// (Private method.)
+unsigned int SneoDetector::processSampleScalar()
+{
+    unsigned int spikes = 0;
+
+    for (int channel = 0; channel < SPIKE_MODEL_CHANNELS; ++channel) {
+        long long a = input[channel] - (filterSumIn[0][channel] >> 15);
+        filtered[channel] = (int) resizeSigned((a * FilterB[0] + filterSumOut[0][channel]) >> 15, 16);
+        for (int i = 0; i < SPIKE_MODEL_FILTER_ORDER - 1; ++i) {
+            filterSumIn[i][channel] = a * FilterA[i] + filterSumIn[i + 1][channel];
+            filterSumOut[i][channel] = a * FilterB[i + 1] + filterSumOut[i + 1][channel];
+        }
+        filterSumIn[SPIKE_MODEL_FILTER_ORDER - 1][channel] = a * FilterA[SPIKE_MODEL_FILTER_ORDER - 1] + (1 << 14);
+        filterSumOut[SPIKE_MODEL_FILTER_ORDER - 1][channel] = a * FilterB[SPIKE_MODEL_FILTER_ORDER] + (1 << 14);
+
+        short minimum = 0;
+        for (int row = 0; row < SPIKE_MODEL_WINDOW_LENGTH; ++row) {
+            if (minRing[row][channel] < minimum) {
+                minimum = minRing[row][channel];
+            }
+        }
+        minima[channel] = minimum;
+    }
+    minRingIndex = (minRingIndex + 1) % SPIKE_MODEL_WINDOW_LENGTH;
+    smootherRingIndex = (smootherRingIndex + 1) % SPIKE_MODEL_SG_TAPS;
+    neoRingIndex = (neoRingIndex + 1) % NEO_RING_LENGTH;
+    energyRingIndex = (energyRingIndex + 1) % SPIKE_MODEL_WINDOW_LENGTH;
+
+    for (int channel = 0; channel < SPIKE_MODEL_CHANNELS; ++channel) {
+        minRing[minRingIndex][channel] = (short) filtered[channel];
+        smootherRing[smootherRingIndex][channel] = filtered[channel];
+
+        int weighted = 0;
+        for (int i = 0; i < SPIKE_MODEL_SG_TAPS; ++i) {
+            weighted += SmootherWeights[i] * smootherRing[ringRow(smootherRingIndex, i, SPIKE_MODEL_SG_TAPS)][channel];
+        }
+        int smoothed = (int) resizeSigned(((long long) SmootherFactor * weighted + (1 << 17)) >> 18, 16);
+
+        neoRing[neoRingIndex][channel] = smoothed;
+        long long current = neoRing[ringRow(neoRingIndex, SPIKE_MODEL_K_MAX, NEO_RING_LENGTH)][channel];
+        long long previous = neoRing[ringRow(neoRingIndex, 2 * SPIKE_MODEL_K_MAX, NEO_RING_LENGTH)][channel];
+        energyRing[energyRingIndex][channel] = (int) wrapSigned(current * current - smoothed * previous, 32);
+
+        long long sum = 1 << 15;
+        for (int j = 0; j < SPIKE_MODEL_WINDOW_LENGTH; ++j) {
+            sum += Triangle[j] * energyRing[ringRow(energyRingIndex, j, SPIKE_MODEL_WINDOW_LENGTH)][channel];
+        }
+        int mneo = (int) (wrapSigned(sum, 48) >> 16);
+
+        int threshold = thresholdLanes[channel];
+        unsigned int root = (mneo <= threshold) ? (unsigned int) (mneo < 0 ? -(long long) mneo : mneo) :
+                                                  previousRmsLanes[channel];
+        unsigned long long square = (unsigned long long) root * root;
+        squaredSumLow[squaredSumSlot(channel)] += square & 0xffffffff;
+        squaredSumHigh[squaredSumSlot(channel)] += square >> 32;
+
+        int *previousEnergy = previousMneo[0];
+        if (previousEnergy[channel] > threshold && previousEnergy[channel] > mneo &&
+                previousEnergy[channel] >= previousMneo[1][channel]) {
+            spikes |= 1u << channel;
+        }
+        previousMneo[1][channel] = previousEnergy[channel];
+        previousEnergy[channel] = mneo;
+    }
+    return spikes;
+}
+
+#ifdef SNEO_DETECTOR_AVX2
+
+// Arithmetic right shift of 64-bit lanes, which AVX2 lacks.
+__attribute__((target("avx2")))
+static inline __m256i shiftRightArithmetic64(__m256i value, int bits)
+{
+    __m256i sign = _mm256_cmpgt_epi64(_mm256_setzero_si256(), value);
+    return _mm256_xor_si256(_mm256_srli_epi64(_mm256_xor_si256(value, sign), bits), sign);
+}
+
+// resize() to 16 bits of 32-bit lanes: sign bit and 15 low bits.
+__attribute__((target("avx2")))
+static inline __m256i resize16(__m256i value)
+{
+    const __m256i low = _mm256_set1_epi32(0x7fff);
+    return _mm256_or_si256(_mm256_and_si256(value, low), _mm256_andnot_si256(low, _mm256_srai_epi32(value, 31)));
+}
+
+// The same stages as processSampleScalar(), 4 to 16 channels per instruction.  (Private method.)
+__attribute__((target("avx2")))
+unsigned int SneoDetector::processSampleAvx2()
+{
+    const __m256i zero = _mm256_setzero_si256();
+    unsigned int spikes = 0;
+
+    // High-pass, 4 channels of 64-bit sums at a time.  |a| < 2^27 for 16-bit input, so the
+    // 32 x 32-bit multiplies of its low half are exact.
+    const __m256i roundingOffset = _mm256_set1_epi64x(1 << 14);
+    const __m256i lowHalves = _mm256_setr_epi32(0, 2, 4, 6, 0, 2, 4, 6);
+    for (int channel = 0; channel < SPIKE_MODEL_CHANNELS; channel += 4) {
+        __m256i x = _mm256_cvtepi16_epi64(_mm_loadl_epi64((const __m128i*) (input + channel)));
+        __m256i sumIn0 = _mm256_loadu_si256((const __m256i*) &filterSumIn[0][channel]);
+        __m256i sumIn1 = _mm256_loadu_si256((const __m256i*) &filterSumIn[1][channel]);
+        __m256i sumIn2 = _mm256_loadu_si256((const __m256i*) &filterSumIn[2][channel]);
+        __m256i sumOut0 = _mm256_loadu_si256((const __m256i*) &filterSumOut[0][channel]);
+        __m256i sumOut1 = _mm256_loadu_si256((const __m256i*) &filterSumOut[1][channel]);
+        __m256i sumOut2 = _mm256_loadu_si256((const __m256i*) &filterSumOut[2][channel]);
+
+        __m256i a = _mm256_sub_epi64(x, shiftRightArithmetic64(sumIn0, 15));
+        __m256i out = shiftRightArithmetic64(_mm256_add_epi64(_mm256_mul_epi32(a, _mm256_set1_epi64x(FilterB[0])),
+                                                              sumOut0), 15);
+        // resize() to 16 bits only needs the low 32 bits of each lane.
+        __m256i out32 = resize16(_mm256_permutevar8x32_epi32(out, lowHalves));
+        _mm_storeu_si128((__m128i*) (filtered + channel), _mm256_castsi256_si128(out32));
+
+        sumIn0 = _mm256_add_epi64(_mm256_mul_epi32(a, _mm256_set1_epi64x(FilterA[0])), sumIn1);
+        sumIn1 = _mm256_add_epi64(_mm256_mul_epi32(a, _mm256_set1_epi64x(FilterA[1])), sumIn2);
+        sumIn2 = _mm256_add_epi64(_mm256_mul_epi32(a, _mm256_set1_epi64x(FilterA[2])), roundingOffset);
+        sumOut0 = _mm256_add_epi64(_mm256_mul_epi32(a, _mm256_set1_epi64x(FilterB[1])), sumOut1);
+        sumOut1 = _mm256_add_epi64(_mm256_mul_epi32(a, _mm256_set1_epi64x(FilterB[2])), sumOut2);
+        sumOut2 = _mm256_add_epi64(_mm256_mul_epi32(a, _mm256_set1_epi64x(FilterB[3])), roundingOffset);
+        _mm256_storeu_si256((__m256i*) &filterSumIn[0][channel], sumIn0);
+        _mm256_storeu_si256((__m256i*) &filterSumIn[1][channel], sumIn1);
+        _mm256_storeu_si256((__m256i*) &filterSumIn[2][channel], sumIn2);
+        _mm256_storeu_si256((__m256i*) &filterSumOut[0][channel], sumOut0);
+        _mm256_storeu_si256((__m256i*) &filterSumOut[1][channel], sumOut1);
+        _mm256_storeu_si256((__m256i*) &filterSumOut[2][channel], sumOut2);
+    }
+
+    // Local minimum, 16 channels of 16-bit samples at a time.
+    int newMinRow = (minRingIndex + 1) % SPIKE_MODEL_WINDOW_LENGTH;
+    for (int channel = 0; channel < SPIKE_MODEL_CHANNELS; channel += 16) {
+        __m256i minimum = zero;
+        for (int row = 0; row < SPIKE_MODEL_WINDOW_LENGTH; ++row) {
+            minimum = _mm256_min_epi16(minimum, _mm256_loadu_si256((const __m256i*) &minRing[row][channel]));
+        }
+        _mm256_storeu_si256((__m256i*) (minima + channel), minimum);
+
+        __m256i packed = _mm256_packs_epi32(_mm256_loadu_si256((const __m256i*) (filtered + channel)),
+                                            _mm256_loadu_si256((const __m256i*) (filtered + channel + 8)));
+        _mm256_storeu_si256((__m256i*) &minRing[newMinRow][channel], _mm256_permute4x64_epi64(packed, 0xd8));
+    }
+    minRingIndex = newMinRow;
+    smootherRingIndex = (smootherRingIndex + 1) % SPIKE_MODEL_SG_TAPS;
+    neoRingIndex = (neoRingIndex + 1) % NEO_RING_LENGTH;
+    energyRingIndex = (energyRingIndex + 1) % SPIKE_MODEL_WINDOW_LENGTH;
+
+    int smootherRows[SPIKE_MODEL_SG_TAPS];
+    for (int i = 0; i < SPIKE_MODEL_SG_TAPS; ++i) {
+        smootherRows[i] = ringRow(smootherRingIndex, i, SPIKE_MODEL_SG_TAPS);
+    }
+    int energyRows[SPIKE_MODEL_WINDOW_LENGTH];
+    for (int j = 0; j < SPIKE_MODEL_WINDOW_LENGTH; ++j) {
+        energyRows[j] = ringRow(energyRingIndex, j, SPIKE_MODEL_WINDOW_LENGTH);
+    }
+    const int currentRow = ringRow(neoRingIndex, SPIKE_MODEL_K_MAX, NEO_RING_LENGTH);
+    const int previousRow = ringRow(neoRingIndex, 2 * SPIKE_MODEL_K_MAX, NEO_RING_LENGTH);
+
+    // Smoothing, energy, RMS and threshold, 8 channels of 32-bit values at a time.
+    const __m256i factor = _mm256_set1_epi32(SmootherFactor);
+    const __m256i lowBits = _mm256_set1_epi32(1023);
+    const __m256i smootherOffset = _mm256_set1_epi32(1 << 17);
+    const __m256i energyOffset = _mm256_set1_epi64x(1 << 15);
+    const __m256i lowWords = _mm256_set1_epi64x(0xffffffff);
+    for (int channel = 0; channel < SPIKE_MODEL_CHANNELS; channel += 8) {
+        __m256i sample = _mm256_loadu_si256((const __m256i*) (filtered + channel));
+        _mm256_storeu_si256((__m256i*) &smootherRing[smootherRingIndex][channel], sample);
+
+        // 12483 * weighted + 2^17 >> 18, in two parts that fit 32 bits: the weighted sum is
+        // split at bit 10 and the low part's product shifted first.
+        __m256i weighted = zero;
+        for (int i = 0; i < SPIKE_MODEL_SG_TAPS; ++i) {
+            __m256i tap = _mm256_loadu_si256((const __m256i*) &smootherRing[smootherRows[i]][channel]);
+            weighted = _mm256_add_epi32(weighted, _mm256_mullo_epi32(tap, _mm256_set1_epi32(SmootherWeights[i])));
+        }
+        __m256i highPart = _mm256_mullo_epi32(_mm256_srai_epi32(weighted, 10), factor);
+        __m256i lowPart = _mm256_add_epi32(_mm256_mullo_epi32(_mm256_and_si256(weighted, lowBits), factor),
+                                           smootherOffset);
+        __m256i smoothed = resize16(_mm256_srai_epi32(_mm256_add_epi32(highPart, _mm256_srai_epi32(lowPart, 10)), 8));
+
+        // Nonlinear energy, wrapping at 32 bits as in MNEO.vhd.
+        _mm256_storeu_si256((__m256i*) &neoRing[neoRingIndex][channel], smoothed);
+        __m256i current = _mm256_loadu_si256((const __m256i*) &neoRing[currentRow][channel]);
+        __m256i previous = _mm256_loadu_si256((const __m256i*) &neoRing[previousRow][channel]);
+        __m256i neo = _mm256_sub_epi32(_mm256_mullo_epi32(current, current), _mm256_mullo_epi32(smoothed, previous));
+        _mm256_storeu_si256((__m256i*) &energyRing[energyRingIndex][channel], neo);
+
+        // Triangular window on 64-bit sums, even and odd channels apart; the smoothed energy is
+        // bits 16-47 of each sum.
+        __m256i sumEven = energyOffset;
+        __m256i sumOdd = energyOffset;
+        for (int j = 0; j < SPIKE_MODEL_WINDOW_LENGTH; ++j) {
+            __m256i energy = _mm256_loadu_si256((const __m256i*) &energyRing[energyRows[j]][channel]);
+            __m256i weight = _mm256_set1_epi64x(Triangle[j]);
+            sumEven = _mm256_add_epi64(sumEven, _mm256_mul_epi32(energy, weight));
+            sumOdd = _mm256_add_epi64(sumOdd, _mm256_mul_epi32(_mm256_srli_epi64(energy, 32), weight));
+        }
+        __m256i mneo = _mm256_blend_epi32(_mm256_srli_epi64(sumEven, 16), _mm256_slli_epi64(sumOdd, 16), 0xaa);
+
+        // Energy above threshold is replaced by the last RMS in the RMS sums.
+        __m256i threshold = _mm256_loadu_si256((const __m256i*) (thresholdLanes + channel));
+        __m256i aboveThreshold = _mm256_cmpgt_epi32(mneo, threshold);
+        __m256i root = _mm256_blendv_epi8(_mm256_abs_epi32(mneo),
+                                          _mm256_loadu_si256((const __m256i*) (previousRmsLanes + channel)),
+                                          aboveThreshold);
+        __m256i squareEven = _mm256_mul_epu32(root, root);
+        __m256i rootOdd = _mm256_srli_epi64(root, 32);
+        __m256i squareOdd = _mm256_mul_epu32(rootOdd, rootOdd);
+        unsigned long long *low = squaredSumLow + channel;
+        unsigned long long *high = squaredSumHigh + channel;
+        _mm256_storeu_si256((__m256i*) low, _mm256_add_epi64(_mm256_loadu_si256((const __m256i*) low),
+                                                             _mm256_and_si256(squareEven, lowWords)));
+        _mm256_storeu_si256((__m256i*) (low + 4), _mm256_add_epi64(_mm256_loadu_si256((const __m256i*) (low + 4)),
+                                                                   _mm256_and_si256(squareOdd, lowWords)));
+        _mm256_storeu_si256((__m256i*) high, _mm256_add_epi64(_mm256_loadu_si256((const __m256i*) high),
+                                                              _mm256_srli_epi64(squareEven, 32)));
+        _mm256_storeu_si256((__m256i*) (high + 4), _mm256_add_epi64(_mm256_loadu_si256((const __m256i*) (high + 4)),
+                                                                    _mm256_srli_epi64(squareOdd, 32)));
+
+        // Peak of the smoothed energy above threshold at the previous sample.
+        __m256i previous0 = _mm256_loadu_si256((const __m256i*) (previousMneo[0] + channel));
+        __m256i previous1 = _mm256_loadu_si256((const __m256i*) (previousMneo[1] + channel));
+        __m256i peak = _mm256_and_si256(_mm256_and_si256(_mm256_cmpgt_epi32(previous0, threshold),
+                                                         _mm256_cmpgt_epi32(previous0, mneo)),
+                                        _mm256_andnot_si256(_mm256_cmpgt_epi32(previous1, previous0),
+                                                            _mm256_set1_epi32(-1)));
+        spikes |= (unsigned int) _mm256_movemask_ps(_mm256_castsi256_ps(peak)) << channel;
+        _mm256_storeu_si256((__m256i*) (previousMneo[1] + channel), previous0);
+        _mm256_storeu_si256((__m256i*) (previousMneo[0] + channel), mneo);
+    }
+    return spikes;
+}
+
+#else
+
+unsigned int SneoDetector::processSampleAvx2()
+{
+    return processSampleScalar();
+}
+
+#endif
+
+// Take the new RMS of every channel, every 2^15 samples.  Channels 15 and 31 are scaled by the
+// multiplier just latched and the others by the one before, as in SpikeDetectorModel.
+// (Private method.)
+void SneoDetector::renewThresholds(int oldThresholdMult)
+{
+    for (int channel = 0; channel < SPIKE_MODEL_CHANNELS; ++channel) {
+        int slot = squaredSumSlot(channel);
+        unsigned __int128 total = ((unsigned __int128) 1 << (SPIKE_MODEL_RMS_SAMPLES_EXP - 1)) +
+                ((unsigned __int128) squaredSumHigh[slot] << 32) + squaredSumLow[slot];
+        squaredSumLow[slot] = 0;
+        squaredSumHigh[slot] = 0;
+
+        long long rms = SpikeDetectorModel::squareRoot((total >> SPIKE_MODEL_RMS_SAMPLES_EXP) &
+                                                       (((unsigned __int128) 1 << 70) - 1));
+        bool lateChannel = (channel % SPIKE_MODEL_CHANNELS_PER_PORT) == SPIKE_MODEL_CHANNELS_PER_PORT - 1;
+        setThreshold(channel, rms, lateChannel ? thresholdMult : oldThresholdMult);
+    }
+}
+
+// New RMS of a channel, and its threshold: RMS times mult / 2, rounded, at most 2^34 - 1.  The
+// lanes hold the threshold saturated to 32 bits, which compares the same with 32-bit energy.
+// (Private method.)
+void SneoDetector::setThreshold(int channel, long long root, int mult)
+{
+    previousRms[channel] = wrapSigned(root, 35);
+    long long scaled = (previousRms[channel] * mult + 1) >> 1;
+    thresholds[channel] = (scaled <= MAX_THRESHOLD) ? resizeSigned(scaled, 35) : MAX_THRESHOLD;
+
+    thresholdLanes[channel] = (thresholds[channel] > INT_MAX) ? INT_MAX :
+                              (thresholds[channel] < INT_MIN) ? INT_MIN : (int) thresholds[channel];
+    previousRmsLanes[channel] = (unsigned int) (previousRms[channel] < 0 ? -previousRms[channel] : previousRms[channel]);
+}
@@ -0,0 +1,105 @@
+#ifndef SNEODETECTOR_H
+#define SNEODETECTOR_H
+
+#include <vector>
+#include "spikedetectormodel.h"
+
+using namespace std;
+
+struct SamplePlanes;
+
+// Channel-parallel form of SpikeDetectorModel for a detector with both ports enabled.  The FPGA
+// runs its channels one after the other through shared multipliers and queues; here every stage
+// advances all 32 channels by one sample at a time, with the state kept as structure-of-arrays
+// lanes: the high-pass on 64-bit lanes (its sums are wider than 32 bits), the local minimum on
+// 16-bit lanes, and the smoothing, nonlinear energy, RMS selection and threshold compare on 32-bit
+// lanes.  With AVX2 that is 4, 16 and 8 channels per register; the AVX2 kernel is chosen at run
+// time if the CPU supports it, the scalar kernel otherwise.
+//
+// The detection records are the model's, bit for bit.  In the high-pass only the fed-back value a
+// is small: the impulse response of 1/A sums to about 3017 in absolute value, so |a| < 9.9e7 < 2^27
+// for any 16-bit input, which the AVX2 kernel's 32 x 32-bit multiplies rely on.  The 48-bit sums,
+// a times coefficients below 2^17, stay near 2^43, so neither the 35-bit wrap of a nor the 48-bit
+// wraps of the sums in filter.vhd ever act.  The energy and RMS arithmetic keeps the widths of the
+// VHDL.  The order in which the detector latches its settings
+// and renews thresholds within a sample is kept too.  A detector with a disabled port spaces its
+// queues differently; use SpikeDetectorModel for it.  Not thread safe; use one detector per thread.
+
+class SneoDetector
+{
+
+public:
+    enum Kernel {
+        KernelScalar,
+        KernelAvx2
+    };
+
+    static Kernel fastestKernel();
+    static bool isKernelSupported(Kernel kernel);
+    static const char* kernelName(Kernel kernel);
+
+    SneoDetector();
+
+    void setKernel(Kernel kernel_);
+    Kernel getKernel() const;
+    void reset();
+
+    void setThresholdMult(int thresholdMult);
+    void setBlindWindow(int blindWindow);
+    void setDisabledChannels(unsigned int disabledChannels);
+
+    int process(const short* const* samples, const unsigned int* timeStamps, const unsigned char* stimTriggers,
+                int numSamples, vector<unsigned short> &records);
+    int process(const SamplePlanes &planes, int firstStream, vector<unsigned short> &records);
+
+    long long getThreshold(int channel) const;
+
+private:
+    unsigned int processSampleScalar();
+    unsigned int processSampleAvx2();
+    void renewThresholds(int oldThresholdMult);
+    void setThreshold(int channel, long long root, int mult);
+
+    Kernel kernel;
+
+    // Settings as written to the board, and as latched by the detector once per sample.
+    int thresholdMultIn;
+    int blindWindowIn;
+    unsigned int disabledChannelsIn;
+    int thresholdMult;
+    int blindWindow;
+    unsigned int disabledChannels;
+    int stimCounter;
+    int rmsCounter;
+
+    // Lanes, indexed [history row][channel] where a stage keeps history; each ring's index is the
+    // row of the newest sample.
+    short input[SPIKE_MODEL_CHANNELS];
+    long long filterSumIn[SPIKE_MODEL_FILTER_ORDER][SPIKE_MODEL_CHANNELS];
+    long long filterSumOut[SPIKE_MODEL_FILTER_ORDER][SPIKE_MODEL_CHANNELS];
+    int filtered[SPIKE_MODEL_CHANNELS];
+    short minRing[SPIKE_MODEL_WINDOW_LENGTH][SPIKE_MODEL_CHANNELS];
+    int minRingIndex;
+    short minima[SPIKE_MODEL_CHANNELS];
+    int smootherRing[SPIKE_MODEL_SG_TAPS][SPIKE_MODEL_CHANNELS];
+    int smootherRingIndex;
+    int neoRing[2 * SPIKE_MODEL_K_MAX + 1][SPIKE_MODEL_CHANNELS];
+    int neoRingIndex;
+    int energyRing[SPIKE_MODEL_WINDOW_LENGTH][SPIKE_MODEL_CHANNELS];
+    int energyRingIndex;
+    int previousMneo[2][SPIKE_MODEL_CHANNELS];
+    int thresholdLanes[SPIKE_MODEL_CHANNELS];               // thresholds, saturated to 32 bits
+    unsigned int previousRmsLanes[SPIKE_MODEL_CHANNELS];    // |previous RMS|, the root of high energy
+
+    // Squared roots summed for the RMS, in 32-bit halves so that 64-bit lanes never carry out;
+    // the slot of a channel is given by squaredSumSlot().
+    unsigned long long squaredSumLow[SPIKE_MODEL_CHANNELS];
+    unsigned long long squaredSumHigh[SPIKE_MODEL_CHANNELS];
+
+    long long thresholds[SPIKE_MODEL_CHANNELS];
+    long long previousRms[SPIKE_MODEL_CHANNELS];
+
+    vector<unsigned char> stimTriggerBuffer;
+};
+
+#endif // SNEODETECTOR_H
@@ -3,6 +3,7 @@
 #include <QtWidgets>
 #endif
 #include <iostream>
+#include <chrono>
 
 // Spike detector dialog.
 // Created by Mattia Tambaro, to be used only with the custom bitfile created by me.
@@ -16,9 +17,11 @@
 #include "spikescopedialog.h"
 #include "waveplot.h"
 #include "rhs2000registers.h"
+#include "boardconfigtransaction.h"
 
 SpikeDetectorDialog::SpikeDetectorDialog(MainWindow *inMain, Rhs2000EvalBoard *inEvalBoard, bool inSynthMode, double inBoardSampleRate, WavePlot* inWavePlot, Rhs2000Registers::StimStepSize inStimStep) :
-    QDialog(inMain)
+    QDialog(inMain),
+    spikeForwarder(inEvalBoard ? inEvalBoard->getSpikeEventBuffer() : nullptr)
 {
     setWindowTitle(tr("Spike Detector"));
 
@@ -30,14 +33,16 @@ SpikeDetectorDialog::SpikeDetectorDialog(MainWindow *inMain, Rhs2000EvalBoard *i
     probePlot = new ProbePlot(this);
     sendSocket = new QUdpSocket();
     recvSocket = new QUdpSocket();
-    channelsOrdered = {21,27,13,31,7,1,25,19,20,26,2,8,32,14,28,22,18,30,12,24,16,6,4,10,9,3,5,15,23,11,29,17};
+    channelsOrdered = SpikeForwarder::probeChannelOrder();
     connected = false;
     boardSampleRate = inBoardSampleRate;
     wavePlot = inWavePlot;
     stimStep = inStimStep;
+    stimCommandCache.setChipParameters(boardSampleRate, stimStep);
 
     lastChannel = -1;
     lastAmpl = -1;
+    spikeForwarder.setFiringCallback([this](quint32 probeChannel) { probePlot->updateFiring(probeChannel); });
 
 
     double thresholdMult = 5.5;
@@ -48,9 +53,11 @@ SpikeDetectorDialog::SpikeDetectorDialog(MainWindow *inMain, Rhs2000EvalBoard *i
     }
 
     if (!synthMode) {
+        BoardConfigTransaction transaction(evalBoard);
         evalBoard->setThresholdMult(thresholdMult);
         evalBoard->setBlindWindowLength(blindWindowLength);
         evalBoard->setDeactiveChannels(deactiveChannels);
+        transaction.commit();
     }
 
     hostAddressComboBox = new QComboBox();
@@ -242,57 +249,29 @@ void  SpikeDetectorDialog::runSynthSpikeDetector()
 
 void  SpikeDetectorDialog::runSpikeDetector()
 {
-    quint32 DT, DT100;
-    quint16 ID, MT, VAL;
-    long spikesToRead;
-    int i;
-    unsigned char* spikeInfo = evalBoard->getSpikesInfo();
+    long spikesRead;
+
+    // UDP/display and disk consume the same events through independent cursors.
+    spikeForwarder.reset();
+
     while (running) {
-        spikesToRead = evalBoard->readSpike();
-        //if (spikesToRead%8 != 0)
-        //    std::cout << "ahia" << endl;
-        for (i=0; i<spikesToRead; i+=8) {
-            VAL = ((quint16)spikeInfo[i+1] << 8)
-                + ((quint16)spikeInfo[i+0]);
-            ID = ((quint16)spikeInfo[i+3]);
-            MT = ((quint16)spikeInfo[i+2]);
-            DT = ((quint32)spikeInfo[i+5] << 24)
-               + ((quint32)spikeInfo[i+4] << 16)
-               + ((quint32)spikeInfo[i+7] << 8)
-               + ((quint32)spikeInfo[i+6]);
-
-            if (ID < 32) { // && !deactiveChannels[ID]) {
-                DT100 = (DT-lastDT[ID])*4;
-                lastDT[ID] = DT;
-                //std::cout << "Spike on channel " << channelsOrdered[ID] << " of " << VAL/* * 0.195*/ << " at " << DT << " (RMS mult: " << float(MT)/2 << ")" << endl;
-                if (sendSocket->state() == QUdpSocket::ConnectedState) {
-                    datagram[0] = qToBigEndian(quint32(0));
-                    datagram[1] = qToBigEndian(quint32(DT100));
-                    datagram[2] = qToBigEndian(qint32(VAL));
-                    datagram[3] = qToBigEndian(channelsOrdered[ID]);
-                    sendSocket->writeDatagram((char*)datagram, 16, destAddress, destPort);
-                }
+        spikesRead = evalBoard->readSpike();
 
-                probePlot->updateFiring(channelsOrdered[ID]);
-            }
-            else
-                std::cout << "Received spike with channel out of range " << ID << endl;
-        }
+        spikeForwarder.forwardEvents();
 
-        if (mainWindow->isRecording() && spikesToRead > 0) {
+        if (mainWindow->isRecording() && spikesRead > 0) {
             saveFileName = *mainWindow->getSaveFileName();
             if (prevFileName != saveFileName) {
                 prevFileName = saveFileName;
                 hwDetectorFileName = saveFileName.left(saveFileName.size()-4) + "_HW_detections.rhs";
             }
-            QFile fileStim(hwDetectorFileName);
-            fileStim.open(QIODevice::WriteOnly | QIODevice::Append);
-            QDataStream out(&fileStim);
-            if (out.writeRawData((char*)spikeInfo, spikesToRead) != spikesToRead)
-                std::cerr << "Error on write spikes to disk" << endl;
-            //cout << spikesToRead << " data written" << endl;
-        } else
+            spikeForwarder.saveEvents(hwDetectorFileName);
+            //cout << spikesRead << " data written" << endl;
+        } else {
+            if (!mainWindow->isRecording())
+                spikeForwarder.skipSavedEvents();
             QThread::msleep(1);
+        }
 
         if (evalBoard->isRunning())
             wasRunning = true;
@@ -349,17 +328,34 @@ void SpikeDetectorDialog::connectUDP()
         cout << hostAddr.toString().toUtf8().constData() << ":" << hostPort << endl;
         connect(recvSocket, SIGNAL(readyRead()), this, SLOT(sendStimTrigger()));
 
-        if (sendSocket->bind(hostAddr, 0))
+        if (!synthMode) {
+            // Serialize the amplitude commands of every probe channel before the first request arrives.
+            auto start = chrono::steady_clock::now();
+            for (int i = 0; i < 32; i++) {
+                SignalChannel* signalChannel = wavePlot->selectedChannel(i);
+                if (signalChannel)
+                    stimCommandCache.prepareSymmetricGrid(signalChannel->commandStream, signalChannel->chipChannel);
+            }
+            stimCommandCache.resetStatistics();
+            cout << "Prepared " << stimCommandCache.size() << " stimulation amplitude command lists in " <<
+                    chrono::duration_cast<chrono::milliseconds>(chrono::steady_clock::now() - start).count() << " ms" << endl;
+        }
+
+        if (sendSocket->bind(hostAddr, 0)) {
+            spikeForwarder.setDestination(sendSocket, destAddress, destPort);
             cout << "Sending spikes from " << hostAddr.toString().toUtf8().constData() << " to "
                  << destAddress.toString().toUtf8().constData() << ":" << destPort << endl;
-        else
+        } else
             cout << "Can't send from " << hostAddr.toString().toUtf8().constData() << endl;
     } else {
         connectUDPButton->setText(tr("Connect"));
+        spikeForwarder.clearDestination();
         if (sendSocket->state() != QAbstractSocket::UnconnectedState)
             sendSocket->close();
         if (recvSocket->state() != QAbstractSocket::UnconnectedState)
             recvSocket->close();
+        if (!synthMode)
+            stimCommandCache.printStatistics();
     }
     connected = !connected;
 }
@@ -371,6 +367,7 @@ void SpikeDetectorDialog::sendStimTrigger()
 
     while (recvSocket->pendingDatagramSize() > 15) {
         recvSocket->readDatagram(recvDatagram, 16, &sender, &senderPort);
+        auto triggerTime = chrono::steady_clock::now();
 
         int ch = uint(recvDatagram[3])+
                 (uint(recvDatagram[2])<<8)+
@@ -421,25 +418,25 @@ void SpikeDetectorDialog::sendStimTrigger()
             }
 
             if (lastAmpl != ampl) {
-                Rhs2000Registers chipRegisters(boardSampleRate, stimStep);
-                int commandSequenceLength;
-                vector<unsigned int> commandList;
-
                 int firstPhaseAmplitude = (int)(ampl / currentstep_uA + 0.5);
                 int secondPhaseAmplitude = (int)(ampl / currentstep_uA + 0.5);
                 int posMag = (parameters->stimPolarity == StimParameters::PositiveFirst) ? firstPhaseAmplitude : secondPhaseAmplitude;
                 int negMag = (parameters->stimPolarity == StimParameters::NegativeFirst) ? firstPhaseAmplitude : secondPhaseAmplitude;
 
-                evalBoard->setStimCmdMode(false);
-                evalBoard->enableAuxCommandsOnOneStream(stream);
-                commandSequenceLength = chipRegisters.createCommandListSetStimMagnitudes(commandList, channel, posMag, 0, negMag, 0);
-                evalBoard->uploadCommandList(commandList, Rhs2000EvalBoard::AuxCmd1);
-                evalBoard->selectAuxCommandLength(Rhs2000EvalBoard::AuxCmd1, 0, commandSequenceLength - 1);
-                evalBoard->setStimCmdMode(true);
+                const StimCommandBuffers* commands = stimCommandCache.find(stream, channel, posMag, negMag);
+                if (!commands) {
+                    // Out-of-range amplitude: do not stimulate at whatever the chip was last set to.
+                    cout << " of amplitude " << ampl << " rejected" << endl;
+                    continue;
+                }
+                evalBoard->uploadStimMagnitudeCommands(stream, commands->commandMsw.data(), commands->commandLsw.data(),
+                                                       commands->numCommands);
+                double uploadLatencyUs = chrono::duration<double, micro>(chrono::steady_clock::now() - triggerTime).count();
+                stimCommandCache.recordUploadLatency(uploadLatencyUs);
 
                 lastAmpl = ampl;
 
-                cout << " of amplitude " << ampl;
+                cout << " of amplitude " << ampl << " (upload " << (int) uploadLatencyUs << " us)";
             }
             cout << endl;
 
@@ -9,6 +9,8 @@
 #include "rhs2000evalboard.h"
 #include "probeplot.h"
 #include "mainwindow.h"
+#include "stimcommandcache.h"
+#include "spikeforwarder.h"
 
 using namespace std;
 
@@ -69,7 +71,6 @@ private:
 
     QVector<quint32> channelsOrdered;
     bool deactiveChannels[32];
-    quint32 lastDT[32];
     QString hwDetectorFileName;
     QString saveFileName;
     QString prevFileName;
@@ -81,11 +82,12 @@ private:
     quint16 senderPort;
     QUdpSocket* sendSocket;
     QUdpSocket* recvSocket;
-    int datagram[4];
     char recvDatagram[16];
 
     int lastChannel;
     int lastAmpl;
+    StimCommandCache stimCommandCache;
+    SpikeForwarder spikeForwarder;
 };
 
 #endif // SPIKEDETECTORDIALOG_H
@@ -0,0 +1,401 @@
+#include <iostream>
+#include <cstring>
+
+#include "usbdeinterleaver.h"
+#include "spikedetectormodel.h"
+
+// Bit-exact host model of the FPGA spike detector
+
+// 300 Hz 3rd order high-pass Butterworth, times 2^15 (filter.vhd)
+static const long long FilterA[SPIKE_MODEL_FILTER_ORDER] = { -93364, 88789, -28180 };
+static const long long FilterB[SPIKE_MODEL_FILTER_ORDER + 1] = { 30388, -91163, 91163, -30388 };
+
+// Savitzky-Golay smoother, times 2^18 (SG_filt.vhd)
+static const long long SmootherCoefficients[SPIKE_MODEL_SG_TAPS] = {
+    -24966, 37449, 74898, 87381, 74898, 37449, -24966
+};
+
+// round(triang(4 * k + 1) * 2^16) (SNEO.vhd)
+static const long long Triangle[SPIKE_MODEL_WINDOW_LENGTH] = {
+    7282, 14564, 21845, 29127, 36409, 43691, 50972, 58254, 65536,
+    58254, 50972, 43691, 36409, 29127, 21845, 14564, 7282
+};
+
+// numeric_std resize() of a signed value to fewer bits: keeps the sign bit and the bits - 1
+// low bits.
+static inline long long resizeSigned(long long value, int bits)
+{
+    long long low = value & ((1LL << (bits - 1)) - 1);
+    return value < 0 ? low - (1LL << (bits - 1)) : low;
+}
+
+// Two's complement wrap to bits, as numeric_std + and - on signed operands of that width.
+static inline long long wrapSigned(long long value, int bits)
+{
+    unsigned long long mask = (1ULL << bits) - 1;
+    unsigned long long low = (unsigned long long) value & mask;
+    return (low >> (bits - 1)) ? (long long) (low | ~mask) : (long long) low;
+}
+
+// Square root of a 70-bit value, digit by digit as in sqrt.vhd; the root is cut to 35 bits.
+long long SpikeDetectorModel::squareRoot(unsigned __int128 value)
+{
+    unsigned __int128 rest = 0;
+    unsigned __int128 bit = (unsigned __int128) 1 << 68;
+
+    while (bit > value) {
+        bit >>= 2;
+    }
+    while (bit != 0) {
+        if (value >= rest + bit) {
+            value -= rest + bit;
+            rest = (rest >> 1) + bit;
+        } else {
+            rest >>= 1;
+        }
+        bit >>= 2;
+    }
+    return (long long) (rest & ((1ULL << 35) - 1));
+}
+
+// Settings start as in the FPGA after configuration: the detector's own registers hold a
+// threshold multiplier of 11 and a blind window of 10 ms, and latch the board's wire-ins (zero
+// until written) after the first sample.
+SpikeDetectorModel::SpikeDetectorModel()
+{
+    for (int port = 0; port < SPIKE_MODEL_PORTS; ++port) {
+        portEnabled[port] = true;
+    }
+    thresholdMultIn = 0;
+    blindWindowIn = 0;
+    disabledChannelsIn = 0;
+    thresholdMult = 11;
+    blindWindow = 10;
+    disabledChannels = 0;
+    reset();
+}
+
+// Clear the detector state, as the FPGA does when the spike detector is enabled: filters,
+// queues and energy histories to zero, RMS accumulators to their rounding offset and thresholds
+// to the maximum, so that nothing is detected during the first 2^15 samples.  Settings are kept.
+void SpikeDetectorModel::reset()
+{
+    stimCounter = 0;
+
+    memset(filterSumIn, 0, sizeof(filterSumIn));
+    memset(filterSumOut, 0, sizeof(filterSumOut));
+    memset(smootherHistory, 0, sizeof(smootherHistory));
+    memset(minQueue, 0, sizeof(minQueue));
+    minQueueIndex = 0;
+    memset(mneoQueue, 0, sizeof(mneoQueue));
+    mneoQueueIndex = 0;
+    memset(neoHistory, 0, sizeof(neoHistory));
+    memset(previousMneo, 0, sizeof(previousMneo));
+
+    for (int channel = 0; channel < SPIKE_MODEL_CHANNELS; ++channel) {
+        squaredSum[channel] = 1 << (SPIKE_MODEL_RMS_SAMPLES_EXP - 1);
+        previousRms[channel] = -1;
+        thresholds[channel] = (1LL << 34) - 1;
+    }
+    rmsCounter = 0;
+    newThreshold = false;
+    rootPending = false;
+    pendingRoot = 0;
+}
+
+// Ports follow the enables of the two data streams of the detector.  A disabled port's channels
+// are skipped, which also changes the spacing of the samples in the shared queues, as in the
+// FPGA.
+void SpikeDetectorModel::setPortEnabled(int port, bool enabled)
+{
+    if (port < 0 || port >= SPIKE_MODEL_PORTS) {
+        cerr << "Error in SpikeDetectorModel::setPortEnabled: port out of range." << endl;
+        return;
+    }
+    portEnabled[port] = enabled;
+}
+
+// Threshold multiplier times two, as written to wire-in 0x15 (Rhs2000EvalBoard::setThresholdMult).
+// Zero is ignored, as by the board.
+void SpikeDetectorModel::setThresholdMult(int thresholdMult)
+{
+    if ((thresholdMult & 0xff) != 0) {
+        thresholdMultIn = thresholdMult & 0xff;
+    }
+}
+
+// Blind window in milliseconds (25 samples each), as written to wire-in 0x15.  Zero is ignored,
+// as by the board.
+void SpikeDetectorModel::setBlindWindow(int blindWindow)
+{
+    if ((blindWindow & 0xff) != 0) {
+        blindWindowIn = blindWindow & 0xff;
+    }
+}
+
+// One bit per channel (bit port * 16 + channel); a disabled channel is processed but never reports.
+void SpikeDetectorModel::setDisabledChannels(unsigned int disabledChannels)
+{
+    disabledChannelsIn = disabledChannels;
+}
+
+// Run numSamples samples through the detector.  samples[port * 16 + channel] points to the signed
+// amplifier samples of each channel (USB word minus 32768; may be null for a disabled port),
+// timeStamps to the USB frame timestamps and stimTriggers to one flag per sample, nonzero if
+// stimulation was on for any channel of either port.  Detection records are appended to records
+// in the pipe 0xa1 format: VAL (local minimum), ID << 8 | th_mult, DT high word, DT low word.
+// Returns the number of records appended.
+int SpikeDetectorModel::process(const short* const* samples, const unsigned int* timeStamps,
+                                const unsigned char* stimTriggers, int numSamples, vector<unsigned short> &records)
+{
+    int numDetections = 0;
+
+    for (int t = 0; t < numSamples; ++t) {
+        // The sample FIFO's timestamps run one behind those of the USB frames.
+        unsigned int detectionTime = timeStamps[t] - 1;
+
+        for (int chipChannel = 0; chipChannel < SPIKE_MODEL_CHANNELS_PER_PORT; ++chipChannel) {
+            if (stimTriggers[t]) {
+                stimCounter = 25 * blindWindow;
+            }
+            for (int port = 0; port < SPIKE_MODEL_PORTS; ++port) {
+                // The detector counts down the blind window and latches new settings when it
+                // starts on the last channel of its second port.
+                if (port == SPIKE_MODEL_PORTS - 1 && chipChannel == SPIKE_MODEL_CHANNELS_PER_PORT - 1) {
+                    if (stimCounter > 0) {
+                        stimCounter--;
+                    }
+                    latchSettings();
+                    if (stimTriggers[t]) {
+                        stimCounter = 25 * blindWindow;
+                    }
+                    if (rootPending) {
+                        setThreshold(SPIKE_MODEL_CHANNELS_PER_PORT - 1, pendingRoot);
+                        rootPending = false;
+                    }
+                }
+                if (!portEnabled[port]) {
+                    continue;
+                }
+
+                int channel = port * SPIKE_MODEL_CHANNELS_PER_PORT + chipChannel;
+                short minimum;
+                if (processChannel(channel, samples[channel][t], minimum) &&
+                        ((disabledChannels >> channel) & 1) == 0 && stimCounter == 0) {
+                    records.push_back((unsigned short) minimum);
+                    records.push_back((unsigned short) ((channel << 8) | thresholdMultIn));
+                    records.push_back((unsigned short) (detectionTime >> 16));
+                    records.push_back((unsigned short) (detectionTime & 0xffff));
+                    numDetections++;
+                }
+            }
+        }
+    }
+    return numDetections;
+}
+
+// Run all samples of planes through the detector, with data streams firstStream and
+// firstStream + 1 as its two ports.
+int SpikeDetectorModel::process(const SamplePlanes &planes, int firstStream, vector<unsigned short> &records)
+{
+    const short* samples[SPIKE_MODEL_CHANNELS];
+    bool present[SPIKE_MODEL_PORTS];
+
+    for (int port = 0; port < SPIKE_MODEL_PORTS; ++port) {
+        int stream = firstStream + port;
+        present[port] = stream >= 0 && stream < planes.numDataStreams;
+        if (portEnabled[port] && !present[port]) {
+            cerr << "Error in SpikeDetectorModel::process: data stream " << stream << " not in sample planes." << endl;
+            return 0;
+        }
+        for (int channel = 0; channel < SPIKE_MODEL_CHANNELS_PER_PORT; ++channel) {
+            samples[port * SPIKE_MODEL_CHANNELS_PER_PORT + channel] =
+                    present[port] ? planes.amplifierPlane(stream, channel) : 0;
+        }
+    }
+
+    // The FPGA triggers the blind window on stimulation of either stream, enabled or not.
+    stimTriggerBuffer.resize(planes.numSamples);
+    for (int t = 0; t < planes.numSamples; ++t) {
+        unsigned short stimOn = 0;
+        for (int port = 0; port < SPIKE_MODEL_PORTS; ++port) {
+            if (present[port]) {
+                stimOn |= planes.stimFlagPlane(firstStream + port, StimFlagOn)[t];
+            }
+        }
+        stimTriggerBuffer[t] = stimOn != 0;
+    }
+
+    return process(samples, planes.timeStamp.data(), stimTriggerBuffer.data(), planes.numSamples, records);
+}
+
+// Current detection threshold of a channel, in the units of the smoothed energy.
+long long SpikeDetectorModel::getThreshold(int channel) const
+{
+    return thresholds[channel];
+}
+
+// One sample of one channel through all stages.  Returns true if the smoothed energy had a peak
+// above threshold at the previous sample; minimum is then the detection record's VAL.
+// (Private method.)
+bool SpikeDetectorModel::processChannel(int channel, short sample, short &minimum)
+{
+    short filtered = filter(channel, sample);
+    minimum = localMinimum(channel, filtered);
+    long long mneo = energy(channel, smooth(channel, filtered));
+    long long channelThreshold = threshold(channel, mneo);
+
+    long long *previous = previousMneo[channel];
+    bool spike = previous[0] > channelThreshold && previous[0] > mneo && previous[0] >= previous[1];
+    previous[1] = previous[0];
+    previous[0] = mneo;
+    return spike;
+}
+
+// High-pass filter, transposed direct form II on 48-bit sums with the input side fed back
+// through a 35-bit register (filter.vhd).  (Private method.)
+short SpikeDetectorModel::filter(int channel, short sample)
+{
+    long long *sumIn = filterSumIn[channel];
+    long long *sumOut = filterSumOut[channel];
+
+    long long a = wrapSigned(sample - (sumIn[0] >> 15), 35);
+    short filtered = (short) resizeSigned((a * FilterB[0] + sumOut[0]) >> 15, 16);
+
+    for (int i = 0; i < SPIKE_MODEL_FILTER_ORDER - 1; ++i) {
+        sumIn[i] = resizeSigned(a * FilterA[i] + sumIn[i + 1], 48);
+        sumOut[i] = resizeSigned(a * FilterB[i + 1] + sumOut[i + 1], 48);
+    }
+    sumIn[SPIKE_MODEL_FILTER_ORDER - 1] = resizeSigned(a * FilterA[SPIKE_MODEL_FILTER_ORDER - 1] + (1 << 14), 48);
+    sumOut[SPIKE_MODEL_FILTER_ORDER - 1] = resizeSigned(a * FilterB[SPIKE_MODEL_FILTER_ORDER] + (1 << 14), 48);
+    return filtered;
+}
+
+// Savitzky-Golay smoothing of the filtered signal (SG_filt.vhd).  (Private method.)
+short SpikeDetectorModel::smooth(int channel, short sample)
+{
+    short *history = smootherHistory[channel];
+    memmove(history + 1, history, (SPIKE_MODEL_SG_TAPS - 1) * sizeof(short));
+    history[0] = sample;
+
+    long long sum = 1 << 17;
+    for (int i = 0; i < SPIKE_MODEL_SG_TAPS; ++i) {
+        sum += SmootherCoefficients[i] * history[i];
+    }
+    return (short) resizeSigned(sum >> 18, 16);
+}
+
+// Smallest of zero and the 17 filtered samples before this one (local_min_finder.vhd).  The
+// queue holds 17 samples of every channel and only moves on after channel 31, so with the
+// second port disabled each channel sees only its previous sample.  (Private method.)
+short SpikeDetectorModel::localMinimum(int channel, short sample)
+{
+    int address = minQueueIndex + channel;
+    short minimum = 0;
+
+    if (minQueue[address] < minimum) {
+        minimum = minQueue[address];
+    }
+    minQueue[address] = sample;
+    for (int j = 1; j < SPIKE_MODEL_WINDOW_LENGTH; ++j) {
+        int previous = address - j * SPIKE_MODEL_CHANNELS;
+        if (previous < 0) {
+            previous += SPIKE_MODEL_MIN_QUEUE;
+        }
+        if (minQueue[previous] < minimum) {
+            minimum = minQueue[previous];
+        }
+    }
+
+    if (channel == SPIKE_MODEL_CHANNELS - 1) {
+        if (minQueueIndex < SPIKE_MODEL_MIN_QUEUE - 1 - SPIKE_MODEL_CHANNELS) {
+            minQueueIndex += SPIKE_MODEL_CHANNELS;
+        } else {
+            minQueueIndex = 0;
+        }
+    }
+    return minimum;
+}
+
+// Nonlinear energy x[n - k]^2 - x[n] x[n - 2k] of the smoothed signal, convolved with the
+// triangular window (MNEO.vhd, SNEO.vhd).  The smoothed samples go through one queue shared by
+// all channels that moves on with every channel processed; k = 4 samples back is 4 * 32 places
+// back, so with one port disabled it reaches 8 samples back.  (Private method.)
+long long SpikeDetectorModel::energy(int channel, short sample)
+{
+    int index = mneoQueueIndex;
+    mneoQueue[index] = sample;
+    long long next = sample;
+    long long current = mneoQueue[(index + SPIKE_MODEL_MNEO_QUEUE - SPIKE_MODEL_CHANNELS * SPIKE_MODEL_K_MAX) %
+                                  SPIKE_MODEL_MNEO_QUEUE];
+    long long previous = mneoQueue[(index + SPIKE_MODEL_MNEO_QUEUE - 2 * SPIKE_MODEL_CHANNELS * SPIKE_MODEL_K_MAX) %
+                                   SPIKE_MODEL_MNEO_QUEUE];
+    mneoQueueIndex = (index < SPIKE_MODEL_MNEO_QUEUE - 1) ? index + 1 : 0;
+
+    long long *history = neoHistory[channel];
+    memmove(history + 1, history, (SPIKE_MODEL_WINDOW_LENGTH - 1) * sizeof(long long));
+    history[0] = wrapSigned(current * current - next * previous, 32);
+
+    long long sum = 1 << 15;
+    for (int j = 0; j < SPIKE_MODEL_WINDOW_LENGTH; ++j) {
+        sum += Triangle[j] * history[j];
+    }
+    return wrapSigned(sum, 48) >> 16;
+}
+
+// Accumulate the squared energy for the RMS (rms.vhd) and return the channel's threshold before
+// this sample.  Energy above threshold is replaced by the last RMS, to keep spikes out of it.
+// Every 2^15 samples of channel 0 all channels take a new RMS.  (Private method.)
+long long SpikeDetectorModel::threshold(int channel, long long value)
+{
+    long long channelThreshold = thresholds[channel];
+
+    if (channel == 0) {
+        if (rmsCounter < (1 << SPIKE_MODEL_RMS_SAMPLES_EXP) - 1) {
+            rmsCounter++;
+            newThreshold = false;
+        } else {
+            rmsCounter = 0;
+            newThreshold = true;
+        }
+    }
+
+    long long root = (value <= channelThreshold) ? value : previousRms[channel];
+    unsigned __int128 total = squaredSum[channel] + (unsigned __int128) ((__int128) root * root);
+    total &= ((unsigned __int128) 1 << (70 + SPIKE_MODEL_RMS_SAMPLES_EXP)) - 1;
+
+    if (newThreshold) {
+        squaredSum[channel] = 1 << (SPIKE_MODEL_RMS_SAMPLES_EXP - 1);
+        long long rms = squareRoot((total >> SPIKE_MODEL_RMS_SAMPLES_EXP) & (((unsigned __int128) 1 << 70) - 1));
+        // The root of channel 15 is ready after the detector has latched the next sample's
+        // settings, so it is scaled by the new multiplier.
+        if (channel == SPIKE_MODEL_CHANNELS_PER_PORT - 1) {
+            rootPending = true;
+            pendingRoot = rms;
+        } else {
+            setThreshold(channel, rms);
+        }
+    } else {
+        squaredSum[channel] = total;
+    }
+    return channelThreshold;
+}
+
+// New RMS of a channel, and its threshold: RMS times th_mult / 2, rounded, at most 2^34 - 1.
+// (Private method.)
+void SpikeDetectorModel::setThreshold(int channel, long long root)
+{
+    const long long maxThreshold = (1LL << 34) - 1;
+
+    previousRms[channel] = wrapSigned(root, 35);
+    long long scaled = (previousRms[channel] * thresholdMult + 1) >> 1;
+    thresholds[channel] = (scaled <= maxThreshold) ? resizeSigned(scaled, 35) : maxThreshold;
+}
+
+// Take over the settings written since the last sample.  (Private method.)
+void SpikeDetectorModel::latchSettings()
+{
+    thresholdMult = thresholdMultIn;
+    blindWindow = blindWindowIn;
+    disabledChannels = disabledChannelsIn;
+}
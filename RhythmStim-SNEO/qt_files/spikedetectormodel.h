@@ -0,0 +1,106 @@
+#ifndef SPIKEDETECTORMODEL_H
+#define SPIKEDETECTORMODEL_H
+
+#include <vector>
+
+using namespace std;
+
+#define SPIKE_MODEL_PORTS 2
+#define SPIKE_MODEL_CHANNELS_PER_PORT 16
+#define SPIKE_MODEL_CHANNELS (SPIKE_MODEL_PORTS * SPIKE_MODEL_CHANNELS_PER_PORT)
+#define SPIKE_MODEL_RECORD_WORDS 4
+
+// Detector dimensions that the FPGA's RAMs are laid out by (generics of spike_detector.vhd and
+// the entities below it).
+#define SPIKE_MODEL_FILTER_ORDER 3
+#define SPIKE_MODEL_SG_TAPS 7
+#define SPIKE_MODEL_K_MAX 4
+#define SPIKE_MODEL_WINDOW_LENGTH (4 * SPIKE_MODEL_K_MAX + 1)
+#define SPIKE_MODEL_MNEO_QUEUE (SPIKE_MODEL_CHANNELS * (3 * SPIKE_MODEL_K_MAX + 1))
+#define SPIKE_MODEL_MIN_QUEUE (SPIKE_MODEL_CHANNELS * SPIKE_MODEL_WINDOW_LENGTH)
+#define SPIKE_MODEL_RMS_SAMPLES_EXP 15
+
+struct SamplePlanes;
+
+// Host model of the FPGA spike detector (spike_detector.vhd), exact to the bit.  Samples go
+// through the same fixed-point stages as in the hardware: the 300 Hz 3rd order high-pass
+// Butterworth (filter.vhd), the 7-tap Savitzky-Golay smoother (SG_filt.vhd), the smoothed
+// nonlinear energy operator with k = 4 and a 17-point triangular window (MNEO.vhd, SNEO.vhd),
+// the threshold of th_mult / 2 times the RMS of the energy, renewed every 2^15 samples
+// (rms.vhd), the local minimum of the filtered signal over the last 17 samples
+// (local_min_finder.vhd) and the blind window after stimulation.  Coefficients, rounding
+// offsets, register widths and the order in which the channels share the detector's RAMs are
+// those of the VHDL, so a recording fed through the model gives the same detection records as
+// pipe 0xa1 did while it was acquired.
+//
+// One model stands for one detector instance: two ports (data streams) of 16 channels, numbered
+// port * 16 + channel like the ID of a detection record.  Not thread safe; use one model per
+// thread.
+
+class SpikeDetectorModel
+{
+
+public:
+    SpikeDetectorModel();
+
+    void reset();
+
+    void setPortEnabled(int port, bool enabled);
+    void setThresholdMult(int thresholdMult);
+    void setBlindWindow(int blindWindow);
+    void setDisabledChannels(unsigned int disabledChannels);
+
+    int process(const short* const* samples, const unsigned int* timeStamps, const unsigned char* stimTriggers,
+                int numSamples, vector<unsigned short> &records);
+    int process(const SamplePlanes &planes, int firstStream, vector<unsigned short> &records);
+
+    long long getThreshold(int channel) const;
+
+    static long long squareRoot(unsigned __int128 value);
+
+private:
+    bool processChannel(int channel, short sample, short &minimum);
+    short filter(int channel, short sample);
+    short smooth(int channel, short sample);
+    short localMinimum(int channel, short sample);
+    long long energy(int channel, short sample);
+    long long threshold(int channel, long long value);
+    void setThreshold(int channel, long long root);
+    void latchSettings();
+
+    bool portEnabled[SPIKE_MODEL_PORTS];
+
+    // Settings as written to the board, and as latched by the detector once per sample.
+    int thresholdMultIn;
+    int blindWindowIn;
+    unsigned int disabledChannelsIn;
+    int thresholdMult;
+    int blindWindow;
+    unsigned int disabledChannels;
+    int stimCounter;
+
+    long long filterSumIn[SPIKE_MODEL_CHANNELS][SPIKE_MODEL_FILTER_ORDER];
+    long long filterSumOut[SPIKE_MODEL_CHANNELS][SPIKE_MODEL_FILTER_ORDER];
+    short smootherHistory[SPIKE_MODEL_CHANNELS][SPIKE_MODEL_SG_TAPS];
+
+    // Queues shared by all channels, in the order the detector processes them.
+    short minQueue[SPIKE_MODEL_MIN_QUEUE];
+    int minQueueIndex;
+    short mneoQueue[SPIKE_MODEL_MNEO_QUEUE];
+    int mneoQueueIndex;
+
+    long long neoHistory[SPIKE_MODEL_CHANNELS][SPIKE_MODEL_WINDOW_LENGTH];
+    long long previousMneo[SPIKE_MODEL_CHANNELS][2];
+
+    unsigned __int128 squaredSum[SPIKE_MODEL_CHANNELS];    // 85-bit accumulator of rms.vhd
+    long long previousRms[SPIKE_MODEL_CHANNELS];
+    long long thresholds[SPIKE_MODEL_CHANNELS];
+    int rmsCounter;
+    bool newThreshold;
+    bool rootPending;               // root of channel 15, scaled after the settings are latched
+    long long pendingRoot;
+
+    vector<unsigned char> stimTriggerBuffer;
+};
+
+#endif // SPIKEDETECTORMODEL_H
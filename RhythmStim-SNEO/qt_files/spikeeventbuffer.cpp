@@ -0,0 +1,105 @@
+#include <cstring>
+
+#include "spikeeventbuffer.h"
+
+// Spike event ring buffer
+// Single producer (the pipe 0xa1 reader), any number of cursor-based consumers.
+
+SpikeEventBuffer::SpikeEventBuffer()
+{
+    reset();
+}
+
+// Drop all events.  Only call while no consumer is reading.
+void SpikeEventBuffer::reset()
+{
+    claimSequence = 0;
+    writeSequence = 0;
+    numLostEvents = 0;
+}
+
+// Destination for one read of pipe 0xa1, large enough for the whole hardware spike FIFO.
+unsigned char* SpikeEventBuffer::pipeBuffer()
+{
+    return pipeData;
+}
+
+int SpikeEventBuffer::pipeBufferSize() const
+{
+    return 2 * SPIKE_FIFO_DEPTH_WORDS;
+}
+
+// Decode the records just read into pipeBuffer() and publish them to consumers.
+// Returns the number of new events.
+int SpikeEventBuffer::commitPipeRead(int numBytes)
+{
+    int numEvents = numBytes / SPIKE_RECORD_BYTES;
+    quint64 first = writeSequence.load(memory_order_relaxed);
+
+    claimSequence.store(first + numEvents, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+
+    const unsigned char* record = pipeData;
+    for (int i = 0; i < numEvents; ++i) {
+        int slot = (int)((first + i) & Mask);
+        SpikeEvent &event = events[slot];
+        event.amplitude = ((quint16)record[1] << 8) + ((quint16)record[0]);
+        event.thresholdMult = record[2];
+        event.channel = record[3];
+        // The two 16-bit halves of the timestamp come out of the FIFO most significant word first.
+        event.timestamp = ((quint32)record[5] << 24) + ((quint32)record[4] << 16) +
+                          ((quint32)record[7] << 8) + ((quint32)record[6]);
+        memcpy(&records[slot * SPIKE_RECORD_BYTES], record, SPIKE_RECORD_BYTES);
+        record += SPIKE_RECORD_BYTES;
+    }
+
+    writeSequence.store(first + numEvents, memory_order_release);
+    return numEvents;
+}
+
+// Sequence number of the next event to be written.  New consumers start reading here.
+quint64 SpikeEventBuffer::writeCursor() const
+{
+    return writeSequence.load(memory_order_acquire);
+}
+
+// Point events and records at the contiguous run of unread events starting at cursor and
+// return its length (0 if the consumer is up to date).  If the consumer has been lapped,
+// cursor is first moved forward to the oldest event still in the ring.
+int SpikeEventBuffer::peek(quint64 &cursor, const SpikeEvent* &firstEvent, const unsigned char* &firstRecord)
+{
+    quint64 available = writeSequence.load(memory_order_acquire);
+
+    if (available - cursor > SPIKE_EVENT_BUFFER_SIZE) {
+        numLostEvents += available - SPIKE_EVENT_BUFFER_SIZE - cursor;
+        cursor = available - SPIKE_EVENT_BUFFER_SIZE;
+    }
+
+    int slot = (int)(cursor & Mask);
+    int numEvents = (int) qMin(available - cursor, (quint64)(SPIKE_EVENT_BUFFER_SIZE - slot));
+
+    firstEvent = &events[slot];
+    firstRecord = &records[slot * SPIKE_RECORD_BYTES];
+    return numEvents;
+}
+
+// Advance cursor past numEvents events obtained from peek().  Returns false if the producer
+// overwrote some of them while they were being read, in which case they must be discarded.
+bool SpikeEventBuffer::release(quint64 &cursor, int numEvents)
+{
+    atomic_thread_fence(memory_order_acquire);
+    quint64 claimed = claimSequence.load(memory_order_relaxed);
+
+    bool intact = (claimed - cursor <= SPIKE_EVENT_BUFFER_SIZE);
+    if (!intact) {
+        numLostEvents += numEvents;
+    }
+    cursor += numEvents;
+    return intact;
+}
+
+// Total number of events consumers missed because they fell too far behind.
+quint64 SpikeEventBuffer::getNumLostEvents() const
+{
+    return numLostEvents;
+}
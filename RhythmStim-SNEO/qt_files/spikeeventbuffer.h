@@ -0,0 +1,62 @@
+#ifndef SPIKEEVENTBUFFER_H
+#define SPIKEEVENTBUFFER_H
+
+#include <QtGlobal>
+#include <atomic>
+
+using namespace std;
+
+// Depth of fifo_spikes_to_pipeout in the FPGA (16-bit words); one pipe 0xa1 read never exceeds it.
+#define SPIKE_FIFO_DEPTH_WORDS 2048
+#define SPIKE_RECORD_BYTES 8
+// Number of events kept in the ring (power of two, 16 full FIFO reads).
+#define SPIKE_EVENT_BUFFER_SIZE 8192
+
+// One hardware detection, decoded from the 8-byte pipe 0xa1 record.
+#pragma pack(push, 1)
+struct SpikeEvent
+{
+    quint32 timestamp;      // DT: sample counter at detection
+    quint16 amplitude;      // VAL: SNEO amplitude
+    quint8 thresholdMult;   // MT: RMS threshold multiplier, times 2
+    quint8 channel;         // ID: hardware channel index (0-31)
+};
+#pragma pack(pop)
+
+// Ring of spike events filled by the thread reading pipe 0xa1 and read in place by any
+// number of consumers.  Each consumer owns a cursor (an absolute event sequence number);
+// a consumer that falls more than SPIKE_EVENT_BUFFER_SIZE events behind skips the lost
+// events.  Decoded events and the raw pipe records (for _HW_detections.rhs files) are
+// kept side by side.
+
+class SpikeEventBuffer
+{
+
+public:
+    SpikeEventBuffer();
+
+    void reset();
+
+    unsigned char* pipeBuffer();
+    int pipeBufferSize() const;
+    int commitPipeRead(int numBytes);
+
+    quint64 writeCursor() const;
+    int peek(quint64 &cursor, const SpikeEvent* &events, const unsigned char* &records);
+    bool release(quint64 &cursor, int numEvents);
+    quint64 getNumLostEvents() const;
+
+private:
+    static const int Mask = SPIKE_EVENT_BUFFER_SIZE - 1;
+
+    SpikeEvent events[SPIKE_EVENT_BUFFER_SIZE];
+    unsigned char records[SPIKE_EVENT_BUFFER_SIZE * SPIKE_RECORD_BYTES];
+    unsigned char pipeData[2 * SPIKE_FIFO_DEPTH_WORDS];
+
+    // Sequence number the producer is about to overwrite up to, and the last published one.
+    atomic<quint64> claimSequence;
+    atomic<quint64> writeSequence;
+    atomic<quint64> numLostEvents;
+};
+
+#endif // SPIKEEVENTBUFFER_H
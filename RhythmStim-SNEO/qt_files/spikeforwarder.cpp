@@ -0,0 +1,153 @@
+#include <QFile>
+#include <QDataStream>
+#include <QUdpSocket>
+#include <QtEndian>
+#include <iostream>
+#include <chrono>
+#include <cstring>
+
+#include "spikeforwarder.h"
+#include "metricsregistry.h"
+
+// Hardware spike event forwarding
+
+SpikeForwarder::SpikeForwarder(SpikeEventBuffer *spikeEvents_) :
+    spikeEvents(spikeEvents_),
+    channelsOrdered(probeChannelOrder()),
+    socket(nullptr),
+    destPort(0)
+{
+    MetricsRegistry* metrics = MetricsRegistry::global();
+    udpSendTimeMetric = metrics->histogram("udp.send_time", "us");
+    udpDatagramMetric = metrics->counter("udp.datagrams");
+    udpErrorMetric = metrics->counter("udp.send_errors");
+
+    reset();
+}
+
+// Probe channel (1-32) wired to each hardware detector channel.
+QVector<quint32> SpikeForwarder::probeChannelOrder()
+{
+    return {21,27,13,31,7,1,25,19,20,26,2,8,32,14,28,22,18,30,12,24,16,6,4,10,9,3,5,15,23,11,29,17};
+}
+
+// Send events from socket_ (bound by the caller) to address_:port_.
+void SpikeForwarder::setDestination(QUdpSocket *socket_, const QHostAddress &address_, quint16 port_)
+{
+    lock_guard<mutex> lock(destinationMutex);
+    socket = socket_;
+    destAddress = address_;
+    destPort = port_;
+}
+
+void SpikeForwarder::clearDestination()
+{
+    lock_guard<mutex> lock(destinationMutex);
+    socket = nullptr;
+}
+
+// Called with the probe channel of every forwarded event, e.g. to update a plot.
+void SpikeForwarder::setFiringCallback(const function<void(quint32)> &callback)
+{
+    firingCallback = callback;
+}
+
+// Start both cursors at the newest event, e.g. when spike detection starts.
+void SpikeForwarder::reset()
+{
+    if (spikeEvents) {
+        udpCursor = spikeEvents->writeCursor();
+    } else {
+        udpCursor = 0;
+    }
+    diskCursor = udpCursor;
+    for (int i = 0; i < SPIKE_DETECTOR_NUM_CHANNELS; ++i) {
+        lastDT[i] = 0;
+    }
+}
+
+// Forward all new events over UDP (if a destination is set).  Returns the number of events.
+int SpikeForwarder::forwardEvents()
+{
+    const SpikeEvent* events;
+    const unsigned char* records;
+    int numEvents, total = 0;
+
+    lock_guard<mutex> lock(destinationMutex);
+    while ((numEvents = spikeEvents->peek(udpCursor, events, records)) > 0) {
+        numEvents = qMin(numEvents, FORWARDER_BATCH_EVENTS);
+        memcpy(eventBatch, events, numEvents * sizeof(SpikeEvent));
+        if (!spikeEvents->release(udpCursor, numEvents)) {
+            continue;       // overwritten while copied
+        }
+        for (int i = 0; i < numEvents; ++i) {
+            const SpikeEvent &event = eventBatch[i];
+            if (event.channel >= SPIKE_DETECTOR_NUM_CHANNELS) {
+                cout << "Received spike with channel out of range " << (int) event.channel << endl;
+                continue;
+            }
+            quint32 DT100 = (event.timestamp - lastDT[event.channel]) * 4;
+            lastDT[event.channel] = event.timestamp;
+
+            if (socket) {
+                datagram[0] = qToBigEndian(qint32(0));
+                datagram[1] = qToBigEndian(qint32(DT100));
+                datagram[2] = qToBigEndian(qint32(event.amplitude));
+                datagram[3] = qToBigEndian(qint32(channelsOrdered[event.channel]));
+                auto sendStart = chrono::steady_clock::now();
+                if (socket->writeDatagram((const char*) datagram, sizeof(datagram), destAddress, destPort) < 0) {
+                    udpErrorMetric->add();
+                }
+                udpSendTimeMetric->record(chrono::duration_cast<chrono::microseconds>(
+                                              chrono::steady_clock::now() - sendStart).count());
+                udpDatagramMetric->add();
+            }
+
+            if (firingCallback) {
+                firingCallback(channelsOrdered[event.channel]);
+            }
+        }
+        total += numEvents;
+    }
+    return total;
+}
+
+// Append the raw records of all new events to fileName.  Returns the number of events.
+int SpikeForwarder::saveEvents(const QString &fileName)
+{
+    const SpikeEvent* events;
+    const unsigned char* records;
+    int numEvents, total = 0;
+
+    numEvents = spikeEvents->peek(diskCursor, events, records);
+    if (numEvents <= 0) {
+        return 0;
+    }
+
+    QFile file(fileName);
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Append)) {
+        cerr << "Error in SpikeForwarder::saveEvents: cannot open " << fileName.toStdString() << endl;
+        skipSavedEvents();
+        return 0;
+    }
+    QDataStream out(&file);
+    do {
+        numEvents = qMin(numEvents, FORWARDER_BATCH_EVENTS);
+        int numBytes = numEvents * SPIKE_RECORD_BYTES;
+        memcpy(recordBatch, records, numBytes);
+        if (!spikeEvents->release(diskCursor, numEvents)) {
+            continue;       // overwritten while copied
+        }
+        if (out.writeRawData((const char*) recordBatch, numBytes) != numBytes) {
+            cerr << "Error on write spikes to disk" << endl;
+        }
+        total += numEvents;
+    } while ((numEvents = spikeEvents->peek(diskCursor, events, records)) > 0);
+    return total;
+}
+
+// Drop the events not yet saved, e.g. while not recording.
+void SpikeForwarder::skipSavedEvents()
+{
+    diskCursor = spikeEvents->writeCursor();
+}
@@ -0,0 +1,69 @@
+#ifndef SPIKEFORWARDER_H
+#define SPIKEFORWARDER_H
+
+#include <QVector>
+#include <QString>
+#include <QHostAddress>
+#include <functional>
+#include <mutex>
+#include "spikeeventbuffer.h"
+
+using namespace std;
+
+class QUdpSocket;
+class MetricCounter;
+class LatencyHistogram;
+
+// Number of hardware spike detector channels (one RHS2116 pair on port A).
+#define SPIKE_DETECTOR_NUM_CHANNELS 32
+// Events copied out of the SpikeEventBuffer at a time.
+#define FORWARDER_BATCH_EVENTS 256
+
+// Consumer of the hardware spike events, shared by SpikeDetectorDialog and the headless
+// acquisition daemon.  Each event is forwarded as a 16-byte UDP datagram of four big-endian
+// words (zero, DT100 = 4 * samples since the channel's previous spike, amplitude, probe channel)
+// and the raw pipe records are appended to the _HW_detections.rhs file while recording.
+// Forwarding and saving read the SpikeEventBuffer through their own cursors, copying each batch
+// out and using it only if the producer did not overwrite it meanwhile.  Call all methods
+// except setDestination() from the thread polling the board.
+
+class SpikeForwarder
+{
+
+public:
+    SpikeForwarder(SpikeEventBuffer *spikeEvents_);
+
+    static QVector<quint32> probeChannelOrder();
+
+    void setDestination(QUdpSocket *socket_, const QHostAddress &address_, quint16 port_);
+    void clearDestination();
+    void setFiringCallback(const function<void(quint32)> &callback);
+    void reset();
+
+    int forwardEvents();
+    int saveEvents(const QString &fileName);
+    void skipSavedEvents();
+
+private:
+    SpikeEventBuffer *spikeEvents;
+    QVector<quint32> channelsOrdered;
+    function<void(quint32)> firingCallback;
+
+    mutex destinationMutex;
+    QUdpSocket *socket;
+    QHostAddress destAddress;
+    quint16 destPort;
+
+    quint64 udpCursor;
+    quint64 diskCursor;
+    quint32 lastDT[SPIKE_DETECTOR_NUM_CHANNELS];
+    qint32 datagram[4];
+    SpikeEvent eventBatch[FORWARDER_BATCH_EVENTS];
+    unsigned char recordBatch[FORWARDER_BATCH_EVENTS * SPIKE_RECORD_BYTES];
+
+    LatencyHistogram *udpSendTimeMetric;
+    MetricCounter *udpDatagramMetric;
+    MetricCounter *udpErrorMetric;
+};
+
+#endif // SPIKEFORWARDER_H
@@ -0,0 +1,156 @@
+#include <iostream>
+#include <iomanip>
+#include <algorithm>
+
+#include "stimcommandcache.h"
+#include "rhs2000evalboard.h"
+
+// Stimulation magnitude command cache
+
+StimCommandCache::StimCommandCache()
+{
+    sampleRate = 30000.0;
+    stimStep = Rhs2000Registers::StimStep10uA;
+    resetStatistics();
+}
+
+// The command lists depend on the chip register settings; changing them drops all entries.
+void StimCommandCache::setChipParameters(double sampleRate_, Rhs2000Registers::StimStepSize stimStep_)
+{
+    if (sampleRate_ != sampleRate || stimStep_ != stimStep) {
+        clear();
+    }
+    sampleRate = sampleRate_;
+    stimStep = stimStep_;
+}
+
+void StimCommandCache::clear()
+{
+    entries.clear();
+}
+
+// Number of cached command lists.
+int StimCommandCache::size() const
+{
+    return (int) entries.size();
+}
+
+// Returns true if the stream, channel and magnitudes are ones the board and chip take; prints an
+// error naming caller otherwise.  (Private method.)
+bool StimCommandCache::inRange(const char *caller, int stream, int channel, int posMag, int negMag)
+{
+    if (stream < 0 || stream > (MAX_NUM_DATA_STREAMS - 1)) {
+        cerr << "Error in StimCommandCache::" << caller << ": stream out of range." << endl;
+        return false;
+    }
+    if (channel < 0 || channel > 15) {
+        cerr << "Error in StimCommandCache::" << caller << ": channel out of range." << endl;
+        return false;
+    }
+    if (posMag < 0 || posMag > MAX_STIM_MAGNITUDE || negMag < 0 || negMag > MAX_STIM_MAGNITUDE) {
+        cerr << "Error in StimCommandCache::" << caller << ": magnitude out of range." << endl;
+        return false;
+    }
+    return true;
+}
+
+// Fields must be in range (see inRange()), so each fits its byte.  (Private method.)
+quint64 StimCommandCache::key(int stream, int channel, int posMag, int negMag)
+{
+    return ((quint64) stream << 24) + ((quint64) channel << 16) + ((quint64) posMag << 8) + (quint64) negMag;
+}
+
+// Generate and serialize one command list (same byte layout as Rhs2000EvalBoard::uploadCommandList).
+StimCommandBuffers& StimCommandCache::build(Rhs2000Registers &chipRegisters, int stream, int channel, int posMag, int negMag)
+{
+    vector<unsigned int> commandList;
+    int commandSequenceLength = chipRegisters.createCommandListSetStimMagnitudes(commandList, channel, posMag, 0, negMag, 0);
+
+    StimCommandBuffers &buffers = entries[key(stream, channel, posMag, negMag)];
+    buffers.numCommands = commandSequenceLength;
+    buffers.commandMsw.resize(2 * commandList.size());
+    buffers.commandLsw.resize(2 * commandList.size());
+    for (unsigned int i = 0; i < commandList.size(); ++i) {
+        buffers.commandMsw[2 * i] = (unsigned char)((commandList[i] & 0x00ff0000) >> 16);
+        buffers.commandMsw[2 * i + 1] = (unsigned char)((commandList[i] & 0xff000000) >> 24);
+        buffers.commandLsw[2 * i] = (unsigned char)((commandList[i] & 0x000000ff) >> 0);
+        buffers.commandLsw[2 * i + 1] = (unsigned char)((commandList[i] & 0x0000ff00) >> 8);
+    }
+    return buffers;
+}
+
+// Add the command list for one amplitude pair, if not already cached.
+void StimCommandCache::prepare(int stream, int channel, int posMag, int negMag)
+{
+    if (!inRange("prepare", stream, channel, posMag, negMag)) {
+        return;
+    }
+    if (entries.count(key(stream, channel, posMag, negMag)) == 0) {
+        Rhs2000Registers chipRegisters(sampleRate, stimStep);
+        build(chipRegisters, stream, channel, posMag, negMag);
+    }
+}
+
+// Add the command lists for every symmetric amplitude (posMag == negMag) from 0 to maxMag.
+void StimCommandCache::prepareSymmetricGrid(int stream, int channel, int maxMag)
+{
+    maxMag = min(maxMag, MAX_STIM_MAGNITUDE);
+    if (!inRange("prepareSymmetricGrid", stream, channel, maxMag, maxMag)) {
+        return;
+    }
+    Rhs2000Registers chipRegisters(sampleRate, stimStep);
+    entries.reserve(entries.size() + maxMag + 1);
+    for (int mag = 0; mag <= maxMag; ++mag) {
+        if (entries.count(key(stream, channel, mag, mag)) == 0) {
+            build(chipRegisters, stream, channel, mag, mag);
+        }
+    }
+}
+
+// Returns the cached command list for this amplitude pair, building it first on a miss, or
+// nullptr if any argument is out of range.
+const StimCommandBuffers* StimCommandCache::find(int stream, int channel, int posMag, int negMag)
+{
+    if (!inRange("find", stream, channel, posMag, negMag)) {
+        return nullptr;
+    }
+    auto entry = entries.find(key(stream, channel, posMag, negMag));
+    if (entry != entries.end()) {
+        numHits++;
+        return &entry->second;
+    }
+
+    numMisses++;
+    Rhs2000Registers chipRegisters(sampleRate, stimStep);
+    return &build(chipRegisters, stream, channel, posMag, negMag);
+}
+
+// Record the time from a stimulation request to the end of its command upload.
+void StimCommandCache::recordUploadLatency(double latencyUs)
+{
+    numUploads++;
+    lastLatencyUs = latencyUs;
+    totalLatencyUs += latencyUs;
+    maxLatencyUs = max(maxLatencyUs, latencyUs);
+}
+
+void StimCommandCache::resetStatistics()
+{
+    numHits = 0;
+    numMisses = 0;
+    numUploads = 0;
+    lastLatencyUs = 0.0;
+    totalLatencyUs = 0.0;
+    maxLatencyUs = 0.0;
+}
+
+void StimCommandCache::printStatistics() const
+{
+    cout << "Stimulation command cache: " << entries.size() << " entries, " << numHits << " hits, " <<
+            numMisses << " misses" << endl;
+    if (numUploads > 0) {
+        cout << "  trigger-to-upload latency (us): mean " << fixed << setprecision(1) <<
+                totalLatencyUs / numUploads << ", max " << maxLatencyUs << endl;
+        cout.unsetf(ios::fixed);
+    }
+}
@@ -0,0 +1,64 @@
+#ifndef STIMCOMMANDCACHE_H
+#define STIMCOMMANDCACHE_H
+
+#include <QtGlobal>
+#include <vector>
+#include <unordered_map>
+
+#include "rhs2000registers.h"
+
+using namespace std;
+
+// Largest stimulation magnitude register value (8 bits).
+#define MAX_STIM_MAGNITUDE 255
+
+// AuxCmd1 command list that sets the stimulation magnitudes of one channel, already split into
+// the MSW and LSW byte buffers written to the two command RAM pipes.
+struct StimCommandBuffers
+{
+    vector<unsigned char> commandMsw;
+    vector<unsigned char> commandLsw;
+    int numCommands;
+};
+
+// Cache of pre-serialized stimulation magnitude command lists keyed by (stream, channel,
+// posMag, negMag).  Building the lists ahead of time for the amplitudes a closed-loop
+// experiment uses lets a UDP stimulation request go straight to the USB upload, with no
+// Rhs2000Registers construction, command list generation or memory allocation.
+
+class StimCommandCache
+{
+
+public:
+    StimCommandCache();
+
+    void setChipParameters(double sampleRate_, Rhs2000Registers::StimStepSize stimStep_);
+    void clear();
+    int size() const;
+
+    void prepare(int stream, int channel, int posMag, int negMag);
+    void prepareSymmetricGrid(int stream, int channel, int maxMag = MAX_STIM_MAGNITUDE);
+    const StimCommandBuffers* find(int stream, int channel, int posMag, int negMag);
+
+    void recordUploadLatency(double latencyUs);
+    void resetStatistics();
+    void printStatistics() const;
+
+private:
+    static bool inRange(const char *caller, int stream, int channel, int posMag, int negMag);
+    static quint64 key(int stream, int channel, int posMag, int negMag);
+    StimCommandBuffers& build(Rhs2000Registers &chipRegisters, int stream, int channel, int posMag, int negMag);
+
+    double sampleRate;
+    Rhs2000Registers::StimStepSize stimStep;
+    unordered_map<quint64, StimCommandBuffers> entries;
+
+    unsigned long long numHits;
+    unsigned long long numMisses;
+    unsigned long long numUploads;
+    double lastLatencyUs;
+    double totalLatencyUs;
+    double maxLatencyUs;
+};
+
+#endif // STIMCOMMANDCACHE_H
@@ -20,8 +20,14 @@
 //  along with this program.  If not, see <http://www.gnu.org/licenses/>.
 
 #include <iostream>
+#include <iomanip>
+#include <chrono>
 #include "usbdatathread.h"
+#include "globalconstants.h"
 #include "rhs2000datablock.h"
+#include "boardioscheduler.h"
+#include "allocationcounter.h"
+#include "metricsregistry.h"
 
 using namespace std;
 
@@ -34,14 +40,22 @@ UsbDataThread::UsbDataThread(Rhs2000EvalBoard* board_, DataStreamFifo* usbFifo_,
     running = false;
     stopThread = false;
     numUsbBlocksToRead = 1;
-    unsigned int bufferSize = BUFFER_SIZE_IN_BLOCKS * 2 * Rhs2000DataBlock::calculateDataBlockSizeInWords(MAX_NUM_DATA_STREAMS);
-    cout << "UsbDataThread: Allocating " << bufferSize / 1.0e6 << " MBytes for USB buffer." << endl;
-    usbBuffer = new unsigned char [bufferSize];
+
+    latencyBudgetMs = USB_LATENCY_BUDGET_MS;
+    minBatchBlocks = 1;
+    maxTransferBlocks = BUFFER_SIZE_IN_BLOCKS;
+    statistics = UsbTransferStatistics();
+    totalBacklogBlocks = 0.0;
+
+    MetricsRegistry* metrics = MetricsRegistry::global();
+    readTimeMetric = metrics->histogram("usb.read_time", "us");
+    backlogMetric = metrics->histogram("usb.fpga_backlog", "blocks");
+    bytesReadMetric = metrics->counter("usb.bytes_read");
+    overrunMetric = metrics->counter("usb.host_fifo_overruns");
 }
 
 UsbDataThread::~UsbDataThread()
 {
-    delete [] usbBuffer;
 }
 
 void UsbDataThread::run()
@@ -50,24 +64,66 @@ void UsbDataThread::run()
         if (keepGoing) {
             running = true;
             long numBytesRead;
+            board->getIoScheduler()->resetStatistics();
             board->setStimCmdMode(true);
             board->setContinuousRunMode(true);
             board->setMaxTimeStep(0);
             board->run();
+
+            unsigned int blockSizeInWords = Rhs2000DataBlock::calculateDataBlockSizeInWords(board->getNumEnabledDataStreams());
+            double blockPeriodMs = 1000.0 * SAMPLES_PER_DATA_BLOCK / board->getSampleRate();
+            int numBlocks, backlogBlocks, waitUs;
+            setTransferLimits(blockPeriodMs);
+            unsigned long long loopAllocations = AllocationCounter::threadAllocations();
+
             while (keepGoing && !stopThread) {
-                numBytesRead = board->readDataBlocksRaw(numUsbBlocksToRead, usbBuffer);
-                if (numBytesRead > 0) {
-                    if (!usbFifo->writeToBuffer(usbBuffer, (unsigned int)numBytesRead)) {
+                // Size each transfer from the current FPGA FIFO backlog, unless adaptation is disabled.
+                waitUs = 100;
+                backlogBlocks = -1;
+                if (latencyBudgetMs > 0.0) {
+                    backlogBlocks = board->getNumWordsInFifo() / blockSizeInWords;
+                    numBlocks = blocksToTransfer(backlogBlocks, blockPeriodMs, waitUs);
+                    backlogMetric->record(backlogBlocks);
+                } else {
+                    numBlocks = numUsbBlocksToRead;
+                }
+
+                // The USB transfer lands directly in the FIFO memory.
+                numBytesRead = 0;
+                if (numBlocks > 0) {
+                    unsigned char* fifoSpan = usbFifo->reserveWrite(numBlocks * 2 * blockSizeInWords);
+                    if (fifoSpan) {
+                        chrono::steady_clock::time_point readStart = chrono::steady_clock::now();
+                        numBytesRead = board->readDataBlocksRaw(numBlocks, fifoSpan);
+                        readTimeMetric->record(chrono::duration_cast<chrono::microseconds>(
+                                                   chrono::steady_clock::now() - readStart).count());
+                        if (numBytesRead > 0) {
+                            usbFifo->commitWrite((unsigned int)numBytesRead);
+                            bytesReadMetric->add(numBytesRead);
+                        }
+                    } else {
                         cerr << "UsbDataThread: USB buffer overrun!" << endl;
+                        overrunMetric->add();
                     }
+                }
+                if (numBytesRead > 0) {
+                    recordTransfer(numBlocks, backlogBlocks);
                 } else {
-                    usleep(100);  // wait 100 microseconds
+                    recordTransfer(0, backlogBlocks);
+                    usleep(waitUs);
                 }
             }
+            loopAllocations = AllocationCounter::threadAllocations() - loopAllocations;
             board->setContinuousRunMode(false);
             board->setStimCmdMode(false);
             board->setMaxTimeStep(0);
             board->flush();  // Flush USB FIFO on XEM6310
+            board->getIoScheduler()->printStatistics();
+            printTransferStatistics();
+            usbFifo->printStatistics();
+            if (AllocationCounter::isEnabled()) {
+                cout << "UsbDataThread: " << loopAllocations << " heap allocations while streaming" << endl;
+            }
             running = false;
         } else {
             usleep(100);
@@ -77,6 +133,12 @@ void UsbDataThread::run()
 
 void UsbDataThread::startRunning()
 {
+    {
+        lock_guard<mutex> lockStatistics(statisticsMutex);
+        statistics = UsbTransferStatistics();
+        totalBacklogBlocks = 0.0;
+    }
+    usbFifo->resetStatistics();
     keepGoing = true;
 }
 
@@ -104,3 +166,107 @@ void UsbDataThread::setNumUsbBlocksToRead(int numUsbBlocksToRead_)
     }
     numUsbBlocksToRead = numUsbBlocksToRead_;
 }
+
+// Set the end-to-end latency budget (in ms) used to size USB transfers, from the next start of
+// acquisition.  Zero disables adaptive sizing and reads a fixed numUsbBlocksToRead blocks per
+// transfer.
+void UsbDataThread::setLatencyBudget(double latencyBudgetMs_)
+{
+    if (latencyBudgetMs_ < 0.0) {
+        cerr << "UsbDataThread::setLatencyBudget: Latency budget cannot be negative." << endl;
+        return;
+    }
+    latencyBudgetMs = latencyBudgetMs_;
+}
+
+double UsbDataThread::getLatencyBudget() const
+{
+    return latencyBudgetMs;
+}
+
+// Derive the transfer size limits from the latency budget for blocks of blockPeriodMs: data is
+// batched for up to half the budget to amortize USB transaction overhead, and no transfer carries
+// more than the budget's worth of blocks, so a catch-up read never holds back the data at its
+// start for longer than the budget.  A larger backlog is drained by back-to-back transfers.
+// (Private method.)
+void UsbDataThread::setTransferLimits(double blockPeriodMs)
+{
+    lock_guard<mutex> lockStatistics(statisticsMutex);
+    if (latencyBudgetMs > 0.0) {
+        maxTransferBlocks = qBound(1, (int)(latencyBudgetMs / blockPeriodMs), BUFFER_SIZE_IN_BLOCKS);
+        minBatchBlocks = qBound(1, (int)(0.5 * latencyBudgetMs / blockPeriodMs), maxTransferBlocks);
+        statistics.minBatchBlocks = minBatchBlocks;
+        statistics.maxTransferBlocks = maxTransferBlocks;
+    } else {
+        statistics.minBatchBlocks = 0;
+        statistics.maxTransferBlocks = 0;
+    }
+}
+
+// Number of data blocks to read for a given FPGA FIFO backlog, or 0 if we should wait
+// waitUs microseconds for more data.  While the backlog is below minBatchBlocks we wait for it
+// to grow; otherwise everything available is read, up to maxTransferBlocks.
+int UsbDataThread::blocksToTransfer(int backlogBlocks, double blockPeriodMs, int &waitUs) const
+{
+    if (backlogBlocks < minBatchBlocks) {
+        waitUs = qBound(100, (int)(1000.0 * (minBatchBlocks - backlogBlocks) * blockPeriodMs), 1000);
+        return 0;
+    }
+    return qMin(backlogBlocks, maxTransferBlocks);
+}
+
+void UsbDataThread::recordTransfer(int numBlocks, int backlogBlocks)
+{
+    lock_guard<mutex> lockStatistics(statisticsMutex);
+
+    if (numBlocks == 0) {
+        statistics.numIdlePolls++;
+        return;
+    }
+
+    if (statistics.numTransfers == 0 || numBlocks < statistics.minBlocksPerTransfer) {
+        statistics.minBlocksPerTransfer = numBlocks;
+    }
+    if (numBlocks > statistics.maxBlocksPerTransfer) {
+        statistics.maxBlocksPerTransfer = numBlocks;
+    }
+    statistics.lastBlocksPerTransfer = numBlocks;
+    statistics.numTransfers++;
+    statistics.numBlocksRead += numBlocks;
+
+    if (backlogBlocks >= 0) {
+        totalBacklogBlocks += backlogBlocks;
+        statistics.meanBacklogBlocks = totalBacklogBlocks / statistics.numTransfers;
+        statistics.lastBacklogBlocks = backlogBlocks;
+        if (backlogBlocks > statistics.maxBacklogBlocks) {
+            statistics.maxBacklogBlocks = backlogBlocks;
+        }
+    }
+}
+
+// Transfer size and FPGA FIFO backlog statistics since data acquisition was last started.
+UsbTransferStatistics UsbDataThread::getTransferStatistics() const
+{
+    lock_guard<mutex> lockStatistics(statisticsMutex);
+    return statistics;
+}
+
+void UsbDataThread::printTransferStatistics() const
+{
+    UsbTransferStatistics s = getTransferStatistics();
+
+    cout << "USB transfers (latency budget " << latencyBudgetMs << " ms): " << s.numTransfers <<
+            " transfers, " << s.numIdlePolls << " idle polls, " << board->getNumWireOutUpdates() <<
+            " wire-out updates" << endl;
+    if (s.maxTransferBlocks > 0) {
+        cout << "  transfer limits from budget: batches of " << s.minBatchBlocks << " to " <<
+                s.maxTransferBlocks << " blocks" << endl;
+    }
+    if (s.numTransfers > 0) {
+        cout << "  blocks per transfer: min " << s.minBlocksPerTransfer << ", mean " <<
+                fixed << setprecision(2) << (double) s.numBlocksRead / s.numTransfers <<
+                ", max " << s.maxBlocksPerTransfer << endl;
+        cout << "  FIFO backlog (blocks): mean " << s.meanBacklogBlocks << ", max " << s.maxBacklogBlocks << endl;
+        cout.unsetf(ios::fixed);
+    }
+}
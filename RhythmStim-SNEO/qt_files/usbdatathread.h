@@ -0,0 +1,102 @@
+//  ------------------------------------------------------------------------
+//
+//  This file is part of the Intan Technologies RHS2000 Interface
+//  Version 1.01
+//  Copyright (C) 2013-2017 Intan Technologies
+//
+//  ------------------------------------------------------------------------
+//
+//  This program is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU Lesser General Public License as published
+//  by the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU Lesser General Public License for more details.
+//
+//  You should have received a copy of the GNU Lesser General Public License
+//  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef USBDATATHREAD_H
+#define USBDATATHREAD_H
+
+#include <QThread>
+#include <mutex>
+#include "rhs2000evalboard.h"
+#include "datastreamfifo.h"
+
+#define BUFFER_SIZE_IN_BLOCKS 32
+
+// Default end-to-end latency budget (in ms) the adaptive transfer sizing aims for: data is batched
+// for up to half of it, and no transfer carries more than all of it.  At 30 kS/s (4.27 ms per
+// block) that is 2 to 4 blocks per transfer.  A budget of zero disables adaptation and reads
+// numUsbBlocksToRead blocks per transfer.
+#define USB_LATENCY_BUDGET_MS 20.0
+
+using namespace std;
+
+class MetricCounter;
+class LatencyHistogram;
+
+struct UsbTransferStatistics
+{
+    unsigned long long numTransfers;
+    unsigned long long numBlocksRead;
+    unsigned long long numIdlePolls;
+    int minBlocksPerTransfer;
+    int maxBlocksPerTransfer;
+    int lastBlocksPerTransfer;
+    double meanBacklogBlocks;
+    int maxBacklogBlocks;
+    int lastBacklogBlocks;
+    int minBatchBlocks;         // transfer size limits derived from the latency budget,
+    int maxTransferBlocks;      // or 0 if adaptation is disabled
+};
+
+class UsbDataThread : public QThread
+{
+    Q_OBJECT
+public:
+    explicit UsbDataThread(Rhs2000EvalBoard* board_, DataStreamFifo* usbFifo_, QObject *parent = nullptr);
+    ~UsbDataThread();
+
+    void run() override;
+    void startRunning();
+    void stopRunning();
+    void close();
+    bool isRunning() const;
+    void setNumUsbBlocksToRead(int numUsbBlocksToRead_);
+
+    void setLatencyBudget(double latencyBudgetMs_);
+    double getLatencyBudget() const;
+    UsbTransferStatistics getTransferStatistics() const;
+    void printTransferStatistics() const;
+
+private:
+    void setTransferLimits(double blockPeriodMs);
+    int blocksToTransfer(int backlogBlocks, double blockPeriodMs, int &waitUs) const;
+    void recordTransfer(int numBlocks, int backlogBlocks);
+
+    Rhs2000EvalBoard* board;
+    DataStreamFifo* usbFifo;
+    bool keepGoing;
+    bool running;
+    bool stopThread;
+    int numUsbBlocksToRead;
+
+    double latencyBudgetMs;
+    int minBatchBlocks;
+    int maxTransferBlocks;
+    mutable mutex statisticsMutex;
+    UsbTransferStatistics statistics;
+    double totalBacklogBlocks;
+
+    LatencyHistogram *readTimeMetric;
+    LatencyHistogram *backlogMetric;
+    MetricCounter *bytesReadMetric;
+    MetricCounter *overrunMetric;
+};
+
+#endif // USBDATATHREAD_H
@@ -0,0 +1,391 @@
+#include <iostream>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define DEINTERLEAVER_AVX2 1
+#endif
+
+#include "usbdeinterleaver.h"
+
+// USB sample frame deinterleaver
+
+// Layout of a USB sample frame with n data streams, in bytes:
+//     0            magic number (8)
+//     8            timestamp (4)
+//     12           auxiliary command 1-3 results, command-major, 4 bytes per stream
+//     12 + 12n     16 amplifier channels, channel-major, DC word and AC word per stream
+//     12 + 76n     auxiliary command 0 results, 4 bytes per stream
+//     12 + 80n     stimulation on, polarity, amp settle and charge recovery flags, 2 bytes per stream
+//     12 + 88n     8 DAC words, 8 ADC words, TTL in, TTL out
+#define FRAME_TIMESTAMP_OFFSET 8
+#define FRAME_AUX_OFFSET 12
+
+static inline unsigned short loadUsbWord(const unsigned char* buffer)
+{
+    return (unsigned short) (buffer[0] | (buffer[1] << 8));
+}
+
+static inline int amplifierOffset(int numDataStreams)
+{
+    return FRAME_AUX_OFFSET + 12 * numDataStreams;
+}
+
+SamplePlanes::SamplePlanes()
+{
+    numDataStreams = 0;
+    numSamples = 0;
+    planeStride = 0;
+}
+
+// Size the planes for numSamples_ samples of numDataStreams_ data streams.  Does nothing if they
+// already have that shape.
+void SamplePlanes::allocate(int numDataStreams_, int numSamples_)
+{
+    if (numDataStreams_ == numDataStreams && numSamples_ == numSamples) {
+        return;
+    }
+    numDataStreams = numDataStreams_;
+    numSamples = numSamples_;
+
+    // Round up to whole cache lines, plus one line so that planes 2^n samples long do not all
+    // map to the same cache sets.
+    planeStride = ((numSamples + 31) & ~31) + 32;
+
+    timeStamp.assign(numSamples, 0);
+    amplifier.assign((size_t) numDataStreams * DEINTERLEAVER_CHANNELS_PER_STREAM * planeStride, 0);
+    dcAmplifier.assign((size_t) numDataStreams * DEINTERLEAVER_CHANNELS_PER_STREAM * planeStride, 0);
+    auxiliary.assign((size_t) numDataStreams * DEINTERLEAVER_AUX_COMMANDS * planeStride, 0);
+    stimFlags.assign((size_t) numDataStreams * DEINTERLEAVER_STIM_FLAGS * planeStride, 0);
+}
+
+short* SamplePlanes::amplifierPlane(int stream, int channel)
+{
+    return amplifier.data() + (size_t) (stream * DEINTERLEAVER_CHANNELS_PER_STREAM + channel) * planeStride;
+}
+
+const short* SamplePlanes::amplifierPlane(int stream, int channel) const
+{
+    return amplifier.data() + (size_t) (stream * DEINTERLEAVER_CHANNELS_PER_STREAM + channel) * planeStride;
+}
+
+const unsigned short* SamplePlanes::dcAmplifierPlane(int stream, int channel) const
+{
+    return dcAmplifier.data() + (size_t) (stream * DEINTERLEAVER_CHANNELS_PER_STREAM + channel) * planeStride;
+}
+
+const unsigned short* SamplePlanes::auxiliaryPlane(int stream, int auxCommand) const
+{
+    return auxiliary.data() + (size_t) (stream * DEINTERLEAVER_AUX_COMMANDS + auxCommand) * planeStride;
+}
+
+unsigned short* SamplePlanes::stimFlagPlane(int stream, StimFlag flag)
+{
+    return stimFlags.data() + (size_t) (stream * DEINTERLEAVER_STIM_FLAGS + flag) * planeStride;
+}
+
+const unsigned short* SamplePlanes::stimFlagPlane(int stream, StimFlag flag) const
+{
+    return stimFlags.data() + (size_t) (stream * DEINTERLEAVER_STIM_FLAGS + flag) * planeStride;
+}
+
+// Convert the amplifier plane of one channel to microvolts, into numSamples floats.
+void SamplePlanes::amplifierMicroVolts(int stream, int channel, float* microVolts) const
+{
+    const short* plane = amplifierPlane(stream, channel);
+    for (int t = 0; t < numSamples; ++t) {
+        microVolts[t] = 0.195F * plane[t];
+    }
+}
+
+// Plane of each amplifier slot (DC/AC word pair) of a frame: slots run channel-major across
+// streams, planes stream-major.
+static void fillPlaneOfSlot(int numDataStreams, int* planeOfSlot)
+{
+    int slot = 0;
+    for (int channel = 0; channel < DEINTERLEAVER_CHANNELS_PER_STREAM; ++channel) {
+        for (int stream = 0; stream < numDataStreams; ++stream) {
+            planeOfSlot[slot++] = stream * DEINTERLEAVER_CHANNELS_PER_STREAM + channel;
+        }
+    }
+}
+
+// Amplifier section of frames firstFrame to numFrames - 1, one word at a time.
+static void deinterleaveAmplifiersScalar(const unsigned char* usbBuffer, int firstFrame, int numFrames,
+                                         const int* planeOfSlot, SamplePlanes &planes, int firstSample)
+{
+    int sampleSize = UsbDeinterleaver::sampleSizeInBytes(planes.numDataStreams);
+    int numSlots = DEINTERLEAVER_CHANNELS_PER_STREAM * planes.numDataStreams;
+
+    for (int t = firstFrame; t < numFrames; ++t) {
+        const unsigned char* slotData = usbBuffer + (long long) t * sampleSize + amplifierOffset(planes.numDataStreams);
+        for (int slot = 0; slot < numSlots; ++slot) {
+            size_t index = (size_t) planeOfSlot[slot] * planes.planeStride + firstSample + t;
+            planes.dcAmplifier[index] = loadUsbWord(slotData);
+            planes.amplifier[index] = (short) (loadUsbWord(slotData + 2) ^ 0x8000);
+            slotData += 4;
+        }
+    }
+}
+
+#ifdef __SSE2__
+// Amplifier section, eight frames at a time: load four slots of each frame (eight words) and
+// transpose the 8 x 8 word matrix, so that each row holds one word of eight consecutive samples.
+// Returns the number of frames done.
+static int deinterleaveAmplifiersSse2(const unsigned char* usbBuffer, int numFrames, const int* planeOfSlot,
+                                      SamplePlanes &planes, int firstSample)
+{
+    int sampleSize = UsbDeinterleaver::sampleSizeInBytes(planes.numDataStreams);
+    int numSlots = DEINTERLEAVER_CHANNELS_PER_STREAM * planes.numDataStreams;
+    const __m128i signFlip = _mm_set1_epi16((short) 0x8000);
+    int t;
+
+    for (t = 0; t + 8 <= numFrames; t += 8) {
+        const unsigned char* slotData = usbBuffer + (long long) t * sampleSize + amplifierOffset(planes.numDataStreams);
+        for (int slot = 0; slot < numSlots; slot += 4) {
+            __m128i r0 = _mm_loadu_si128((const __m128i*) (slotData));
+            __m128i r1 = _mm_loadu_si128((const __m128i*) (slotData + sampleSize));
+            __m128i r2 = _mm_loadu_si128((const __m128i*) (slotData + 2 * sampleSize));
+            __m128i r3 = _mm_loadu_si128((const __m128i*) (slotData + 3 * sampleSize));
+            __m128i r4 = _mm_loadu_si128((const __m128i*) (slotData + 4 * sampleSize));
+            __m128i r5 = _mm_loadu_si128((const __m128i*) (slotData + 5 * sampleSize));
+            __m128i r6 = _mm_loadu_si128((const __m128i*) (slotData + 6 * sampleSize));
+            __m128i r7 = _mm_loadu_si128((const __m128i*) (slotData + 7 * sampleSize));
+            slotData += 16;
+
+            // Pairs of samples, then quads, then all eight.
+            __m128i t0 = _mm_unpacklo_epi16(r0, r1);
+            __m128i t1 = _mm_unpackhi_epi16(r0, r1);
+            __m128i t2 = _mm_unpacklo_epi16(r2, r3);
+            __m128i t3 = _mm_unpackhi_epi16(r2, r3);
+            __m128i t4 = _mm_unpacklo_epi16(r4, r5);
+            __m128i t5 = _mm_unpackhi_epi16(r4, r5);
+            __m128i t6 = _mm_unpacklo_epi16(r6, r7);
+            __m128i t7 = _mm_unpackhi_epi16(r6, r7);
+
+            __m128i u0 = _mm_unpacklo_epi32(t0, t2);
+            __m128i u1 = _mm_unpackhi_epi32(t0, t2);
+            __m128i u2 = _mm_unpacklo_epi32(t1, t3);
+            __m128i u3 = _mm_unpackhi_epi32(t1, t3);
+            __m128i u4 = _mm_unpacklo_epi32(t4, t6);
+            __m128i u5 = _mm_unpackhi_epi32(t4, t6);
+            __m128i u6 = _mm_unpacklo_epi32(t5, t7);
+            __m128i u7 = _mm_unpackhi_epi32(t5, t7);
+
+            __m128i dc[4], ac[4];
+            dc[0] = _mm_unpacklo_epi64(u0, u4);
+            ac[0] = _mm_unpackhi_epi64(u0, u4);
+            dc[1] = _mm_unpacklo_epi64(u1, u5);
+            ac[1] = _mm_unpackhi_epi64(u1, u5);
+            dc[2] = _mm_unpacklo_epi64(u2, u6);
+            ac[2] = _mm_unpackhi_epi64(u2, u6);
+            dc[3] = _mm_unpacklo_epi64(u3, u7);
+            ac[3] = _mm_unpackhi_epi64(u3, u7);
+
+            for (int j = 0; j < 4; ++j) {
+                size_t index = (size_t) planeOfSlot[slot + j] * planes.planeStride + firstSample + t;
+                _mm_storeu_si128((__m128i*) &planes.dcAmplifier[index], dc[j]);
+                _mm_storeu_si128((__m128i*) &planes.amplifier[index], _mm_xor_si128(ac[j], signFlip));
+            }
+        }
+    }
+    return t;
+}
+#endif
+
+#ifdef DEINTERLEAVER_AVX2
+// As deinterleaveAmplifiersSse2(), with eight slots per load: the unpacks work within each
+// 128-bit lane, so the low lane transposes slots 0-3 and the high lane slots 4-7.
+__attribute__((target("avx2")))
+static int deinterleaveAmplifiersAvx2(const unsigned char* usbBuffer, int numFrames, const int* planeOfSlot,
+                                      SamplePlanes &planes, int firstSample)
+{
+    int sampleSize = UsbDeinterleaver::sampleSizeInBytes(planes.numDataStreams);
+    int numSlots = DEINTERLEAVER_CHANNELS_PER_STREAM * planes.numDataStreams;
+    const __m256i signFlip = _mm256_set1_epi16((short) 0x8000);
+    int t;
+
+    for (t = 0; t + 8 <= numFrames; t += 8) {
+        const unsigned char* slotData = usbBuffer + (long long) t * sampleSize + amplifierOffset(planes.numDataStreams);
+        for (int slot = 0; slot < numSlots; slot += 8) {
+            __m256i r0 = _mm256_loadu_si256((const __m256i*) (slotData));
+            __m256i r1 = _mm256_loadu_si256((const __m256i*) (slotData + sampleSize));
+            __m256i r2 = _mm256_loadu_si256((const __m256i*) (slotData + 2 * sampleSize));
+            __m256i r3 = _mm256_loadu_si256((const __m256i*) (slotData + 3 * sampleSize));
+            __m256i r4 = _mm256_loadu_si256((const __m256i*) (slotData + 4 * sampleSize));
+            __m256i r5 = _mm256_loadu_si256((const __m256i*) (slotData + 5 * sampleSize));
+            __m256i r6 = _mm256_loadu_si256((const __m256i*) (slotData + 6 * sampleSize));
+            __m256i r7 = _mm256_loadu_si256((const __m256i*) (slotData + 7 * sampleSize));
+            slotData += 32;
+
+            __m256i t0 = _mm256_unpacklo_epi16(r0, r1);
+            __m256i t1 = _mm256_unpackhi_epi16(r0, r1);
+            __m256i t2 = _mm256_unpacklo_epi16(r2, r3);
+            __m256i t3 = _mm256_unpackhi_epi16(r2, r3);
+            __m256i t4 = _mm256_unpacklo_epi16(r4, r5);
+            __m256i t5 = _mm256_unpackhi_epi16(r4, r5);
+            __m256i t6 = _mm256_unpacklo_epi16(r6, r7);
+            __m256i t7 = _mm256_unpackhi_epi16(r6, r7);
+
+            __m256i u0 = _mm256_unpacklo_epi32(t0, t2);
+            __m256i u1 = _mm256_unpackhi_epi32(t0, t2);
+            __m256i u2 = _mm256_unpacklo_epi32(t1, t3);
+            __m256i u3 = _mm256_unpackhi_epi32(t1, t3);
+            __m256i u4 = _mm256_unpacklo_epi32(t4, t6);
+            __m256i u5 = _mm256_unpackhi_epi32(t4, t6);
+            __m256i u6 = _mm256_unpacklo_epi32(t5, t7);
+            __m256i u7 = _mm256_unpackhi_epi32(t5, t7);
+
+            __m256i dc[4], ac[4];
+            dc[0] = _mm256_unpacklo_epi64(u0, u4);
+            ac[0] = _mm256_xor_si256(_mm256_unpackhi_epi64(u0, u4), signFlip);
+            dc[1] = _mm256_unpacklo_epi64(u1, u5);
+            ac[1] = _mm256_xor_si256(_mm256_unpackhi_epi64(u1, u5), signFlip);
+            dc[2] = _mm256_unpacklo_epi64(u2, u6);
+            ac[2] = _mm256_xor_si256(_mm256_unpackhi_epi64(u2, u6), signFlip);
+            dc[3] = _mm256_unpacklo_epi64(u3, u7);
+            ac[3] = _mm256_xor_si256(_mm256_unpackhi_epi64(u3, u7), signFlip);
+
+            for (int j = 0; j < 4; ++j) {
+                size_t lowIndex = (size_t) planeOfSlot[slot + j] * planes.planeStride + firstSample + t;
+                size_t highIndex = (size_t) planeOfSlot[slot + 4 + j] * planes.planeStride + firstSample + t;
+                _mm_storeu_si128((__m128i*) &planes.dcAmplifier[lowIndex], _mm256_castsi256_si128(dc[j]));
+                _mm_storeu_si128((__m128i*) &planes.dcAmplifier[highIndex], _mm256_extracti128_si256(dc[j], 1));
+                _mm_storeu_si128((__m128i*) &planes.amplifier[lowIndex], _mm256_castsi256_si128(ac[j]));
+                _mm_storeu_si128((__m128i*) &planes.amplifier[highIndex], _mm256_extracti128_si256(ac[j], 1));
+            }
+        }
+    }
+    return t;
+}
+#endif
+
+// Timestamps, auxiliary command results and stimulation flags.
+static void deinterleaveOtherWords(const unsigned char* usbBuffer, int numFrames, SamplePlanes &planes,
+                                   int firstSample)
+{
+    int numDataStreams = planes.numDataStreams;
+    int sampleSize = UsbDeinterleaver::sampleSizeInBytes(numDataStreams);
+    int aux0Offset = amplifierOffset(numDataStreams) + 4 * DEINTERLEAVER_CHANNELS_PER_STREAM * numDataStreams;
+    int stimOffset = aux0Offset + 4 * numDataStreams;
+    size_t planeSize = planes.planeStride;
+
+    for (int t = 0; t < numFrames; ++t) {
+        const unsigned char* frame = usbBuffer + (long long) t * sampleSize;
+        int sample = firstSample + t;
+
+        planes.timeStamp[sample] = (unsigned int) loadUsbWord(frame + FRAME_TIMESTAMP_OFFSET) |
+                ((unsigned int) loadUsbWord(frame + FRAME_TIMESTAMP_OFFSET + 2) << 16);
+
+        for (int stream = 0; stream < numDataStreams; ++stream) {
+            unsigned short* aux = &planes.auxiliary[stream * DEINTERLEAVER_AUX_COMMANDS * planeSize + sample];
+            aux[0] = loadUsbWord(frame + aux0Offset + 4 * stream);
+            for (int command = 1; command < DEINTERLEAVER_AUX_COMMANDS; ++command) {
+                aux[command * planeSize] = loadUsbWord(frame + FRAME_AUX_OFFSET + 4 * ((command - 1) * numDataStreams + stream));
+            }
+
+            unsigned short* flags = &planes.stimFlags[stream * DEINTERLEAVER_STIM_FLAGS * planeSize + sample];
+            for (int flag = 0; flag < DEINTERLEAVER_STIM_FLAGS; ++flag) {
+                flags[flag * planeSize] = loadUsbWord(frame + stimOffset + 2 * (flag * numDataStreams + stream));
+            }
+        }
+    }
+}
+
+// Size in bytes of one USB sample frame, as Rhs2000DataBlock::calculateDataBlockSizeInWords()
+// gives per sample.
+int UsbDeinterleaver::sampleSizeInBytes(int numDataStreams)
+{
+    return 2 * (4 + 2 + numDataStreams * (2 * DEINTERLEAVER_CHANNELS_PER_STREAM + 4 * 3) + 8 + 8 + 2);
+}
+
+bool UsbDeinterleaver::isKernelSupported(Kernel kernel)
+{
+    switch (kernel) {
+    case KernelScalar:
+        return true;
+    case KernelSse2:
+#ifdef __SSE2__
+        return true;
+#else
+        return false;
+#endif
+    case KernelAvx2:
+#ifdef DEINTERLEAVER_AVX2
+        return __builtin_cpu_supports("avx2");
+#else
+        return false;
+#endif
+    }
+    return false;
+}
+
+UsbDeinterleaver::Kernel UsbDeinterleaver::fastestKernel()
+{
+    static const Kernel kernel = isKernelSupported(KernelAvx2) ? KernelAvx2 :
+                                 (isKernelSupported(KernelSse2) ? KernelSse2 : KernelScalar);
+    return kernel;
+}
+
+const char* UsbDeinterleaver::kernelName(Kernel kernel)
+{
+    switch (kernel) {
+    case KernelScalar:
+        return "scalar";
+    case KernelSse2:
+        return "SSE2";
+    case KernelAvx2:
+        return "AVX2";
+    }
+    return "unknown";
+}
+
+// Deinterleave numSamples consecutive USB sample frames from usbBuffer into samples firstSample
+// onwards of planes, with the fastest kernel this CPU supports.  planes must already be allocated
+// for the number of enabled data streams.
+void UsbDeinterleaver::deinterleave(const unsigned char* usbBuffer, int numSamples, SamplePlanes &planes,
+                                    int firstSample)
+{
+    deinterleave(fastestKernel(), usbBuffer, numSamples, planes, firstSample);
+}
+
+void UsbDeinterleaver::deinterleave(Kernel kernel, const unsigned char* usbBuffer, int numSamples,
+                                    SamplePlanes &planes, int firstSample)
+{
+    if (firstSample < 0 || firstSample + numSamples > planes.numSamples) {
+        cerr << "Error in UsbDeinterleaver::deinterleave: samples " << firstSample << " to " <<
+                firstSample + numSamples - 1 << " do not fit in " << planes.numSamples << " sample planes." << endl;
+        return;
+    }
+    if (!isKernelSupported(kernel)) {
+        kernel = KernelScalar;
+    }
+
+    int planeOfSlot[DEINTERLEAVER_CHANNELS_PER_STREAM * 8];
+    if (planes.numDataStreams > 8) {
+        cerr << "Error in UsbDeinterleaver::deinterleave: at most 8 data streams supported." << endl;
+        return;
+    }
+    fillPlaneOfSlot(planes.numDataStreams, planeOfSlot);
+
+    int numDone = 0;
+    switch (kernel) {
+    case KernelAvx2:
+#ifdef DEINTERLEAVER_AVX2
+        numDone = deinterleaveAmplifiersAvx2(usbBuffer, numSamples, planeOfSlot, planes, firstSample);
+#endif
+        break;
+    case KernelSse2:
+#ifdef __SSE2__
+        numDone = deinterleaveAmplifiersSse2(usbBuffer, numSamples, planeOfSlot, planes, firstSample);
+#endif
+        break;
+    case KernelScalar:
+        break;
+    }
+    deinterleaveAmplifiersScalar(usbBuffer, numDone, numSamples, planeOfSlot, planes, firstSample);
+    deinterleaveOtherWords(usbBuffer, numSamples, planes, firstSample);
+}
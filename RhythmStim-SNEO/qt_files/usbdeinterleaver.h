@@ -0,0 +1,80 @@
+#ifndef USBDEINTERLEAVER_H
+#define USBDEINTERLEAVER_H
+
+#include <vector>
+
+using namespace std;
+
+#define DEINTERLEAVER_CHANNELS_PER_STREAM 16
+#define DEINTERLEAVER_AUX_COMMANDS 4
+#define DEINTERLEAVER_STIM_FLAGS 4
+
+// Stimulation flag words, one per data stream per sample, with one bit per channel.
+enum StimFlag
+{
+    StimFlagOn = 0,
+    StimFlagPolarity = 1,
+    StimFlagAmpSettle = 2,
+    StimFlagChargeRecovery = 3
+};
+
+// Samples of numSamples USB sample frames in structure-of-arrays form: one contiguous plane of
+// numSamples values per signal, so a channel is read with a pointer increment rather than
+// through nested vectors.  Amplifier samples are stored as signed 16-bit values (the offset
+// binary USB word minus 32768; 0.195 uV per LSB).  DC amplifier, auxiliary command and
+// stimulation flag words are stored as they come over USB.
+
+struct SamplePlanes
+{
+    SamplePlanes();
+    void allocate(int numDataStreams_, int numSamples_);
+
+    short* amplifierPlane(int stream, int channel);
+    const short* amplifierPlane(int stream, int channel) const;
+    const unsigned short* dcAmplifierPlane(int stream, int channel) const;
+    const unsigned short* auxiliaryPlane(int stream, int auxCommand) const;
+    unsigned short* stimFlagPlane(int stream, StimFlag flag);
+    const unsigned short* stimFlagPlane(int stream, StimFlag flag) const;
+    void amplifierMicroVolts(int stream, int channel, float* microVolts) const;
+
+    int numDataStreams;
+    int numSamples;
+    int planeStride;                        // values from the start of one plane to the next
+
+    vector<unsigned int> timeStamp;
+    vector<short> amplifier;                // plane (stream * 16 + channel)
+    vector<unsigned short> dcAmplifier;     // plane (stream * 16 + channel)
+    vector<unsigned short> auxiliary;       // plane (stream * 4 + auxCommand), low result word
+    vector<unsigned short> stimFlags;       // plane (stream * 4 + StimFlag)
+};
+
+// Converts USB sample frames from the Rhythm Stim FPGA into SamplePlanes in one pass over the
+// buffer.  The amplifier section, which is most of every frame, is transposed eight samples at a
+// time with 16-bit unpack shuffles: four DC/AC word pairs per SSE2 register, eight with AVX2.  The
+// remaining words (timestamp, auxiliary results, stimulation flags) are copied with scalar code.
+// The AVX2 kernel is chosen at run time if the CPU supports it.  Headers are not checked; use
+// UsbHeaderScanner first.
+
+class UsbDeinterleaver
+{
+
+public:
+    enum Kernel {
+        KernelScalar,
+        KernelSse2,
+        KernelAvx2
+    };
+
+    static Kernel fastestKernel();
+    static bool isKernelSupported(Kernel kernel);
+    static const char* kernelName(Kernel kernel);
+
+    static void deinterleave(const unsigned char* usbBuffer, int numSamples, SamplePlanes &planes,
+                             int firstSample = 0);
+    static void deinterleave(Kernel kernel, const unsigned char* usbBuffer, int numSamples,
+                             SamplePlanes &planes, int firstSample = 0);
+
+    static int sampleSizeInBytes(int numDataStreams);
+};
+
+#endif // USBDEINTERLEAVER_H
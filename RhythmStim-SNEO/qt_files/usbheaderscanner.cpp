@@ -0,0 +1,153 @@
+#include <cstring>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "usbheaderscanner.h"
+#include "datastreamfifo.h"
+#include "metricsregistry.h"
+
+// USB sample header scanner
+
+static inline unsigned long long loadWord64(const unsigned char* buffer)
+{
+    unsigned long long word;
+    memcpy(&word, buffer, sizeof(word));    // unaligned load; headers sit at any even offset
+    return word;
+}
+
+// Check for the magic number at the start of a USB sample frame.
+bool UsbHeaderScanner::isHeader(const unsigned char* buffer)
+{
+    return loadWord64(buffer) == RHS_USB_HEADER_MAGIC_NUMBER;
+}
+
+// Check the headers of samples firstSample to firstSample + numSamples - 1 in buffer, and return
+// the index of the first sample without a valid header, or -1 if all are valid.
+int UsbHeaderScanner::findBadHeader(const unsigned char* buffer, int firstSample, int numSamples, int sampleSizeInBytes)
+{
+    int sample = firstSample;
+    int lastSample = firstSample + numSamples;
+
+#ifdef __SSE2__
+    // Eight headers per batch: XOR each pair with the magic number and OR the results together,
+    // so the batch is clean if the accumulator is all zero.
+    const int BatchSize = 8;
+    const __m128i magic = _mm_set1_epi64x((long long) RHS_USB_HEADER_MAGIC_NUMBER);
+    const __m128i zero = _mm_setzero_si128();
+    while (sample + BatchSize <= lastSample) {
+        const unsigned char* header = buffer + (long long) sample * sampleSizeInBytes;
+        __m128i mismatch = zero;
+        for (int i = 0; i < BatchSize; i += 2) {
+            __m128i headers = _mm_set_epi64x((long long) loadWord64(header + sampleSizeInBytes),
+                                             (long long) loadWord64(header));
+            mismatch = _mm_or_si128(mismatch, _mm_xor_si128(headers, magic));
+            header += 2 * sampleSizeInBytes;
+        }
+        if (_mm_movemask_epi8(_mm_cmpeq_epi8(mismatch, zero)) != 0xffff) {
+            break;      // the bad header is in this batch; find it below
+        }
+        sample += BatchSize;
+    }
+#endif
+
+    for (; sample < lastSample; ++sample) {
+        if (!isHeader(buffer + (long long) sample * sampleSizeInBytes)) {
+            return sample;
+        }
+    }
+    return -1;
+}
+
+// Return the offset in 16-bit words of the first magic number starting within the first numWords
+// words of buffer, or -1 if there is none.  The magic number may run up to three words past
+// numWords, so that much of buffer must be readable.
+int UsbHeaderScanner::findHeader(const unsigned char* buffer, int numWords)
+{
+    const unsigned short firstWord = (unsigned short) (RHS_USB_HEADER_MAGIC_NUMBER & 0xffff);
+    int word = 0;
+
+#ifdef __SSE2__
+    // Compare eight words at a time against the first word of the magic number, and only
+    // check the full 64 bits where that matches.
+    const __m128i target = _mm_set1_epi16((short) firstWord);
+    for (; word + 8 <= numWords; word += 8) {
+        __m128i words = _mm_loadu_si128((const __m128i*) (buffer + 2 * word));
+        int matches = _mm_movemask_epi8(_mm_cmpeq_epi16(words, target));
+        while (matches) {
+            int i = __builtin_ctz(matches) / 2;
+            if (isHeader(buffer + 2 * (word + i))) {
+                return word + i;
+            }
+            matches &= ~(3 << (2 * i));
+        }
+    }
+#endif
+
+    for (; word < numWords; ++word) {
+        if (buffer[2 * word] == (firstWord & 0xff) && buffer[2 * word + 1] == (firstWord >> 8) &&
+                isHeader(buffer + 2 * word)) {
+            return word;
+        }
+    }
+    return -1;
+}
+
+// Look for the proper 'magic number' header in all samples of usbData, a span of numBytesToRead
+// bytes just peeked from fifo, and repair USB glitches: after a bad header the data is shifted
+// back to the next header found, and the span is refilled with the words that follow it in
+// fifo.  numBytesConsumed (initially numBytesToRead) grows by the words pulled in, and is what
+// the caller must release.  Waits for those words while keepWaiting is true.  Returns the span,
+// which moves if it had to be extended, or nullptr if acquisition stopped before the words came;
+// the span is then left unrepaired and the caller should stop parsing.
+unsigned char* UsbHeaderScanner::repairGlitches(DataStreamFifo* fifo, unsigned char* usbData, unsigned int numBytesToRead,
+                                                int sampleSizeInBytes, unsigned int &numBytesConsumed,
+                                                UsbGlitchStatistics &statistics, const atomic<bool> &keepWaiting)
+{
+    static MetricCounter* badHeaderMetric = MetricsRegistry::global()->counter("usb.bad_headers");
+    static MetricCounter* wordsSkippedMetric = MetricsRegistry::global()->counter("usb.words_skipped");
+    static MetricCounter* realignStallMetric = MetricsRegistry::global()->counter("usb.realign_stalls");
+
+    int numSamples = numBytesToRead / sampleSizeInBytes;
+    int badSample = findBadHeader(usbData, 0, numSamples, sampleSizeInBytes);
+    while (badSample >= 0) {
+        statistics.numBadHeaders++;
+        badHeaderMetric->add();
+        if (badSample > 0) {
+            // If we have a bad data sample header on any sample but the first, we shouldn't trust
+            // the integrity of the prior sample, since it is likely contains a "hole" where missing
+            // USB data should be.  Jump back one sample and try to fix that one.
+            badSample--;
+        }
+        unsigned int index = badSample * sampleSizeInBytes;
+
+        // Search for correct header throughout the sample.
+        int lag = findHeader(&usbData[index + 2], sampleSizeInBytes / 2 - 1);
+        lag = (lag < 0) ? sampleSizeInBytes / 2 : lag + 1;
+
+        // Realign data and read additional words from the USB to refill buffer.
+
+        unsigned int numBytes = 2 * lag;
+        // Shift all data beyond error point back by N words (2N bytes)...
+        memmove(&usbData[index], &usbData[index + numBytes], numBytesToRead - numBytes - index);
+        statistics.numWordsSkipped += lag;
+        wordsSkippedMetric->add(lag);
+
+        if (fifo->bytesAvailable() < numBytesConsumed + numBytes) {
+            statistics.numRealignStalls++;
+            realignStallMetric->add();
+            if (!fifo->waitForData(numBytesConsumed + numBytes, keepWaiting)) {    // ...wait for data words to arrive...
+                return nullptr;
+            }
+        }
+
+        // ...and extend the span by N more words (2N more bytes), moving them to the end.
+        usbData = fifo->peekRead(numBytesConsumed + numBytes);
+        memcpy(&usbData[numBytesToRead - numBytes], &usbData[numBytesConsumed], numBytes);
+        numBytesConsumed += numBytes;
+
+        badSample = findBadHeader(usbData, badSample + 1, numSamples - badSample - 1, sampleSizeInBytes);
+    }
+    return usbData;
+}
@@ -0,0 +1,38 @@
+#ifndef USBHEADERSCANNER_H
+#define USBHEADERSCANNER_H
+
+#include <atomic>
+
+using namespace std;
+
+class DataStreamFifo;
+
+// Magic number that starts every USB sample frame from the Rhythm Stim FPGA (little endian).
+#define RHS_USB_HEADER_MAGIC_NUMBER 0x8d542c8a49712f0bULL
+
+// USB glitch counters for one run.
+struct UsbGlitchStatistics
+{
+    unsigned long long numBadHeaders;       // sample frames that did not start with the magic number
+    unsigned long long numWordsSkipped;     // 16-bit words dropped to realign the data
+    unsigned long long numRealignStalls;    // realignments that had to wait for more USB data
+};
+
+// Batch USB sample header checks, used instead of calling Rhs2000DataBlock::checkUsbHeader()
+// for every sample.  With SSE2 (all x86-64 builds) headers are compared two at a time with
+// mismatches accumulated in one register, so a clean buffer costs one load and one XOR per
+// header; only a batch containing a bad header is searched for it.
+
+class UsbHeaderScanner
+{
+
+public:
+    static bool isHeader(const unsigned char* buffer);
+    static int findBadHeader(const unsigned char* buffer, int firstSample, int numSamples, int sampleSizeInBytes);
+    static int findHeader(const unsigned char* buffer, int numWords);
+    static unsigned char* repairGlitches(DataStreamFifo* fifo, unsigned char* usbData, unsigned int numBytesToRead,
+                                         int sampleSizeInBytes, unsigned int &numBytesConsumed,
+                                         UsbGlitchStatistics &statistics, const atomic<bool> &keepWaiting);
+};
+
+#endif // USBHEADERSCANNER_H
@@ -0,0 +1,161 @@
+#include <cmath>
+#include <QtGlobal>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "waveenvelope.h"
+
+// Pixel column min/max envelope of a displayed trace
+
+WaveEnvelope::WaveEnvelope()
+{
+    reset();
+}
+
+// Forget the column carried over from the last batch, e.g. when a new sweep starts.
+void WaveEnvelope::reset()
+{
+    lastColumn = -1;
+    lastMinimum = 0.0;
+    lastMaximum = 0.0;
+}
+
+// Build the polyline for numSamples samples, the first at x = x0 and then every xStep pixels
+// (xStep at most 1), at y = yScaleFactor * sample + yOffset.  If continuesSweep, the samples
+// follow those of the last call without a gap.  Returns the number of points in points().
+int WaveEnvelope::build(const double *samples, int numSamples, double x0, double xStep, double yScaleFactor,
+                        double yOffset, bool continuesSweep)
+{
+    return buildColumns(samples, numSamples, x0, xStep, yScaleFactor, yOffset, continuesSweep);
+}
+
+int WaveEnvelope::build(const int *samples, int numSamples, double x0, double xStep, double yScaleFactor,
+                        double yOffset, bool continuesSweep)
+{
+    return buildColumns(samples, numSamples, x0, xStep, yScaleFactor, yOffset, continuesSweep);
+}
+
+const QPointF* WaveEnvelope::points() const
+{
+    return polyline.constData();
+}
+
+// Smallest and largest of numSamples (at least one) samples.
+void WaveEnvelope::minMax(const double *samples, int numSamples, double &minimum, double &maximum)
+{
+    int i = 0;
+    minimum = samples[0];
+    maximum = samples[0];
+
+#ifdef __SSE2__
+    if (numSamples >= 4) {
+        __m128d min0 = _mm_loadu_pd(samples);
+        __m128d min1 = _mm_loadu_pd(samples + 2);
+        __m128d max0 = min0;
+        __m128d max1 = min1;
+        for (i = 4; i + 4 <= numSamples; i += 4) {
+            __m128d a = _mm_loadu_pd(samples + i);
+            __m128d b = _mm_loadu_pd(samples + i + 2);
+            min0 = _mm_min_pd(min0, a);
+            min1 = _mm_min_pd(min1, b);
+            max0 = _mm_max_pd(max0, a);
+            max1 = _mm_max_pd(max1, b);
+        }
+        min0 = _mm_min_pd(min0, min1);
+        max0 = _mm_max_pd(max0, max1);
+        min0 = _mm_min_sd(min0, _mm_unpackhi_pd(min0, min0));
+        max0 = _mm_max_sd(max0, _mm_unpackhi_pd(max0, max0));
+        minimum = _mm_cvtsd_f64(min0);
+        maximum = _mm_cvtsd_f64(max0);
+    }
+#endif
+
+    for (; i < numSamples; ++i) {
+        minimum = qMin(minimum, samples[i]);
+        maximum = qMax(maximum, samples[i]);
+    }
+}
+
+// Digital traces; these are short runs of 0 and 1, so plain code is fast enough.
+void WaveEnvelope::minMax(const int *samples, int numSamples, double &minimum, double &maximum)
+{
+    int low = samples[0];
+    int high = samples[0];
+    for (int i = 1; i < numSamples; ++i) {
+        low = qMin(low, samples[i]);
+        high = qMax(high, samples[i]);
+    }
+    minimum = low;
+    maximum = high;
+}
+
+// Two points per pixel column, at the column's extremes, ordered to continue from the previous
+// column's last point so that joins stay short.  A continued sweep starts from the end of the
+// last column already drawn, or redraws that column whole if the new samples start in it.
+// (Private method.)
+template <typename T>
+int WaveEnvelope::buildColumns(const T *samples, int numSamples, double x0, double xStep, double yScaleFactor,
+                               double yOffset, bool continuesSweep)
+{
+    if (numSamples <= 0) {
+        polyline.resize(0);
+        return 0;
+    }
+
+    int firstColumn = (int) floor(x0);
+    int endColumn = (int) floor(x0 + xStep * (numSamples - 1));
+    bool mergeFirstColumn = continuesSweep && firstColumn == lastColumn;
+    bool joinPrevious = continuesSweep && (mergeFirstColumn || firstColumn == lastColumn + 1);
+
+    polyline.resize(2 * (endColumn - firstColumn + 1) + (joinPrevious ? 1 : 0));
+    QPointF *point = polyline.data();
+
+    double previousY = yScaleFactor * samples[0] + yOffset;
+    if (joinPrevious) {
+        *point = mergeFirstColumn ? previousColumnEnd : lastColumnEnd;
+        previousY = point->y();
+        point++;
+    }
+
+    double minimum = 0.0, maximum = 0.0;
+    int start = 0;
+    for (int column = firstColumn; column <= endColumn; ++column) {
+        int end = (column == endColumn) ? numSamples :
+                                          qBound(start, (int) ceil((column + 1 - x0) / xStep), numSamples);
+        if (end > start) {
+            minMax(samples + start, end - start, minimum, maximum);
+        } else {
+            minimum = maximum = samples[qMin(start, numSamples - 1)];
+        }
+        if (column == firstColumn && mergeFirstColumn) {
+            minimum = qMin(minimum, lastMinimum);
+            maximum = qMax(maximum, lastMaximum);
+        }
+
+        double yMinimum = yScaleFactor * minimum + yOffset;
+        double yMaximum = yScaleFactor * maximum + yOffset;
+        if (column > firstColumn) {
+            previousColumnEnd = point[-1];
+        } else if (!mergeFirstColumn) {
+            previousColumnEnd = joinPrevious ? lastColumnEnd : QPointF(column, previousY);
+        }
+        if (qAbs(previousY - yMinimum) <= qAbs(previousY - yMaximum)) {
+            *point++ = QPointF(column, yMinimum);
+            *point++ = QPointF(column, yMaximum);
+            previousY = yMaximum;
+        } else {
+            *point++ = QPointF(column, yMaximum);
+            *point++ = QPointF(column, yMinimum);
+            previousY = yMinimum;
+        }
+        start = end;
+    }
+
+    lastColumn = endColumn;
+    lastMinimum = minimum;
+    lastMaximum = maximum;
+    lastColumnEnd = point[-1];
+    return polyline.size();
+}
@@ -0,0 +1,46 @@
+#ifndef WAVEENVELOPE_H
+#define WAVEENVELOPE_H
+
+#include <QVector>
+#include <QPointF>
+
+using namespace std;
+
+// Minimum/maximum envelope of one displayed trace at pixel column resolution.  When a sweep has
+// several samples per pixel, the polyline through every sample only overdraws each column with a
+// vertical run from its smallest to its largest value; the envelope draws that run directly, as
+// two points per column, so drawing cost follows the frame width instead of the sample rate.
+// Updated incrementally: a column split between two data block batches keeps the extremes of its
+// first part, and is redrawn complete from the next batch.
+
+class WaveEnvelope
+{
+
+public:
+    WaveEnvelope();
+
+    void reset();
+
+    int build(const double *samples, int numSamples, double x0, double xStep, double yScaleFactor,
+              double yOffset, bool continuesSweep);
+    int build(const int *samples, int numSamples, double x0, double xStep, double yScaleFactor,
+              double yOffset, bool continuesSweep);
+    const QPointF* points() const;
+
+    static void minMax(const double *samples, int numSamples, double &minimum, double &maximum);
+    static void minMax(const int *samples, int numSamples, double &minimum, double &maximum);
+
+private:
+    template <typename T>
+    int buildColumns(const T *samples, int numSamples, double x0, double xStep, double yScaleFactor,
+                     double yOffset, bool continuesSweep);
+
+    QVector<QPointF> polyline;      // two points per column, reused from batch to batch
+    int lastColumn;                 // pixel column of the last sample built, or -1
+    double lastMinimum;             // extremes of the samples of lastColumn
+    double lastMaximum;
+    QPointF lastColumnEnd;          // last point of lastColumn, and of the column before it
+    QPointF previousColumnEnd;
+};
+
+#endif // WAVEENVELOPE_H
@@ -36,6 +36,7 @@
 #include "signalsources.h"
 #include "signalprocessor.h"
 #include "stimparameters.h"
+#include "waveenvelope.h"
 
 // The WavePlot widget displays multiple waveform plots in the Main Window.
 // Five types of waveforms may be displayed: amplifier, auxiliary input, supply
@@ -43,6 +44,11 @@
 // the displays using cursor keys, and may drag and drop displays with the mouse.
 // Other keypresses are used to change the voltage and time scales of the plots.
 
+// Drawing buffers kept by drawWaveforms() from one batch to the next: the per-sample polyline,
+// and the min/max envelope of each plot (indexed like plotDataOld).
+static QVector<QPointF> polylineBuffer;
+static QVector<WaveEnvelope> frameEnvelopes;
+
 // Constructor.
 WavePlot::WavePlot(SignalProcessor *inSignalProcessor, SignalSources *inSignalSources,
                    MainWindow *inMainWindow, QWidget *parent) :
@@ -1199,11 +1205,12 @@ void WavePlot::setNumUsbBlocksToPlot(int numBlocks)
     numUsbBlocksToPlot = numBlocks;
 }
 
-// Plot waveforms on screen.
+// Plot waveforms on screen.  When the time scale puts two or more samples in each pixel column,
+// traces are drawn as their min/max envelope (see WaveEnvelope) rather than through every sample.
 void WavePlot::drawWaveforms()
 {
-    int i, j, xOffset, yOffset, stream, channel;
-    double yAxisLength, tAxisLength;
+    int i, j, xOffset, yOffset, stream, channel, plotIndex;
+    double yAxisLength, tAxisLength, xSweep;
     QRect adjustedFrame, eraseBlock;
     SignalType type;
     double tStepMsec, xScaleFactor, yScaleFactor;
@@ -1214,7 +1221,13 @@ void WavePlot::drawWaveforms()
 
     int length = Rhs2000DataBlock::getSamplesPerDataBlock() * numUsbBlocksToPlot;
 
-    QPointF *polyline = new QPointF[length + 1];
+    if (polylineBuffer.size() < length + 1) {
+        polylineBuffer.resize(length + 1);
+    }
+    QPointF *polyline = polylineBuffer.data();
+    if (frameEnvelopes.size() < plotDataOld.size()) {
+        frameEnvelopes.resize(plotDataOld.size());
+    }
 
     ReferenceSource referenceSource = mainWindow->getReferenceSource();
 
@@ -1252,8 +1265,8 @@ void WavePlot::drawWaveforms()
         type = selectedChannel(j + topLeftFrame[selectedPort])->signalType;
 
         if (selectedChannel(j + topLeftFrame[selectedPort])->enabled) {
-            xOffset = frameList[numFramesIndex[selectedPort]][j].left() + 1;
-            xOffset += tPosition * tAxisLength / tScale;
+            xSweep = frameList[numFramesIndex[selectedPort]][j].left() + 1 + tPosition * tAxisLength / tScale;
+            xOffset = xSweep;
 
             tStepMsec = 1000.0 / sampleRate;
             xScaleFactor = tAxisLength * tStepMsec / tScale;
@@ -1298,59 +1311,24 @@ void WavePlot::drawWaveforms()
             // Redraw y = 0 axis
             drawAxisLines(painter, j);
 
+            const double *samples = nullptr;
+            const int *digitalSamples = nullptr;
             if (type == AmplifierSignal) {
                 // Plot RHS2000 amplifier waveform
                 if (plotDc) {
                     yScaleFactor = -yAxisLength / (yScaleDcAmp);
+                    samples = signalProcessor->dcAmplifier.at(stream).at(channel).constData();
                 } else {
                     yScaleFactor = -yAxisLength / yScale;
+                    samples = signalProcessor->amplifierPostFilter.at(stream).at(channel).constData();
                 }
                 yOffset = frameList[numFramesIndex[selectedPort]][j].center().y();
-
-                // build waveform
-                for (i = 0; i < length; ++i) {
-                    if (plotDc) {
-                        polyline[i+1] =
-                                QPointF(xScaleFactor * i + xOffset,
-                                        yScaleFactor * signalProcessor->dcAmplifier.at(stream).at(channel).at(i) + yOffset);
-                    } else {
-                        polyline[i+1] =
-                                QPointF(xScaleFactor * i + xOffset,
-                                        yScaleFactor * signalProcessor->amplifierPostFilter.at(stream).at(channel).at(i) + yOffset);
-                    }
-                }
-
-                // join to old waveform
-                if (tPosition == 0.0) {
-                    polyline[0] = polyline[1];
-                } else {
-                    polyline[0] =
-                            QPointF(xScaleFactor * -1 + xOffset,
-                                    yScaleFactor * plotDataOld.at(j + topLeftFrame[selectedPort]) + yOffset);
-                }
-
-                // save last point in waveform to join to next segment
-                if (plotDc) {
-                    plotDataOld[j + topLeftFrame[selectedPort]] =
-                            signalProcessor->dcAmplifier.at(stream).at(channel).at(length - 1);
-                } else {
-                    plotDataOld[j + topLeftFrame[selectedPort]] =
-                            signalProcessor->amplifierPostFilter.at(stream).at(channel).at(length - 1);
-                }
-
-                // draw waveform
                 painter.setPen(traceAmpColor);
                 if (referenceSource.softwareMode == true) {
                     if (referenceSource.stream == stream && referenceSource.channel == channel) {
                         painter.setPen(traceRefColor); // plot selected re-reference waveform in a different color
                     }
                 }
-                if (pointPlotMode) {
-                    painter.drawPoints(polyline, length + 1);
-                } else {
-                    painter.drawPolyline(polyline, length + 1);
-                }
-
             } else if (type == AuxInputSignal) {
                 // error: aux inputs not present in RHS2000 system
             } else if (type == SupplyVoltageSignal) {
@@ -1359,136 +1337,70 @@ void WavePlot::drawWaveforms()
                 // Plot USB interface board ADC input signal
                 yScaleFactor = -1.0 * yAxisLength / yScaleAdc;
                 yOffset = frameList[numFramesIndex[selectedPort]][j].center().y();
-
-                // build waveform
-                for (i = 0; i < length; ++i) {
-                    polyline[i+1] =
-                            QPointF(xScaleFactor * i + xOffset,
-                                    yScaleFactor * signalProcessor->boardAdc.at(channel).at(i) + yOffset);
-                }
-
-                // join to old waveform
-                if (tPosition == 0.0) {
-                    polyline[0] = polyline[1];
-                } else {
-                    polyline[0] =
-                            QPointF(xScaleFactor * -1 + xOffset,
-                                    yScaleFactor * plotDataOld.at(j + topLeftFrame[selectedPort]) + yOffset);
-                }
-
-                // save last point in waveform to join to next segment
-                plotDataOld[j + topLeftFrame[selectedPort]] =
-                        signalProcessor->boardAdc.at(channel).at(length - 1);
-
-                // draw waveform
+                samples = signalProcessor->boardAdc.at(channel).constData();
                 painter.setPen(traceAnalogInColor);
-                if (pointPlotMode) {
-                    painter.drawPoints(polyline, length + 1);
-                } else {
-                    painter.drawPolyline(polyline, length + 1);
-                }
-
             } else if (type == BoardDacSignal) {
                 // Plot USB interface board DAC output signal
                 yScaleFactor = -1.0 * yAxisLength / yScaleAdc;
                 yOffset = frameList[numFramesIndex[selectedPort]][j].center().y();
-
-                // build waveform
-                for (i = 0; i < length; ++i) {
-                    polyline[i+1] =
-                            QPointF(xScaleFactor * i + xOffset,
-                                    yScaleFactor * signalProcessor->boardDac.at(channel).at(i) + yOffset);
-                }
-
-                // join to old waveform
-                if (tPosition == 0.0) {
-                    polyline[0] = polyline[1];
-                } else {
-                    polyline[0] =
-                            QPointF(xScaleFactor * -1 + xOffset,
-                                    yScaleFactor * plotDataOld.at(j + topLeftFrame[selectedPort]) + yOffset);
-                }
-
-                // save last point in waveform to join to next segment
-                plotDataOld[j + topLeftFrame[selectedPort]] =
-                        signalProcessor->boardDac.at(channel).at(length - 1);
-
-                // draw waveform
+                samples = signalProcessor->boardDac.at(channel).constData();
                 painter.setPen(traceAnalogInColor);
-                if (pointPlotMode) {
-                    painter.drawPoints(polyline, length + 1);
-                } else {
-                    painter.drawPolyline(polyline, length + 1);
-                }
-
             } else if (type == BoardDigInSignal) {
                 // Plot USB interface board digital input signal
                 yScaleFactor = -(2.0 * yAxisLength) / 2.0;
                 yOffset = (frameList[numFramesIndex[selectedPort]][j].bottom() +
                            frameList[numFramesIndex[selectedPort]][j].center().y()) / 2.0;
-
-                // build waveform
-                for (i = 0; i < length; ++i) {
-                    polyline[i+1] =
-                            QPointF(xScaleFactor * i + xOffset,
-                                    yScaleFactor * signalProcessor->boardDigIn.at(channel).at(i) + yOffset);
-                }
-
-                // join to old waveform
-                if (tPosition == 0.0) {
-                    polyline[0] = polyline[1];
-                } else {
-                    polyline[0] =
-                            QPointF(xScaleFactor * -1 + xOffset,
-                                    yScaleFactor * plotDataOld.at(j + topLeftFrame[selectedPort]) + yOffset);
-                }
-
-                // save last point in waveform to join to next segment
-                plotDataOld[j + topLeftFrame[selectedPort]] =
-                        signalProcessor->boardDigIn.at(channel).at(length - 1);
-
-                // draw waveform
+                digitalSamples = signalProcessor->boardDigIn.at(channel).constData();
                 pen.setColor(traceDigitalInColor);
                 painter.setPen(pen);
-                if (pointPlotMode) {
-                    painter.drawPoints(polyline, length + 1);
-                } else {
-                    painter.drawPolyline(polyline, length + 1);
-                }
             } else if (type == BoardDigOutSignal) {
                 // Plot USB interface board digital output signal
                 yScaleFactor = -(2.0 * yAxisLength) / 2.0;
                 yOffset = (frameList[numFramesIndex[selectedPort]][j].bottom() +
                            frameList[numFramesIndex[selectedPort]][j].center().y()) / 2.0;
+                digitalSamples = signalProcessor->boardDigOut.at(channel).constData();
+                pen.setColor(traceDigitalOutColor);
+                painter.setPen(pen);
+            }
 
-                // build waveform
-                for (i = 0; i < length; ++i) {
-                    polyline[i+1] =
-                            QPointF(xScaleFactor * i + xOffset,
-                                    yScaleFactor * signalProcessor->boardDigOut.at(channel).at(i) + yOffset);
-                }
+            if (samples || digitalSamples) {
+                plotIndex = j + topLeftFrame[selectedPort];
 
-                // join to old waveform
-                if (tPosition == 0.0) {
-                    polyline[0] = polyline[1];
+                if (!pointPlotMode && xScaleFactor <= 0.5) {
+                    // draw min/max envelope, continuing the one drawn from the last batch
+                    WaveEnvelope &envelope = frameEnvelopes[plotIndex];
+                    int numPoints = samples ?
+                                envelope.build(samples, length, xSweep, xScaleFactor, yScaleFactor, yOffset, tPosition != 0.0) :
+                                envelope.build(digitalSamples, length, xSweep, xScaleFactor, yScaleFactor, yOffset, tPosition != 0.0);
+                    painter.drawPolyline(envelope.points(), numPoints);
                 } else {
-                    polyline[0] =
-                            QPointF(xScaleFactor * -1 + xOffset,
-                                    yScaleFactor * plotDataOld.at(j + topLeftFrame[selectedPort]) + yOffset);
-                }
+                    // build waveform
+                    for (i = 0; i < length; ++i) {
+                        polyline[i+1] =
+                                QPointF(xScaleFactor * i + xOffset,
+                                        yScaleFactor * (samples ? samples[i] : digitalSamples[i]) + yOffset);
+                    }
 
-                // save last point in waveform to join to next segment
-                plotDataOld[j + topLeftFrame[selectedPort]] =
-                        signalProcessor->boardDigOut.at(channel).at(length - 1);
+                    // join to old waveform
+                    if (tPosition == 0.0) {
+                        polyline[0] = polyline[1];
+                    } else {
+                        polyline[0] =
+                                QPointF(xScaleFactor * -1 + xOffset,
+                                        yScaleFactor * plotDataOld.at(plotIndex) + yOffset);
+                    }
 
-                // draw waveform
-                pen.setColor(traceDigitalOutColor);
-                painter.setPen(pen);
-                if (pointPlotMode) {
-                    painter.drawPoints(polyline, length + 1);
-                } else {
-                    painter.drawPolyline(polyline, length + 1);
+                    // draw waveform
+                    if (pointPlotMode) {
+                        painter.drawPoints(polyline, length + 1);
+                    } else {
+                        painter.drawPolyline(polyline, length + 1);
+                    }
+                    frameEnvelopes[plotIndex].reset();
                 }
+
+                // save last point in waveform to join to next segment
+                plotDataOld[plotIndex] = samples ? samples[length - 1] : digitalSamples[length - 1];
             }
             painter.setClipping(false);
         }
@@ -1499,8 +1411,6 @@ void WavePlot::drawWaveforms()
     if (tPosition >= tScale) {
         tPosition = 0.0;
     }
-
-    delete [] polyline;
 }
 
 void WavePlot::highlightEvent(QVector<int> &data, QColor color, int length, QRect frame, QPainter &painter, double xScaleFactor, double xOffset)